@@ -21,6 +21,7 @@
 #define __WPAN_APS_H
 
 #include "wpan/types.h"
+#include "xbee/timer_wheel.h"
 
 XBEE_BEGIN_DECLS
 
@@ -417,6 +418,10 @@ typedef struct wpan_dev_t {
    /// wpan_endpoint_get_next() to walk the table.
    const wpan_endpoint_table_entry_t   *endpoint_table;
 
+   /// Timeouts for the device (conversations, requests and frame IDs),
+   /// run by wpan_tick().
+   xbee_timer_wheel_t   timers;
+
 } wpan_dev_t;
 
 /// Macro to test whether a device has joined the network.
@@ -440,6 +445,7 @@ typedef struct wpan_dev_t {
 
 
 int wpan_tick( wpan_dev_t *dev);
+int32_t wpan_next_timeout( wpan_dev_t *dev);
 
 const wpan_cluster_table_entry_t *wpan_cluster_match( uint16_t match,
    uint8_t mask, const wpan_cluster_table_entry_t *entry);
@@ -505,11 +511,10 @@ typedef int (*wpan_response_fn)(
 typedef struct wpan_conversation_t {
    uint8_t           transaction_id;
    void        FAR *context;
-   /// Time to expire conversation (0 for never or lower 16 bits of
-   /// xbee_seconds_timer) -- limited to 9 hours (32,768 seconds).
-   /// We could save another byte if it's ok to limit to 2 minutes
-   /// and we'll check for expirations at least every 7 seconds.
-   uint16_t          timeout;          // time to expire converstation
+   /// Expires the conversation (\c callback is NULL for a conversation
+   /// without a timeout).  Started on the device's timer wheel once the
+   /// endpoint state knows its device.
+   xbee_timer_t      timer;
    wpan_response_fn  handler;          // if NULL, record is unused
 } wpan_conversation_t;
 
@@ -528,6 +533,9 @@ typedef struct wpan_conversation_t {
 /// (requests waiting for responses).
 typedef struct wpan_ep_state_t {
    uint8_t              last_transaction;
+   /// Device whose timer wheel expires the conversations, set by
+   /// wpan_tick() and zdo_endpoint_state().
+   struct wpan_dev_t    *dev;
    wpan_conversation_t  conversations[WPAN_MAX_CONVERSATIONS];
 } wpan_ep_state_t;
 
@@ -536,6 +544,7 @@ int wpan_conversation_register( wpan_ep_state_t FAR *state,
 int wpan_conversation_response( wpan_ep_state_t FAR *state,
    uint8_t transaction_id, const wpan_envelope_t FAR *envelope);
 uint8_t wpan_endpoint_next_trans( const wpan_endpoint_table_entry_t *ep);
+void _wpan_endpoint_set_dev( wpan_ep_state_t FAR *state, wpan_dev_t *dev);
 
 int wpan_envelope_dispatch( wpan_envelope_t *envelope);
 
@@ -30,6 +30,42 @@ XBEE_BEGIN_DECLS
    #define XBEE_CMD_REQUEST_TABLESIZE  2
 #endif
 
+#ifndef XBEE_CMD_REQUEST_MAX
+   /// Maximum number of requests, counting xbee_cmd_request_table and
+   /// entries added at runtime with xbee_cmd_request_pool_add() (or by
+   /// XBEE_CMD_REQUEST_GROW).  Up to 2048; handles keep fewer sequence bits
+   /// when this is over 128.
+   #define XBEE_CMD_REQUEST_MAX        XBEE_CMD_REQUEST_TABLESIZE
+#endif
+
+#ifndef XBEE_CMD_REQUEST_GROW
+   /// Number of requests to malloc() when all of them are in use (until
+   /// there are XBEE_CMD_REQUEST_MAX), or 0 to only grow the request pool
+   /// with xbee_cmd_request_pool_add().
+   #define XBEE_CMD_REQUEST_GROW       0
+#endif
+
+#if XBEE_CMD_REQUEST_TABLESIZE > XBEE_CMD_REQUEST_MAX
+   #error "XBEE_CMD_REQUEST_MAX must be at least XBEE_CMD_REQUEST_TABLESIZE"
+#endif
+
+// Handles hold a request's index above XBEE_CMD_HANDLE_SHIFT bits of its
+// sequence, and must fit in a positive int16_t.
+#if XBEE_CMD_REQUEST_MAX <= 128
+   #define XBEE_CMD_HANDLE_SHIFT       8
+#elif XBEE_CMD_REQUEST_MAX <= 256
+   #define XBEE_CMD_HANDLE_SHIFT       7
+#elif XBEE_CMD_REQUEST_MAX <= 512
+   #define XBEE_CMD_HANDLE_SHIFT       6
+#elif XBEE_CMD_REQUEST_MAX <= 1024
+   #define XBEE_CMD_HANDLE_SHIFT       5
+#elif XBEE_CMD_REQUEST_MAX <= 2048
+   #define XBEE_CMD_HANDLE_SHIFT       4
+#else
+   #error "XBEE_CMD_REQUEST_MAX can't be over 2048"
+#endif
+#define XBEE_CMD_HANDLE_SEQ_MASK    ((1 << XBEE_CMD_HANDLE_SHIFT) - 1)
+
 /// Maximum number of bytes in the parameter sent to a command.
 /// Platforms can override this when limiting to AT commands with shorter
 /// parameters (e.g., 16 bytes when not using the certificate parameters).
@@ -104,6 +140,9 @@ typedef struct xbee_cmd_response {
       - #XBEE_CMD_RESP_FLAG_TIMEOUT
          Did not receive a response before timing out.
 
+      - #XBEE_CMD_RESP_FLAG_CACHED
+         Value came from the AT parameter cache instead of the XBee.
+
       - #XBEE_CMD_RESP_ATND_RSSI_INVALID [DigiMesh only]
          The RSSI field of the DigiMesh ATND response is not valid.
    */
@@ -118,6 +157,8 @@ typedef struct xbee_cmd_response {
       #define XBEE_CMD_RESP_ATND_RSSI_INVALID   XBEE_AT_RESP_ATND_RSSI_INVALID
       /// AT command timed out
       #define XBEE_CMD_RESP_FLAG_TIMEOUT        0x8000
+      /// value came from the AT parameter cache (see xbee_cmd_cache_read())
+      #define XBEE_CMD_RESP_FLAG_CACHED         0x4000
    ///@}
 
    /// Number of bytes in .value_bytes or zero if there wasn't a value sent
@@ -180,12 +221,19 @@ typedef struct xbee_cmd_request {
    /// Handle is a combination of index and this sequence byte.
    uint8_t        sequence;
 
+   /// Position of this entry in the request pool (see _xbee_cmd_pool).
+   uint16_t       index;
+
+   /// Index of the next free entry while this one is free
+   /// (XBEE_CMD_POOL_NONE while it's in use).
+   uint16_t       link;
+
    /// Device that sent this request -- if we have a table for each XBee, this
    /// element isn't necessary.  NULL if slot is empty.
    xbee_dev_t     *device;
 
-   /// expire entry if XBEE_CHECK_TIMEOUT_SEC(timeout) is true
-   uint16_t       timeout;
+   /// expires the request, on \c device's timer wheel
+   xbee_timer_t   timer;
 
    /// combination of XBEE_CMD_FLAG_* macros
    uint16_t       flags;
@@ -397,6 +445,41 @@ typedef union xbee_frame_at_response {
 
 // ---- API for command lists ----
 
+#ifndef XBEE_CMD_LIST_WINDOW_MAX
+   /// Maximum number of commands from a list that xbee_cmd_list_execute()
+   /// keeps in flight.  With the default of 1, it sends each command after
+   /// receiving the response to the previous one.
+   #define XBEE_CMD_LIST_WINDOW_MAX       1
+#endif
+
+#ifndef XBEE_CMD_LIST_WINDOW_LOCAL
+   /// Commands in flight for lists sent to the local XBee.  The XBee handles
+   /// API frames in order, so this can be as large as the serial buffers
+   /// allow.
+   #define XBEE_CMD_LIST_WINDOW_LOCAL     XBEE_CMD_LIST_WINDOW_MAX
+#endif
+
+#ifndef XBEE_CMD_LIST_WINDOW_REMOTE
+   /// Upper limit on commands in flight for lists sent to a remote node.
+   /// The window starts at 1 and grows by one with each response.
+   #define XBEE_CMD_LIST_WINDOW_REMOTE    XBEE_CMD_LIST_WINDOW_MAX
+#endif
+
+#ifndef XBEE_CMD_LIST_VALUE_MAX
+   /// Bytes saved from a response that arrives before the responses to
+   /// earlier commands in its list.  Commands with longer responses are
+   /// sent again once the earlier commands complete.
+   #define XBEE_CMD_LIST_VALUE_MAX        32
+#endif
+
+#if XBEE_CMD_LIST_WINDOW_MAX < 1 || XBEE_CMD_LIST_WINDOW_MAX > 64
+   #error "XBEE_CMD_LIST_WINDOW_MAX must be from 1 to 64"
+#endif
+#if XBEE_CMD_LIST_WINDOW_LOCAL > XBEE_CMD_LIST_WINDOW_MAX \
+   || XBEE_CMD_LIST_WINDOW_REMOTE > XBEE_CMD_LIST_WINDOW_MAX
+   #error "XBEE_CMD_LIST_WINDOW_LOCAL/_REMOTE can't exceed _WINDOW_MAX"
+#endif
+
 struct xbee_atcmd_reg_t;   // forward
 
 /**
@@ -439,6 +522,38 @@ enum xbee_command_list_status {
 };
 
 
+/**
+   @brief A command from a list that's in flight (see
+   xbee_command_list_context_t).
+*/
+typedef struct xbee_command_list_slot_t {
+   /// request sending this command
+   int16_t        handle;
+#if XBEE_CMD_LIST_WINDOW_MAX > 1
+   /// one of the XBEE_CMD_LIST_SLOT_* values
+   uint8_t        state;
+   /** @name
+      Values for \c state field of xbee_command_list_slot_t
+      @{
+   */
+      /// waiting for a response
+      #define XBEE_CMD_LIST_SLOT_SENT     0
+      /// response saved in the slot, \c handle already released
+      #define XBEE_CMD_LIST_SLOT_READY    1
+      /// response too long to save, send again once it's the oldest
+      #define XBEE_CMD_LIST_SLOT_RESEND   2
+   ///@}
+   /// number of bytes in \c value_bytes
+   uint8_t        value_length;
+   /// \c flags from the response
+   uint16_t       flags;
+   /// \c value from the response
+   uint32_t       value;
+   /// \c value_bytes from the response
+   uint8_t        value_bytes[XBEE_CMD_LIST_VALUE_MAX];
+#endif
+} xbee_command_list_slot_t;
+
 /**
    @brief Context data passed to command list processor.
 
@@ -452,8 +567,21 @@ typedef struct xbee_command_list_context_t {
    void FAR                            *base;
    /// Execution status
    enum xbee_command_list_status       status;
-   /// Where we are in the command list (index of last entry submitted).
+   /// Where we are in the command list (index of oldest entry in flight;
+   /// entries before it have completed).
    uint16_t                            index;
+   /// Index of the next entry to send.
+   uint16_t                            issued;
+   /// Number of entries to keep in flight.
+   uint8_t                             window;
+   /// Upper limit on \c window.
+   uint8_t                             window_limit;
+   /// Remote node the list is sent to (if \c remote is set).
+   wpan_address_t                      address;
+   /// Is the list sent to \c address, instead of the local XBee?
+   bool_t                              remote;
+   /// Entries in flight, indexed by entry % XBEE_CMD_LIST_WINDOW_MAX.
+   xbee_command_list_slot_t            slot[XBEE_CMD_LIST_WINDOW_MAX];
 } xbee_command_list_context_t;
 
 
@@ -540,7 +668,7 @@ typedef struct xbee_atcmd_reg_t {
 #define XBEE_ATCMD_REG(c1,c2,type,obj,field) \
    { { { c1, c2 } }, 0, type, NULL, \
       (uint8_t) sizeof((*(obj *)NULL).field), \
-      (uint8_t) offsetof( obj, field) }
+      (uint16_t) offsetof( obj, field) }
 
 /**
    @brief Macro used in creating command list tables.
@@ -591,7 +719,7 @@ typedef struct xbee_atcmd_reg_t {
 #define XBEE_ATCMD_REG_MOVE_THEN_CB(c1,c2,type,obj,field,cb,flags) \
    { { { c1, c2 } }, flags, type, cb,     \
       (uint8_t) sizeof((*(obj *)NULL).field), \
-      (uint8_t) offsetof( obj, field) }
+      (uint16_t) offsetof( obj, field) }
 
 
 /**
@@ -655,27 +783,53 @@ int xbee_cmd_list_execute(
          const wpan_address_t FAR *address
          );
 
+int xbee_cmd_list_execute_window(
+         xbee_dev_t *xbee,
+         xbee_command_list_context_t FAR *clc,
+         const xbee_atcmd_reg_t FAR *list,
+         void FAR *base,
+         const wpan_address_t FAR *address,
+         uint_fast8_t window
+         );
+
 enum xbee_command_list_status (xbee_cmd_list_status)(
          xbee_command_list_context_t FAR *clc);
 #define xbee_cmd_list_status(clc)      ((clc)->status)
 // ---- End of API for command lists ----
 
 
+/// Marks the end of the free list, or a request that isn't on it.
+#define XBEE_CMD_POOL_NONE    0xFFFF
+
+/// Requests available to xbee_cmd_create(), see xbee_cmd_request_pool_add().
+typedef struct xbee_cmd_pool_t {
+   /// requests, indexed by the upper bits of their handles
+   xbee_cmd_request_t   FAR   *entry[XBEE_CMD_REQUEST_MAX];
+
+   uint16_t                   count;      ///< entries in the pool
+   uint16_t                   in_use;     ///< entries not on the free list
+   uint16_t                   free_head;  ///< index of first free entry
+   uint16_t                   expired;    ///< requests timed out (wraps)
+} xbee_cmd_pool_t;
+
 /// Is entry \a index available (unused)?
 #define XBEE_CMD_REQUEST_EMPTY(index)  \
-                              (xbee_cmd_request_table[index].device == NULL)
+                              (_xbee_cmd_pool.entry[index]->device == NULL)
 
-/// Return the handle for entry \a index (combination of \a index and
-/// \a .sequence member of entry).
-#define XBEE_CMD_REQUEST_HANDLE(index) \
-   ((index << 8) || xbee_cmd_request_table[index].sequence)
+/// Return the handle for \a request (combination of its \c index and
+/// \c sequence members).
+#define XBEE_CMD_REQUEST_HANDLE(request)                 \
+   ((int16_t) (((request)->index << XBEE_CMD_HANDLE_SHIFT) \
+               | ((request)->sequence & XBEE_CMD_HANDLE_SEQ_MASK)))
 
 // documented in xbee_atcmd.c
 extern FAR xbee_cmd_request_t
                            xbee_cmd_request_table[XBEE_CMD_REQUEST_TABLESIZE];
+extern xbee_cmd_pool_t _xbee_cmd_pool;
 
 // all functions are documented in xbee_atcmd.c
 int xbee_cmd_tick( void);
+int32_t xbee_cmd_next_timeout( void);
 xbee_cmd_request_t FAR *_xbee_cmd_handle_to_address( int16_t handle);
 int xbee_cmd_init_device( xbee_dev_t *xbee);
 int xbee_cmd_query_device( xbee_dev_t *xbee, uint_fast8_t refresh);
@@ -683,6 +837,12 @@ int xbee_cmd_query_status( xbee_dev_t *xbee);
 
 int16_t xbee_cmd_create( xbee_dev_t *xbee, const char FAR command[3]);
 int _xbee_cmd_release_request( xbee_cmd_request_t FAR *request);
+int xbee_cmd_request_pool_add( xbee_cmd_request_t FAR *block,
+   uint16_t count);
+xbee_cmd_request_t FAR *_xbee_cmd_pool_alloc( void);
+void _xbee_cmd_pool_free( xbee_cmd_request_t FAR *request);
+void _xbee_cmd_set_timeout( xbee_cmd_request_t FAR *request,
+   uint32_t timeout_ms);
 int xbee_cmd_release_handle( int16_t handle);
 int xbee_cmd_set_command( int16_t handle, const char FAR command[3]);
 int xbee_cmd_set_callback( int16_t handle, xbee_cmd_callback_fn callback,
@@ -700,6 +860,8 @@ int xbee_cmd_simple( xbee_dev_t *xbee, const char FAR command[3],
    uint32_t value);
 int xbee_cmd_execute( xbee_dev_t *xbee, const char FAR command[3],
    const void FAR *data, uint8_t length);
+int xbee_cmd_negotiate_baudrate( xbee_dev_t *xbee, const uint32_t FAR *rates,
+   uint_fast8_t count, uint16_t timeout_ms);
 
 #define XBEE_FRAME_HANDLE_LOCAL_AT     \
    { XBEE_FRAME_LOCAL_AT_RESPONSE, 0, _xbee_cmd_handle_response, NULL },   \
@@ -713,6 +875,93 @@ int _xbee_cmd_handle_response( xbee_dev_t *xbee, const void FAR *rawframe,
 int _xbee_cmd_modem_status( xbee_dev_t *xbee,
    const void FAR *payload, uint16_t length, void FAR *context);
 
+
+// ---- API for the AT parameter cache ----
+
+#ifndef XBEE_CMD_CACHE_SIZE
+   /// Number of AT parameter values the cache holds, shared by all devices
+   /// and remote nodes.  With the default of 0, the cache is disabled and
+   /// the xbee_cmd_cache_* functions return -ENOSYS.
+   #define XBEE_CMD_CACHE_SIZE         0
+#endif
+
+#ifndef XBEE_CMD_CACHE_VALUE_MAX
+   /// Longest value (in bytes) saved in the cache.  Longer responses
+   /// aren't cached.
+   #define XBEE_CMD_CACHE_VALUE_MAX    20
+#endif
+
+#ifndef XBEE_CMD_CACHE_WAITERS
+   /// Number of xbee_cmd_cache_read() callbacks that can wait on requests
+   /// in flight.
+   #define XBEE_CMD_CACHE_WAITERS      8
+#endif
+
+/// Suggested \c max_age_ms for xbee_cmd_cache_read() and
+/// xbee_cmd_cache_get(), for settings that only change when written.
+#define XBEE_CMD_CACHE_TTL             60000
+
+#if XBEE_CMD_CACHE_SIZE > 255
+   #error "XBEE_CMD_CACHE_SIZE must be 255 or less"
+#endif
+
+#if XBEE_CMD_CACHE_SIZE
+/// Cached value of one AT parameter, see xbee_cmd_cache_read().
+typedef struct xbee_cmd_cache_entry_t {
+   xbee_dev_t              *device;       ///< NULL if entry is unused
+   addr64                  ieee;          ///< node, for remote entries
+   uint32_t                updated_ms;    ///< when \c value was saved
+   int16_t                 handle;        ///< read in flight, or -1
+   xbee_at_cmd_t           command;
+   uint8_t                 flags;         ///< XBEE_CMD_CACHE_FLAG_* bits
+   /** @name
+      Values for \c flags field of xbee_cmd_cache_entry_t
+      @{
+   */
+      /// entry is for the node at \c ieee instead of the local XBee
+      #define XBEE_CMD_CACHE_FLAG_REMOTE     0x01
+      /// \c value is set
+      #define XBEE_CMD_CACHE_FLAG_VALID      0x02
+      /// written while a read was in flight, don't save the read's response
+      #define XBEE_CMD_CACHE_FLAG_DISCARD    0x04
+   ///@}
+   uint8_t                 value_length;
+   uint8_t                 value[XBEE_CMD_CACHE_VALUE_MAX];
+} xbee_cmd_cache_entry_t;
+
+/// Callback waiting on a read started by xbee_cmd_cache_read().
+typedef struct xbee_cmd_cache_waiter_t {
+   xbee_cmd_callback_fn    callback;      ///< NULL if unused
+   void              FAR   *context;
+   int16_t                 handle;        ///< request the callback waits on
+} xbee_cmd_cache_waiter_t;
+
+/// AT parameter cache, see xbee_cmd_cache_read().
+typedef struct xbee_cmd_cache_t {
+   xbee_cmd_cache_entry_t  entry[XBEE_CMD_CACHE_SIZE];
+   xbee_cmd_cache_waiter_t waiter[XBEE_CMD_CACHE_WAITERS];
+} xbee_cmd_cache_t;
+
+// documented in xbee_atcmd.c
+extern xbee_cmd_cache_t _xbee_cmd_cache;
+#endif
+
+int xbee_cmd_cache_read( xbee_dev_t *xbee, const addr64 FAR *ieee,
+   const char FAR command[3], uint32_t max_age_ms,
+   xbee_cmd_callback_fn callback, void FAR *context);
+int xbee_cmd_cache_get( xbee_dev_t *xbee, const addr64 FAR *ieee,
+   const char FAR command[3], uint32_t max_age_ms,
+   void FAR *buffer, uint_fast8_t buffer_size);
+int xbee_cmd_cache_invalidate( xbee_dev_t *xbee, const addr64 FAR *ieee,
+   const char FAR command[3]);
+int xbee_cmd_cache_flush( xbee_dev_t *xbee);
+void _xbee_cmd_cache_written( xbee_dev_t *xbee, const addr64 FAR *ieee,
+   uint16_t command, bool_t has_param);
+void _xbee_cmd_cache_update( const xbee_cmd_request_t FAR *request,
+   const addr64 FAR *ieee, uint_fast8_t status,
+   const uint8_t FAR *value, uint_fast8_t value_length);
+// ---- End of API for the AT parameter cache ----
+
 ///@}
 
 /**
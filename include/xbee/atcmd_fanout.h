@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2019 Digi International Inc.,
+ * All rights not expressly granted are reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Digi International Inc. 11001 Bren Road East, Minnetonka, MN 55343
+ * =======================================================================
+ */
+
+/**
+   @addtogroup xbee_atcmd
+   @{
+   @file xbee/atcmd_fanout.h
+
+   Send the same remote AT command (e.g., ATDB, ATVR, or a change to a
+   setting) to a list of nodes.
+
+   An xbee_fanout_t walks the list with xbee_cmd_create() and
+   xbee_cmd_send(), limiting the requests it starts per second, the
+   requests in flight, and the requests in flight on each route.  Targets
+   on the same route (e.g., behind the same router) share its limit, and
+   targets waiting on a busy route don't hold up targets on other routes.
+   Requests that time out, fail to transmit or can't be sent (e.g., when
+   the request pool is full) are sent again, up to xbee_fanout_t.retries
+   times.
+
+   Each target's result goes to a callback as it completes, followed by a
+   call with a NULL result once every target is done.
+   xbee_fanout_status() reports a summary of the results.
+
+   Call xbee_fanout_tick() from the main loop (along with xbee_dev_tick())
+   to start requests as the limits allow.
+*/
+
+#ifndef __XBEE_ATCMD_FANOUT
+#define __XBEE_ATCMD_FANOUT
+
+#include "xbee/atcmd.h"
+
+XBEE_BEGIN_DECLS
+
+#ifndef XBEE_FANOUT_MAX_IN_FLIGHT
+   /// Maximum number of requests an xbee_fanout_t can have in flight (or
+   /// waiting to retry).  Also limited by the AT command request pool (see
+   /// XBEE_CMD_REQUEST_MAX).
+   #define XBEE_FANOUT_MAX_IN_FLIGHT   8
+#endif
+
+/// Number of targets past the first unstarted one that xbee_fanout_tick()
+/// considers when routes are busy.
+#define XBEE_FANOUT_LOOKAHEAD          32
+
+#ifndef XBEE_FANOUT_SEND_RETRY_MS
+   /// Milliseconds xbee_fanout_tick() waits after failing to create or send
+   /// a request before starting another one.
+   #define XBEE_FANOUT_SEND_RETRY_MS   100
+#endif
+
+/// Target of an xbee_fanout_t.
+typedef struct xbee_fanout_target_t {
+   /// Remote node (network address can be WPAN_NET_ADDR_UNDEFINED).
+   wpan_address_t       address;
+   /// Arbitrary route identifier, targets with the same route share
+   /// xbee_fanout_t.route_limit.
+   uint16_t             route;
+} xbee_fanout_target_t;
+
+/// Result for one target, passed to an xbee_fanout_result_fn.
+typedef struct xbee_fanout_result_t {
+   /// Index of the target in the list passed to xbee_fanout_start().
+   uint16_t                         target;
+   /// Number of attempts to send a request to the target.
+   uint8_t                          attempts;
+   /// 0 for success, -EIO if the node returned an error or the request
+   /// failed to transmit (see \c response), -ETIMEDOUT, or the error from
+   /// creating or sending the last request.
+   int                              status;
+   /// Response from the node (with XBEE_CMD_RESP_FLAG_TIMEOUT set in
+   /// \c flags after a timeout), or NULL if the last request couldn't be
+   /// sent.
+   const xbee_cmd_response_t  FAR   *response;
+} xbee_fanout_result_t;
+
+struct xbee_fanout_t;
+
+/**
+   @brief
+   Callback for an xbee_fanout_t's results.
+
+   @param[in]  fanout  Fan-out that completed a target.
+   @param[in]  result  Result for one target, or NULL once every target
+                       is done.
+*/
+typedef void (*xbee_fanout_result_fn)(
+   struct xbee_fanout_t       FAR   *fanout,
+   const xbee_fanout_result_t FAR   *result
+);
+
+/// Summary of an xbee_fanout_t's results, see xbee_fanout_status().
+typedef struct xbee_fanout_summary_t {
+   uint16_t       targets;          ///< targets in the list
+   uint16_t       succeeded;        ///< targets completed with status 0
+   uint16_t       failed;           ///< targets completed with other errors
+   uint16_t       timed_out;        ///< targets completed with -ETIMEDOUT
+   uint16_t       retries;          ///< attempts made again
+   uint32_t       elapsed_ms;       ///< time from start to the last result
+} xbee_fanout_summary_t;
+
+/// Request in flight (or waiting to retry) for an xbee_fanout_t.
+typedef struct xbee_fanout_slot_t {
+   int16_t        handle;           ///< request for current attempt
+   uint16_t       target;           ///< index into xbee_fanout_t.targets
+   uint8_t        attempts;         ///< attempts to send so far
+   uint8_t        state;            ///< one of XBEE_FANOUT_SLOT_*
+   /** @name
+      Values for \c state field of xbee_fanout_slot_t
+      @{
+   */
+      #define XBEE_FANOUT_SLOT_FREE    0     ///< not in use
+      #define XBEE_FANOUT_SLOT_SENT    1     ///< waiting for a response
+      #define XBEE_FANOUT_SLOT_RETRY   2     ///< waiting to send again
+   ///@}
+} xbee_fanout_slot_t;
+
+/// State of a fan-out, see xbee_fanout_init().
+typedef struct xbee_fanout_t {
+   /// Requests to start per second, 0 for no limit.
+   uint16_t                         rate;
+   /// Requests in flight, up to XBEE_FANOUT_MAX_IN_FLIGHT.
+   uint8_t                          in_flight_limit;
+   /// Requests in flight on each route, 0 for no limit.
+   uint8_t                          route_limit;
+   /// Times to send a request again after a timeout, a transmit failure or
+   /// an error sending it.
+   uint8_t                          retries;
+   /// Seconds to wait for each response.
+   uint8_t                          timeout;
+
+   // remaining fields are managed by the xbee_fanout_* functions
+
+   xbee_dev_t                       *xbee;
+   xbee_at_cmd_t                    command;
+   uint8_t                          param_length;
+   uint8_t                          param[XBEE_CMD_MAX_PARAM_LENGTH];
+
+   const xbee_fanout_target_t FAR   *targets;
+   uint16_t                         count;
+   xbee_fanout_result_fn            callback;
+   void                       FAR   *context;
+
+   /// first target not started yet
+   uint16_t                         next;
+   /// bit n set if target (next + n) was started out of order
+   uint32_t                         started;
+   /// targets started and not complete
+   uint16_t                         pending;
+   /// value for xbee_fanout_status() to return (-EBUSY while running)
+   int                              status;
+   uint32_t                         start_ms;
+   uint32_t                         next_send_ms;
+   xbee_fanout_summary_t            summary;
+   xbee_fanout_slot_t               slot[XBEE_FANOUT_MAX_IN_FLIGHT];
+} xbee_fanout_t;
+
+/** @name Defaults set by xbee_fanout_init()
+   @{
+*/
+#define XBEE_FANOUT_DEFAULT_RATE          20
+#define XBEE_FANOUT_DEFAULT_ROUTE_LIMIT   2
+#define XBEE_FANOUT_DEFAULT_RETRIES       2
+#define XBEE_FANOUT_DEFAULT_TIMEOUT       10
+///@}
+
+int xbee_fanout_init( xbee_fanout_t FAR *fanout, xbee_dev_t *xbee,
+   const char FAR command[3], const void FAR *param, uint8_t param_length);
+
+int xbee_fanout_start( xbee_fanout_t FAR *fanout,
+   const xbee_fanout_target_t FAR *targets, uint16_t count,
+   xbee_fanout_result_fn callback, void FAR *context);
+
+int xbee_fanout_tick( xbee_fanout_t FAR *fanout);
+
+int xbee_fanout_status( const xbee_fanout_t FAR *fanout,
+   xbee_fanout_summary_t FAR *summary);
+
+int xbee_fanout_cancel( xbee_fanout_t FAR *fanout);
+
+XBEE_END_DECLS
+
+// If compiling in Dynamic C, automatically #use the appropriate C file.
+#ifdef __DC__
+   #use "xbee_atcmd_fanout.c"
+#endif
+
+#endif   // __XBEE_ATCMD_FANOUT
+
+///@}
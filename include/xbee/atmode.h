@@ -34,6 +34,11 @@ int xbee_atmode_send_request(xbee_dev_t *xbee, const char FAR *command);
 int xbee_atmode_read_response(xbee_dev_t *xbee, char FAR *response,
     int resp_size, int FAR *bytesread);
 
+int xbee_atmode_send_batch(xbee_dev_t *xbee,
+    const char FAR * const FAR *commands, int count);
+int xbee_atmode_read_batch(xbee_dev_t *xbee, char FAR *buffer, int bufsize,
+    int FAR *bytesread);
+
 XBEE_END_DECLS
 
 // If compiling in Dynamic C, automatically #use the appropriate C file.
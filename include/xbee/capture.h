@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2019 Digi International Inc.,
+ * All rights not expressly granted are reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Digi International Inc. 11001 Bren Road East, Minnetonka, MN 55343
+ * =======================================================================
+ */
+
+/**
+   @addtogroup xbee_device
+   @{
+   @file xbee/capture.h
+
+   Binary capture of the API frames an xbee_dev_t sends and receives, and
+   replay of those captures into _xbee_frame_dispatch().
+
+   A capture is an append-only log in memory: an xbee_capture_header_t,
+   followed by an xbee_capture_record_t and the frame's bytes (starting
+   with the frame type, without framing or checksum) for each frame.  All
+   fields are little-endian and records aren't padded, so a capture can be
+   written to (or mapped from) a file and read on any host.  A record with
+   a length of 0 (e.g., unused space at the end of a mapped file) ends the
+   log.
+
+   Timestamps come from XBEE_DEV_STATS_TIMER(), in microseconds.  The
+   32-bit value wraps after about 71 minutes, so only differences between
+   consecutive records are meaningful.  Received frames are stamped with
+   the time their start-of-frame was read.
+
+   Frames are recorded from the thread that calls xbee_dev_tick() (frames
+   from the reader thread's queue are recorded as they're dispatched), so
+   don't send frames from other threads while capturing.
+
+   ports/posix/xbee_capture_posix.c adds functions to capture to, and map
+   captures from, files.
+*/
+
+#ifndef __XBEE_CAPTURE
+#define __XBEE_CAPTURE
+
+#include "xbee/device.h"
+
+XBEE_BEGIN_DECLS
+
+/// First bytes of a capture.
+#define XBEE_CAPTURE_MAGIC       "XBcp"
+/// Current value for the \c version_le field of xbee_capture_header_t.
+#define XBEE_CAPTURE_VERSION     1
+
+/// Header at the start of a capture.
+typedef XBEE_PACKED(xbee_capture_header_t, {
+   char           magic[4];         ///< XBEE_CAPTURE_MAGIC
+   uint16_t       version_le;       ///< XBEE_CAPTURE_VERSION
+   uint16_t       reserved_le;      ///< set to 0
+}) xbee_capture_header_t;
+
+/// Header for each frame in a capture, followed by \c length_le bytes.
+typedef XBEE_PACKED(xbee_capture_record_t, {
+   uint32_t       timestamp_le;     ///< XBEE_DEV_STATS_TIMER() value
+   uint16_t       length_le;        ///< bytes of frame data that follow
+   uint8_t        direction;        ///< one of XBEE_CAPTURE_DIR_xxx
+   uint8_t        reserved;         ///< set to 0
+}) xbee_capture_record_t;
+
+/** @name XBEE_CAPTURE_DIR_*
+   Values for \c direction field of xbee_capture_record_t.
+   @{
+*/
+#define XBEE_CAPTURE_DIR_RX      0x01     ///< frame received from the XBee
+#define XBEE_CAPTURE_DIR_TX      0x02     ///< frame sent to the XBee
+///@}
+
+/// State of a capture in progress, see xbee_capture_init().
+typedef struct xbee_capture_t {
+   uint8_t FAR    *buffer;          ///< log, starting with the header
+   uint32_t       size;             ///< bytes available at \c buffer
+   uint32_t       used;             ///< bytes of \c buffer written so far
+   uint32_t       dropped;          ///< frames that didn't fit in \c buffer
+   int            handle;           ///< platform's handle for a mapped file
+} xbee_capture_t;
+
+/** @name xbee_capture_replay() flags
+   @{
+*/
+/// dispatch frames as fast as possible
+#define XBEE_CAPTURE_REPLAY_FAST       0x0000
+/// wait between frames to match their original timing
+#define XBEE_CAPTURE_REPLAY_REALTIME   0x0001
+///@}
+
+int xbee_capture_init( xbee_capture_t *capture, void FAR *buffer,
+   uint32_t size);
+
+int xbee_capture_start( xbee_dev_t *xbee, xbee_capture_t *capture);
+
+const xbee_capture_record_t FAR *xbee_capture_next( const void FAR *log,
+   uint32_t length, uint32_t *offset);
+
+int xbee_capture_replay( xbee_dev_t *xbee, const void FAR *log,
+   uint32_t length, uint16_t flags);
+
+// implemented by platforms with files (e.g., ports/posix/xbee_capture_posix.c)
+int xbee_capture_open( xbee_capture_t *capture, const char *filename,
+   uint32_t size);
+
+int xbee_capture_close( xbee_capture_t *capture);
+
+int xbee_capture_map( const char *filename, const void **log,
+   uint32_t *length);
+
+int xbee_capture_unmap( const void *log, uint32_t length);
+
+// private functions exposed for unit testing
+
+void _xbee_capture_frame( xbee_capture_t *capture, uint_fast8_t direction,
+   uint32_t timestamp, const void FAR *header, uint16_t headerlen,
+   const void FAR *data, uint16_t datalen);
+
+XBEE_END_DECLS
+
+#endif   // __XBEE_CAPTURE
+
+///@}
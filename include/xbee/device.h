@@ -18,7 +18,91 @@
    @file xbee/device.h
 
    @def XBEE_DEV_MAX_DISPATCH_PER_TICK
-      Maximum number of frames to dispatch per call to xbee_tick().
+      Maximum number of frames to dispatch per call to xbee_tick().  See
+      xbee_dev_tick_budget() for a tick limited by time or bytes instead.
+
+   @def XBEE_DEV_RX_STAGING_SIZE
+      Size of a per-device staging ring that _xbee_frame_load() fills from
+      the serial port in large chunks, instead of reading one byte at a time
+      while looking for a frame's start and length.  Must be a power of 2
+      no larger than 32768.  Defaults to 0 (read directly from the serial
+      port) for platforms with inexpensive, byte-oriented serial drivers.
+
+   @def XBEE_DEV_RX_ZERO_COPY
+      Set to 1 to verify received frames and pass them to handlers in place
+      in the staging ring, instead of copying each one into a buffer in
+      xbee_dev_t.  A frame that would run past the end of the ring is first
+      moved, with any bytes staged after it, to the start of the ring.
+      Drops the \c rx.frame_data buffer (XBEE_MAX_RX_FRAME_LEN bytes) from
+      xbee_dev_t.  Requires an XBEE_DEV_RX_STAGING_SIZE larger than
+      XBEE_MAX_RX_FRAME_LEN.  Defaults to 0 (copy each frame).
+
+   @def XBEE_DEV_DISPATCH_INDEX_SIZE
+      Capacity of the per-frame-type index of xbee_frame_handlers[] built by
+      xbee_dev_init(), in handler references (each wildcard entry counts once
+      for every frame type with its own handlers).  With the index,
+      _xbee_frame_dispatch() only visits handlers that match a frame's type
+      instead of scanning the whole table.  Defaults to 0 (no index, saving
+      the 512 bytes of RAM it requires).  Maximum of 256.
+
+   @def XBEE_DEV_HANDLER_REGISTRY_SIZE
+      Number of frame handlers each xbee_dev_t can register at runtime with
+      xbee_frame_handler_add(), in addition to the static
+      xbee_frame_handlers[] table shared by all devices.  Defaults to 0 (no
+      runtime registry).  Maximum of 255.
+
+   @def XBEE_DEV_HANDLER_BUCKETS
+      Number of hash buckets (a power of 2) for the runtime frame handler
+      registry, hashed by frame type and frame ID.  Defaults to 8.
+
+   @def XBEE_DEV_RX_QUEUE_SIZE
+      Number of frames (a power of 2, up to 128) in a per-device queue
+      filled by a reader thread started with xbee_dev_rx_thread_start().
+      The reader thread reads and validates frames, and xbee_dev_tick() only
+      dispatches them, so slow frame handlers don't hold up the serial port.
+      Requires a platform with threads that defines XBEE_ATOMIC_LOAD() and
+      XBEE_ATOMIC_STORE().  Defaults to 0 (no reader thread).
+
+   @def XBEE_DEV_TX_QUEUE_SIZE
+      Bytes of memory for each priority class (XBEE_TX_PRIORITY_xxx) of a
+      per-device transmit queue.  With the queue, xbee_frame_write() holds
+      frames the XBee can't accept yet (CTS deasserted or a full serial
+      buffer) instead of returning -EBUSY, and xbee_dev_tick() sends them
+      once it can.  Each queued frame uses its length plus about 16 bytes.
+      Defaults to 0 (no queue).  Maximum of 32768.
+
+   @def XBEE_DEV_STATS
+      Set to 1 to keep an xbee_dev_stats_t of frame and byte counts, errors,
+      handler times and latency histograms in each xbee_dev_t, for
+      xbee_dev_stats_snapshot().  Adds about 2.5KB to each device.
+      Defaults to 0 (no statistics).
+
+   @def XBEE_DEV_CAPTURE
+      Set to 1 to support recording frames with xbee_capture_start() (see
+      xbee/capture.h).  Adds a pointer to each xbee_dev_t.  Defaults to 0
+      (no capture).
+
+   @def XBEE_DEV_API_ESCAPED
+      Set to 1 to support escaped API mode (ATAP=2, required with software
+      flow control), selected for each device with xbee_dev_api_mode().
+      Adds a byte to each xbee_dev_t, and a 128-byte stack buffer to
+      xbee_frame_write().  Defaults to 0 (only unescaped API mode, ATAP=1).
+
+   @def XBEE_DEV_FRAME_ID_TRACKING
+      Set to 1 to track the frame IDs in flight on each xbee_dev_t.
+      xbee_frame_id_alloc() (and xbee_next_frame_id()) only hand out IDs
+      that aren't in use, and _xbee_frame_dispatch() passes a response with
+      a tracked ID to the handler registered for that ID (with its context)
+      before the frame handler table and registry.  Adds a
+      slot for each of the 255 IDs (about 6KB on 64-bit hosts) to each
+      device.  Defaults to 0 (IDs simply increment and wrap).
+
+   @def XBEE_DEV_STATS_TIMER
+      Expression returning a free-running uint32_t count of microseconds,
+      used to time handlers and frame latency when XBEE_DEV_STATS is set,
+      to timestamp frames for XBEE_DEV_CAPTURE, and for the time budget of
+      xbee_dev_tick_budget().  Defaults to
+      xbee_millisecond_timer() * 1000, for platforms without a finer timer.
 */
 
 #ifndef __XBEE_DEVICE
@@ -42,6 +126,83 @@ XBEE_BEGIN_DECLS
    #define XBEE_DEV_MAX_DISPATCH_PER_TICK 5
 #endif
 
+#ifndef XBEE_DEV_RX_STAGING_SIZE
+   #define XBEE_DEV_RX_STAGING_SIZE 0
+#elif XBEE_DEV_RX_STAGING_SIZE & (XBEE_DEV_RX_STAGING_SIZE - 1)
+   #error "XBEE_DEV_RX_STAGING_SIZE must be a power of 2"
+#elif XBEE_DEV_RX_STAGING_SIZE > 32768
+   #error "XBEE_DEV_RX_STAGING_SIZE must not be larger than 32768"
+#endif
+
+#ifndef XBEE_DEV_DISPATCH_INDEX_SIZE
+   #define XBEE_DEV_DISPATCH_INDEX_SIZE 0
+#elif XBEE_DEV_DISPATCH_INDEX_SIZE > 256
+   #error "XBEE_DEV_DISPATCH_INDEX_SIZE must not be larger than 256"
+#endif
+
+#ifndef XBEE_DEV_HANDLER_REGISTRY_SIZE
+   #define XBEE_DEV_HANDLER_REGISTRY_SIZE 0
+#elif XBEE_DEV_HANDLER_REGISTRY_SIZE > 255
+   #error "XBEE_DEV_HANDLER_REGISTRY_SIZE must not be larger than 255"
+#endif
+
+#ifndef XBEE_DEV_HANDLER_BUCKETS
+   #define XBEE_DEV_HANDLER_BUCKETS 8
+#elif XBEE_DEV_HANDLER_BUCKETS & (XBEE_DEV_HANDLER_BUCKETS - 1)
+   #error "XBEE_DEV_HANDLER_BUCKETS must be a power of 2"
+#endif
+
+#ifndef XBEE_DEV_RX_QUEUE_SIZE
+   #define XBEE_DEV_RX_QUEUE_SIZE 0
+#elif XBEE_DEV_RX_QUEUE_SIZE & (XBEE_DEV_RX_QUEUE_SIZE - 1)
+   #error "XBEE_DEV_RX_QUEUE_SIZE must be a power of 2"
+#elif XBEE_DEV_RX_QUEUE_SIZE > 128
+   #error "XBEE_DEV_RX_QUEUE_SIZE must not be larger than 128"
+#elif XBEE_DEV_RX_QUEUE_SIZE && ! defined XBEE_ATOMIC_STORE
+   #error "XBEE_DEV_RX_QUEUE_SIZE requires XBEE_ATOMIC_LOAD/XBEE_ATOMIC_STORE"
+#endif
+
+#ifndef XBEE_DEV_TX_QUEUE_SIZE
+   #define XBEE_DEV_TX_QUEUE_SIZE 0
+#elif XBEE_DEV_TX_QUEUE_SIZE > 32768
+   #error "XBEE_DEV_TX_QUEUE_SIZE must not be larger than 32768"
+#endif
+
+// milliseconds to keep trying to finish a frame the serial driver only took
+// part of, while it doesn't take any more
+#ifndef XBEE_DEV_TX_STALL_TIMEOUT
+   #define XBEE_DEV_TX_STALL_TIMEOUT 1000
+#endif
+
+// milliseconds that bytes already written can keep the serial port busy
+// (see _xbee_dev_tx_idle_timer()); a stamp further ahead is left over from
+// writes over 24.8 days ago that wrapped around
+#ifndef XBEE_DEV_TX_IDLE_LEAD_MAX
+   #define XBEE_DEV_TX_IDLE_LEAD_MAX 30000
+#endif
+
+#ifndef XBEE_DEV_STATS
+   #define XBEE_DEV_STATS 0
+#endif
+#ifndef XBEE_DEV_STATS_TIMER
+   #define XBEE_DEV_STATS_TIMER()   (xbee_millisecond_timer() * 1000)
+#endif
+
+#ifndef XBEE_DEV_CAPTURE
+   #define XBEE_DEV_CAPTURE 0
+#endif
+
+#ifndef XBEE_DEV_API_ESCAPED
+   #define XBEE_DEV_API_ESCAPED 0
+#endif
+
+#ifndef XBEE_DEV_FRAME_ID_TRACKING
+   #define XBEE_DEV_FRAME_ID_TRACKING 0
+#endif
+
+// record when each frame's start-of-frame was read
+#define _XBEE_DEV_RX_STARTED     (XBEE_DEV_STATS || XBEE_DEV_CAPTURE)
+
 /** Possible values for the \c frame_type field of frames sent to and
    from the XBee module.  Values with the upper bit set (0x80) are frames
    we receive from the XBee module.  Values with the upper bit clear are
@@ -196,6 +357,27 @@ enum xbee_frame_type {
 /// Deprecated legacy macro, use XBEE_MAX_RX_FRAME_LEN instead.
 #define XBEE_MAX_FRAME_LEN    XBEE_MAX_RX_FRAME_LEN
 
+// Largest a frame with <len> bytes (starting with the frame type) can be in
+// escaped API mode, where every byte after the start-of-frame could double.
+#define _XBEE_ESCAPED_FRAME_SIZE(len)  (1 + 2 * ((len) + 3))
+
+// In escaped API mode (ATAP=2), start-of-frame (0x7E), escape (0x7D), XON
+// (0x11) and XOFF (0x13) bytes that follow a frame's start-of-frame are
+// sent as an escape followed by the byte XORed with 0x20.
+#define _XBEE_API_ESCAPE      0x7D
+#define _XBEE_API_ESCAPE_XOR  0x20
+#define _XBEE_API_NEEDS_ESCAPE(b) \
+   ((b) == 0x7E || (b) == 0x7D || (b) == 0x11 || (b) == 0x13)
+
+#ifndef XBEE_DEV_RX_ZERO_COPY
+   #define XBEE_DEV_RX_ZERO_COPY 0
+#elif XBEE_DEV_RX_ZERO_COPY && ! XBEE_DEV_RX_STAGING_SIZE
+   #error "XBEE_DEV_RX_ZERO_COPY requires XBEE_DEV_RX_STAGING_SIZE"
+#elif XBEE_DEV_RX_ZERO_COPY \
+         && XBEE_DEV_RX_STAGING_SIZE <= XBEE_MAX_RX_FRAME_LEN
+   #error "XBEE_DEV_RX_STAGING_SIZE must be larger than XBEE_MAX_RX_FRAME_LEN"
+#endif
+
 // We need to declare struct xbee_dev_t here so the compiler doesn't treat it
 // as a local definition in the parameter lists for the function pointer
 // typedefs that follow.
@@ -223,7 +405,8 @@ struct xbee_dev_t;
    @param[in] frame
                Pointer to frame data.  Data starts with the frame type (the
                0x7E start byte and frame length are stripped by lower layers
-               of the driver).
+               of the driver).  NULL (with a \a length of 0) if a frame ID
+               allocated with xbee_frame_id_alloc() timed out.
    @param[in] length
                Number of bytes in frame.
    @param[in] context
@@ -231,6 +414,10 @@ struct xbee_dev_t;
                registered with xbee_frame_handler_add.
 
    @retval  0  successfully processed frame
+   @retval  XBEE_FRAME_HANDLER_DONE   successfully processed frame, and
+               handler registered with xbee_frame_handler_add() should be
+               removed from the device's registry (e.g., a handler waiting
+               for a single status frame)
    @retval  !0 error processing frame
 */
 /*
@@ -240,13 +427,9 @@ struct xbee_dev_t;
                -  Invalid length (must be > 0)
                -  Frame pointer is NULL
 
-   @todo       What will _xbee_frame_dispatch do with those return values?
-               Does there need to be a return value equivalent to "thanks
-               for that frame, but please remove me from the dispatch table"?
-               Right now, the dispatcher is ignoring the return value.
-               Could be useful when registering to receive status information
-               on outbound frames -- once we have status, we don't need
-               to receive any additional notifications.
+               _xbee_frame_dispatch ignores return values from handlers in
+               the static xbee_frame_handlers table, and only acts on
+               XBEE_FRAME_HANDLER_DONE from handlers in the runtime registry.
 */
 typedef int (*xbee_frame_handler_fn)(
    struct xbee_dev_t          *xbee,
@@ -255,6 +438,24 @@ typedef int (*xbee_frame_handler_fn)(
    void                 FAR   *context
 );
 
+/// Return value for frame handlers registered with xbee_frame_handler_add()
+/// to remove themselves from the device's registry.
+#define XBEE_FRAME_HANDLER_DONE     0x7FFF
+
+/**
+   @brief
+   Function called when a frame passed to xbee_frame_queue() has left the
+   transmit queue.
+
+   @param[in] xbee      XBee device the frame was written to
+   @param[in] status    0 if the frame was handed to the serial driver,
+                        -ECANCELED if xbee_frame_queue_flush() dropped it,
+                        or another error from the serial driver
+   @param[in] context   \a context passed to xbee_frame_queue()
+*/
+typedef void (*xbee_frame_sent_fn)( struct xbee_dev_t *xbee, int status,
+   void FAR *context);
+
 /**
    @brief
    Function to check the XBee device's AWAKE pin to see if it is awake.
@@ -302,7 +503,48 @@ typedef struct xbee_dispatch_table_entry {
    void              FAR   *context;
 } xbee_dispatch_table_entry_t;
 
+/// Entry in an xbee_dev_t's runtime frame handler registry.
+typedef struct xbee_dev_handler_t {
+   xbee_frame_handler_fn   handler;
+   void              FAR   *context;
+   uint8_t                 frame_type; ///< if 0, match all frames of this type
+   uint8_t                 frame_id;   ///< if 0, match all frames of this identifier
+   int8_t                  priority;   ///< higher priorities are called first
+   uint8_t                 flags;      ///< XBEE_DEV_HANDLER_FLAG_xxx
+      #define XBEE_DEV_HANDLER_FLAG_INUSE    0x01  ///< slot is registered
+      #define XBEE_DEV_HANDLER_FLAG_REMOVED  0x02  ///< unlink after dispatch
+   uint8_t                 next;       ///< 1-based index of next in bucket
+} xbee_dev_handler_t;
+
+/// Owner of a frame ID in flight, see xbee_frame_id_alloc().
+typedef struct xbee_dev_frame_id_t {
+   xbee_frame_handler_fn   handler;    ///< NULL if only reserved
+   void              FAR   *context;   ///< passed to \c handler
+   xbee_timer_t            timer;      ///< pending if allocated w/timeout
+} xbee_dev_frame_id_t;
+
+/// Header of each frame in an xbee_dev_t's transmit queue, followed by the
+/// complete frame (0x7E start byte through checksum).
+typedef struct xbee_dev_tx_entry_t {
+   uint16_t                size;       ///< frame bytes; 0 marks a wrap
+   xbee_frame_sent_fn      callback;   ///< optional, called once sent
+   void              FAR   *context;   ///< passed to \c callback
+#if XBEE_DEV_STATS
+   uint32_t                queued;     ///< XBEE_DEV_STATS_TIMER() when queued
+#endif
+} xbee_dev_tx_entry_t;
 
+/** @name XBEE_TX_PRIORITY_*
+   Priority classes for the transmit queue, sent in this order.
+   @{
+*/
+/// Local and remote AT commands, or frames written with
+/// XBEE_WRITE_FLAG_PRIORITY.
+#define XBEE_TX_PRIORITY_HIGH       0
+/// All other frames (e.g., data transmit requests).
+#define XBEE_TX_PRIORITY_NORMAL     1
+#define XBEE_TX_PRIORITY_COUNT      2
+///@}
 
 enum xbee_dev_rx_state {
    XBEE_RX_STATE_WAITSTART = 0,  ///< waiting for initial 0x7E
@@ -319,6 +561,7 @@ enum xbee_dev_flags
    XBEE_DEV_FLAG_QUERY_ERROR     = 0x0008,   ///< querying timed out or error
    XBEE_DEV_FLAG_QUERY_REFRESH   = 0x0010,   ///< need to re-query device
    XBEE_DEV_FLAG_QUERY_INPROGRESS= 0x0020,   ///< query is in progress
+   XBEE_DEV_FLAG_API_ESCAPED     = 0x0040,   ///< XBee is using ATAP=2
 
    XBEE_DEV_FLAG_IN_TICK         = 0x0080,   ///< in xbee_dev_tick
 
@@ -348,6 +591,59 @@ enum xbee_dev_mode {
    XBEE_MODE_WAIT_RESPONSE ///< sent a command and now waiting for a response
 };
 
+/// Number of buckets in an xbee_dev_histogram_t.
+#define XBEE_DEV_HISTOGRAM_BUCKETS  24
+
+/**
+   Histogram of microsecond times with logarithmic buckets.  \c bucket[0]
+   counts times of 0, and \c bucket[n] counts times from 2^(n-1) to
+   2^n - 1.  The last bucket also counts everything longer.
+
+   @sa xbee_dev_histogram_percentile()
+*/
+typedef struct xbee_dev_histogram_t {
+   uint32_t bucket[XBEE_DEV_HISTOGRAM_BUCKETS];
+   uint32_t max;                 ///< longest time recorded
+} xbee_dev_histogram_t;
+
+/**
+   Statistics kept in an xbee_dev_t when the program sets XBEE_DEV_STATS.
+   Counters wrap at 2^32; read them with xbee_dev_stats_snapshot() and
+   clear them with xbee_dev_stats_reset().
+*/
+typedef struct xbee_dev_stats_t {
+   uint32_t frames_in;        ///< frames received with a valid checksum
+   uint32_t bytes_in;         ///< bytes in those frames, including framing
+   uint32_t frames_out;       ///< frames written to the serial port
+   uint32_t bytes_out;        ///< bytes in those frames, including framing
+   uint32_t checksum_errors;  ///< frames dropped for a bad checksum
+   uint32_t bad_lengths;      ///< length fields out of range
+   uint32_t skipped;          ///< bytes discarded (see \c rx.skipped)
+   /// times a tick stopped at XBEE_DEV_MAX_DISPATCH_PER_TICK frames (or
+   /// the end of its xbee_dev_tick_budget() budget) with more waiting for
+   /// the next tick
+   uint32_t dispatch_limited;
+   /// frames xbee_frame_write() couldn't send right away, because CTS was
+   /// deasserted or the serial port's buffer was full
+   uint32_t tx_busy;
+   /// busy frames dropped because the transmit queue was full
+   uint32_t tx_dropped;
+
+   /// frames dispatched and total microseconds in their handlers, by frame
+   /// type; \c time wraps after about 71 minutes
+   struct xbee_dev_stats_handler {
+      uint32_t frames;
+      uint32_t time;
+   } handler[256];
+
+   /// microseconds to dispatch each frame to all of its handlers
+   xbee_dev_histogram_t handler_time;
+   /// microseconds from reading a frame's start-of-frame to dispatching it
+   xbee_dev_histogram_t rx_latency;
+   /// microseconds that frames waited in the transmit queue
+   xbee_dev_histogram_t tx_latency;
+} xbee_dev_stats_t;
+
 /**
    @note
    -  This structure must start with a wpan_dev_t so that the device
@@ -466,16 +762,115 @@ typedef struct xbee_dev_t
    // idle mode, command mode, pre-escape guard-time, post-escape guard-time.
    // Current timeout: value of MS_TIMER when guard-time expired or we expect
    // to return to idle mode from command mode.
-   // If we track MS_TIMER from the last byte we sent to the XBee, we can
-   // potentially skip over the pre-escape guard time and send the escape chars.
+   // We track when the last byte we sent to the XBee leaves the serial port,
+   // so xbee_atmode_enter() can skip over the part of the pre-escape guard
+   // time that has already passed.
 
    /// Current mode of the XBee device (e.g., boot loader, API, command).
    #ifdef XBEE_DEVICE_ENABLE_ATMODE
       enum xbee_dev_mode   mode;
       uint32_t       mode_timer;    ///< MS_TIMER value used for timeouts
+      /// estimated MS_TIMER value when the serial port finishes sending the
+      /// bytes written so far, see _xbee_dev_tx_note()
+      uint32_t       tx_idle_timer;
       uint16_t       guard_time;    ///< value of GT (default 1000) * 1ms
       uint16_t       idle_timeout;  ///< value of CT (default 100) * 100ms
       char           escape_char;   ///< value of CC (default '+')
+      /// responses left from xbee_atmode_send_batch() in WAIT_RESPONSE mode
+      uint8_t        atmode_responses;
+   #endif
+
+   #if XBEE_DEV_RX_STAGING_SIZE
+      /// Bytes read from the serial port in bulk and not yet parsed by
+      /// _xbee_frame_load().  Indexes are free-running and masked with
+      /// (XBEE_DEV_RX_STAGING_SIZE - 1) to access \c buf.
+      struct xbee_dev_rx_staging {
+         uint16_t head;       ///< index of next byte to parse
+         uint16_t tail;       ///< index of next byte to fill
+         uint8_t  buf[XBEE_DEV_RX_STAGING_SIZE];
+      } staging;
+   #endif
+
+   #if XBEE_DEV_HANDLER_REGISTRY_SIZE
+      /// Frame handlers registered at runtime for this device only.
+      struct xbee_dev_registry {
+         /// 1-based index of first entry (highest priority) in each bucket
+         uint8_t              bucket[XBEE_DEV_HANDLER_BUCKETS];
+         uint8_t              dispatching;   ///< dispatch nesting depth
+         bool_t               removed;       ///< entries to unlink
+         xbee_dev_handler_t   entry[XBEE_DEV_HANDLER_REGISTRY_SIZE];
+      } registry;
+   #endif
+
+   #if XBEE_DEV_FRAME_ID_TRACKING
+      /// Frame IDs in flight, see xbee_frame_id_alloc().  \c slot is indexed
+      /// by frame ID (frame ID 0 asks for no response, so slot[0] is unused).
+      struct xbee_dev_frame_ids {
+         uint32_t             inuse[8];      ///< bit for each frame ID
+         xbee_dev_frame_id_t  slot[256];
+      } frame_ids;
+   #endif
+
+   #if XBEE_DEV_RX_QUEUE_SIZE
+      /// Frames read by the reader thread, waiting for xbee_dev_tick() to
+      /// dispatch them.  The reader thread only writes \c tail and the
+      /// slot it refers to, xbee_dev_tick() only writes \c head.
+      struct xbee_dev_rx_queue {
+         uint16_t    head;          ///< next slot to dispatch
+         uint16_t    tail;          ///< next slot to fill
+         bool_t      enabled;       ///< reader thread is filling queue
+         uint8_t     thread;        ///< one of XBEE_RX_THREAD_xxx
+         #define XBEE_RX_THREAD_STOPPED   0
+         #define XBEE_RX_THREAD_RUNNING   1
+         #define XBEE_RX_THREAD_STOPPING  2
+
+         /// arrival time of the frame being dispatched, for handlers
+         /// measuring latency
+         uint32_t    received;
+
+         /// Frames and errors counted by the reader thread (the only
+         /// writer, with XBEE_ATOMIC_STORE()), and the counts already
+         /// added to \c stats and \c rx.skipped by _xbee_rx_counts_merge().
+         struct xbee_dev_rx_counts {
+            uint32_t frames_in;
+            uint32_t bytes_in;
+            uint32_t checksum_errors;
+            uint32_t bad_lengths;
+            uint32_t skipped;
+         } counted, merged;
+         struct xbee_dev_rx_slot {
+            /// xbee_millisecond_timer() when start-of-frame was read
+            uint32_t timestamp;
+            /// bytes in frame; does not include checksum byte
+            uint16_t length;
+            #if _XBEE_DEV_RX_STARTED
+               /// XBEE_DEV_STATS_TIMER() when start-of-frame was read
+               uint32_t started;
+            #endif
+            uint8_t  frame[XBEE_MAX_FRAME_LEN + 1];
+         } slot[XBEE_DEV_RX_QUEUE_SIZE];
+      } rx_queue;
+   #endif
+
+   #if XBEE_DEV_TX_QUEUE_SIZE
+      /// Frames waiting for the XBee to accept them, one ring for each
+      /// XBEE_TX_PRIORITY_xxx class.  Each entry is an xbee_dev_tx_entry_t
+      /// followed by the frame, and doesn't wrap around the end of \c buf.
+      struct xbee_dev_tx_queue {
+         uint16_t head;       ///< offset of first entry
+         uint16_t tail;       ///< offset for next entry
+         uint16_t count;      ///< number of entries
+         uint8_t  buf[XBEE_DEV_TX_QUEUE_SIZE];
+      } tx_queue[XBEE_TX_PRIORITY_COUNT];
+   #endif
+
+   #if XBEE_DEV_STATS
+      xbee_dev_stats_t  stats;      ///< see xbee_dev_stats_snapshot()
+   #endif
+
+   #if XBEE_DEV_CAPTURE
+      /// frames sent and received are recorded here, see xbee_capture_start()
+      struct xbee_capture_t   *capture;
    #endif
 
    /// Buffer and state variables used for receiving a frame.  Keep at the
@@ -490,8 +885,33 @@ typedef struct xbee_dev_t
       /// bytes read so far
       uint16_t                bytes_read;
 
-      /// bytes received, starting with frame_type, +1 is for checksum
-      uint8_t  frame_data[XBEE_MAX_FRAME_LEN + 1];
+      /// running checksum of bytes read so far (see _xbee_checksum())
+      uint8_t                 checksum;
+
+      #if XBEE_DEV_API_ESCAPED
+         /// last byte read was an escape (0x7D), see _xbee_unescape()
+         uint8_t              escape;
+
+         /// parser's copy of XBEE_DEV_FLAG_API_ESCAPED, since a reader
+         /// thread can't share \c flags with xbee_dev_tick()
+         uint8_t              escaped;
+      #endif
+
+      /// bytes discarded after frames failed their checksum; with
+      /// XBEE_DEV_RX_STAGING_SIZE, bytes that might start another frame are
+      /// parsed again instead of being discarded (a reader thread counts
+      /// them in \c rx_queue.counted until they're merged)
+      uint32_t                skipped;
+
+      #if _XBEE_DEV_RX_STARTED
+         /// XBEE_DEV_STATS_TIMER() when start-of-frame was read
+         uint32_t             started;
+      #endif
+
+      #if ! XBEE_DEV_RX_ZERO_COPY
+         /// bytes received, starting with frame_type, +1 is for checksum
+         uint8_t  frame_data[XBEE_MAX_FRAME_LEN + 1];
+      #endif
    } rx;
 } xbee_dev_t;
 
@@ -536,27 +956,143 @@ void xbee_dev_dump_settings( xbee_dev_t *xbee, uint16_t flags);
 
 int xbee_dev_reset( xbee_dev_t *xbee);
 
+/**
+   @brief
+   Limits on the work done by one call to xbee_dev_tick_budget().  A limit
+   of 0 is unlimited.
+*/
+typedef struct xbee_dev_budget_t {
+   /// stop dispatching frames after this many microseconds (measured with
+   /// XBEE_DEV_STATS_TIMER())
+   uint32_t usec;
+   /// stop dispatching frames after this many bytes, including framing
+   uint32_t bytes;
+   /// ignore \c usec and \c bytes while more than this many received bytes
+   /// are waiting, to catch up before the serial port's buffer overflows
+   uint32_t high_water;
+} xbee_dev_budget_t;
+
 int xbee_dev_tick( xbee_dev_t *xbee);
 
+int xbee_dev_tick_budget( xbee_dev_t *xbee, const xbee_dev_budget_t *budget);
+
+int xbee_dev_wait( xbee_dev_t *xbee, int32_t timeout_ms);
+
 int xbee_frame_write( xbee_dev_t *xbee, const void FAR *header,
    uint16_t headerlen, const void FAR *data, uint16_t datalen,
    uint16_t flags);
 #define XBEE_WRITE_FLAG_NONE     0x0000
+/// return -EBUSY instead of queueing a frame the XBee can't accept yet
+#define XBEE_WRITE_FLAG_NOQUEUE  0x0001
+/// queue frame with XBEE_TX_PRIORITY_HIGH, ahead of other data frames
+#define XBEE_WRITE_FLAG_PRIORITY 0x0002
+
+int xbee_frame_queue( xbee_dev_t *xbee, const void FAR *header,
+   uint16_t headerlen, const void FAR *data, uint16_t datalen,
+   uint16_t flags, xbee_frame_sent_fn callback, void FAR *context);
+
+int xbee_frame_queue_pending( const xbee_dev_t *xbee);
+
+int xbee_frame_queue_flush( xbee_dev_t *xbee);
+
+int xbee_dev_stats_snapshot( xbee_dev_t *xbee, xbee_dev_stats_t FAR *stats);
+
+int xbee_dev_stats_reset( xbee_dev_t *xbee);
+
+void xbee_dev_stats_dump( const xbee_dev_stats_t FAR *stats);
+
+uint32_t xbee_dev_histogram_percentile( const xbee_dev_histogram_t FAR *hist,
+   uint_fast8_t percent);
 
 void xbee_dev_flowcontrol( xbee_dev_t *xbee, bool_t enabled);
 
+/** @name xbee_dev_api_mode() modes
+   Same values as the XBee's ATAP setting.
+   @{
+*/
+#define XBEE_DEV_API_MODE_UNESCAPED    1     ///< API mode (ATAP=1)
+#define XBEE_DEV_API_MODE_ESCAPED      2     ///< escaped API mode (ATAP=2)
+///@}
+
+int xbee_dev_api_mode( xbee_dev_t *xbee, uint_fast8_t mode);
+
+int xbee_frame_handler_add( xbee_dev_t *xbee, uint8_t frame_type,
+   uint8_t frame_id, xbee_frame_handler_fn handler, void FAR *context,
+   int8_t priority);
+
+int xbee_frame_handler_remove( xbee_dev_t *xbee, int handle);
+
+int xbee_frame_id_alloc( xbee_dev_t *xbee, xbee_frame_handler_fn handler,
+   void FAR *context, uint32_t timeout_ms);
+
+int xbee_frame_id_release( xbee_dev_t *xbee, uint_fast8_t frame_id);
+
+// implemented by platforms with threads (e.g., ports/posix/xbee_rxthread_posix.c)
+int xbee_dev_rx_thread_start( xbee_dev_t *xbee);
+
+int xbee_dev_rx_thread_stop( xbee_dev_t *xbee);
+
 // private functions exposed for unit testing
 
 void _xbee_dispatch_table_dump( const xbee_dev_t *xbee);
 
-uint8_t _xbee_checksum( const void FAR *bytes, uint16_t length,
+int _xbee_dispatch_index_build( void);
+
+void _xbee_dispatch_index_dump( void);
+
+// names in parenthesis to declare the portable versions, even on platforms
+// that replace them with a macro (see XBEE_PLATFORM_HEADER)
+uint8_t (_xbee_checksum)( const void FAR *bytes, uint16_t length,
    uint_fast8_t initial);
 
+uint8_t (_xbee_checksum_copy)( void FAR *dest, const void FAR *src,
+   uint16_t length, uint_fast8_t initial);
+
+uint16_t (_xbee_escape)( void FAR *dest, const void FAR *src,
+   uint16_t length);
+
+uint16_t (_xbee_unescape)( void FAR *dest, const void FAR *src,
+   uint16_t length, uint8_t *escape);
+
+uint16_t _xbee_frame_escape( void FAR *dest, const void FAR *header,
+   uint16_t headerlen, const void FAR *data, uint16_t datalen);
+
+#if XBEE_DEV_API_ESCAPED
+   int _xbee_frame_escaped_size( const void FAR *header, uint16_t headerlen,
+      const void FAR *data, uint16_t datalen);
+   int _xbee_frame_write_escaped( xbee_dev_t *xbee, const void FAR *header,
+      uint16_t headerlen, const void FAR *data, uint16_t datalen);
+#endif
+
 int _xbee_frame_load( xbee_dev_t *xbee);
 
+int _xbee_frame_load_budget( xbee_dev_t *xbee,
+   const xbee_dev_budget_t *budget);
+
+int _xbee_frame_drain( xbee_dev_t *xbee, const xbee_dev_budget_t *budget);
+
+#if XBEE_DEV_RX_QUEUE_SIZE
+   void _xbee_rx_counts_merge( xbee_dev_t *xbee);
+#endif
+
+uint32_t _xbee_rx_backlog( xbee_dev_t *xbee);
+
+bool_t _xbee_tick_budget_spent( xbee_dev_t *xbee,
+   const xbee_dev_budget_t *budget, uint32_t start, int frames,
+   uint32_t bytes);
+
+int _xbee_frame_queue_send( xbee_dev_t *xbee);
+
+#ifdef XBEE_DEVICE_ENABLE_ATMODE
+   void _xbee_dev_tx_note( xbee_dev_t *xbee, uint16_t bytes);
+   uint32_t _xbee_dev_tx_idle_timer( xbee_dev_t *xbee, uint32_t now);
+#endif
+
 int _xbee_frame_dispatch( xbee_dev_t *xbee, const void FAR *frame,
    uint16_t length);
 
+void _xbee_histogram_add( xbee_dev_histogram_t FAR *hist, uint32_t usec);
+
 
 typedef XBEE_PACKED(xbee_frame_modem_status_t, {
    uint8_t        frame_type;          ///< XBEE_FRAME_MODEM_STATUS (0x8A)
@@ -165,6 +165,32 @@
    returns void.  If defined, called by xbee_dev_init() before setting up
    the xbee_dev_t structure.
 
+   @def XBEE_SER_HAS_WRITEV
+   Optional macro, defined if the platform's serial driver implements
+   xbee_ser_writev() to send multiple buffers with a single operation.  If
+   not defined, xbee_device.c provides a version that calls xbee_ser_write()
+   for each buffer.
+
+   @def XBEE_SER_HAS_WAIT
+   Optional macro, defined if the platform's serial driver implements
+   xbee_ser_wait() to sleep until bytes arrive on the serial port.  If not
+   defined, xbee_device.c provides a version that returns immediately.
+
+   @def XBEE_SER_HAS_LOW_LATENCY
+   Optional macro, defined if the platform's serial driver implements
+   xbee_ser_low_latency() to deliver received bytes as soon as they arrive.
+   If not defined, xbee_device.c provides a version that returns -ENOSYS.
+
+   @def XBEE_ATOMIC_LOAD
+   Optional macro, defined on platforms with threads as a load of an integer
+   from a pointer with acquire semantics: XBEE_ATOMIC_LOAD(ptr).  Required
+   by XBEE_DEV_RX_QUEUE_SIZE.
+
+   @def XBEE_ATOMIC_STORE
+   Optional macro, defined on platforms with threads as a store of an
+   integer to a pointer with release semantics: XBEE_ATOMIC_STORE(ptr, val).
+   Required by XBEE_DEV_RX_QUEUE_SIZE.
+
    @def XBEE_RESET_FN
    Function pointer to pass to xbee_dev_init() in shared sample code for the
    xbee_reset_fn parameter.  Set to NULL by default.
@@ -725,6 +751,45 @@ int memcheck( const void FAR *src, int c, size_t length);
 #define XBEE_CHECK_TIMEOUT_SEC(timer) \
    ((int16_t)((uint16_t)xbee_seconds_timer() - (timer)) >= 0)
 
+/**
+   Timeout for xbee_dev_wait() and xbee_ser_wait() to wait indefinitely.
+   Also returned by functions that report the time until their next timeout
+   (e.g., xbee_cmd_next_timeout()) when nothing is waiting to expire.
+*/
+#define XBEE_WAIT_FOREVER  (-1L)
+
+/**
+   Macro used to convert a timer set by XBEE_SET_TIMEOUT_SEC() to the number
+   of milliseconds until XBEE_CHECK_TIMEOUT_SEC() will return TRUE (0 if it
+   already does).  Limited to the one-second resolution of
+   xbee_seconds_timer(), so the result may be up to a second late.
+
+   @param[in]  timer    16-bit variable set by XBEE_SET_TIMEOUT_SEC().
+
+   @return  Milliseconds remaining, as an int32_t.
+*/
+#define XBEE_TIMEOUT_SEC_REMAINING_MS(timer) \
+   (XBEE_CHECK_TIMEOUT_SEC(timer) ? (int32_t) 0 : \
+      (int32_t)(int16_t)((uint16_t)(timer) \
+         - (uint16_t)xbee_seconds_timer()) * 1000)
+
+/**
+   Macro used to combine two wait timeouts, either of which may be
+   XBEE_WAIT_FOREVER, into the shorter of the two.
+
+   @code
+      int32_t timeout;
+
+      timeout = XBEE_WAIT_MIN( xbee_cmd_next_timeout(),
+         wpan_next_timeout( &xbee.wpan_dev));
+      xbee_dev_wait( &xbee, timeout);
+      wpan_tick( &xbee.wpan_dev);
+      xbee_cmd_tick();
+   @endcode
+*/
+#define XBEE_WAIT_MIN(a, b) \
+   ((a) < 0 ? (b) : (b) < 0 ? (a) : (a) < (b) ? (a) : (b))
+
 // include support for 64-bit integers
 #include "xbee/jslong_glue.h"
 
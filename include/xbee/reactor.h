@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2019 Digi International Inc.,
+ * All rights not expressly granted are reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Digi International Inc. 11001 Bren Road East, Minnetonka, MN 55343
+ * =======================================================================
+ */
+
+/**
+   @addtogroup xbee_device
+   @{
+   @file xbee/reactor.h
+
+   Gateway reactor for hosts with many XBee modules: a single event loop
+   waits on the serial ports of all devices and calls xbee_dev_tick() for
+   each device with pending bytes (or timers due), taking turns between
+   busy devices.  Currently implemented for Linux (epoll) in
+   ports/posix/xbee_reactor_posix.c.
+
+   @def XBEE_REACTOR_MAX_DEVICES
+      Maximum number of devices managed by a single xbee_reactor_t.
+
+   @def XBEE_REACTOR_TX_RETRY_MS
+      How often xbee_reactor_poll() ticks the devices while frames are
+      waiting in a transmit queue, since the XBee accepting them (e.g.,
+      by raising CTS) doesn't make the serial port readable.
+*/
+
+#ifndef __XBEE_REACTOR
+#define __XBEE_REACTOR
+
+#include "xbee/device.h"
+
+XBEE_BEGIN_DECLS
+
+#ifndef XBEE_REACTOR_MAX_DEVICES
+   #define XBEE_REACTOR_MAX_DEVICES    32
+#elif XBEE_REACTOR_MAX_DEVICES > 255
+   #error "XBEE_REACTOR_MAX_DEVICES must not be larger than 255"
+#endif
+
+#ifndef XBEE_REACTOR_TX_RETRY_MS
+   #define XBEE_REACTOR_TX_RETRY_MS    10
+#endif
+
+/// State of a device managed by an xbee_reactor_t.
+enum xbee_reactor_dev_state {
+   XBEE_REACTOR_DEV_IDLE,     ///< waiting for bytes on serial port
+   XBEE_REACTOR_DEV_QUEUED    ///< in run queue, waiting for xbee_dev_tick()
+};
+
+/// Event loop for ticking multiple xbee_dev_t devices.
+typedef struct xbee_reactor_t {
+   int               epfd;       ///< epoll instance for serial ports
+   uint8_t           count;      ///< number of devices in \c dev[]
+
+   /// devices added with xbee_reactor_add()
+   xbee_dev_t        *dev[XBEE_REACTOR_MAX_DEVICES];
+   /// one of XBEE_REACTOR_DEV_xxx for each entry in \c dev[]
+   uint8_t           state[XBEE_REACTOR_MAX_DEVICES];
+   /// frames dispatched for each entry in \c dev[]
+   uint32_t          frames[XBEE_REACTOR_MAX_DEVICES];
+
+   /// FIFO of indexes into \c dev[] ready for xbee_dev_tick(); each device
+   /// appears at most once
+   uint8_t           runq[XBEE_REACTOR_MAX_DEVICES];
+   uint8_t           runq_head;  ///< index of first entry in \c runq[]
+   uint8_t           runq_used;  ///< number of entries in \c runq[]
+} xbee_reactor_t;
+
+// all functions are documented in ports/posix/xbee_reactor_posix.c
+int xbee_reactor_init( xbee_reactor_t *reactor);
+int xbee_reactor_add( xbee_reactor_t *reactor, xbee_dev_t *xbee);
+int xbee_reactor_poll( xbee_reactor_t *reactor, int32_t timeout_ms);
+int xbee_reactor_destroy( xbee_reactor_t *reactor);
+
+XBEE_END_DECLS
+
+#endif      // __XBEE_REACTOR
+
+///@}
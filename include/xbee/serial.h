@@ -27,9 +27,12 @@
 
    - sending and receiving serial data
       - xbee_ser_write()
+      - xbee_ser_writev()
       - xbee_ser_read()
       - xbee_ser_putchar()
       - xbee_ser_getchar()
+      - xbee_ser_wait()
+      - xbee_ser_tx_wait()
 
    - checking the status of transmit and receive buffers
       - xbee_ser_tx_free()
@@ -45,6 +48,7 @@
       - xbee_ser_close()
       - xbee_ser_break()
       - xbee_ser_flowcontrol()
+      - xbee_ser_low_latency()
       - xbee_ser_set_rts()
       - xbee_ser_get_cts()
 
@@ -119,6 +123,44 @@ int xbee_ser_write( xbee_serial_t *serial, const void FAR *buffer,
    int length);
 
 
+/// One block of bytes for xbee_ser_writev().
+typedef struct xbee_ser_iovec_t {
+   const void FAR *base;         ///< address of bytes to send
+   int            length;        ///< number of bytes at \c base
+} xbee_ser_iovec_t;
+
+/// Maximum number of blocks passed to a single xbee_ser_writev() call.
+#define XBEE_SER_IOV_MAX   8
+
+/**
+   @brief
+   Transmits \a iovcnt blocks of bytes, described by \a iov, to the XBee
+   serial port \a serial as a single write.
+
+   Platforms that can send multiple buffers with a single operation (e.g.,
+   writev() on POSIX) define XBEE_SER_HAS_WRITEV in their platform_config.h
+   and implement this function in their serial driver.  On all other
+   platforms, the device layer provides a version that calls
+   xbee_ser_write() once for each block.
+
+   @param[in]  serial   XBee serial port
+
+   @param[in]  iov      array of blocks to send, in order
+
+   @param[in]  iovcnt   number of entries in \a iov (up to XBEE_SER_IOV_MAX)
+
+   @retval  >=0      The number of bytes successfully written to XBee
+                     serial port.
+   @retval  -EINVAL  \a serial is not a valid XBee serial port or
+                     \a iovcnt is out of range.
+   @retval  -EIO     I/O error attempting to write to serial port.
+
+   @see  xbee_ser_write()
+*/
+int xbee_ser_writev( xbee_serial_t *serial, const xbee_ser_iovec_t *iov,
+   int iovcnt);
+
+
 /**
    @brief
    Reads up to \a bufsize bytes from XBee serial port \a serial
@@ -142,6 +184,55 @@ int xbee_ser_write( xbee_serial_t *serial, const void FAR *buffer,
 int xbee_ser_read( xbee_serial_t *serial, void FAR *buffer, int bufsize);
 
 
+/**
+   @brief
+   Blocks until the XBee serial port \a serial has bytes available to read,
+   or until \a timeout_ms milliseconds have elapsed.
+
+   Platforms that can sleep on a serial port (e.g., poll() on POSIX) define
+   XBEE_SER_HAS_WAIT in their platform_config.h and implement this function
+   in their serial driver.  On all other platforms, the device layer provides
+   a version that returns immediately, as if data was available.
+
+   @param[in]  serial      XBee serial port
+
+   @param[in]  timeout_ms  maximum time to wait, in milliseconds, or
+                           XBEE_WAIT_FOREVER to wait until data arrives
+
+   @retval  1        Data (or an error condition) is ready to read.
+   @retval  0        Timeout elapsed (or wait was interrupted by a signal).
+   @retval  -EINVAL  \a serial is not a valid XBee serial port.
+   @retval  -EIO     I/O error attempting to wait on serial port.
+
+   @see  xbee_ser_read(), xbee_dev_wait()
+*/
+int xbee_ser_wait( xbee_serial_t *serial, int32_t timeout_ms);
+
+
+/**
+   @brief
+   Blocks until the XBee serial port \a serial can take more bytes to
+   write, or until \a timeout_ms milliseconds have elapsed.
+
+   Platforms that define XBEE_SER_HAS_WAIT implement this function along
+   with xbee_ser_wait().  On all other platforms, the device layer provides
+   a version that returns immediately, as if the port was ready.
+
+   @param[in]  serial      XBee serial port
+
+   @param[in]  timeout_ms  maximum time to wait, in milliseconds, or
+                           XBEE_WAIT_FOREVER to wait until the port is ready
+
+   @retval  1        Port can take more bytes (or has an error condition).
+   @retval  0        Timeout elapsed (or wait was interrupted by a signal).
+   @retval  -EINVAL  \a serial is not a valid XBee serial port.
+   @retval  -EIO     I/O error attempting to wait on serial port.
+
+   @see  xbee_ser_write(), xbee_ser_writev()
+*/
+int xbee_ser_tx_wait( xbee_serial_t *serial, int32_t timeout_ms);
+
+
 /**
    @brief
    Transmits a single character, \a ch, to the XBee serial
@@ -318,9 +409,13 @@ int xbee_ser_open( xbee_serial_t *serial, uint32_t baudrate);
    @param[in]  serial   XBee serial port
 
    @param[in]  baudrate Bits per second of serial data transfer speed.
+                        On Linux, the POSIX driver accepts any rate the
+                        UART supports (e.g., 250000 or 1000000 for XBee 3
+                        modules), not just the standard rates.
 
    @retval  0        Opened serial port within 5% of requested baudrate.
-   @retval  -EINVAL  \a serial is not a valid XBee serial port.
+   @retval  -EINVAL  \a serial is not a valid XBee serial port, or the
+                     platform doesn't support \a baudrate.
    @retval  -EIO     Can't open serial port within 5% of requested baudrate.
 
    @see xbee_ser_open(), xbee_ser_close(), xbee_ser_break()
@@ -379,6 +474,32 @@ int xbee_ser_break( xbee_serial_t *serial, bool_t enabled);
 int xbee_ser_flowcontrol( xbee_serial_t *serial, bool_t enabled);
 
 
+/**
+   @brief
+   Tune XBee serial port \a serial to deliver received bytes as soon as
+   possible, at the cost of more interrupts and wakeups.
+
+   Platforms with such a setting (e.g., ASYNC_LOW_LATENCY on Linux) define
+   XBEE_SER_HAS_LOW_LATENCY in their platform_config.h and implement this
+   function in their serial driver.  On all other platforms, the device
+   layer provides a version that returns -ENOSYS.
+
+   @param[in]  serial   XBee serial port
+
+   @param[in]  enabled  Set to 1 to enable low-latency mode or 0 to restore
+                        the settings the port had before it was enabled.
+
+   @retval  0        Success (or the port's driver doesn't have a
+                     low-latency setting).
+   @retval  -EINVAL  \a serial is not a valid XBee serial port.
+   @retval  -ENOSYS  Platform doesn't have a low-latency mode.
+   @retval  -EPERM   Process isn't allowed to change the setting.
+
+   @see  xbee_ser_baudrate(), xbee_ser_wait()
+*/
+int xbee_ser_low_latency( xbee_serial_t *serial, bool_t enabled);
+
+
 /**
    @brief
    Disable hardware flow control and manually set the RTS (ready to
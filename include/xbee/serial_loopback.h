@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2019 Digi International Inc.,
+ * All rights not expressly granted are reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Digi International Inc. 11001 Bren Road East, Minnetonka, MN 55343
+ * =======================================================================
+ */
+
+/**
+   @addtogroup xbee_serial
+   @{
+   @file xbee/serial_loopback.h
+
+   In-memory serial driver for benchmarks and tests, implemented for POSIX
+   in ports/posix/xbee_serial_loopback.c.  Link with that file instead of
+   xbee_serial_posix.c.
+
+   Each open port has two rings of bytes in place of a UART.  The program
+   plays the part of the XBee: it calls xbee_ser_loopback_feed() to add
+   bytes for xbee_ser_read() to return, and xbee_ser_loopback_drain() to
+   collect bytes written with xbee_ser_write().  Feeding and reading (or
+   writing and draining) can happen on different threads.
+
+   @def XBEE_SER_LOOPBACK_PORTS
+      Maximum number of loopback ports open at once.
+
+   @def XBEE_SER_LOOPBACK_SIZE
+      Size of each port's receive and transmit rings (a power of 2).
+*/
+
+#ifndef __XBEE_SERIAL_LOOPBACK
+#define __XBEE_SERIAL_LOOPBACK
+
+#include "xbee/serial.h"
+
+XBEE_BEGIN_DECLS
+
+#ifndef XBEE_SER_LOOPBACK_PORTS
+   #define XBEE_SER_LOOPBACK_PORTS     4
+#endif
+
+#ifndef XBEE_SER_LOOPBACK_SIZE
+   #define XBEE_SER_LOOPBACK_SIZE      65536
+#elif XBEE_SER_LOOPBACK_SIZE & (XBEE_SER_LOOPBACK_SIZE - 1)
+   #error "XBEE_SER_LOOPBACK_SIZE must be a power of 2"
+#endif
+
+int xbee_ser_loopback_feed( xbee_serial_t *serial, const void *data,
+   int length);
+
+int xbee_ser_loopback_drain( xbee_serial_t *serial, void *buffer,
+   int bufsize);
+
+int xbee_ser_loopback_set_cts( xbee_serial_t *serial, bool_t asserted);
+
+XBEE_END_DECLS
+
+#endif   // __XBEE_SERIAL_LOOPBACK
+
+///@}
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2019 Digi International Inc.,
+ * All rights not expressly granted are reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Digi International Inc. 11001 Bren Road East, Minnetonka, MN 55343
+ * =======================================================================
+ */
+
+/**
+   @addtogroup xbee_timer_wheel Timer Wheel
+   @ingroup xbee
+   @{
+   @file xbee/timer_wheel.h
+
+   Millisecond timers for the library's timeouts (AT command requests,
+   frame IDs, xbee_wpan_send() requests and APS conversations).
+
+   Each device has an xbee_timer_wheel_t (the \c timers member of its
+   wpan_dev_t), and xbee_dev_tick() and wpan_tick() call the callbacks of
+   timers that have expired.  Starting and cancelling a timer take the same
+   time no matter how many are pending, and the wheel only visits slots
+   holding timers, so the cost of a tick doesn't grow with the number of
+   outstanding requests.
+
+   The wheel has XBEE_TIMER_WHEEL_LEVELS levels of 2^XBEE_TIMER_WHEEL_BITS
+   slots.  Level 0 has a slot for each millisecond, and each level above it
+   has slots covering 2^XBEE_TIMER_WHEEL_BITS times as long, which are moved
+   down a level as their time approaches.  Timers past the end of the top
+   level wait in its last slot.
+*/
+
+#ifndef __XBEE_TIMER_WHEEL
+#define __XBEE_TIMER_WHEEL
+
+#include "xbee/platform.h"
+
+XBEE_BEGIN_DECLS
+
+// The defaults keep the wheel in each device small (24 slots) for embedded
+// targets, at the cost of moving timers more than 512ms out back to the top
+// level a few times before they expire.  Ports with RAM to spare can use
+// more slots (see ports/posix/platform_config.h).
+#ifndef XBEE_TIMER_WHEEL_BITS
+   /// log2 of the number of slots in each level of an xbee_timer_wheel_t.
+   #define XBEE_TIMER_WHEEL_BITS    3
+#endif
+
+#ifndef XBEE_TIMER_WHEEL_LEVELS
+   /// Levels in an xbee_timer_wheel_t.  Timers up to
+   /// 2^(XBEE_TIMER_WHEEL_BITS * XBEE_TIMER_WHEEL_LEVELS) milliseconds out
+   /// only move between levels once per level.
+   #define XBEE_TIMER_WHEEL_LEVELS  3
+#endif
+
+#if XBEE_TIMER_WHEEL_BITS < 1 || XBEE_TIMER_WHEEL_LEVELS < 1 \
+   || XBEE_TIMER_WHEEL_BITS * XBEE_TIMER_WHEEL_LEVELS > 30
+   #error "invalid XBEE_TIMER_WHEEL_BITS or XBEE_TIMER_WHEEL_LEVELS"
+#endif
+
+/// Slots in each level of an xbee_timer_wheel_t.
+#define XBEE_TIMER_WHEEL_SLOTS   (1 << XBEE_TIMER_WHEEL_BITS)
+
+struct xbee_timer_t;
+struct xbee_timer_wheel_t;
+
+/**
+   @brief
+   Function called when a timer expires.
+
+   The timer is no longer pending, so the callback can start it again.
+
+   @param[in]  timer    Timer that expired (its \c context member holds the
+                        context passed to xbee_timer_init()).
+*/
+typedef void (*xbee_timer_fn)( struct xbee_timer_t FAR *timer);
+
+/// Timer to start on an xbee_timer_wheel_t, usually a member of the
+/// structure it times out.  Set up with xbee_timer_init().
+typedef struct xbee_timer_t {
+   struct xbee_timer_t        FAR   *next;      ///< next timer in slot
+   struct xbee_timer_t  FAR * FAR   *pprev;     ///< link pointing to this
+   /// wheel the timer is pending on, or NULL if it isn't pending
+   struct xbee_timer_wheel_t  FAR   *wheel;
+   uint32_t                         expires;    ///< xbee_millisecond_timer()
+   xbee_timer_fn                    callback;
+   void                       FAR   *context;
+} xbee_timer_t;
+
+/// Timers pending on one device.  Set up with xbee_timer_wheel_init()
+/// (xbee_dev_init() sets up the wheel in an xbee_dev_t).
+typedef struct xbee_timer_wheel_t {
+   /// next millisecond to process
+   uint32_t                         now;
+   /// timers pending
+   uint16_t                         count;
+   /// timers whose time had already passed when they were started
+   xbee_timer_t               FAR   *overdue;
+   /// wheels attached for xbee_timer_tick(), see xbee_timer_wheel_attach()
+   struct xbee_timer_wheel_t  FAR   *attached_next;
+   struct xbee_timer_wheel_t  FAR * FAR *attached_pprev;
+   xbee_timer_t               FAR   *slot[XBEE_TIMER_WHEEL_LEVELS]
+                                       [XBEE_TIMER_WHEEL_SLOTS];
+} xbee_timer_wheel_t;
+
+/// Is \a timer (an xbee_timer_t *) waiting to expire?
+#define xbee_timer_pending(timer)   ((timer)->wheel != NULL)
+
+// all functions are documented in xbee_timer_wheel.c
+void xbee_timer_wheel_init( xbee_timer_wheel_t FAR *wheel);
+void xbee_timer_init( xbee_timer_t FAR *timer, xbee_timer_fn callback,
+   void FAR *context);
+int xbee_timer_start( xbee_timer_wheel_t FAR *wheel, xbee_timer_t FAR *timer,
+   uint32_t delay_ms);
+int xbee_timer_start_at( xbee_timer_wheel_t FAR *wheel,
+   xbee_timer_t FAR *timer, uint32_t expires);
+int xbee_timer_cancel( xbee_timer_t FAR *timer);
+int xbee_timer_wheel_advance( xbee_timer_wheel_t FAR *wheel, uint32_t until);
+int xbee_timer_wheel_run( xbee_timer_wheel_t FAR *wheel);
+int32_t xbee_timer_wheel_next( const xbee_timer_wheel_t FAR *wheel);
+void xbee_timer_wheel_attach( xbee_timer_wheel_t FAR *wheel);
+int xbee_timer_tick( void);
+int32_t xbee_timer_next_timeout( void);
+
+XBEE_END_DECLS
+
+// If compiling in Dynamic C, automatically #use the appropriate C file.
+#ifdef __DC__
+   #use "xbee_timer_wheel.c"
+#endif
+
+#endif      // __XBEE_TIMER_WHEEL
+
+///@}
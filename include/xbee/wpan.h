@@ -26,6 +26,20 @@
 
 XBEE_BEGIN_DECLS
 
+#ifndef XBEE_WPAN_TX_PENDING
+   /// Maximum number of xbee_wpan_send() requests waiting for a Transmit
+   /// Status (across all devices), which bounds the in-flight window for
+   /// pipelined sends.
+   #define XBEE_WPAN_TX_PENDING     8
+#endif
+
+#ifndef XBEE_WPAN_TX_TIMEOUT
+   /// Seconds to wait for the Transmit Status of an xbee_wpan_send()
+   /// request.  ZigBee sends with extended timeouts and route discovery can
+   /// take tens of seconds.
+   #define XBEE_WPAN_TX_TIMEOUT     60
+#endif
+
 /// Format of XBee API frame type 0x90 (#XBEE_FRAME_RECEIVE);
 /// received from XBee by host.
 typedef XBEE_PACKED(xbee_frame_receive_t, {
@@ -145,19 +159,64 @@ typedef XBEE_PACKED(xbee_frame_transmit_status_t, {
       #define XBEE_TX_DISCOVERY_EXTENDED_TIMEOUT 0x40
 ///@}
 
+/// Result of an xbee_wpan_send() request, passed to its
+/// xbee_wpan_tx_done_fn callback.
+typedef struct xbee_wpan_tx_status_t {
+   xbee_dev_t     *xbee;               ///< device that sent the request
+   int            handle;              ///< returned by xbee_wpan_send()
+   uint16_t       network_address;     ///< 16-bit address of destination
+   uint8_t        retries;             ///< number of application Tx retries
+   uint8_t        delivery;            ///< See xbee/delivery_status.h
+   uint8_t        discovery;           ///< XBEE_TX_DISCOVERY_* bitfield
+   uint8_t        flags;               ///< XBEE_WPAN_TX_FLAG_* bitfield
+} xbee_wpan_tx_status_t;
+
+/** @name XBEE_WPAN_TX_FLAG_*
+   Values for \c flags member of xbee_wpan_tx_status_t.
+   @{
+*/
+/// No Transmit Status within XBEE_WPAN_TX_TIMEOUT seconds, other fields
+/// (except \c xbee and \c handle) are 0.
+#define XBEE_WPAN_TX_FLAG_TIMEOUT         0x01
+///@}
+
+/**
+   @brief
+   Callback for xbee_wpan_send(), called from wpan_tick() when the XBee
+   reports the request's Transmit Status (or it times out).
+
+   The request is complete (and its handle invalid) before the callback
+   runs, so the callback can send the next frame of a pipeline.
+
+   @param[in]  status   Delivery status, retries and discovery status.
+   @param[in]  context  \a context passed to xbee_wpan_send().
+*/
+typedef void (*xbee_wpan_tx_done_fn)( const xbee_wpan_tx_status_t *status,
+   void FAR *context);
+
+int xbee_wpan_send( const wpan_envelope_t FAR *envelope,
+   xbee_wpan_tx_done_fn callback, void FAR *context);
+
+int xbee_wpan_send_cancel( int handle);
+
+int xbee_wpan_tx_pending( const xbee_dev_t *xbee);
+
 /**
    @internal
-   Dummy frame handler for 0x8B (XBEE_FRAME_TRANSMIT_STATUS) frames.
-   Placeholder until we integrate processing of those frames into the stack.
-   @see xbee_frame_handler_fn()
+   Frame handler for 0x8B (XBEE_FRAME_TRANSMIT_STATUS) frames.  Completes
+   the matching xbee_wpan_send() request.  With XBEE_DEV_FRAME_ID_TRACKING,
+   xbee_wpan_send() routes the request's status here directly (with the
+   request as \a context); otherwise add XBEE_FRAME_HANDLE_TRANSMIT_STATUS
+   to the frame handler table.
 
-   @todo Figure out what needs to happen with these frames.  Does atcmd
-         layer need to pass errors down to callbacks?  Registered endpoints?
-         Tracked conversations?
+   @see xbee_frame_handler_fn()
 */
 int _xbee_handle_transmit_status( xbee_dev_t *xbee,
    const void FAR *frame, uint16_t length, void FAR *context);
 
+int _xbee_endpoint_send_id( const wpan_envelope_t FAR *envelope,
+   uint16_t flags, uint8_t frame_id);
+
 #define XBEE_FRAME_HANDLE_TRANSMIT_STATUS \
    { XBEE_FRAME_TRANSMIT_STATUS, 0, _xbee_handle_transmit_status, NULL }
 
@@ -10,7 +10,9 @@
  * ===========================================================================
  */
 
-// digiapix platforms use a slightly modified version of the POSIX platform
+// digiapix platforms use a slightly modified version of the POSIX platform,
+// but link xbee_platform_digiapix.c instead of xbee_platform_posix.c
+#define XBEE_PLATFORM_POSIX_KERNELS 0
 #include "../posix/platform_config.h"
 
 /**
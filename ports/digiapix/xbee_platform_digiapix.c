@@ -51,6 +51,17 @@ uint32_t xbee_millisecond_timer()
 }
 
 
+// Free-running microsecond count for XBEE_DEV_STATS_TIMER(), unaffected by
+// changes to the system clock.
+uint32_t xbee_microsecond_timer()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint32_t)t.tv_sec * 1000000 + (uint32_t)(t.tv_nsec / 1000);
+}
+
+
 typedef struct {
     const char      *name;
     int             xbee_io_num;        // XBee DIO number
@@ -71,6 +71,12 @@ typedef struct xbee_serial_t {
     uint32_t    baudrate;
     int         fd;
     char        device[40];     // /dev/ttySxx
+
+    // settings to restore when xbee_ser_low_latency() disables low latency
+    bool_t      low_latency;    // TRUE if low latency is enabled
+    bool_t      saved_async;    // ASYNC_LOW_LATENCY was already set
+    uint8_t     saved_vmin;
+    uint8_t     saved_vtime;
 } xbee_serial_t;
 
 #ifndef XBEE_SERIAL_MAX_BAUDRATE
@@ -86,6 +92,114 @@ typedef struct xbee_serial_t {
     #endif
 #endif // def XBEE_SERIAL_MAX_BAUDRATE
 
+// xbee_serial_posix.c sends each API frame with a single writev()
+#define XBEE_SER_HAS_WRITEV
+
+// xbee_serial_posix.c can sleep in poll() until the serial port is readable
+#define XBEE_SER_HAS_WAIT
+
+// xbee_serial_posix.c can set ASYNC_LOW_LATENCY on Linux serial ports
+#define XBEE_SER_HAS_LOW_LATENCY
+
+// Each xbee_ser_read() is a read() system call, so have the device layer
+// pull bytes from the serial port in large chunks.
+#ifndef XBEE_DEV_RX_STAGING_SIZE
+    #define XBEE_DEV_RX_STAGING_SIZE 4096
+#endif
+
+// pass received frames to handlers in place in the staging ring
+#if ! defined XBEE_DEV_RX_ZERO_COPY && XBEE_DEV_RX_STAGING_SIZE
+    #define XBEE_DEV_RX_ZERO_COPY 1
+#endif
+
+// index the frame handler table by frame type for faster dispatching
+#ifndef XBEE_DEV_DISPATCH_INDEX_SIZE
+    #define XBEE_DEV_DISPATCH_INDEX_SIZE 256
+#endif
+
+// memory ordering for data shared with the reader thread
+#define XBEE_ATOMIC_LOAD(ptr)        __atomic_load_n( ptr, __ATOMIC_ACQUIRE)
+#define XBEE_ATOMIC_STORE(ptr, val)  __atomic_store_n( ptr, val, __ATOMIC_RELEASE)
+
+// queue frames the XBee can't accept yet, instead of returning -EBUSY
+#ifndef XBEE_DEV_TX_QUEUE_SIZE
+    #define XBEE_DEV_TX_QUEUE_SIZE 4096
+#endif
+
+// Features that add to each xbee_dev_t are left to programs to enable
+// (e.g., with -D in their Makefile), see xbee/device.h:
+//   XBEE_DEV_RX_QUEUE_SIZE           reader thread (xbee_rxthread_posix.c)
+//   XBEE_DEV_HANDLER_REGISTRY_SIZE   frame handlers registered at runtime
+//   XBEE_DEV_STATS                   statistics
+//   XBEE_DEV_CAPTURE                 recording frames (xbee/capture.h)
+//   XBEE_DEV_API_ESCAPED             escaped API mode (ATAP=2)
+
+// time XBEE_DEV_STATS, captured frames and tick budgets with CLOCK_MONOTONIC
+uint32_t xbee_microsecond_timer( void);
+#define XBEE_DEV_STATS_TIMER()  xbee_microsecond_timer()
+
+// track frame IDs in flight and route responses straight to their owners
+#ifndef XBEE_DEV_FRAME_ID_TRACKING
+    #define XBEE_DEV_FRAME_ID_TRACKING 1
+#endif
+
+// grow the AT command request pool as needed, for remote AT commands to
+// large networks
+#ifndef XBEE_CMD_REQUEST_MAX
+    #define XBEE_CMD_REQUEST_MAX 1024
+#endif
+#ifndef XBEE_CMD_REQUEST_GROW
+    #define XBEE_CMD_REQUEST_GROW 32
+#endif
+
+// keep several commands from an AT command list in flight
+#ifndef XBEE_CMD_LIST_WINDOW_MAX
+    #define XBEE_CMD_LIST_WINDOW_MAX 8
+    #define XBEE_CMD_LIST_WINDOW_LOCAL 4
+#endif
+
+// cache AT parameters read from the XBee, see xbee_cmd_cache_read()
+#ifndef XBEE_CMD_CACHE_SIZE
+    #define XBEE_CMD_CACHE_SIZE 32
+#endif
+
+// four 64-slot timer wheel levels, so timeouts up to 4.6 hours don't wait
+// in the top level
+#ifndef XBEE_TIMER_WHEEL_BITS
+    #define XBEE_TIMER_WHEEL_BITS 6
+#endif
+#ifndef XBEE_TIMER_WHEEL_LEVELS
+    #define XBEE_TIMER_WHEEL_LEVELS 4
+#endif
+
+// Ports that include this file but link their own platform file in place
+// of xbee_platform_posix.c (e.g., digiapix) set this to 0 before including
+// it, since the vectorized functions below are only in that file.
+#ifndef XBEE_PLATFORM_POSIX_KERNELS
+    #define XBEE_PLATFORM_POSIX_KERNELS 1
+#endif
+
+#if XBEE_PLATFORM_POSIX_KERNELS
+// vectorized checksums (SSE2/AVX2/NEON) from xbee_platform_posix.c
+uint8_t _xbee_checksum_posix( const void *bytes, uint16_t length,
+    uint_fast8_t initial);
+uint8_t _xbee_checksum_copy_posix( void *dest, const void *src,
+    uint16_t length, uint_fast8_t initial);
+#define _xbee_checksum(bytes, length, initial) \
+    _xbee_checksum_posix( bytes, length, initial)
+#define _xbee_checksum_copy(dest, src, length, initial) \
+    _xbee_checksum_copy_posix( dest, src, length, initial)
+
+// vectorized escaping for escaped API mode, also from xbee_platform_posix.c
+uint16_t _xbee_escape_posix( void *dest, const void *src, uint16_t length);
+uint16_t _xbee_unescape_posix( void *dest, const void *src, uint16_t length,
+    uint8_t *escape);
+#define _xbee_escape(dest, src, length) \
+    _xbee_escape_posix( dest, src, length)
+#define _xbee_unescape(dest, src, length, escape) \
+    _xbee_unescape_posix( dest, src, length, escape)
+#endif
+
 // Unix epoch is 1/1/1970
 #define ZCL_TIME_EPOCH_DELTA    ZCL_TIME_EPOCH_DELTA_1970
 
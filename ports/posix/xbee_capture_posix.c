@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2019 Digi International Inc.,
+ * All rights not expressly granted are reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Digi International Inc. 11001 Bren Road East, Minnetonka, MN 55343
+ * =======================================================================
+ */
+/**
+    @addtogroup hal_posix
+    @{
+    @file xbee_capture_posix.c
+    Frame captures in memory-mapped files (POSIX Platform)
+
+    xbee_capture_open() maps a file of a fixed size, so frames are copied
+    straight into the page cache without a system call per frame, and a
+    capture survives a crash of the program writing it (unused space at
+    the end of the file reads as an empty record, which ends the log).
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "xbee/capture.h"
+
+/**
+    @brief
+    Create (or replace) a capture file and map it for xbee_capture_start().
+
+    @param[out] capture  Capture to initialize.
+    @param[in]  filename File to create.
+    @param[in]  size     Maximum size of the capture, in bytes.  Frames
+                         that don't fit are counted in
+                         \c capture->dropped.
+
+    @retval  0        Capture ready for xbee_capture_start().
+    @retval  -EINVAL  Invalid parameter.
+    @retval  <0       Error from open(), ftruncate() or mmap().
+
+    @sa xbee_capture_close()
+*/
+int xbee_capture_open( xbee_capture_t *capture, const char *filename,
+    uint32_t size)
+{
+    void *buffer;
+    int fd, err;
+
+    if (capture == NULL || filename == NULL
+        || size < sizeof(xbee_capture_header_t))
+    {
+        return -EINVAL;
+    }
+
+    fd = open( filename, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        return -errno;
+    }
+
+    if (ftruncate( fd, size) == -1)
+    {
+        err = -errno;
+        close( fd);
+        return err;
+    }
+
+    buffer = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (buffer == MAP_FAILED)
+    {
+        err = -errno;
+        close( fd);
+        return err;
+    }
+
+    xbee_capture_init( capture, buffer, size);
+    capture->handle = fd;
+
+    return 0;
+}
+
+
+/**
+    @brief
+    Unmap a capture file opened with xbee_capture_open(), and trim the file
+    to the bytes used.
+
+    Stop the capture on all devices (xbee_capture_start() with a NULL
+    capture) before closing it.
+
+    @param[in,out] capture  Capture to close.
+
+    @retval  0        Capture closed.
+    @retval  -EINVAL  \a capture wasn't opened with xbee_capture_open().
+    @retval  <0       Error from ftruncate() or close().
+*/
+int xbee_capture_close( xbee_capture_t *capture)
+{
+    int err = 0;
+
+    if (capture == NULL || capture->handle < 0)
+    {
+        return -EINVAL;
+    }
+
+    munmap( capture->buffer, capture->size);
+    if (ftruncate( capture->handle, capture->used) == -1)
+    {
+        err = -errno;
+    }
+    if (close( capture->handle) == -1 && err == 0)
+    {
+        err = -errno;
+    }
+    capture->handle = -1;
+    capture->buffer = NULL;
+    capture->size = 0;
+
+    return err;
+}
+
+
+/**
+    @brief
+    Map a capture file read-only, for xbee_capture_next() and
+    xbee_capture_replay().
+
+    @param[in]  filename File to map.
+    @param[out] log      Set to the start of the mapped file.
+    @param[out] length   Set to the size of the mapped file.
+
+    @retval  0        File mapped, release it with xbee_capture_unmap().
+    @retval  -EINVAL  Invalid parameter, or file is empty.
+    @retval  -EFBIG   File is larger than 4GB.
+    @retval  <0       Error from open(), fstat() or mmap().
+*/
+int xbee_capture_map( const char *filename, const void **log,
+    uint32_t *length)
+{
+    struct stat st;
+    void *mapped;
+    int fd, err;
+
+    if (filename == NULL || log == NULL || length == NULL)
+    {
+        return -EINVAL;
+    }
+
+    fd = open( filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -errno;
+    }
+
+    if (fstat( fd, &st) == -1)
+    {
+        err = -errno;
+    }
+    else if (st.st_size == 0)
+    {
+        err = -EINVAL;
+    }
+    else if ((uint64_t) st.st_size > UINT32_MAX)
+    {
+        err = -EFBIG;
+    }
+    else
+    {
+        mapped = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED)
+        {
+            err = -errno;
+        }
+        else
+        {
+            *log = mapped;
+            *length = (uint32_t) st.st_size;
+            err = 0;
+        }
+    }
+
+    // the mapping stays valid after closing the file
+    close( fd);
+
+    return err;
+}
+
+
+/**
+    @brief
+    Release a capture mapped with xbee_capture_map().
+
+    @param[in]  log      Mapped capture.
+    @param[in]  length   Length returned by xbee_capture_map().
+
+    @retval  0        Capture unmapped.
+    @retval  <0       Error from munmap().
+*/
+int xbee_capture_unmap( const void *log, uint32_t length)
+{
+    if (munmap( (void *) log, length) == -1)
+    {
+        return -errno;
+    }
+
+    return 0;
+}
+
+///@}
@@ -20,10 +20,19 @@
             the seconds timer (base it on the HCS08 regression).
 */
 
+#include <string.h>
 #include <time.h>
 #include <sys/time.h>
 #include "xbee/platform.h"
 
+#if defined __AVX2__
+    #include <immintrin.h>
+#elif defined __SSE2__
+    #include <emmintrin.h>
+#elif defined __ARM_NEON
+    #include <arm_neon.h>
+#endif
+
 uint32_t xbee_seconds_timer()
 {
     // On BSD OSes, time can include leap seconds.  That's OK, because this
@@ -39,4 +48,297 @@ uint32_t xbee_millisecond_timer()
     return (uint32_t) (t.tv_sec * 1000 + t.tv_usec / 1000);
 }
 
+// Free-running microsecond count for XBEE_DEV_STATS_TIMER(), unaffected by
+// changes to the system clock.
+uint32_t xbee_microsecond_timer()
+{
+    struct timespec t;
+
+    clock_gettime( CLOCK_MONOTONIC, &t);
+    return (uint32_t) t.tv_sec * 1000000 + (uint32_t) (t.tv_nsec / 1000);
+}
+
+/*
+    Vectorized versions of _xbee_checksum(), _xbee_checksum_copy(),
+    _xbee_escape() and _xbee_unescape(), selected at build time (AVX2 if
+    compiling with -mavx2, SSE2 on all x86-64 targets, or NEON on ARM).
+
+    The checksum only needs the sum of the bytes modulo 256, so each vector
+    lane accumulates with a wrapping 8-bit add and the lanes are only summed
+    once at the end.
+*/
+#if defined __AVX2__
+    #define XBEE_SIMD_BYTES     32
+    typedef __m256i xbee_simd_t;
+    #define XBEE_SIMD_ZERO()        _mm256_setzero_si256()
+    #define XBEE_SIMD_LOAD(p)       _mm256_loadu_si256( (const __m256i *)(p))
+    #define XBEE_SIMD_STORE(p, v)   _mm256_storeu_si256( (__m256i *)(p), v)
+    #define XBEE_SIMD_ADD(a, b)     _mm256_add_epi8( a, b)
+    #define XBEE_SIMD_SET1(x)       _mm256_set1_epi8( (char)(x))
+    #define XBEE_SIMD_EQ(a, b)      _mm256_cmpeq_epi8( a, b)
+    #define XBEE_SIMD_OR(a, b)      _mm256_or_si256( a, b)
+    #define XBEE_SIMD_MASK(v)       ((uint32_t) _mm256_movemask_epi8( v))
+#elif defined __SSE2__
+    #define XBEE_SIMD_BYTES     16
+    typedef __m128i xbee_simd_t;
+    #define XBEE_SIMD_ZERO()        _mm_setzero_si128()
+    #define XBEE_SIMD_LOAD(p)       _mm_loadu_si128( (const __m128i *)(p))
+    #define XBEE_SIMD_STORE(p, v)   _mm_storeu_si128( (__m128i *)(p), v)
+    #define XBEE_SIMD_ADD(a, b)     _mm_add_epi8( a, b)
+    #define XBEE_SIMD_SET1(x)       _mm_set1_epi8( (char)(x))
+    #define XBEE_SIMD_EQ(a, b)      _mm_cmpeq_epi8( a, b)
+    #define XBEE_SIMD_OR(a, b)      _mm_or_si128( a, b)
+    #define XBEE_SIMD_MASK(v)       ((uint32_t) _mm_movemask_epi8( v))
+#elif defined __ARM_NEON
+    #define XBEE_SIMD_BYTES     16
+    typedef uint8x16_t xbee_simd_t;
+    #define XBEE_SIMD_ZERO()        vdupq_n_u8( 0)
+    #define XBEE_SIMD_LOAD(p)       vld1q_u8( (const uint8_t *)(p))
+    #define XBEE_SIMD_STORE(p, v)   vst1q_u8( (uint8_t *)(p), v)
+    #define XBEE_SIMD_ADD(a, b)     vaddq_u8( a, b)
+    #define XBEE_SIMD_SET1(x)       vdupq_n_u8( x)
+    #define XBEE_SIMD_EQ(a, b)      vceqq_u8( a, b)
+    #define XBEE_SIMD_OR(a, b)      vorrq_u8( a, b)
+    // no movemask on NEON, narrow each lane of a comparison to 4 bits
+    #define XBEE_SIMD_MASK(v)       vget_lane_u64( vreinterpret_u64_u8( \
+                        vshrn_n_u16( vreinterpretq_u16_u8( v), 4)), 0)
+    #define XBEE_SIMD_MASK_BITS     4
+#endif
+
+#if defined XBEE_SIMD_MASK && ! defined XBEE_SIMD_MASK_BITS
+    #define XBEE_SIMD_MASK_BITS     1
+#endif
+
+#ifdef XBEE_SIMD_BYTES
+// add up the lanes of <acc>, modulo 256
+static uint8_t xbee_simd_sum( xbee_simd_t acc)
+{
+    uint8_t lanes[XBEE_SIMD_BYTES];
+    uint8_t sum = 0;
+    int i;
+
+    XBEE_SIMD_STORE( lanes, acc);
+    for (i = 0; i < XBEE_SIMD_BYTES; ++i)
+    {
+        sum += lanes[i];
+    }
+
+    return sum;
+}
+#endif
+
+uint8_t _xbee_checksum_posix( const void *bytes, uint16_t length,
+    uint_fast8_t initial)
+{
+    const uint8_t *p = bytes;
+    uint8_t checksum = initial;
+
+#ifdef XBEE_SIMD_BYTES
+    xbee_simd_t acc;
+
+    if (length >= XBEE_SIMD_BYTES)
+    {
+        acc = XBEE_SIMD_ZERO();
+        do {
+            acc = XBEE_SIMD_ADD( acc, XBEE_SIMD_LOAD( p));
+            p += XBEE_SIMD_BYTES;
+            length -= XBEE_SIMD_BYTES;
+        } while (length >= XBEE_SIMD_BYTES);
+        checksum -= xbee_simd_sum( acc);
+    }
+#endif
+
+    for (; length; ++p, --length)
+    {
+        checksum -= *p;
+    }
+
+    return checksum;
+}
+
+uint8_t _xbee_checksum_copy_posix( void *dest, const void *src,
+    uint16_t length, uint_fast8_t initial)
+{
+    const uint8_t *s = src;
+    uint8_t *d = dest;
+    uint8_t checksum = initial;
+
+#ifdef XBEE_SIMD_BYTES
+    xbee_simd_t acc, v;
+
+    if (length >= XBEE_SIMD_BYTES)
+    {
+        acc = XBEE_SIMD_ZERO();
+        do {
+            v = XBEE_SIMD_LOAD( s);
+            XBEE_SIMD_STORE( d, v);
+            acc = XBEE_SIMD_ADD( acc, v);
+            s += XBEE_SIMD_BYTES;
+            d += XBEE_SIMD_BYTES;
+            length -= XBEE_SIMD_BYTES;
+        } while (length >= XBEE_SIMD_BYTES);
+        checksum -= xbee_simd_sum( acc);
+    }
+#endif
+
+    for (; length; ++s, ++d, --length)
+    {
+        checksum -= (*d = *s);
+    }
+
+    return checksum;
+}
+
+/*
+    Escaped API mode (ATAP=2).  Escaped bytes are rare in most frames, so
+    the kernels compare a block of XBEE_SIMD_BYTES against all of the
+    special bytes at once, copy the block up to the first special byte
+    without looking at each byte, and only handle that byte on its own.
+*/
+#define XBEE_API_ESCAPE         0x7D
+#define XBEE_API_ESCAPE_XOR     0x20
+
+static uint8_t *xbee_unescape_bytes( uint8_t *d, const uint8_t *s,
+    uint16_t n, uint8_t *escape)
+{
+    uint8_t ch;
+
+    for (; n; --n)
+    {
+        ch = *s++;
+        if (ch == XBEE_API_ESCAPE)
+        {
+            *escape = 1;
+        }
+        else if (ch == 0x11 || ch == 0x13)
+        {
+            // XON/XOFF, not part of the frame
+        }
+        else if (*escape && ch != 0x7E)
+        {
+            *escape = 0;
+            *d++ = ch ^ XBEE_API_ESCAPE_XOR;
+        }
+        else
+        {
+            *escape = 0;
+            *d++ = ch;
+        }
+    }
+
+    return d;
+}
+
+#ifdef XBEE_SIMD_BYTES
+// index of the first lane set in comparison result <v>, or XBEE_SIMD_BYTES
+static unsigned xbee_simd_first( xbee_simd_t v)
+{
+    uint64_t mask = XBEE_SIMD_MASK( v);
+
+    return mask ? (unsigned) __builtin_ctzll( mask) / XBEE_SIMD_MASK_BITS
+                : XBEE_SIMD_BYTES;
+}
+#endif
+
+uint16_t _xbee_escape_posix( void *dest, const void *src, uint16_t length)
+{
+    const uint8_t *s = src;
+    uint8_t *d = dest;
+
+#ifdef XBEE_SIMD_BYTES
+    const xbee_simd_t start = XBEE_SIMD_SET1( 0x7E);
+    const xbee_simd_t escape = XBEE_SIMD_SET1( XBEE_API_ESCAPE);
+    const xbee_simd_t xon = XBEE_SIMD_SET1( 0x11);
+    const xbee_simd_t xoff = XBEE_SIMD_SET1( 0x13);
+    xbee_simd_t v;
+    unsigned n;
+
+    while (length >= XBEE_SIMD_BYTES)
+    {
+        v = XBEE_SIMD_LOAD( s);
+        n = xbee_simd_first( XBEE_SIMD_OR(
+            XBEE_SIMD_OR( XBEE_SIMD_EQ( v, start), XBEE_SIMD_EQ( v, escape)),
+            XBEE_SIMD_OR( XBEE_SIMD_EQ( v, xon), XBEE_SIMD_EQ( v, xoff))));
+
+        // store the whole block, but only keep the bytes before lane <n>
+        XBEE_SIMD_STORE( d, v);
+        s += n;
+        d += n;
+        length -= n;
+        if (n < XBEE_SIMD_BYTES)
+        {
+            *d++ = XBEE_API_ESCAPE;
+            *d++ = *s++ ^ XBEE_API_ESCAPE_XOR;
+            --length;
+        }
+    }
+#endif
+
+    for (; length; ++s, --length)
+    {
+        if (*s == 0x7E || *s == 0x7D || *s == 0x11 || *s == 0x13)
+        {
+            *d++ = XBEE_API_ESCAPE;
+            *d++ = *s ^ XBEE_API_ESCAPE_XOR;
+        }
+        else
+        {
+            *d++ = *s;
+        }
+    }
+
+    return (uint16_t) (d - (uint8_t *) dest);
+}
+
+uint16_t _xbee_unescape_posix( void *dest, const void *src, uint16_t length,
+    uint8_t *escape)
+{
+    const uint8_t *s = src;
+    uint8_t *d = dest;
+
+#ifdef XBEE_SIMD_BYTES
+    // 0x7E only needs work when it follows an escape, which is always
+    // handled by xbee_unescape_bytes()
+    const xbee_simd_t esc = XBEE_SIMD_SET1( XBEE_API_ESCAPE);
+    const xbee_simd_t xon = XBEE_SIMD_SET1( 0x11);
+    const xbee_simd_t xoff = XBEE_SIMD_SET1( 0x13);
+    xbee_simd_t v;
+    unsigned n;
+
+    while (length >= XBEE_SIMD_BYTES)
+    {
+        n = 0;
+        if (! *escape)
+        {
+            v = XBEE_SIMD_LOAD( s);
+            n = xbee_simd_first( XBEE_SIMD_OR( XBEE_SIMD_EQ( v, esc),
+                XBEE_SIMD_OR( XBEE_SIMD_EQ( v, xon), XBEE_SIMD_EQ( v, xoff))));
+
+            // d never gets ahead of s, but when working in place, storing
+            // the whole block could overwrite bytes after lane <n> of s
+            if (n == XBEE_SIMD_BYTES)
+            {
+                XBEE_SIMD_STORE( d, v);
+            }
+            else if (d != s)
+            {
+                memmove( d, s, n);
+            }
+            s += n;
+            d += n;
+            length -= n;
+        }
+        if (n < XBEE_SIMD_BYTES)
+        {
+            d = xbee_unescape_bytes( d, s++, 1, escape);
+            --length;
+        }
+    }
+#endif
+
+    d = xbee_unescape_bytes( d, s, length, escape);
+
+    return (uint16_t) (d - (uint8_t *) dest);
+}
+
 ///@}
@@ -0,0 +1,368 @@
+/*
+ * Copyright (c) 2019 Digi International Inc.,
+ * All rights not expressly granted are reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Digi International Inc. 11001 Bren Road East, Minnetonka, MN 55343
+ * =======================================================================
+ */
+/**
+    @addtogroup hal_posix
+    @{
+    @file xbee_reactor_posix.c
+    Gateway reactor for multiple XBee devices (Linux)
+
+    The program calls xbee_reactor_poll() to wait on the serial ports of
+    all devices with epoll.  Devices with pending bytes (or timers due) go
+    into a FIFO run queue, and xbee_reactor_poll() then calls
+    xbee_dev_tick() for each device in the queue.
+
+    - Single dispatcher:  the AT command layer (request pool and table,
+      cache), the timer wheels and the WPAN and socket layers keep state
+      shared by all devices, so frames from every device are dispatched by
+      the thread calling xbee_reactor_poll().  Frame handlers, and the
+      program's own calls into the library between calls to
+      xbee_reactor_poll(), don't need any locking.
+    - Per-device ordering:  a device is in the run queue at most once, and
+      is ticked by a single thread.  The XBEE_DEV_FLAG_IN_TICK guard in
+      xbee_dev_tick() still protects against handlers that tick their own
+      device.
+    - Fair scheduling:  each call to xbee_dev_tick() dispatches at most
+      XBEE_DEV_MAX_DISPATCH_PER_TICK frames from a device, and a device
+      with frames left over goes back at the end of the run queue for the
+      next call to xbee_reactor_poll(), so a busy radio can't starve the
+      others.
+    - Timers:  xbee_reactor_poll() doesn't wait past the devices' next
+      timer (AT command timeouts, frame ID expiry, ...), or longer than
+      XBEE_REACTOR_TX_RETRY_MS while frames wait in a transmit queue, and
+      then ticks every device.  The program doesn't need to call
+      xbee_cmd_tick().
+
+    Don't use xbee_dev_rx_thread_start() with devices added to a reactor.
+*/
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "xbee/reactor.h"
+
+// Add device <index> to the end of the run queue.
+static void xbee_reactor_enqueue( xbee_reactor_t *reactor, uint_fast8_t index)
+{
+    reactor->runq[(reactor->runq_head + reactor->runq_used)
+                                        % XBEE_REACTOR_MAX_DEVICES] = index;
+    ++reactor->runq_used;
+    reactor->state[index] = XBEE_REACTOR_DEV_QUEUED;
+}
+
+
+// Add every idle device to the run queue.
+static void xbee_reactor_enqueue_all( xbee_reactor_t *reactor)
+{
+    uint_fast8_t index;
+
+    for (index = 0; index < reactor->count; ++index)
+    {
+        if (reactor->state[index] == XBEE_REACTOR_DEV_IDLE)
+        {
+            xbee_reactor_enqueue( reactor, index);
+        }
+    }
+}
+
+
+// Milliseconds until a device needs a tick for its timers or transmit
+// queue, or XBEE_WAIT_FOREVER.
+static int32_t xbee_reactor_next_timeout( xbee_reactor_t *reactor)
+{
+    xbee_dev_t *xbee;
+    uint_fast8_t index;
+    int32_t next, timeout;
+
+    next = XBEE_WAIT_FOREVER;
+    for (index = 0; index < reactor->count; ++index)
+    {
+        xbee = reactor->dev[index];
+        timeout = xbee_timer_wheel_next( &xbee->wpan_dev.timers);
+        if (xbee_frame_queue_pending( xbee) > 0)
+        {
+            timeout = XBEE_WAIT_MIN( timeout, XBEE_REACTOR_TX_RETRY_MS);
+        }
+        next = XBEE_WAIT_MIN( next, timeout);
+    }
+
+    return next;
+}
+
+
+/**
+    @brief
+    Initialize a reactor.
+
+    @param[out] reactor  Reactor to initialize.
+
+    @retval  0        Reactor is ready for xbee_reactor_add().
+    @retval  -EINVAL  Invalid parameter.
+    @retval  <0       Error from epoll_create1().
+
+    @sa xbee_reactor_destroy()
+*/
+int xbee_reactor_init( xbee_reactor_t *reactor)
+{
+    if (reactor == NULL)
+    {
+        return -EINVAL;
+    }
+
+    memset( reactor, 0, sizeof *reactor);
+    reactor->epfd = epoll_create1( EPOLL_CLOEXEC);
+    if (reactor->epfd < 0)
+    {
+        return -errno;
+    }
+
+    return 0;
+}
+
+
+/**
+    @brief
+    Add an XBee device to a reactor.
+
+    Call after xbee_dev_init().  From then on, xbee_reactor_poll() calls
+    xbee_dev_tick() for the device whenever bytes arrive on its serial
+    port or its timers are due, so the program should no longer tick it
+    directly.
+
+    @param[in]  reactor  Reactor initialized by xbee_reactor_init().
+    @param[in]  xbee     XBee device to add.
+
+    @retval  >=0      Device's index in \c reactor->dev[] and
+                      \c reactor->frames[].
+    @retval  -EINVAL  Invalid parameter.
+    @retval  -EBUSY   Device has a reader thread running.
+    @retval  -ENOSPC  Reactor already has XBEE_REACTOR_MAX_DEVICES devices.
+    @retval  <0       Error from epoll_ctl().
+*/
+int xbee_reactor_add( xbee_reactor_t *reactor, xbee_dev_t *xbee)
+{
+    struct epoll_event event;
+    uint_fast8_t index;
+    int err;
+
+    if (reactor == NULL || xbee == NULL || xbee_ser_invalid( &xbee->serport))
+    {
+        return -EINVAL;
+    }
+#if XBEE_DEV_RX_QUEUE_SIZE
+    if (xbee->rx_queue.enabled)
+    {
+        return -EBUSY;
+    }
+#endif
+
+    if (reactor->count == XBEE_REACTOR_MAX_DEVICES)
+    {
+        err = -ENOSPC;
+    }
+    else
+    {
+        index = reactor->count;
+        memset( &event, 0, sizeof event);
+        event.events = EPOLLIN;
+        event.data.u32 = index;
+        if (epoll_ctl( reactor->epfd, EPOLL_CTL_ADD, xbee->serport.fd,
+            &event))
+        {
+            err = -errno;
+        }
+        else
+        {
+            reactor->dev[index] = xbee;
+            reactor->state[index] = XBEE_REACTOR_DEV_IDLE;
+            reactor->frames[index] = 0;
+            ++reactor->count;
+            err = index;
+        }
+    }
+
+    #ifdef XBEE_DEVICE_VERBOSE
+        printf( "%s: %s added as device %d\n", __FUNCTION__,
+            xbee_ser_portname( &xbee->serport), err);
+    #endif
+
+    return err;
+}
+
+
+/**
+    @brief
+    Wait for bytes to arrive on any of the reactor's serial ports, and tick
+    those devices.
+
+    Waits no longer than the devices' next timer (or XBEE_REACTOR_TX_RETRY_MS
+    if frames are waiting in a transmit queue), and then ticks every device
+    so xbee_dev_tick() can expire the timers and send the frames.  Doesn't
+    wait at all if devices had frames left over from the previous call.
+
+    Each device in the run queue gets a single xbee_dev_tick(), so call
+    from the program's main loop:
+
+    @code
+        for (;;)
+        {
+            xbee_reactor_poll( &reactor, 1000);
+
+            // work for the program's own timers, calling into the library
+        }
+    @endcode
+
+    @param[in]  reactor     Reactor initialized by xbee_reactor_init().
+    @param[in]  timeout_ms  Maximum time to wait, or XBEE_WAIT_FOREVER.
+
+    @retval  >=0      Number of devices ticked (0 on timeout without timers
+                      due, or if interrupted by a signal).
+    @retval  -EINVAL  Invalid parameter.
+    @retval  <0       Error from epoll_wait().
+*/
+int xbee_reactor_poll( xbee_reactor_t *reactor, int32_t timeout_ms)
+{
+    struct epoll_event events[XBEE_REACTOR_MAX_DEVICES];
+    xbee_dev_t *xbee;
+    uint_fast8_t index;
+    uint32_t start;
+    int32_t next;
+    int i, count, ticked, result;
+    bool_t timers;
+
+    if (reactor == NULL)
+    {
+        return -EINVAL;
+    }
+
+    timers = FALSE;
+    if (reactor->runq_used)
+    {
+        timeout_ms = 0;                 // frames left over from last call
+    }
+    else
+    {
+        next = xbee_reactor_next_timeout( reactor);
+        timers = (next >= 0 && (timeout_ms < 0 || next <= timeout_ms));
+        if (timers)
+        {
+            timeout_ms = next;
+        }
+    }
+
+    if (timeout_ms < 0)
+    {
+        timeout_ms = -1;                // epoll_wait() waits forever
+    }
+    else if (timeout_ms > INT_MAX)
+    {
+        timeout_ms = INT_MAX;
+    }
+
+    start = xbee_millisecond_timer();
+    count = epoll_wait( reactor->epfd, events, XBEE_REACTOR_MAX_DEVICES,
+        (int) timeout_ms);
+    if (count < 0)
+    {
+        if (errno != EINTR)
+        {
+            return -errno;
+        }
+        count = 0;
+        timers = FALSE;
+    }
+    if (timers && count > 0
+        && xbee_millisecond_timer() - start < (uint32_t) timeout_ms)
+    {
+        timers = FALSE;         // bytes arrived before the timers were due
+    }
+
+    for (i = 0; i < count; ++i)
+    {
+        index = (uint_fast8_t) events[i].data.u32;
+        if (index < reactor->count
+            && reactor->state[index] == XBEE_REACTOR_DEV_IDLE)
+        {
+            xbee_reactor_enqueue( reactor, index);
+        }
+    }
+    if (timers)
+    {
+        xbee_reactor_enqueue_all( reactor);
+    }
+
+    // Tick each device queued so far once.  Devices put back in the queue
+    // go after them, and wait for the next call.
+    ticked = reactor->runq_used;
+    for (i = 0; i < ticked; ++i)
+    {
+        index = reactor->runq[reactor->runq_head];
+        reactor->runq_head = (reactor->runq_head + 1)
+                                                % XBEE_REACTOR_MAX_DEVICES;
+        --reactor->runq_used;
+        xbee = reactor->dev[index];
+
+        result = xbee_dev_tick( xbee);
+        if (result > 0)
+        {
+            reactor->frames[index] += result;
+        }
+
+        // Frames left over from the per-tick limit (or bytes sitting in the
+        // staging ring) won't make the serial port readable, so check for
+        // them before going back to waiting on it.
+        if (result > 0 && xbee_dev_wait( xbee, 0) > 0)
+        {
+            // back of the line, give other devices a turn
+            xbee_reactor_enqueue( reactor, index);
+        }
+        else
+        {
+            reactor->state[index] = XBEE_REACTOR_DEV_IDLE;
+        }
+    }
+
+    return ticked;
+}
+
+
+/**
+    @brief
+    Release a reactor's resources.
+
+    Does not close the devices' serial ports; the program can go back to
+    ticking them directly.
+
+    @param[in]  reactor  Reactor initialized by xbee_reactor_init().
+
+    @retval  0        Reactor released.
+    @retval  -EINVAL  Invalid parameter.
+*/
+int xbee_reactor_destroy( xbee_reactor_t *reactor)
+{
+    if (reactor == NULL)
+    {
+        return -EINVAL;
+    }
+
+    close( reactor->epfd);
+    reactor->epfd = -1;
+    reactor->count = 0;
+    reactor->runq_used = 0;
+
+    return 0;
+}
+
+///@}
@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2019 Digi International Inc.,
+ * All rights not expressly granted are reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Digi International Inc. 11001 Bren Road East, Minnetonka, MN 55343
+ * =======================================================================
+ */
+/**
+    @addtogroup hal_posix
+    @{
+    @file xbee_rxthread_posix.c
+    Reader thread for the XBee device layer (POSIX Platform)
+
+    Moves serial reads and frame validation onto a separate thread, which
+    passes complete frames to xbee_dev_tick() through the device's frame
+    queue.  Programs using this file need to set XBEE_DEV_RX_QUEUE_SIZE
+    (e.g., -DXBEE_DEV_RX_QUEUE_SIZE=16) and link with -pthread.
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "xbee/device.h"
+
+#if XBEE_DEV_RX_QUEUE_SIZE
+
+// how long the thread sleeps on the serial port before checking for a stop
+#define XBEE_RX_THREAD_POLL_MS  50
+
+static void xbee_rx_thread_nap( void)
+{
+    static const struct timespec nap = { 0, 1000000L };     // 1ms
+
+    nanosleep( &nap, NULL);
+}
+
+
+static void *xbee_rx_thread( void *arg)
+{
+    xbee_dev_t *xbee = arg;
+    int result;
+
+    #ifdef XBEE_DEVICE_VERBOSE
+        printf( "%s: started for %s\n", __FUNCTION__,
+            xbee_ser_portname( &xbee->serport));
+    #endif
+
+    while (XBEE_ATOMIC_LOAD( &xbee->rx_queue.thread) == XBEE_RX_THREAD_RUNNING)
+    {
+        result = _xbee_frame_load( xbee);
+        if (result == 0)
+        {
+            // wait for more bytes from the XBee
+            xbee_ser_wait( &xbee->serport, XBEE_RX_THREAD_POLL_MS);
+        }
+        else if (result < 0)
+        {
+            // queue is full (-ENOSPC) or serial port error, give
+            // xbee_dev_tick() a chance to catch up
+            xbee_rx_thread_nap();
+        }
+    }
+
+    #ifdef XBEE_DEVICE_VERBOSE
+        printf( "%s: stopped\n", __FUNCTION__);
+    #endif
+
+    XBEE_ATOMIC_STORE( &xbee->rx_queue.thread, XBEE_RX_THREAD_STOPPED);
+
+    return NULL;
+}
+
+
+/**
+    @brief
+    Start a thread to read frames from \a xbee's serial port and queue them
+    for xbee_dev_tick() to dispatch.
+
+    Call after xbee_dev_init(), and continue to call xbee_dev_tick() (or
+    wpan_tick()) from the program's main thread, where all frame handlers
+    will run.  A handler can compare the \c received member of
+    \c xbee->rx_queue to xbee_millisecond_timer() to measure the time since
+    its frame started to arrive.
+
+    @param[in]  xbee  XBee device to read from.
+
+    @retval  0        Started thread.
+    @retval  -EINVAL  Invalid parameter.
+    @retval  -EBUSY   Thread is already running.
+    @retval  <0       Error from pthread_create().
+
+    @sa xbee_dev_rx_thread_stop()
+*/
+int xbee_dev_rx_thread_start( xbee_dev_t *xbee)
+{
+    pthread_t thread;
+    int err;
+
+    if (xbee == NULL || xbee_ser_invalid( &xbee->serport))
+    {
+        return -EINVAL;
+    }
+    if (xbee->rx_queue.enabled)
+    {
+        return -EBUSY;
+    }
+
+    xbee->rx_queue.head = xbee->rx_queue.tail = 0;
+    xbee->rx_queue.thread = XBEE_RX_THREAD_RUNNING;
+    xbee->rx_queue.enabled = TRUE;
+    xbee->rx.state = XBEE_RX_STATE_WAITSTART;
+
+    err = pthread_create( &thread, NULL, xbee_rx_thread, xbee);
+    if (err)
+    {
+        xbee->rx_queue.enabled = FALSE;
+        xbee->rx_queue.thread = XBEE_RX_THREAD_STOPPED;
+        return -err;
+    }
+    pthread_detach( thread);
+
+    return 0;
+}
+
+
+/**
+    @brief
+    Stop the reader thread started by xbee_dev_rx_thread_start() and
+    dispatch any frames it already queued.
+
+    Must be called from the thread calling xbee_dev_tick(), but not from
+    within a frame handler.  Afterwards, xbee_dev_tick() reads frames
+    directly from the serial port again.
+
+    @param[in]  xbee  XBee device with reader thread.
+
+    @retval  0        Stopped thread.
+    @retval  -EINVAL  Invalid parameter or thread isn't running.
+*/
+int xbee_dev_rx_thread_stop( xbee_dev_t *xbee)
+{
+    if (xbee == NULL || ! xbee->rx_queue.enabled)
+    {
+        return -EINVAL;
+    }
+
+    XBEE_ATOMIC_STORE( &xbee->rx_queue.thread, XBEE_RX_THREAD_STOPPING);
+    while (XBEE_ATOMIC_LOAD( &xbee->rx_queue.thread) != XBEE_RX_THREAD_STOPPED)
+    {
+        xbee_rx_thread_nap();
+    }
+
+    while (_xbee_frame_drain( xbee, NULL) > 0)
+    {
+        // dispatch frames left in the queue
+    }
+    xbee->rx_queue.enabled = FALSE;
+
+    // drop any partial frame, it was being read into a queue slot
+    xbee->rx.state = XBEE_RX_STATE_WAITSTART;
+
+    return 0;
+}
+
+#endif // XBEE_DEV_RX_QUEUE_SIZE
+
+///@}
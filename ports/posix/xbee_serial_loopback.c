@@ -0,0 +1,520 @@
+/*
+ * Copyright (c) 2019 Digi International Inc.,
+ * All rights not expressly granted are reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Digi International Inc. 11001 Bren Road East, Minnetonka, MN 55343
+ * =======================================================================
+ */
+/**
+    @addtogroup hal_posix
+    @{
+    @file xbee_serial_loopback.c
+    In-memory loopback serial driver (POSIX Platform)
+
+    Drop-in replacement for xbee_serial_posix.c that moves bytes through
+    memory instead of a serial port, so benchmarks measure the driver's own
+    cost and tests can inject any byte stream.  See xbee/serial_loopback.h.
+
+    xbee_ser_open() assigns a free loopback port (ignoring the device name)
+    and stores its number, starting at 1, in \c serial->fd.  Each ring has a
+    single producer and a single consumer, synchronized with
+    XBEE_ATOMIC_LOAD() and XBEE_ATOMIC_STORE().
+*/
+// NOTE: Documentation for these functions can be found in xbee/serial.h.
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "xbee/serial_loopback.h"
+
+#define XBEE_LOOPBACK_MASK      (XBEE_SER_LOOPBACK_SIZE - 1)
+
+// Bytes in one direction.  Indexes are free-running and masked to access buf.
+typedef struct xbee_loopback_ring_t {
+    uint32_t    head;           // next byte to consume
+    uint32_t    tail;           // next byte to produce
+    uint8_t     buf[XBEE_SER_LOOPBACK_SIZE];
+} xbee_loopback_ring_t;
+
+typedef struct xbee_loopback_port_t {
+    bool_t                  open;
+    bool_t                  cts;
+    xbee_loopback_ring_t    rx;     // fed by program, read by driver
+    xbee_loopback_ring_t    tx;     // written by driver, drained by program
+} xbee_loopback_port_t;
+
+static xbee_loopback_port_t xbee_loopback_port[XBEE_SER_LOOPBACK_PORTS];
+
+#define XBEE_SER_CHECK(ptr) \
+    do { if (xbee_ser_invalid(ptr)) return -EINVAL; } while (0)
+
+#define XBEE_LOOPBACK(serial)   (&xbee_loopback_port[(serial)->fd - 1])
+
+
+// Copy up to <length> bytes into <ring>, returns number of bytes copied.
+static int xbee_loopback_put( xbee_loopback_ring_t *ring, const void *data,
+    int length)
+{
+    uint32_t tail, room, offset, chunk;
+
+    tail = ring->tail;
+    room = XBEE_SER_LOOPBACK_SIZE - (tail - XBEE_ATOMIC_LOAD( &ring->head));
+    if ((uint32_t) length > room)
+    {
+        length = (int) room;
+    }
+
+    offset = tail & XBEE_LOOPBACK_MASK;
+    chunk = XBEE_SER_LOOPBACK_SIZE - offset;
+    if (chunk > (uint32_t) length)
+    {
+        chunk = length;
+    }
+    memcpy( &ring->buf[offset], data, chunk);
+    memcpy( ring->buf, (const uint8_t *) data + chunk, length - chunk);
+
+    XBEE_ATOMIC_STORE( &ring->tail, tail + length);
+
+    return length;
+}
+
+
+// Copy up to <bufsize> bytes out of <ring>, returns number of bytes copied.
+static int xbee_loopback_get( xbee_loopback_ring_t *ring, void *buffer,
+    int bufsize)
+{
+    uint32_t head, used, offset, chunk;
+
+    head = ring->head;
+    used = XBEE_ATOMIC_LOAD( &ring->tail) - head;
+    if ((uint32_t) bufsize > used)
+    {
+        bufsize = (int) used;
+    }
+
+    offset = head & XBEE_LOOPBACK_MASK;
+    chunk = XBEE_SER_LOOPBACK_SIZE - offset;
+    if (chunk > (uint32_t) bufsize)
+    {
+        chunk = bufsize;
+    }
+    memcpy( buffer, &ring->buf[offset], chunk);
+    memcpy( (uint8_t *) buffer + chunk, ring->buf, bufsize - chunk);
+
+    XBEE_ATOMIC_STORE( &ring->head, head + bufsize);
+
+    return bufsize;
+}
+
+
+static int xbee_loopback_used( xbee_loopback_ring_t *ring)
+{
+    return (int) (XBEE_ATOMIC_LOAD( &ring->tail)
+                                        - XBEE_ATOMIC_LOAD( &ring->head));
+}
+
+
+int xbee_ser_invalid( xbee_serial_t *serial)
+{
+    if (serial && serial->fd > 0 && serial->fd <= XBEE_SER_LOOPBACK_PORTS
+        && XBEE_LOOPBACK( serial)->open)
+    {
+        return 0;
+    }
+
+    #ifdef XBEE_SERIAL_VERBOSE
+        printf( "%s: serial=%p (invalid)\n", __FUNCTION__, serial);
+    #endif
+
+    return 1;
+}
+
+
+const char *xbee_ser_portname( xbee_serial_t *serial)
+{
+    if (serial == NULL)
+    {
+        return "(invalid)";
+    }
+
+    return serial->device;
+}
+
+
+int xbee_ser_write( xbee_serial_t *serial, const void FAR *buffer,
+    int length)
+{
+    XBEE_SER_CHECK( serial);
+    if (buffer == NULL || length < 0)
+    {
+        return -EINVAL;
+    }
+
+    return xbee_loopback_put( &XBEE_LOOPBACK( serial)->tx, buffer, length);
+}
+
+
+int xbee_ser_writev( xbee_serial_t *serial, const xbee_ser_iovec_t *iov,
+    int iovcnt)
+{
+    xbee_loopback_ring_t *ring;
+    int i, length, room;
+
+    XBEE_SER_CHECK( serial);
+    if (iov == NULL || iovcnt < 0 || iovcnt > XBEE_SER_IOV_MAX)
+    {
+        return -EINVAL;
+    }
+
+    // like writev(), take as much as fits
+    ring = &XBEE_LOOPBACK( serial)->tx;
+    room = XBEE_SER_LOOPBACK_SIZE - xbee_loopback_used( ring);
+    length = 0;
+    for (i = 0; i < iovcnt && length < room; ++i)
+    {
+        if (iov[i].length < 0)
+        {
+            return -EINVAL;
+        }
+        length += xbee_loopback_put( ring, iov[i].base, iov[i].length);
+    }
+
+    return length;
+}
+
+
+int xbee_ser_read( xbee_serial_t *serial, void FAR *buffer, int bufsize)
+{
+    XBEE_SER_CHECK( serial);
+    if (! buffer || bufsize < 0)
+    {
+        return -EINVAL;
+    }
+
+    return xbee_loopback_get( &XBEE_LOOPBACK( serial)->rx, buffer, bufsize);
+}
+
+
+int xbee_ser_wait( xbee_serial_t *serial, int32_t timeout_ms)
+{
+    static const struct timespec nap = { 0, 100000L };      // 100us
+    uint32_t start;
+
+    XBEE_SER_CHECK( serial);
+
+    // nothing to sleep on, poll for bytes from the feeding thread
+    start = xbee_millisecond_timer();
+    while (xbee_loopback_used( &XBEE_LOOPBACK( serial)->rx) == 0)
+    {
+        if (timeout_ms >= 0
+            && xbee_millisecond_timer() - start >= (uint32_t) timeout_ms)
+        {
+            return 0;
+        }
+        nanosleep( &nap, NULL);
+    }
+
+    return 1;
+}
+
+
+int xbee_ser_tx_wait( xbee_serial_t *serial, int32_t timeout_ms)
+{
+    static const struct timespec nap = { 0, 100000L };      // 100us
+    uint32_t start;
+
+    XBEE_SER_CHECK( serial);
+
+    // poll for the draining thread to make room
+    start = xbee_millisecond_timer();
+    while (xbee_loopback_used( &XBEE_LOOPBACK( serial)->tx)
+                                                    == XBEE_SER_LOOPBACK_SIZE)
+    {
+        if (timeout_ms >= 0
+            && xbee_millisecond_timer() - start >= (uint32_t) timeout_ms)
+        {
+            return 0;
+        }
+        nanosleep( &nap, NULL);
+    }
+
+    return 1;
+}
+
+
+int xbee_ser_putchar( xbee_serial_t *serial, uint8_t ch)
+{
+    int retval;
+
+    retval = xbee_ser_write( serial, &ch, 1);
+    if (retval == 1)
+    {
+        return 0;
+    }
+    else if (retval == 0)
+    {
+        return -ENOSPC;
+    }
+    else
+    {
+        return retval;
+    }
+}
+
+
+int xbee_ser_getchar( xbee_serial_t *serial)
+{
+    uint8_t ch = 0;
+    int retval;
+
+    retval = xbee_ser_read( serial, &ch, 1);
+    if (retval != 1)
+    {
+        return retval ? retval : -ENODATA;
+    }
+
+    return ch;
+}
+
+
+int xbee_ser_tx_free( xbee_serial_t *serial)
+{
+    XBEE_SER_CHECK( serial);
+    return XBEE_SER_LOOPBACK_SIZE
+                            - xbee_loopback_used( &XBEE_LOOPBACK( serial)->tx);
+}
+
+
+int xbee_ser_tx_used( xbee_serial_t *serial)
+{
+    XBEE_SER_CHECK( serial);
+    return xbee_loopback_used( &XBEE_LOOPBACK( serial)->tx);
+}
+
+
+int xbee_ser_tx_flush( xbee_serial_t *serial)
+{
+    xbee_loopback_ring_t *ring;
+
+    XBEE_SER_CHECK( serial);
+
+    // only safe if the program isn't draining on another thread
+    ring = &XBEE_LOOPBACK( serial)->tx;
+    XBEE_ATOMIC_STORE( &ring->head, XBEE_ATOMIC_LOAD( &ring->tail));
+
+    return 0;
+}
+
+
+int xbee_ser_rx_free( xbee_serial_t *serial)
+{
+    XBEE_SER_CHECK( serial);
+    return XBEE_SER_LOOPBACK_SIZE
+                            - xbee_loopback_used( &XBEE_LOOPBACK( serial)->rx);
+}
+
+
+int xbee_ser_rx_used( xbee_serial_t *serial)
+{
+    XBEE_SER_CHECK( serial);
+    return xbee_loopback_used( &XBEE_LOOPBACK( serial)->rx);
+}
+
+
+int xbee_ser_rx_flush( xbee_serial_t *serial)
+{
+    xbee_loopback_ring_t *ring;
+
+    XBEE_SER_CHECK( serial);
+
+    ring = &XBEE_LOOPBACK( serial)->rx;
+    XBEE_ATOMIC_STORE( &ring->head, XBEE_ATOMIC_LOAD( &ring->tail));
+
+    return 0;
+}
+
+
+int xbee_ser_baudrate( xbee_serial_t *serial, uint32_t baudrate)
+{
+    XBEE_SER_CHECK( serial);
+
+    // no UART to pace the bytes, just remember the setting
+    serial->baudrate = baudrate;
+
+    return 0;
+}
+
+
+int xbee_ser_open( xbee_serial_t *serial, uint32_t baudrate)
+{
+    int i;
+
+    if (serial == NULL)
+    {
+        return -EINVAL;
+    }
+
+    // if port isn't already open
+    if (xbee_ser_invalid( serial))
+    {
+        for (i = 0; i < XBEE_SER_LOOPBACK_PORTS; ++i)
+        {
+            if (! xbee_loopback_port[i].open)
+            {
+                break;
+            }
+        }
+        if (i == XBEE_SER_LOOPBACK_PORTS)
+        {
+            #ifdef XBEE_SERIAL_VERBOSE
+                printf( "%s: all %u loopback ports in use\n", __FUNCTION__,
+                    XBEE_SER_LOOPBACK_PORTS);
+            #endif
+            return -EBUSY;
+        }
+
+        memset( &xbee_loopback_port[i], 0, sizeof xbee_loopback_port[i]);
+        xbee_loopback_port[i].open = TRUE;
+        xbee_loopback_port[i].cts = TRUE;
+        serial->fd = i + 1;
+        snprintf( serial->device, sizeof serial->device, "loopback%d", i);
+    }
+
+    return xbee_ser_baudrate( serial, baudrate);
+}
+
+
+int xbee_ser_close( xbee_serial_t *serial)
+{
+    XBEE_SER_CHECK( serial);
+
+    XBEE_LOOPBACK( serial)->open = FALSE;
+    serial->fd = -1;
+
+    return 0;
+}
+
+
+int xbee_ser_break( xbee_serial_t *serial, int enabled)
+{
+    XBEE_SER_CHECK( serial);
+    XBEE_UNUSED_PARAMETER( enabled);
+
+    return 0;
+}
+
+
+int xbee_ser_flowcontrol( xbee_serial_t *serial, int enabled)
+{
+    XBEE_SER_CHECK( serial);
+    XBEE_UNUSED_PARAMETER( enabled);
+
+    return 0;
+}
+
+
+
+int xbee_ser_low_latency( xbee_serial_t *serial, bool_t enabled)
+{
+    XBEE_SER_CHECK( serial);
+    XBEE_UNUSED_PARAMETER( enabled);
+
+    // bytes are always available to read as soon as they're fed
+    return 0;
+}
+
+int xbee_ser_set_rts( xbee_serial_t *serial, int asserted)
+{
+    XBEE_SER_CHECK( serial);
+    XBEE_UNUSED_PARAMETER( asserted);
+
+    return 0;
+}
+
+
+int xbee_ser_get_cts( xbee_serial_t *serial)
+{
+    XBEE_SER_CHECK( serial);
+
+    return XBEE_LOOPBACK( serial)->cts ? 1 : 0;
+}
+
+
+/**
+    @brief
+    Add bytes for xbee_ser_read() to return, as if the XBee had sent them.
+
+    @param[in]  serial  Port opened by xbee_ser_open().
+    @param[in]  data    Bytes to add.
+    @param[in]  length  Number of bytes in \a data.
+
+    @retval  >=0      Number of bytes added (fewer than \a length if the
+                      port's receive ring is full).
+    @retval  -EINVAL  Invalid parameter.
+*/
+int xbee_ser_loopback_feed( xbee_serial_t *serial, const void *data,
+    int length)
+{
+    XBEE_SER_CHECK( serial);
+    if (data == NULL || length < 0)
+    {
+        return -EINVAL;
+    }
+
+    return xbee_loopback_put( &XBEE_LOOPBACK( serial)->rx, data, length);
+}
+
+
+/**
+    @brief
+    Remove bytes written with xbee_ser_write(), as if the XBee had
+    received them.
+
+    @param[in]  serial   Port opened by xbee_ser_open().
+    @param[out] buffer   Buffer for bytes.
+    @param[in]  bufsize  Size of \a buffer.
+
+    @retval  >=0      Number of bytes removed.
+    @retval  -EINVAL  Invalid parameter.
+*/
+int xbee_ser_loopback_drain( xbee_serial_t *serial, void *buffer,
+    int bufsize)
+{
+    XBEE_SER_CHECK( serial);
+    if (buffer == NULL || bufsize < 0)
+    {
+        return -EINVAL;
+    }
+
+    return xbee_loopback_get( &XBEE_LOOPBACK( serial)->tx, buffer, bufsize);
+}
+
+
+/**
+    @brief
+    Set the state of the port's simulated CTS line, for testing flow control.
+    CTS is asserted when the port is opened.
+
+    @param[in]  serial    Port opened by xbee_ser_open().
+    @param[in]  asserted  TRUE if the XBee can accept more bytes.
+
+    @retval  0        CTS updated.
+    @retval  -EINVAL  Invalid parameter.
+*/
+int xbee_ser_loopback_set_cts( xbee_serial_t *serial, bool_t asserted)
+{
+    XBEE_SER_CHECK( serial);
+
+    XBEE_LOOPBACK( serial)->cts = asserted;
+
+    return 0;
+}
+
+///@}
@@ -32,12 +32,39 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <poll.h>
 #include <termios.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
+#ifdef __linux__
+    #include <linux/serial.h>
+#endif
 
 #include "xbee/serial.h"
 
+// Linux sets arbitrary baud rates with the termios2 ioctls.  The kernel's
+// struct termios2 (from <asm/termbits.h>) conflicts with <termios.h>, so
+// declare it here.  TCGETS2 encodes the structure's size, so a mismatch
+// makes the ioctl fail instead of corrupting memory.
+#if defined __linux__ && defined TCGETS2
+    #define XBEE_SER_TERMIOS2
+    #define XBEE_KERNEL_NCCS    19
+    #ifndef BOTHER
+        #define BOTHER          0010000
+    #endif
+    struct termios2 {
+        tcflag_t    c_iflag;
+        tcflag_t    c_oflag;
+        tcflag_t    c_cflag;
+        tcflag_t    c_lflag;
+        cc_t        c_line;
+        cc_t        c_cc[XBEE_KERNEL_NCCS];
+        speed_t     c_ispeed;
+        speed_t     c_ospeed;
+    };
+#endif
+
 #define XBEE_SER_CHECK(ptr) \
     do { if (xbee_ser_invalid(ptr)) return -EINVAL; } while (0)
 
@@ -107,6 +134,53 @@ int xbee_ser_write( xbee_serial_t *serial, const void FAR *buffer,
 }
 
 
+int xbee_ser_writev( xbee_serial_t *serial, const xbee_ser_iovec_t *iov,
+    int iovcnt)
+{
+    struct iovec vec[XBEE_SER_IOV_MAX];
+    int i, length, result;
+
+    XBEE_SER_CHECK( serial);
+    if (iov == NULL || iovcnt < 0 || iovcnt > XBEE_SER_IOV_MAX)
+    {
+        return -EINVAL;
+    }
+
+    length = 0;
+    for (i = 0; i < iovcnt; ++i)
+    {
+        if (iov[i].length < 0)
+        {
+            return -EINVAL;
+        }
+        vec[i].iov_base = (void *) iov[i].base;
+        vec[i].iov_len = iov[i].length;
+        length += iov[i].length;
+    }
+
+    result = writev( serial->fd, vec, iovcnt);
+
+    if (result < 0)
+    {
+        #ifdef XBEE_SERIAL_VERBOSE
+            printf( "%s: error %d trying to write %d bytes\n", __FUNCTION__,
+                errno, length);
+        #endif
+        return -errno;
+    }
+
+    #ifdef XBEE_SERIAL_VERBOSE
+        printf( "%s: wrote %d of %d bytes\n", __FUNCTION__, result, length);
+        for (i = 0; i < iovcnt; ++i)
+        {
+            hex_dump( iov[i].base, iov[i].length, HEX_DUMP_FLAG_TAB);
+        }
+    #endif
+
+    return result;
+}
+
+
 int xbee_ser_read( xbee_serial_t *serial, void FAR *buffer, int bufsize)
 {
     int result;
@@ -145,6 +219,61 @@ int xbee_ser_read( xbee_serial_t *serial, void FAR *buffer, int bufsize)
 }
 
 
+// Wait for <events> on the serial port, for xbee_ser_wait() and
+// xbee_ser_tx_wait().
+static int xbee_ser_poll( xbee_serial_t *serial, short events,
+    int32_t timeout_ms)
+{
+    struct pollfd pfd;
+    int result;
+
+    XBEE_SER_CHECK( serial);
+
+    pfd.fd = serial->fd;
+    pfd.events = events;
+    pfd.revents = 0;
+
+    if (timeout_ms < 0)
+    {
+        timeout_ms = -1;                // poll() waits forever
+    }
+    else if (timeout_ms > INT_MAX)
+    {
+        timeout_ms = INT_MAX;
+    }
+
+    result = poll( &pfd, 1, (int) timeout_ms);
+    if (result == -1)
+    {
+        if (errno == EINTR)
+        {
+            return 0;
+        }
+        #ifdef XBEE_SERIAL_VERBOSE
+            printf( "%s: error %d waiting on fd %d\n", __FUNCTION__,
+                errno, serial->fd);
+        #endif
+        return -EIO;
+    }
+
+    // POLLERR and POLLHUP also count as ready, so the next read or write
+    // reports them
+    return result ? 1 : 0;
+}
+
+
+int xbee_ser_wait( xbee_serial_t *serial, int32_t timeout_ms)
+{
+    return xbee_ser_poll( serial, POLLIN, timeout_ms);
+}
+
+
+int xbee_ser_tx_wait( xbee_serial_t *serial, int32_t timeout_ms)
+{
+    return xbee_ser_poll( serial, POLLOUT, timeout_ms);
+}
+
+
 int xbee_ser_putchar( xbee_serial_t *serial, uint8_t ch)
 {
     int retval;
@@ -242,11 +371,63 @@ int xbee_ser_rx_flush( xbee_serial_t *serial)
 }
 
 
+#ifdef XBEE_SER_TERMIOS2
+// Set a rate without a Bxxx constant (e.g., 250000 or 1000000 for XBee 3)
+// with BOTHER, and confirm that the UART's divisor gets within 5% of it.
+static int xbee_ser_custom_baud( xbee_serial_t *serial, uint32_t baudrate)
+{
+    struct termios2 options;
+    uint32_t error;
+
+    if (ioctl( serial->fd, TCGETS2, &options) == -1)
+    {
+        #ifdef XBEE_SERIAL_VERBOSE
+            printf( "%s: %s failed (%d) for %" PRIu32 "\n",
+                __FUNCTION__, "TCGETS2", errno, baudrate);
+        #endif
+        return (errno == ENOTTY) ? -EINVAL : -errno;
+    }
+
+    options.c_cflag &= ~CBAUD;
+    options.c_cflag |= BOTHER;
+    options.c_ispeed = options.c_ospeed = baudrate;
+
+    if (ioctl( serial->fd, TCSETS2, &options) == -1
+        || ioctl( serial->fd, TCGETS2, &options) == -1)
+    {
+        #ifdef XBEE_SERIAL_VERBOSE
+            printf( "%s: %s failed (%d) for %" PRIu32 "\n",
+                __FUNCTION__, "TCSETS2", errno, baudrate);
+        #endif
+        return -errno;
+    }
+
+    // driver reports the rate it actually configured
+    error = (options.c_ospeed > baudrate) ? options.c_ospeed - baudrate
+                                          : baudrate - options.c_ospeed;
+    if (error > baudrate / 20)
+    {
+        #ifdef XBEE_SERIAL_VERBOSE
+            printf( "%s: asked for %" PRIu32 ", got %u\n",
+                __FUNCTION__, baudrate, (unsigned) options.c_ospeed);
+        #endif
+        return -EIO;
+    }
+
+    return 0;
+}
+#endif
+
+
 #define _BAUDCASE(b)        case b: baud = B ## b; break
 int xbee_ser_baudrate( xbee_serial_t *serial, uint32_t baudrate)
 {
     struct termios options;
     speed_t baud;
+#ifdef XBEE_SER_TERMIOS2
+    struct termios2 saved;
+    int retval;
+#endif
 
     XBEE_SER_CHECK( serial);
 
@@ -268,7 +449,13 @@ int xbee_ser_baudrate( xbee_serial_t *serial, uint32_t baudrate)
         _BAUDCASE(921600);
 #endif
         default:
+#ifdef XBEE_SER_TERMIOS2
+            // start with a standard rate, replaced by xbee_ser_custom_baud()
+            baud = B38400;
+            break;
+#else
             return -EINVAL;
+#endif
     }
 
     // Get the current options for the port...
@@ -281,6 +468,20 @@ int xbee_ser_baudrate( xbee_serial_t *serial, uint32_t baudrate)
         return -errno;
     }
 
+#ifdef XBEE_SER_TERMIOS2
+    // keep the current settings (including a custom rate) to put back if
+    // xbee_ser_custom_baud() fails after the port has switched to B38400
+    if (baud == B38400 && baudrate != 38400
+        && ioctl( serial->fd, TCGETS2, &saved) == -1)
+    {
+        #ifdef XBEE_SERIAL_VERBOSE
+            printf( "%s: %s failed (%d) for %" PRIu32 "\n",
+                __FUNCTION__, "TCGETS2", errno, baudrate);
+        #endif
+        return (errno == ENOTTY) ? -EINVAL : -errno;
+    }
+#endif
+
     // Set the baud rates...
     cfsetispeed( &options, baud);
     cfsetospeed( &options, baud);
@@ -300,6 +501,19 @@ int xbee_ser_baudrate( xbee_serial_t *serial, uint32_t baudrate)
         return -errno;
     }
 
+#ifdef XBEE_SER_TERMIOS2
+    if (baud == B38400 && baudrate != 38400)
+    {
+        retval = xbee_ser_custom_baud( serial, baudrate);
+        if (retval)
+        {
+            // leave the port at serial->baudrate
+            ioctl( serial->fd, TCSETS2, &saved);
+            return retval;
+        }
+    }
+#endif
+
     serial->baudrate = baudrate;
     return 0;
 }
@@ -333,6 +547,7 @@ int xbee_ser_open( xbee_serial_t *serial, uint32_t baudrate)
         // Configure file descriptor to not block on read() if there aren't
         // any characters available.
         fcntl( serial->fd, F_SETFL, FNDELAY);
+        serial->low_latency = FALSE;
     }
 
     return xbee_ser_baudrate( serial, baudrate);
@@ -428,6 +643,100 @@ int xbee_ser_flowcontrol( xbee_serial_t *serial, int enabled)
 }
 
 
+
+int xbee_ser_low_latency( xbee_serial_t *serial, bool_t enabled)
+{
+    struct termios options, saved;
+#ifdef TIOCGSERIAL
+    struct serial_struct serinfo;
+    bool_t saved_async;
+    int retval;
+#endif
+
+    XBEE_SER_CHECK( serial);
+
+    enabled = enabled ? TRUE : FALSE;
+    if (enabled == serial->low_latency)
+    {
+        return 0;           // nothing to change (or restore)
+    }
+
+    if (tcgetattr( serial->fd, &options) == -1)
+    {
+        #ifdef XBEE_SERIAL_VERBOSE
+            printf( "%s: %s failed (%d)\n", __FUNCTION__, "tcgetattr", errno);
+        #endif
+        return -errno;
+    }
+    saved = options;
+
+    // With VMIN above 1 (and VTIME 0), poll() doesn't report the port as
+    // readable until VMIN bytes arrive.  Wake on the first byte instead,
+    // and put back the old values when disabled.
+    if (enabled)
+    {
+        options.c_cc[VMIN] = 1;
+        options.c_cc[VTIME] = 0;
+    }
+    else
+    {
+        options.c_cc[VMIN] = serial->saved_vmin;
+        options.c_cc[VTIME] = serial->saved_vtime;
+    }
+    if (tcsetattr( serial->fd, TCSANOW, &options) == -1)
+    {
+        #ifdef XBEE_SERIAL_VERBOSE
+            printf( "%s: %s failed (%d)\n", __FUNCTION__, "tcsetattr",
+                errno);
+        #endif
+        return -errno;
+    }
+
+#ifdef TIOCGSERIAL
+    // Have the driver push bytes to the tty layer as they arrive (USB
+    // adapters like the FTDI also drop their latency timer to 1ms).  Not all
+    // drivers support TIOCGSERIAL, so ignore ports that don't.  Leave the
+    // flag set when disabling if it was set before we enabled it.
+    if (ioctl( serial->fd, TIOCGSERIAL, &serinfo) == 0)
+    {
+        saved_async = (serinfo.flags & ASYNC_LOW_LATENCY) != 0;
+        if (enabled)
+        {
+            serinfo.flags |= ASYNC_LOW_LATENCY;
+        }
+        else if (! serial->saved_async)
+        {
+            serinfo.flags &= ~ASYNC_LOW_LATENCY;
+        }
+        if (ioctl( serial->fd, TIOCSSERIAL, &serinfo) == -1)
+        {
+            retval = -errno;
+            #ifdef XBEE_SERIAL_VERBOSE
+                printf( "%s: %s failed (%d)\n", __FUNCTION__, "TIOCSSERIAL",
+                    errno);
+            #endif
+            // put back VMIN and VTIME, so nothing has changed
+            tcsetattr( serial->fd, TCSANOW, &saved);
+            return retval;
+        }
+        if (enabled)
+        {
+            serial->saved_async = saved_async;
+        }
+    }
+#endif
+
+    if (enabled)
+    {
+        serial->saved_vmin = saved.c_cc[VMIN];
+        serial->saved_vtime = saved.c_cc[VTIME];
+    }
+
+    serial->low_latency = enabled;
+
+    return 0;
+}
+
 int xbee_ser_set_rts( xbee_serial_t *serial, int asserted)
 {
     int status;
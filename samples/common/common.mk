@@ -76,7 +76,8 @@ SRCS = \
 base_OBJECTS = xbee_platform_$(PORT).o xbee_serial_$(PORT).o hexstrtobyte.o \
 					memcheck.o swapbytes.o swapcpy.o hexdump.o parse_serial_args.o
 
-xbee_OBJECTS = $(base_OBJECTS) xbee_device.o xbee_atcmd.o wpan_types.o
+xbee_OBJECTS = $(base_OBJECTS) xbee_device.o xbee_atcmd.o wpan_types.o \
+	xbee_timer_wheel.o
 
 wpan_OBJECTS = $(xbee_OBJECTS) wpan_aps.o xbee_wpan.o
 
@@ -275,8 +275,19 @@ const wpan_endpoint_table_entry_t *wpan_endpoint_of_cluster( wpan_dev_t *dev,
 #endif
 
 
-/*** BeginHeader wpan_conversation_register */
+/*** BeginHeader wpan_conversation_register, wpan_conversation_delete,
+   _wpan_endpoint_set_dev */
 /*** EndHeader */
+// Timer callback for a conversation that didn't get a response in time.
+static void _wpan_conversation_expired( xbee_timer_t FAR *timer)
+{
+   wpan_conversation_t FAR *conversation = timer->context;
+
+   // send timeout to conversation's handler, ignore the response
+   conversation->handler( conversation, NULL);
+   wpan_conversation_delete( conversation);
+}
+
 /** @brief
    Add a conversation to the table of tracked conversations.
 
@@ -323,14 +334,16 @@ int wpan_conversation_register( wpan_ep_state_t FAR *state,
          conversation->handler = handler;
          if (timeout != 0)
          {
-            timeout += (uint16_t) xbee_seconds_timer();
-            if (timeout == 0)
+            xbee_timer_init( &conversation->timer, _wpan_conversation_expired,
+               conversation);
+            conversation->timer.expires = xbee_millisecond_timer()
+                                          + timeout * UINT32_C(1000);
+            if (state->dev != NULL)
             {
-               // timeout of 0 is reserved for "never", so add an extra second
-               timeout = 1;
+               xbee_timer_start_at( &state->dev->timers, &conversation->timer,
+                  conversation->timer.expires);
             }
          }
-         conversation->timeout = timeout;
          return (conversation->transaction_id = ++state->last_transaction);
       }
    }
@@ -338,8 +351,6 @@ int wpan_conversation_register( wpan_ep_state_t FAR *state,
    return -ENOSPC;
 }
 
-/*** BeginHeader wpan_conversation_delete */
-/*** EndHeader */
 /** @brief
    Delete a conversation from an endpoint's conversation table.
 
@@ -350,51 +361,39 @@ void wpan_conversation_delete( wpan_conversation_t FAR *conversation)
 {
    if (conversation != NULL)
    {
+      xbee_timer_cancel( &conversation->timer);
       _f_memset( conversation, 0, sizeof *conversation);
    }
 }
 
-/*** BeginHeader _wpan_endpoint_expire_conversations */
-void _wpan_endpoint_expire_conversations( wpan_ep_state_t FAR *state);
-/*** EndHeader */
 /**
    @internal @brief
-   Walk an endpoint's conversation table and expire any conversations
-   that have timed out.
+   Record the device an endpoint's conversations go out on, and start the
+   timers of conversations registered before the endpoint had one.
 
-   @param[in]  state    endpoint state (from endpoint table)
+   @param[in,out] state    endpoint state (from endpoint table)
+   @param[in]     dev      device with the endpoint
 */
 wpan_aps_debug
-void _wpan_endpoint_expire_conversations( wpan_ep_state_t FAR *state)
+void _wpan_endpoint_set_dev( wpan_ep_state_t FAR *state, wpan_dev_t *dev)
 {
    wpan_conversation_t FAR *conversation;
    uint_fast8_t i;
-   uint16_t now;
 
-   if (state == NULL)
+   if (state == NULL || state->dev == dev)
    {
       return;
    }
 
-   /*
-      Notes regarding timeout calculation:  We just store the lower 16 bits of
-      the xbee_seconds_timer() value of when we should timeout.  We can tell
-      whether we're before or after that time by subtracting the target time
-      from the curent time.  If the result as a signed integer is >= 0, we
-      have passed the selected timeout value.
-   */
-
-   now = (uint16_t) xbee_seconds_timer();
+   state->dev = dev;
    conversation = state->conversations;
    for (i = WPAN_MAX_CONVERSATIONS; i; ++conversation, --i)
    {
       if (conversation->handler != NULL
-         && conversation->timeout != 0
-         && (int16_t)(now - conversation->timeout) >= 0)
+         && conversation->timer.callback != NULL)
       {
-         // send timeout to conversation's handler, ignore the response
-         conversation->handler( conversation, NULL);
-         wpan_conversation_delete( conversation);
+         xbee_timer_start_at( &dev->timers, &conversation->timer,
+            conversation->timer.expires);
       }
    }
 }
@@ -845,7 +844,8 @@ void wpan_envelope_dump( const wpan_envelope_t FAR *envelope)
 /**
    @brief
    Calls the underlying hardware tick function to process received frames,
-   and times out expired conversations.
+   and times out expired conversations (and anything else on the device's
+   timer wheel).
 
    @param[in]  dev   WPAN device to tick
 
@@ -869,12 +869,14 @@ int wpan_tick( wpan_dev_t *dev)
          retval = dev->tick( dev);
       }
 
-      // walk endpoint table, expiring each endpoint's conversations
+      // tie each endpoint's conversations to this device's timer wheel
       ep = NULL;
       while ( (ep = wpan_endpoint_get_next( dev, ep)) != NULL)
       {
-         _wpan_endpoint_expire_conversations( ep->ep_state);
+         _wpan_endpoint_set_dev( ep->ep_state, dev);
       }
+
+      xbee_timer_wheel_run( &dev->timers);
    }
 
    return retval;
@@ -883,4 +885,32 @@ int wpan_tick( wpan_dev_t *dev)
    #pragma MESSAGE DEFAULT C5909    // restore C5909 (Assignment in condition)
 #endif
 
+/*** BeginHeader wpan_next_timeout */
+/*** EndHeader */
+/**
+   @brief
+   Report how long a program can wait before wpan_tick() needs to expire
+   one of the device's conversations (or other timeouts on its timer wheel,
+   like AT command requests).
+
+   Use with xbee_dev_wait() to sleep until the next frame arrives or a
+   conversation times out, instead of polling wpan_tick().
+
+   @param[in]  dev   WPAN device to check
+
+   @return  milliseconds until wpan_tick() has a timeout to process (0 if
+            it has one now), or XBEE_WAIT_FOREVER if nothing on the device
+            has a timeout
+*/
+wpan_aps_debug
+int32_t wpan_next_timeout( wpan_dev_t *dev)
+{
+   if (dev == NULL)
+   {
+      return XBEE_WAIT_FOREVER;
+   }
+
+   return xbee_timer_wheel_next( &dev->timers);
+}
+
 ///@}
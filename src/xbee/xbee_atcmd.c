@@ -66,88 +66,283 @@
 FAR xbee_cmd_request_t xbee_cmd_request_table[XBEE_CMD_REQUEST_TABLESIZE];
 
 
-/*** BeginHeader xbee_cmd_tick */
+/*** BeginHeader _xbee_cmd_pool, xbee_cmd_request_pool_add,
+   _xbee_cmd_pool_alloc, _xbee_cmd_pool_free, _xbee_cmd_set_timeout */
 /*** EndHeader */
+#if XBEE_CMD_REQUEST_GROW
+   #include <stdlib.h>
+#endif
+
+/// Every request (starting with xbee_cmd_request_table) and the free list.
+/// Requests in use time out on their device's timer wheel.
+xbee_cmd_pool_t _xbee_cmd_pool;
+
+// Has xbee_cmd_request_table been added to _xbee_cmd_pool?
+static bool_t _xbee_cmd_pool_ready = FALSE;
+
+// Timer callback for a request that didn't get a response in time.
+static void _xbee_cmd_request_expired( xbee_timer_t FAR *timer)
+{
+   xbee_cmd_request_t FAR *request = timer->context;
+   xbee_cmd_response_t expired;
+   xbee_dev_t *device;
+   int reuse;
+
+   ++_xbee_cmd_pool.expired;
+
+   memset( &expired, 0, sizeof expired);
+   // set the timeout flag, but also make sure STATUS is invalid
+   expired.flags = XBEE_CMD_RESP_FLAG_TIMEOUT | XBEE_CMD_RESP_MASK_STATUS;
+   expired.handle = XBEE_CMD_REQUEST_HANDLE( request);
+
+   #ifdef XBEE_ATCMD_VERBOSE
+      printf( "%s: request 0x%04x timed out\n", __FUNCTION__,
+         expired.handle);
+   #endif
+   reuse = XBEE_ATCMD_DONE;
+   if (request->callback)
+   {
+      expired.device = request->device;
+      expired.context = request->context;
+      expired.command.w = request->command.w;
+
+      #ifdef XBEE_ATCMD_VERBOSE
+         printf( "%s: dispatch to handler @%p w/context %" PRIpFAR "\n",
+            __FUNCTION__, request->callback, expired.context);
+      #endif
+      reuse = request->callback( &expired);
+   }
+   if (reuse != XBEE_ATCMD_REUSE)
+   {
+      #ifdef XBEE_ATCMD_VERBOSE
+         printf( "%s: releasing expired request 0x%04x\n",
+            __FUNCTION__, expired.handle);
+      #endif
+
+      device = request->device;
+      _xbee_cmd_release_request( request);
+      if (device != NULL
+         && (device->flags & XBEE_DEV_FLAG_QUERY_REFRESH))
+      {
+         // If we're waiting to refresh network settings due to a full
+         // command table, now's our chance since we just opened a slot.
+         xbee_cmd_query_device( device, 1);
+      }
+   }
+   else if (request->device != NULL && ! xbee_timer_pending( timer))
+   {
+      // callback kept the request without resending it, expire it
+      // again in a second
+      _xbee_cmd_set_timeout( request, 1000);
+   }
+}
+
 /**
    @brief
-   This function should be called periodically (at least every few seconds)
-   to expire old entries from the AT Command Request table.
+   Add requests to the pool used by xbee_cmd_create(), for applications
+   with more outstanding requests than XBEE_CMD_REQUEST_TABLESIZE (e.g.,
+   remote AT commands to hundreds of nodes).
 
-   @return  >0 number of requests expired
-   @return  0  none of the requests in the table expired
+   The pool starts with xbee_cmd_request_table, and can hold up to
+   XBEE_CMD_REQUEST_MAX requests.  Requests can't be removed from the pool.
+
+   @param[in]  block  Memory for \a count requests, which must remain valid
+                      for the life of the program.
+   @param[in]  count  Number of requests in \a block.
+
+   @retval  >0       Number of requests added (fewer than \a count if the
+                     pool reached XBEE_CMD_REQUEST_MAX).
+   @retval  -EINVAL  \a block is NULL or \a count is 0.
+   @retval  -ENOSPC  Pool already holds XBEE_CMD_REQUEST_MAX requests.
 */
 _xbee_atcmd_debug
-int xbee_cmd_tick( void)
+int xbee_cmd_request_pool_add( xbee_cmd_request_t FAR *block,
+   uint16_t count)
 {
-   static uint8_t             last_time;
-   uint8_t                    now;
-   uint_fast8_t               i;
-   int                        reuse;
-   xbee_cmd_request_t   FAR *request;
-   xbee_cmd_response_t        expired;
-   xbee_dev_t                 *device;
-   int                        count = 0;
-
-   // only process expirations once per second
-   now = (uint8_t) xbee_seconds_timer();
-   if (last_time == now)
+   xbee_cmd_pool_t *pool = &_xbee_cmd_pool;
+   uint16_t i;
+
+   if (block == NULL || count == 0)
    {
-      return 0;
+      return -EINVAL;
    }
-   last_time = now;
 
-   memset( &expired, 0, sizeof expired);
-   // set the timeout flag, but also make sure STATUS is invalid
-   expired.flags = XBEE_CMD_RESP_FLAG_TIMEOUT | XBEE_CMD_RESP_MASK_STATUS;
-   // walk through the table of requests, looking for expired entries
-   for (request = xbee_cmd_request_table, i = XBEE_CMD_REQUEST_TABLESIZE;
-      i; ++request, --i)
+   if (! _xbee_cmd_pool_ready)
    {
-      if (request->device && XBEE_CHECK_TIMEOUT_SEC(request->timeout))
+      _xbee_cmd_pool_ready = TRUE;
+      pool->count = pool->in_use = 0;
+      pool->free_head = XBEE_CMD_POOL_NONE;
+      xbee_cmd_request_pool_add( xbee_cmd_request_table,
+         XBEE_CMD_REQUEST_TABLESIZE);
+      if (block == xbee_cmd_request_table)
       {
-         ++count;
-         expired.handle =
-            ((XBEE_CMD_REQUEST_TABLESIZE - i) << 8) | request->sequence;
+         return XBEE_CMD_REQUEST_TABLESIZE;
+      }
+   }
 
-         #ifdef XBEE_ATCMD_VERBOSE
-            printf( "%s: request 0x%04x timed out\n", __FUNCTION__,
-               expired.handle);
-         #endif
-         reuse = XBEE_ATCMD_DONE;
-         if (request->callback)
-         {
-            expired.device = request->device;
-            expired.context = request->context;
-            expired.command.w = request->command.w;
-
-            #ifdef XBEE_ATCMD_VERBOSE
-               printf( "%s: dispatch to handler @%p w/context %" PRIpFAR "\n",
-                  __FUNCTION__, request->callback, expired.context);
-            #endif
-            reuse = request->callback( &expired);
-         }
-         if (reuse != XBEE_ATCMD_REUSE)
-         {
-            #ifdef XBEE_ATCMD_VERBOSE
-               printf( "%s: releasing expired request 0x%04x\n",
-                  __FUNCTION__, expired.handle);
-            #endif
-
-            device = request->device;
-            _xbee_cmd_release_request( request);
-            if (device->flags & XBEE_DEV_FLAG_QUERY_REFRESH)
-            {
-               // If we're waiting to refresh network settings due to a full
-               // command table, now's our chance since we just opened a slot.
-               xbee_cmd_query_device( device, 1);
-            }
-         }
+   if (count > XBEE_CMD_REQUEST_MAX - pool->count)
+   {
+      count = XBEE_CMD_REQUEST_MAX - pool->count;
+      if (count == 0)
+      {
+         return -ENOSPC;
       }
    }
 
+   _f_memset( block, 0, count * sizeof *block);
+
+   // push in reverse, so xbee_cmd_create() uses the block in order
+   for (i = count; i--; )
+   {
+      block[i].index = pool->count + i;
+      block[i].link = pool->free_head;
+      pool->entry[pool->count + i] = &block[i];
+      pool->free_head = block[i].index;
+   }
+   pool->count += count;
+
    return count;
 }
 
+/**
+   @internal
+   @brief
+   Take a request from the pool's free list.
+
+   With XBEE_CMD_REQUEST_GROW, adds requests to the pool if they're all in
+   use.  The request doesn't have a timeout until the first call to
+   _xbee_cmd_set_timeout().
+
+   @return  Free request, or NULL if all are in use.
+*/
+_xbee_atcmd_debug
+xbee_cmd_request_t FAR *_xbee_cmd_pool_alloc( void)
+{
+   xbee_cmd_pool_t *pool = &_xbee_cmd_pool;
+   xbee_cmd_request_t FAR *request;
+
+   if (! _xbee_cmd_pool_ready)
+   {
+      xbee_cmd_request_pool_add( xbee_cmd_request_table,
+         XBEE_CMD_REQUEST_TABLESIZE);
+   }
+
+#if XBEE_CMD_REQUEST_GROW
+   if (pool->free_head == XBEE_CMD_POOL_NONE
+      && pool->count < XBEE_CMD_REQUEST_MAX)
+   {
+      request = malloc( XBEE_CMD_REQUEST_GROW * sizeof *request);
+      if (request != NULL)
+      {
+         // never freed, requests stay in the pool
+         xbee_cmd_request_pool_add( request, XBEE_CMD_REQUEST_GROW);
+      }
+   }
+#endif
+
+   if (pool->free_head == XBEE_CMD_POOL_NONE)
+   {
+      return NULL;
+   }
+
+   request = pool->entry[pool->free_head];
+   pool->free_head = request->link;
+   request->link = XBEE_CMD_POOL_NONE;
+   ++pool->in_use;
+
+   return request;
+}
+
+/**
+   @internal
+   @brief
+   Return a request to the pool's free list, cancelling its timeout.
+   Called by _xbee_cmd_release_request().
+
+   @param[in]  request  Request from _xbee_cmd_pool_alloc().
+*/
+_xbee_atcmd_debug
+void _xbee_cmd_pool_free( xbee_cmd_request_t FAR *request)
+{
+   xbee_cmd_pool_t *pool = &_xbee_cmd_pool;
+
+   xbee_timer_cancel( &request->timer);
+   --pool->in_use;
+   request->link = pool->free_head;
+   pool->free_head = request->index;
+}
+
+/**
+   @internal
+   @brief
+   Set a request's timeout, on its device's timer wheel.
+
+   Also attaches the wheel for xbee_cmd_tick() and xbee_cmd_next_timeout().
+
+   @param[in]  request     Request in use (with \c device set).
+   @param[in]  timeout_ms  Milliseconds until the request expires.
+*/
+_xbee_atcmd_debug
+void _xbee_cmd_set_timeout( xbee_cmd_request_t FAR *request,
+   uint32_t timeout_ms)
+{
+   xbee_timer_wheel_t *wheel = &request->device->wpan_dev.timers;
+
+   if (request->timer.callback == NULL)
+   {
+      xbee_timer_init( &request->timer, _xbee_cmd_request_expired, request);
+   }
+   xbee_timer_start( wheel, &request->timer, timeout_ms);
+   xbee_timer_wheel_attach( wheel);
+}
+
+
+/*** BeginHeader xbee_cmd_tick */
+/*** EndHeader */
+/**
+   @brief
+   Expire old entries from the AT Command Request table.
+
+   Requests time out on their device's timer wheel, so xbee_dev_tick()
+   (and wpan_tick()) expire them as well.  This function runs the wheels of
+   every device with requests outstanding, for programs that don't tick
+   each device regularly.  Only looks at requests that have expired, so
+   the cost doesn't grow with the number of requests.
+
+   @return  >0 number of requests expired
+   @return  0  none of the requests in the table expired
+*/
+_xbee_atcmd_debug
+int xbee_cmd_tick( void)
+{
+   uint16_t before = _xbee_cmd_pool.expired;
+
+   xbee_timer_tick();
+
+   return (uint16_t) (_xbee_cmd_pool.expired - before);
+}
+
+/*** BeginHeader xbee_cmd_next_timeout */
+/*** EndHeader */
+/**
+   @brief
+   Report how long a program can wait before xbee_cmd_tick() needs to
+   expire an entry in the AT Command Request table.
+
+   Use with xbee_dev_wait() to sleep until the next frame arrives or a
+   request times out, instead of polling xbee_cmd_tick().  Also covers
+   other timeouts on the same devices' timer wheels.
+
+   @return  milliseconds until the next request expires (0 if one already
+            has), or XBEE_WAIT_FOREVER if there aren't any active requests
+*/
+_xbee_atcmd_debug
+int32_t xbee_cmd_next_timeout( void)
+{
+   return xbee_timer_next_timeout();
+}
+
+
 /*** BeginHeader _xbee_cmd_handle_to_address */
 xbee_cmd_request_t FAR *_xbee_cmd_handle_to_address( int16_t handle);
 /*** EndHeader */
@@ -170,14 +365,14 @@ xbee_cmd_request_t FAR *_xbee_cmd_handle_to_address( int16_t handle)
 {
    xbee_cmd_request_t FAR *request;
 
-   if (handle < 0 || handle >= (XBEE_CMD_REQUEST_TABLESIZE << 8))
+   if (handle < 0 || (handle >> XBEE_CMD_HANDLE_SHIFT) >= _xbee_cmd_pool.count)
    {
       return NULL;
    }
 
-   request = &xbee_cmd_request_table[handle >> 8];
+   request = _xbee_cmd_pool.entry[handle >> XBEE_CMD_HANDLE_SHIFT];
 
-   if (request->sequence != (handle & 0x00FF))
+   if ((request->sequence ^ handle) & XBEE_CMD_HANDLE_SEQ_MASK)
    {
       return NULL;
    }
@@ -187,33 +382,44 @@ xbee_cmd_request_t FAR *_xbee_cmd_handle_to_address( int16_t handle)
 
 
 
-/*** BeginHeader xbee_cmd_list_execute */
+/*** BeginHeader xbee_cmd_list_execute, xbee_cmd_list_execute_window,
+   _xbee_cmd_list_complete */
+void _xbee_cmd_list_complete( void FAR *base,
+                           const xbee_atcmd_reg_t FAR *reg,
+                           const xbee_cmd_response_t FAR *response
+                           );
 /*** EndHeader */
+int _xbee_cmd_list_callback( const xbee_cmd_response_t FAR *response);
+
+// slot in clc->slot[] for entry <entry> of the list
+#define _XBEE_CMD_LIST_SLOT(clc, entry)   \
+   (&(clc)->slot[(entry) % XBEE_CMD_LIST_WINDOW_MAX])
+
 /**   @internal
-   Helper function to send off the next command in the list.
+   Helper function to set up the request for entry \a entry of the list.
+
+   @param[in]  request  request to reuse, or -1 to create a new one
+
+   @return  handle of the request, or error from xbee_cmd_create()
 */
 _xbee_atcmd_debug
 int _xbee_cmd_issue_list( xbee_dev_t *xbee,
                            xbee_command_list_context_t FAR *clc,
-                           const xbee_cmd_response_t FAR *response
+                           uint16_t entry,
+                           int16_t request
                            )
 {
    uint8_t FAR    *devptr;
-   int16_t        request;
    uint32_t       param;
-   const xbee_atcmd_reg_t FAR *reg = clc->list + clc->index;
+   const xbee_atcmd_reg_t FAR *reg = clc->list + entry;
 
 #ifdef XBEE_ATCMD_VERBOSE
    printf( "%s: next command AT%c%c\n", __FUNCTION__,
          reg->command.str[0], reg->command.str[1]);
 #endif
-   if (response)
-   {
-      request = response->handle;
-   }
-   else
+   if (request < 0)
    {
-      request = xbee_cmd_create( xbee, clc->list->command.str);
+      request = xbee_cmd_create( xbee, reg->command.str);
       if (request < 0)
       {
 #ifdef XBEE_ATCMD_VERBOSE
@@ -222,6 +428,12 @@ int _xbee_cmd_issue_list( xbee_dev_t *xbee,
 #endif
          return request;
       }
+      if (clc->remote)
+      {
+         xbee_cmd_set_target( request, &clc->address.ieee,
+            clc->address.network);
+      }
+      xbee_cmd_set_callback( request, _xbee_cmd_list_callback, clc);
    }
 
    xbee_cmd_set_command( request, reg->command.str);
@@ -265,177 +477,415 @@ int _xbee_cmd_issue_list( xbee_dev_t *xbee,
 }
 
 /**   @internal
-   Callback used by xbee_cmd_query_device (and possibly other
-   functions) to learn about the attached XBee device
-   (hardware/firmware version, address, etc.)
+   Does list entry \a reg need every earlier entry to complete before it's
+   sent (and hold off the entries after it until it completes)?
 
-   View function help for xbee_cmd_set_callback() for details on
-   xbee_cmd_response_t structure.
-
-   *** This callback should only be called by xbee_cmd_handle_response(). ***
-*/
-/*
-   @todo Figure out timeouts for this table.
-      What if there's a timeout?  Should we resend or move on to the
-      next register to query? Currently, it halts the entire list.
+   XBEE_CLT_LAST entries complete as soon as they're sent.  Remote commands
+   can arrive out of order, so changes (and commands like WR and AC, listed
+   without a callback) to a remote node stay in order with everything else.
 */
 _xbee_atcmd_debug
-int _xbee_cmd_list_callback( const xbee_cmd_response_t FAR *response)
+bool_t _xbee_cmd_list_barrier( const xbee_command_list_context_t FAR *clc,
+                              const xbee_atcmd_reg_t FAR *reg)
 {
-   xbee_dev_t *xbee;
-   uint8_t FAR *devptr;
-   const xbee_atcmd_reg_t FAR *reg;
-   xbee_command_list_context_t FAR *clc = response->context;
+   if (reg->type == XBEE_CLT_LAST)
+   {
+      return TRUE;
+   }
+   if (! clc->remote)
+   {
+      return FALSE;
+   }
 
-   int16_t        request;
-   uint16_t       command;
-   int            count, offset;
+   switch (reg->type)
+   {
+      case XBEE_CLT_COPY:
+      case XBEE_CLT_COPY_PAD_LEFT:
+      case XBEE_CLT_COPY_BE:
+         return FALSE;
 
-   xbee = response->device;
+      case XBEE_CLT_NONE:
+         return reg->callback == NULL;
 
-   if (response->flags & XBEE_CMD_RESP_FLAG_TIMEOUT)
-   {
-#ifdef XBEE_ATCMD_VERBOSE
-       printf( "%s: timed out\n", __FUNCTION__);
-#endif
-      clc->status = XBEE_COMMAND_LIST_TIMEOUT;
-      // Find 'end handler' callback...
-      for (reg = clc->list; XBEE_ATCMD_REG_VALID(reg); ++reg) {
-         ;
-      }
-      if (reg->callback)
-      {
-         // A final callback was specified (via XBEE_ATCMD_REG_END_CB)
-#ifdef XBEE_ATCMD_VERBOSE
-         printf( "%s: found final callback\n", __FUNCTION__);
-#endif
-         reg->callback(response, reg, clc->base);
-      }
-      return XBEE_ATCMD_DONE;       // give up
+      default:
+         return TRUE;
    }
+}
+
+/**   @internal
+   Send entries from the list until \a clc->window of them are in flight.
 
-   request = response->handle;
-   command = response->command.w;
+   @param[in]     response   response being processed, or NULL when
+                              starting the list
+   @param[in,out] reuse      request to use for the first entry sent (set to
+                              -1 once used), or -1 to create requests; left
+                              unchanged if sending with it fails
 
-   reg = clc->list + clc->index;
+   @retval  0     sent entries, or waiting on entries in flight
+   @retval  <0    couldn't send the next entry and none are in flight
+*/
+_xbee_atcmd_debug
+int _xbee_cmd_list_fill( xbee_dev_t *xbee,
+                           xbee_command_list_context_t FAR *clc,
+                           const xbee_cmd_response_t FAR *response,
+                           int16_t *reuse
+                           )
+{
+   const xbee_atcmd_reg_t FAR *reg;
+   xbee_command_list_slot_t FAR *slot;
+   int16_t request;
+   int error;
 
-   // Basic sanity check that response was for the command we last issued
-   if (command == reg->command.w)
+   while ((uint16_t)(clc->issued - clc->index) < clc->window)
    {
-#ifdef XBEE_ATCMD_VERBOSE
-      printf( "%s: matched command result AT%c%c\n", __FUNCTION__,
-            reg->command.str[0],reg->command.str[1]);
-#endif
-      // found it in the list, copy the response if status is success
-      if ((response->flags & XBEE_CMD_RESP_MASK_STATUS)
-                                                == XBEE_AT_RESP_SUCCESS)
+      reg = clc->list + clc->issued;
+      if (! XBEE_ATCMD_REG_VALID(reg))
       {
-         // First do 'copy' action if specified, then do callback.
-         devptr = (uint8_t FAR *)clc->base + reg->offset;
-         switch (reg->type)
-         {
-            default:
-               // Was not a copy command.
-               break;
-            case XBEE_CLT_COPY:
-            case XBEE_CLT_COPY_PAD_LEFT:
-               // Zero out the field
-               _f_memset( devptr, 0, reg->bytes);
-
-               // Copy minimum of response length and receiving field length
-               count = response->value_length < reg->bytes ?
-                     response->value_length : reg->bytes;
-               // copy to start of devptr (XBEE_CLT_COPY) or end
-               // (XBEE_CLT_COPY_PAD_LEFT)
-               offset = reg->type == XBEE_CLT_COPY ? 0 : (reg->bytes - count);
-               _f_memcpy( devptr + offset, response->value_bytes, count);
-               break;
-            case XBEE_CLT_COPY_BE:
-               switch (reg->bytes)
-               {
-                  case 1:
-                     // Even though one byte doesn't technically need a
-                     // swap, support it here for convenience of truncating
-                     // a longer response value.
-                     *(uint8_t FAR *)devptr = (uint8_t) response->value;
-                     break;
-
-                  case 2:
-                     xbee_set_unaligned16( devptr, (uint16_t) response->value);
-                     break;
-
-                  case 4:
-                     xbee_set_unaligned32( devptr, (uint32_t) response->value);
-                     break;
-               }
-               break;
-         }
+         break;
       }
-      if (reg->callback)
+      if (clc->issued != clc->index
+         && (_xbee_cmd_list_barrier( clc, reg)
+            || _xbee_cmd_list_barrier( clc, reg - 1)))
       {
-         reg->callback(response, reg, clc->base);
+         // wait for the entries in flight to complete
+         break;
       }
-   }
-   else
-   {
-      // Command did not match
-      clc->status = XBEE_COMMAND_LIST_ERROR;
-      if (reg->callback)
-      {
-         // A final callback was specified (via XBEE_ATCMD_REG_END_CB)
-         // Call with NULL reg, since this is an error and doesn't
-         // correspond to any list entry.
-#ifdef XBEE_ATCMD_VERBOSE
-         printf( "%s: final callback (error proc)\n", __FUNCTION__);
+      if (*reuse < 0 && clc->issued != clc->index
+         && _xbee_cmd_pool.count - _xbee_cmd_pool.in_use < 2
+#if XBEE_CMD_REQUEST_GROW
+         && _xbee_cmd_pool.count >= XBEE_CMD_REQUEST_MAX
 #endif
-         reg->callback(response, NULL, clc->base);
+         )
+      {
+         // leave the last free request for other commands
+         break;
       }
-      #ifdef XBEE_ATCMD_VERBOSE
-         if (response->value_length <= 4)
-         {
-            printf( "%s: Unexpected response AT%.*" PRIsFAR \
-               " = 0x%0*" PRIX32 "\n",
-               __FUNCTION__, 2, response->command.str,
-               response->value_length * 2, response->value);
-         }
-         else
+
+      request = _xbee_cmd_issue_list( xbee, clc, clc->issued, *reuse);
+      if (request >= 0)
+      {
+         error = xbee_cmd_send( request);
+         if (error)
          {
-            printf( "%s: Unexpected %d-byte response to AT%.*" PRIsFAR "\n",
-               __FUNCTION__, response->value_length, 2, response->command.str);
+            // the caller releases a reused request
+            if (request != *reuse)
+            {
+               xbee_cmd_release_handle( request);
+            }
+            request = error;
          }
-      #endif
-      // Give up
-      return XBEE_ATCMD_DONE;
-   }
-
-   // Try next list entry
-   ++clc->index;
-   reg = clc->list + clc->index;
-   if (XBEE_ATCMD_REG_VALID(reg))
-   {
-      request = _xbee_cmd_issue_list( xbee, clc, response);
+      }
+      if (request < 0)
+      {
+         // try again as entries complete, unless there aren't any in flight
+         return clc->issued == clc->index ? request : 0;
+      }
 
-      xbee_cmd_send( request);
+      slot = _XBEE_CMD_LIST_SLOT( clc, clc->issued);
+      slot->handle = request;
+#if XBEE_CMD_LIST_WINDOW_MAX > 1
+      slot->state = XBEE_CMD_LIST_SLOT_SENT;
+#endif
+      ++clc->issued;
 
-      if (reg->type == XBEE_CLT_LAST)
+      if (response != NULL && reg->type == XBEE_CLT_LAST)
       {
-         // Last command, with no response processing, so release
-         // handle after sending.
-         xbee_cmd_release_handle( request);
+         // Last command, with no response processing, so it's done once
+         // it's sent.  Release its handle (or let the caller release it).
+         ++clc->index;
+         if (request != *reuse)
+         {
+            xbee_cmd_release_handle( request);
+         }
       }
       else
       {
-         return XBEE_ATCMD_REUSE;         // keep this request alive
+         *reuse = -1;
       }
    }
 
-   // Got through to end of list.
-#ifdef XBEE_ATCMD_VERBOSE
-   printf( "%s: done\n", __FUNCTION__);
-#endif
-   clc->status = XBEE_COMMAND_LIST_DONE;
-   if (reg->callback)
-   {
+   return 0;
+}
+
+/**   @internal
+   Stop processing a list, releasing its requests in flight (other than the
+   one for \a response) and calling its final callback.
+
+   @param[in]  status   XBEE_COMMAND_LIST_TIMEOUT or XBEE_COMMAND_LIST_ERROR
+                        (final callback gets a NULL reg for errors)
+*/
+_xbee_atcmd_debug
+void _xbee_cmd_list_end( xbee_command_list_context_t FAR *clc,
+                           const xbee_cmd_response_t FAR *response,
+                           enum xbee_command_list_status status
+                           )
+{
+   const xbee_atcmd_reg_t FAR *reg;
+   xbee_command_list_slot_t FAR *slot;
+   uint16_t entry;
+
+   clc->status = status;
+
+   for (entry = clc->index; entry != clc->issued; ++entry)
+   {
+      slot = _XBEE_CMD_LIST_SLOT( clc, entry);
+      if (slot->handle != response->handle
+#if XBEE_CMD_LIST_WINDOW_MAX > 1
+         && slot->state != XBEE_CMD_LIST_SLOT_READY
+#endif
+         )
+      {
+         xbee_cmd_release_handle( slot->handle);
+      }
+   }
+   clc->issued = clc->index;
+
+   // Find 'end handler' callback...
+   for (reg = clc->list; XBEE_ATCMD_REG_VALID(reg); ++reg) {
+      ;
+   }
+   if (reg->callback)
+   {
+      // A final callback was specified (via XBEE_ATCMD_REG_END_CB)
+#ifdef XBEE_ATCMD_VERBOSE
+      printf( "%s: found final callback\n", __FUNCTION__);
+#endif
+      reg->callback( response,
+         status == XBEE_COMMAND_LIST_ERROR ? NULL : reg, clc->base);
+   }
+}
+
+/**   @internal
+   Process the response for list entry \a reg: copy its value to the list's
+   \a base structure (according to reg->type) and then call its callback.
+*/
+_xbee_atcmd_debug
+void _xbee_cmd_list_complete( void FAR *base,
+                           const xbee_atcmd_reg_t FAR *reg,
+                           const xbee_cmd_response_t FAR *response
+                           )
+{
+   uint8_t FAR *devptr;
+   int            count, offset;
+
+#ifdef XBEE_ATCMD_VERBOSE
+   printf( "%s: matched command result AT%c%c\n", __FUNCTION__,
+         reg->command.str[0],reg->command.str[1]);
+#endif
+   // copy the response if status is success
+   if ((response->flags & XBEE_CMD_RESP_MASK_STATUS)
+                                             == XBEE_AT_RESP_SUCCESS)
+   {
+      // First do 'copy' action if specified, then do callback.
+      devptr = (uint8_t FAR *)base + reg->offset;
+      switch (reg->type)
+      {
+         default:
+            // Was not a copy command.
+            break;
+         case XBEE_CLT_COPY:
+         case XBEE_CLT_COPY_PAD_LEFT:
+            // Zero out the field
+            _f_memset( devptr, 0, reg->bytes);
+
+            // Copy minimum of response length and receiving field length
+            count = response->value_length < reg->bytes ?
+                  response->value_length : reg->bytes;
+            // copy to start of devptr (XBEE_CLT_COPY) or end
+            // (XBEE_CLT_COPY_PAD_LEFT)
+            offset = reg->type == XBEE_CLT_COPY ? 0 : (reg->bytes - count);
+            _f_memcpy( devptr + offset, response->value_bytes, count);
+            break;
+         case XBEE_CLT_COPY_BE:
+            switch (reg->bytes)
+            {
+               case 1:
+                  // Even though one byte doesn't technically need a
+                  // swap, support it here for convenience of truncating
+                  // a longer response value.
+                  *(uint8_t FAR *)devptr = (uint8_t) response->value;
+                  break;
+
+               case 2:
+                  xbee_set_unaligned16( devptr, (uint16_t) response->value);
+                  break;
+
+               case 4:
+                  xbee_set_unaligned32( devptr, (uint32_t) response->value);
+                  break;
+            }
+            break;
+      }
+   }
+   if (reg->callback)
+   {
+      reg->callback(response, reg, base);
+   }
+}
+
+/**   @internal
+   Callback used by xbee_cmd_query_device (and possibly other
+   functions) to learn about the attached XBee device
+   (hardware/firmware version, address, etc.)
+
+   Entries complete in list order: a response that arrives before the
+   responses to earlier entries is saved in its slot until they complete.
+
+   View function help for xbee_cmd_set_callback() for details on
+   xbee_cmd_response_t structure.
+
+   *** This callback should only be called by xbee_cmd_handle_response(). ***
+*/
+/*
+   @todo Figure out timeouts for this table.
+      What if there's a timeout?  Should we resend or move on to the
+      next register to query? Currently, it halts the entire list.
+*/
+_xbee_atcmd_debug
+int _xbee_cmd_list_callback( const xbee_cmd_response_t FAR *response)
+{
+   xbee_dev_t *xbee;
+   const xbee_atcmd_reg_t FAR *reg;
+   xbee_command_list_context_t FAR *clc = response->context;
+   xbee_command_list_slot_t FAR *slot;
+   uint16_t       entry;
+   int16_t        reuse;
+#if XBEE_CMD_LIST_WINDOW_MAX > 1
+   xbee_cmd_response_t saved;
+#endif
+
+   xbee = response->device;
+
+   if (clc->status != XBEE_COMMAND_LIST_RUNNING)
+   {
+      // list already stopped
+      return XBEE_ATCMD_DONE;
+   }
+
+   if (response->flags & XBEE_CMD_RESP_FLAG_TIMEOUT)
+   {
+#ifdef XBEE_ATCMD_VERBOSE
+       printf( "%s: timed out\n", __FUNCTION__);
+#endif
+      _xbee_cmd_list_end( clc, response, XBEE_COMMAND_LIST_TIMEOUT);
+      return XBEE_ATCMD_DONE;       // give up
+   }
+
+   // find the entry in flight that the response is for
+   for (entry = clc->index; entry != clc->issued; ++entry)
+   {
+      slot = _XBEE_CMD_LIST_SLOT( clc, entry);
+      if (slot->handle == response->handle
+#if XBEE_CMD_LIST_WINDOW_MAX > 1
+         && slot->state == XBEE_CMD_LIST_SLOT_SENT
+#endif
+         )
+      {
+         break;
+      }
+   }
+   reg = clc->list + entry;
+
+   // Basic sanity check that response was for a command we issued
+   if (entry == clc->issued || response->command.w != reg->command.w)
+   {
+      #ifdef XBEE_ATCMD_VERBOSE
+         if (response->value_length <= 4)
+         {
+            printf( "%s: Unexpected response AT%.*" PRIsFAR \
+               " = 0x%0*" PRIX32 "\n",
+               __FUNCTION__, 2, response->command.str,
+               response->value_length * 2, response->value);
+         }
+         else
+         {
+            printf( "%s: Unexpected %d-byte response to AT%.*" PRIsFAR "\n",
+               __FUNCTION__, response->value_length, 2, response->command.str);
+         }
+      #endif
+      // Give up
+      _xbee_cmd_list_end( clc, response, XBEE_COMMAND_LIST_ERROR);
+      return XBEE_ATCMD_DONE;
+   }
+
+#if XBEE_CMD_LIST_WINDOW_MAX > 1
+   if (entry != clc->index)
+   {
+      // Earlier entries are still in flight, hold on to the response.
+      if (response->value_length > XBEE_CMD_LIST_VALUE_MAX)
+      {
+         slot->state = XBEE_CMD_LIST_SLOT_RESEND;
+         return XBEE_ATCMD_REUSE;
+      }
+      slot->state = XBEE_CMD_LIST_SLOT_READY;
+      slot->flags = response->flags;
+      slot->value = response->value;
+      slot->value_length = (uint8_t) response->value_length;
+      _f_memcpy( slot->value_bytes, response->value_bytes,
+         response->value_length);
+      return XBEE_ATCMD_DONE;
+   }
+#endif
+
+   _xbee_cmd_list_complete( clc->base, reg, response);
+   ++clc->index;
+   reuse = response->handle;
+
+#if XBEE_CMD_LIST_WINDOW_MAX > 1
+   // complete entries that were waiting on this one
+   saved = *response;
+   while (clc->index != clc->issued)
+   {
+      slot = _XBEE_CMD_LIST_SLOT( clc, clc->index);
+      if (slot->state == XBEE_CMD_LIST_SLOT_RESEND)
+      {
+         slot->state = XBEE_CMD_LIST_SLOT_SENT;
+         xbee_cmd_send( slot->handle);
+      }
+      if (slot->state != XBEE_CMD_LIST_SLOT_READY)
+      {
+         break;
+      }
+      reg = clc->list + clc->index;
+      saved.handle = slot->handle;
+      saved.command.w = reg->command.w;
+      saved.flags = slot->flags;
+      saved.value = slot->value;
+      saved.value_length = slot->value_length;
+      saved.value_bytes = slot->value_bytes;
+      response = &saved;
+      _xbee_cmd_list_complete( clc->base, reg, response);
+      ++clc->index;
+   }
+#endif
+
+   // widen the window as responses come back (see xbee_cmd_list_execute())
+   if (clc->window < clc->window_limit)
+   {
+      ++clc->window;
+   }
+
+   // Try next list entries
+   if (_xbee_cmd_list_fill( xbee, clc, response, &reuse) < 0)
+   {
+      // couldn't send the next entry, and nothing left in flight
+      _xbee_cmd_list_end( clc, response, XBEE_COMMAND_LIST_ERROR);
+      return XBEE_ATCMD_DONE;
+   }
+   if (clc->index != clc->issued)
+   {
+      // keep this request alive if it was used for the next entry
+      return reuse < 0 ? XBEE_ATCMD_REUSE : XBEE_ATCMD_DONE;
+   }
+
+   // Got through to end of list.
+#ifdef XBEE_ATCMD_VERBOSE
+   printf( "%s: done\n", __FUNCTION__);
+#endif
+   clc->status = XBEE_COMMAND_LIST_DONE;
+   reg = clc->list + clc->index;
+   if (reg->callback)
+   {
       // A final callback was specified (via XBEE_ATCMD_REG_END_CB)
 #ifdef XBEE_ATCMD_VERBOSE
       printf( "%s: final callback\n", __FUNCTION__);
@@ -453,6 +903,11 @@ int _xbee_cmd_list_callback( const xbee_cmd_response_t FAR *response)
    @brief
    Execute a list of AT commands.
 
+   Same as xbee_cmd_list_execute_window() with a \a window of 0: commands
+   to the local XBee use a window of XBEE_CMD_LIST_WINDOW_LOCAL, and
+   commands to a remote node use a window that starts at 1 and grows to
+   XBEE_CMD_LIST_WINDOW_REMOTE as responses arrive.
+
    @param[in,out] xbee Device to execute commands
    @param[out] clc   List head to set up.  This must be static since callback
                      functions access it asynchronously.
@@ -480,25 +935,88 @@ int xbee_cmd_list_execute(
          const wpan_address_t FAR *address
          )
 {
-   int16_t request;
+   return xbee_cmd_list_execute_window( xbee, clc, list, base, address, 0);
+}
+
+/**
+   @brief
+   Execute a list of AT commands, keeping up to \a window of them in
+   flight.
+
+   Entries complete (copying values to \a base and calling their callbacks)
+   in list order, even if responses arrive out of order.  XBEE_CLT_LAST
+   entries wait for the entries before them to complete.  For remote
+   nodes, so do changes (XBEE_CLT_SET* entries) and entries without a
+   callback or copy (e.g., WR and AC), and entries after them wait for them
+   to complete.
+
+   @param[in,out] xbee Device to execute commands
+   @param[out] clc   List head to set up.  This must be static since callback
+                     functions access it asynchronously.
+   @param[in]  list  First entry of list of commands to execute (see
+                     xbee_cmd_list_execute()).
+   @param[in]  base  Base address of a structure to fill in with command
+                     results or as a source of values to set.
+   @param[in]  address Remote address, or NULL if local device.
+   @param[in]  window Maximum number of commands in flight (limited to
+                     XBEE_CMD_LIST_WINDOW_MAX), or 0 to pick a window based
+                     on \a address (see xbee_cmd_list_execute()).
+
+   @retval  0  started sending commands from the list
+   @retval  -ENOSPC  the AT command table is full
+   @retval  -EINVAL  an invalid parameter was passed to the function
+
+   @see  xbee_cmd_list_status()
+*/
+_xbee_atcmd_debug
+int xbee_cmd_list_execute_window(
+         xbee_dev_t *xbee,
+         xbee_command_list_context_t FAR *clc,
+         const xbee_atcmd_reg_t FAR *list,
+         void FAR *base,
+         const wpan_address_t FAR *address,
+         uint_fast8_t window
+         )
+{
+   int16_t reuse = -1;
    int error;
 
+   if (xbee == NULL || clc == NULL || list == NULL)
+   {
+      return -EINVAL;
+   }
+
    clc->base = base;
    clc->list = list;
    clc->status = XBEE_COMMAND_LIST_RUNNING;
-   clc->index = 0;
-   request = _xbee_cmd_issue_list( xbee, clc, NULL);
-   if (request < 0)
+   clc->index = clc->issued = 0;
+   clc->remote = (address != NULL);
+   if (address)
    {
-      return request;
+      clc->address = *address;
    }
-   if (address)
+
+   if (window == 0)
+   {
+      // a remote node's route may be slow or congested, ramp up to the limit
+      clc->window_limit = address ? XBEE_CMD_LIST_WINDOW_REMOTE
+                                  : XBEE_CMD_LIST_WINDOW_LOCAL;
+      clc->window = address ? 1 : clc->window_limit;
+   }
+   else
    {
-      xbee_cmd_set_target(request, &address->ieee, address->network);
+      clc->window = clc->window_limit = (uint8_t)
+         (window < XBEE_CMD_LIST_WINDOW_MAX ? window
+                                            : XBEE_CMD_LIST_WINDOW_MAX);
+   }
+
+   error = _xbee_cmd_list_fill( xbee, clc, NULL, &reuse);
+   if (error)
+   {
+      clc->status = XBEE_COMMAND_LIST_ERROR;
    }
-   error = xbee_cmd_set_callback( request, _xbee_cmd_list_callback, clc);
 
-   return error ? error : xbee_cmd_send( request);
+   return error;
 }
 
 /*** BeginHeader xbee_cmd_list_status */
@@ -575,6 +1093,8 @@ int xbee_cmd_init_device( xbee_dev_t *xbee)
 
 /*** BeginHeader xbee_cmd_query_device, xbee_cmd_query_status */
 /*** EndHeader */
+uint32_t _xbee_cmd_decode_value( const uint8_t FAR *value,
+   uint_fast8_t length);
 
 _xbee_atcmd_debug
 void _xbee_cmd_query_handle_eo(
@@ -739,11 +1259,63 @@ xbee_command_list_context_t _xbee_atcmd_query_regs_head;
    #define XBEE_ATCMD_REG_REFRESH_IDX  7
 #endif
 
+/**   @internal
+   Copy values for the leading copy-only entries of _xbee_atcmd_query_regs
+   (hardware and firmware versions, serial number, ...) from the AT
+   parameter cache to \a xbee, so a repeated query (e.g., after an error)
+   only sends the rest.  The cache drops the local XBee's values when it
+   resets.
+
+   @param[in,out] xbee  XBee device to query.
+
+   @return  Index of the first entry to send.
+*/
+_xbee_atcmd_debug
+uint_fast8_t _xbee_cmd_query_cached( xbee_dev_t *xbee)
+{
+#if XBEE_CMD_CACHE_SIZE
+   const xbee_atcmd_reg_t FAR *reg;
+   xbee_cmd_response_t response;
+   uint8_t value[XBEE_CMD_CACHE_VALUE_MAX];
+   int length;
+
+   memset( &response, 0, sizeof response);
+   response.device = xbee;
+   response.handle = -1;
+   response.flags = XBEE_AT_RESP_SUCCESS | XBEE_CMD_RESP_FLAG_CACHED;
+   response.value_bytes = value;
+   for (reg = _xbee_atcmd_query_regs;
+      XBEE_ATCMD_REG_VALID( reg) && reg->callback == NULL; ++reg)
+   {
+      length = xbee_cmd_cache_get( xbee, NULL, reg->command.str,
+         XBEE_CMD_CACHE_TTL, value, sizeof value);
+      if (length < 0)
+      {
+         break;
+      }
+      response.command.w = reg->command.w;
+      response.value_length = (uint8_t) length;
+      response.value = _xbee_cmd_decode_value( value, (uint8_t) length);
+      _xbee_cmd_list_complete( xbee, reg, &response);
+   }
+
+   return (uint_fast8_t) (reg - _xbee_atcmd_query_regs);
+#else
+   XBEE_UNUSED_PARAMETER( xbee);
+
+   return 0;
+#endif
+}
+
 /**
    @brief
    Learn about the underlying device by sending a series of
    commands and storing the results in the xbee_dev_t.
 
+   Values that can't change until the XBee resets (e.g., its serial
+   number) come from the AT parameter cache if they're still there from an
+   earlier query (see xbee_cmd_cache_read()).
+
    This function will likely get called by the XBee stack
    at some point in the startup/initialization phase.
 
@@ -790,6 +1362,11 @@ int xbee_cmd_query_device( xbee_dev_t *xbee, uint_fast8_t refresh)
       return 0;
    }
 
+   if (! refresh)
+   {
+      refresh = _xbee_cmd_query_cached( xbee);
+   }
+
    error = xbee_cmd_list_execute(xbee,
                            &_xbee_atcmd_query_regs_head,
                            _xbee_atcmd_query_regs + refresh,
@@ -869,8 +1446,7 @@ int xbee_cmd_query_status( xbee_dev_t *xbee)
 _xbee_atcmd_debug
 int16_t xbee_cmd_create( xbee_dev_t *xbee, const char FAR command[3])
 {
-   static uint8_t initialized = 0;
-   int_fast8_t index;
+   static uint8_t retrying = 0;
    int16_t handle;
    xbee_cmd_request_t FAR *request;
 
@@ -879,53 +1455,39 @@ int16_t xbee_cmd_create( xbee_dev_t *xbee, const char FAR command[3])
       return -EINVAL;
    }
 
-   if (! initialized)
-   {
-      initialized = 1;
-      _f_memset( xbee_cmd_request_table, 0, sizeof(xbee_cmd_request_table));
-   }
-
    if (! (xbee->flags & XBEE_DEV_FLAG_CMD_INIT))
    {
       // user hasn't called xbee_cmd_init() yet, do it for them
       xbee_cmd_init_device( xbee);
    }
 
-   request = xbee_cmd_request_table;
-   for (index = 0; index < XBEE_CMD_REQUEST_TABLESIZE; ++request, ++index)
-   {
-      if (request->device == NULL)
-      {
-         break;
-      }
-   }
-
-   if (index == XBEE_CMD_REQUEST_TABLESIZE)
+   request = _xbee_cmd_pool_alloc();
+   if (request == NULL)
    {
-      // all slots in table are in use
+      // all requests in the pool are in use
 
-      // re-use `initialized` static to limit recursion
-      if (initialized != 2)
+      // limit recursion
+      if (! retrying)
       {
-         initialized = 2;
+         retrying = 1;
          xbee_cmd_tick();     // try to free up a slot
          handle = xbee_cmd_create( xbee, command);
-         initialized = 1;
+         retrying = 0;
 
          return handle;
       }
       return -ENOSPC;
    }
 
-   handle = (index << 8) | request->sequence;
+   handle = XBEE_CMD_REQUEST_HANDLE( request);
 
-   // clear out most of the entry (preserve sequence)
-   _f_memset( &request->timeout, 0,
-               sizeof(*request) - offsetof(xbee_cmd_request_t, timeout));
+   // clear out most of the entry (preserve sequence, index and link)
+   _f_memset( &request->timer, 0,
+               sizeof(*request) - offsetof(xbee_cmd_request_t, timer));
 
    request->device = xbee;
    // allow 2 seconds to finish building command and successfully send it
-   request->timeout = XBEE_SET_TIMEOUT_SEC(2);
+   _xbee_cmd_set_timeout( request, 2000);
    request->command.w = xbee_get_unaligned16( command);
 
    return handle;
@@ -962,8 +1524,24 @@ int _xbee_cmd_release_request( xbee_cmd_request_t FAR *request)
       return -EINVAL;
    }
 
+   if (request->device == NULL)
+   {
+      // already released
+      return 0;
+   }
+
+#if XBEE_DEV_FRAME_ID_TRACKING
+   if (request->frame_id != 0)
+   {
+      // stop routing responses to this request
+      xbee_frame_id_release( request->device, request->frame_id);
+   }
+   request->frame_id = 0;
+#endif
+
    request->device = NULL;       // free up entry in the table
    ++request->sequence;          // alter sequence to expire old handles
+   _xbee_cmd_pool_free( request);
 
    return 0;
 }
@@ -1180,6 +1758,45 @@ uint8_t _xbee_cmd_encode_param( void FAR *buffer, uint32_t value)
 }
 
 
+/*** BeginHeader _xbee_cmd_decode_value */
+uint32_t _xbee_cmd_decode_value( const uint8_t FAR *value,
+   uint_fast8_t length);
+/*** EndHeader */
+/**
+   @internal
+   @brief
+   Convert an AT response's value to the \c value member of an
+   xbee_cmd_response_t.
+
+   @param[in]  value    value from the response
+   @param[in]  length   bytes at \a value
+
+   @return  0 for empty values, the value in host byte order for 1, 2 and
+            4-byte values, or 0xFFFFFFFF for other lengths
+*/
+_xbee_atcmd_debug
+uint32_t _xbee_cmd_decode_value( const uint8_t FAR *value,
+   uint_fast8_t length)
+{
+   switch (length)
+   {
+      case 0:
+         return 0;
+
+      case 1:
+         return value[0];
+
+      case 2:
+         return be16toh( xbee_get_unaligned16( value));
+
+      case 4:
+         return be32toh( xbee_get_unaligned32( value));
+   }
+
+   return 0xFFFFFFFF;
+}
+
+
 /*** BeginHeader xbee_cmd_set_flags */
 /*** EndHeader */
 /**
@@ -1394,6 +2011,8 @@ int xbee_cmd_set_param_str( int16_t handle, const char FAR *str)
    @retval  -EINVAL  handle is not valid
    @retval  -EBUSY   transmit serial buffer is full, or XBee is not accepting
                      serial data (deasserting /CTS signal).
+   @retval  -ENOSPC  all 255 frame IDs are in flight (only with
+                     XBEE_DEV_FRAME_ID_TRACKING)
 
    @note If the request does not have a callback set, it will be automatically
          released if xbee_cmd_send() returns 0.
@@ -1416,17 +2035,37 @@ int xbee_cmd_send( int16_t handle)
       return -EINVAL;
    }
 
-   if (! request->callback)
+#if XBEE_DEV_FRAME_ID_TRACKING
+   if (request->frame_id != 0)
    {
-      // Nothing cares about the response, so use Frame ID 0 so the target
-      // device won't send a response.
+      // resending, responses to the last frame ID are no longer expected
+      xbee_frame_id_release( request->device, request->frame_id);
       request->frame_id = 0;
    }
-   else
+#endif
+
+   if (! request->callback)
    {
+      // Nothing cares about the response, so use Frame ID 0 so the target
+      // device won't send a response.
+      request->frame_id = 0;
+   }
+   else
+   {
+#if XBEE_DEV_FRAME_ID_TRACKING
+      // route responses straight to this request, without searching the table
+      error = xbee_frame_id_alloc( request->device, _xbee_cmd_handle_response,
+         request, 0);
+      if (error < 0)
+      {
+         return error;
+      }
+      request->frame_id = (uint8_t) error;
+#else
       // set the request's frame ID
       // DEVNOTE: What if this is a resend?  Should we keep the same frame ID?
       request->frame_id = (uint8_t) xbee_next_frame_id( request->device);
+#endif
    }
 
 #ifndef XBEE_CMD_DISABLE_REMOTE
@@ -1466,15 +2105,22 @@ int xbee_cmd_send( int16_t handle)
 
    if (! error)
    {
+#if XBEE_CMD_CACHE_SIZE
+      _xbee_cmd_cache_written( request->device,
+#ifndef XBEE_CMD_DISABLE_REMOTE
+         (request->flags & XBEE_CMD_FLAG_REMOTE) ? &request->address.ieee :
+#endif
+         NULL, request->command.w, request->param_length != 0);
+#endif
       if (request->frame_id != 0)
       {
          // we're expecting a response, so update the timeout value
-         request->timeout =
+         _xbee_cmd_set_timeout( request, UINT32_C(1000) *
 #ifdef XBEE_CMD_DISABLE_REMOTE
-            XBEE_SET_TIMEOUT_SEC( XBEE_CMD_LOCAL_TIMEOUT);
+            XBEE_CMD_LOCAL_TIMEOUT);
 #else
-            XBEE_SET_TIMEOUT_SEC( request->flags & XBEE_CMD_FLAG_REMOTE
-                  ? XBEE_CMD_REMOTE_TIMEOUT : XBEE_CMD_LOCAL_TIMEOUT);
+            (request->flags & XBEE_CMD_FLAG_REMOTE
+                  ? XBEE_CMD_REMOTE_TIMEOUT : XBEE_CMD_LOCAL_TIMEOUT));
 #endif
       }
       else if (! (request->flags & XBEE_CMD_FLAG_REUSE_HANDLE))
@@ -1498,7 +2144,9 @@ int xbee_cmd_send( int16_t handle)
    #XBEE_FRAME_LOCAL_AT_RESPONSE (0x88) and
    #XBEE_FRAME_REMOTE_AT_RESPONSE (0x97).
 
-   Should only be called by the frame dispatcher and unit tests.
+   Should only be called by the frame dispatcher and unit tests.  With
+   XBEE_DEV_FRAME_ID_TRACKING, xbee_cmd_send() registers this handler for
+   each request's frame ID, with the request as \a context.
 
    See the function help for xbee_frame_handler_fn() for full
    documentation on this function's API.
@@ -1517,7 +2165,7 @@ int _xbee_cmd_handle_response( xbee_dev_t *xbee, const void FAR *rawframe,
    bool_t is_local;
    uint8_t status, frame_id;
 
-   uint_fast8_t index;
+   uint_fast16_t index, last;
    xbee_cmd_request_t FAR *request;
 
    wpan_address_t sender;
@@ -1531,9 +2179,6 @@ int _xbee_cmd_handle_response( xbee_dev_t *xbee, const void FAR *rawframe,
       uint16_t i;
    #endif
 
-   // standard frame handler API, but we don't make use of context
-   XBEE_UNUSED_PARAMETER( context);
-
    if (frame == NULL)
    {
       // extra checking, since stack always passes a valid frame
@@ -1570,10 +2215,22 @@ int _xbee_cmd_handle_response( xbee_dev_t *xbee, const void FAR *rawframe,
    // local.frame_id and remote.frame_id are at the same offset in the struct
    frame_id = frame->local.header.frame_id;
 
-   // Look for the frame in the table of pending requests.
-   request = xbee_cmd_request_table;
-   for (index = 0; index < XBEE_CMD_REQUEST_TABLESIZE; ++request, ++index)
+   if (context != NULL)
+   {
+      // routed by frame ID (see xbee_cmd_send()), only check that request
+      request = context;
+      index = request->index;
+      last = index + 1;
+   }
+   else
+   {
+      // Look for the frame in the pool of pending requests.
+      index = 0;
+      last = _xbee_cmd_pool.count;
+   }
+   for (; index < last; ++index)
    {
+      request = _xbee_cmd_pool.entry[index];
       // Match device, frame_id, command and local/remote
       if (request->device == xbee &&            // sent on this device
          request->frame_id == frame_id &&       // frame ID matches
@@ -1586,7 +2243,7 @@ int _xbee_cmd_handle_response( xbee_dev_t *xbee, const void FAR *rawframe,
       }
    }
 
-   if (index == XBEE_CMD_REQUEST_TABLESIZE)
+   if (index == last)
    {
       // didn't find request in table
       #ifdef XBEE_ATCMD_VERBOSE
@@ -1613,14 +2270,24 @@ int _xbee_cmd_handle_response( xbee_dev_t *xbee, const void FAR *rawframe,
    }
 
    #ifdef XBEE_ATCMD_VERBOSE
-      printf( "%s: response matched request %d\n", __FUNCTION__, index);
+      printf( "%s: response matched request %d\n", __FUNCTION__, (int) index);
    #endif
 
+#if XBEE_CMD_CACHE_SIZE
+   if (! is_local)
+   {
+      sender.ieee = frame->remote.header.ieee_address;
+   }
+   _xbee_cmd_cache_update( request, is_local ? NULL : &sender.ieee, status,
+      value, value_length);
+#endif
+
    // build response to pass to callback
    if (! request->callback)
    {
       #ifdef XBEE_ATCMD_VERBOSE
-         printf( "%s: no callback registered for %d\n", __FUNCTION__, index);
+         printf( "%s: no callback registered for %d\n", __FUNCTION__,
+            (int) index);
       #endif
    }
    else
@@ -1637,36 +2304,12 @@ int _xbee_cmd_handle_response( xbee_dev_t *xbee, const void FAR *rawframe,
       }
       response.device = xbee;
       response.context = request->context;
-      response.handle = (index << 8) | request->sequence;
+      response.handle = XBEE_CMD_REQUEST_HANDLE( request);
       response.command.w = request->command.w;
       response.flags = status;
       response.value_bytes = value;
       response.value_length = value_length;
-      if (value_length == 0)
-      {
-         response.value = 0;
-      }
-      else
-      {
-         switch (value_length)
-         {
-            case 1:
-               response.value = value[0];
-               break;
-
-            case 2:
-               response.value = be16toh( xbee_get_unaligned16( value));
-               break;
-
-            case 4:
-               response.value = be32toh( xbee_get_unaligned32( value));
-               break;
-
-            default:
-               response.value = 0xFFFFFFFF;
-               break;
-         }
-      }
+      response.value = _xbee_cmd_decode_value( value, value_length);
 
       #ifdef XBEE_ATCMD_VERBOSE
          printf( "%s: dispatch to handler @%p w/context %" PRIpFAR "\n",
@@ -1676,7 +2319,7 @@ int _xbee_cmd_handle_response( xbee_dev_t *xbee, const void FAR *rawframe,
       if (request->callback( &response) == XBEE_ATCMD_REUSE)
       {
          // keep the request alive (possibly resent by the callback)
-         request->timeout = XBEE_SET_TIMEOUT_SEC(5);
+         _xbee_cmd_set_timeout( request, 5000);
          return 0;
       }
    }
@@ -1696,7 +2339,8 @@ int _xbee_cmd_handle_response( xbee_dev_t *xbee, const void FAR *rawframe,
    @internal
    @brief
    Receive modem status frames and update our network address (and payload
-   size) on state changes.
+   size) on state changes.  Drops the local XBee's cached AT parameters
+   (see xbee_cmd_cache_read()) after a reset.
 
    @see xbee_frame_handler_fn()
 */
@@ -1716,6 +2360,14 @@ int _xbee_cmd_modem_status( xbee_dev_t *xbee,
    }
 
    status = ((const xbee_frame_modem_status_t FAR *)payload)->status;
+#if XBEE_CMD_CACHE_SIZE
+   if (status == XBEE_MODEM_STATUS_HW_RESET ||
+      status == XBEE_MODEM_STATUS_WATCHDOG)
+   {
+      // XBee restarted, so settings may have reverted to saved values
+      xbee_cmd_cache_invalidate( xbee, NULL, NULL);
+   }
+#endif
    if (status == XBEE_MODEM_STATUS_KEY_ESTABLISHED ||
       status == XBEE_MODEM_STATUS_JOINED ||
       status == XBEE_MODEM_STATUS_COORD_START)
@@ -1787,6 +2439,10 @@ int xbee_cmd_simple( xbee_dev_t *xbee, const char FAR command[3],
                                           __FUNCTION__, command, value, value);
    #endif
 
+#if XBEE_CMD_CACHE_SIZE
+   _xbee_cmd_cache_written( xbee, NULL, request.header.command.w, TRUE);
+#endif
+
    return xbee_frame_write( xbee, &request, request_size, NULL, 0,
                                                       XBEE_DEV_FLAG_NONE);
 }
@@ -1839,6 +2495,11 @@ int xbee_cmd_execute( xbee_dev_t *xbee, const char FAR command[3],
                                     __FUNCTION__, command, request.frame_id);
    #endif
 
+#if XBEE_CMD_CACHE_SIZE
+   _xbee_cmd_cache_written( xbee, NULL, request.command.w,
+      data != NULL && length != 0);
+#endif
+
    return xbee_frame_write( xbee, &request, sizeof(request), data, length,
                                                       XBEE_DEV_FLAG_NONE);
 }
@@ -1859,4 +2520,858 @@ void xbee_identify( xbee_dev_t *xbee, bool_t identify)
 }
 
 
+/*** BeginHeader xbee_cmd_negotiate_baudrate */
+/*** EndHeader */
+// Standard ATBD values 0 to 0x0A; other rates are set with their raw value.
+static const uint32_t FAR _xbee_cmd_baud_std[] = {
+   1200, 2400, 4800, 9600, 19200, 38400, 57600, 115200,
+   230400, 460800, 921600
+};
+
+// Result of an ATBD request, filled in by _xbee_cmd_baud_response().
+typedef struct _xbee_cmd_baud_wait_t {
+   bool_t      done;
+   uint16_t    flags;
+   uint32_t    value;
+} _xbee_cmd_baud_wait_t;
+
+static int _xbee_cmd_baud_response( const xbee_cmd_response_t FAR *response)
+{
+   _xbee_cmd_baud_wait_t FAR *wait = response->context;
+
+   wait->flags = response->flags;
+   wait->value = response->value;
+   wait->done = TRUE;
+
+   return XBEE_ATCMD_DONE;
+}
+
+// Send ATBD, setting it to <param> if <set> is TRUE, and tick the device
+// until the response arrives or <timeout_ms> elapses.  Returns 0 and stores
+// the response's value in <*value> (if not NULL), -ETIMEDOUT, -EIO if the
+// XBee rejected the command, or an error from xbee_cmd_create()/send().
+static int _xbee_cmd_baud_request( xbee_dev_t *xbee, bool_t set,
+   uint32_t param, uint32_t *value, uint16_t timeout_ms)
+{
+   _xbee_cmd_baud_wait_t wait;
+   int16_t handle;
+   uint32_t start, elapsed;
+   int error;
+
+   handle = xbee_cmd_create( xbee, "BD");
+   if (handle < 0)
+   {
+      return handle;
+   }
+
+   wait.done = FALSE;
+   xbee_cmd_set_callback( handle, _xbee_cmd_baud_response, &wait);
+   if (set)
+   {
+      xbee_cmd_set_param( handle, param);
+   }
+   error = xbee_cmd_send( handle);
+   if (error)
+   {
+      xbee_cmd_release_handle( handle);
+      return error;
+   }
+
+   start = xbee_millisecond_timer();
+   while (! wait.done)
+   {
+      elapsed = xbee_millisecond_timer() - start;
+      if (elapsed >= timeout_ms)
+      {
+         xbee_cmd_release_handle( handle);
+         return -ETIMEDOUT;
+      }
+      xbee_dev_wait( xbee, (int32_t) (timeout_ms - elapsed));
+      xbee_dev_tick( xbee);
+      xbee_cmd_tick();
+   }
+
+   if (wait.flags & (XBEE_CMD_RESP_FLAG_TIMEOUT | XBEE_CMD_RESP_MASK_STATUS))
+   {
+      return (wait.flags & XBEE_CMD_RESP_FLAG_TIMEOUT) ? -ETIMEDOUT : -EIO;
+   }
+
+   if (value != NULL)
+   {
+      *value = wait.value;
+   }
+
+   return 0;
+}
+
+// After a step that may or may not have changed the XBee's rate failed,
+// check for the XBee at <old_rate> (with ATBD set to <old_param>) and then
+// at <rate> (with ATBD set to <param>).  Leaves the host's serial port at
+// the rate the XBee answered at and returns 0 for <old_rate> or 1 for
+// <rate>, or returns -EIO (with the port at <old_rate>) if it didn't answer
+// at either one.
+static int _xbee_cmd_baud_probe( xbee_dev_t *xbee, uint32_t old_rate,
+   uint32_t old_param, uint32_t rate, uint32_t param, uint16_t timeout_ms)
+{
+   uint32_t value;
+   int at_new;
+
+   for (at_new = 0; at_new < 2; ++at_new)
+   {
+      xbee_ser_baudrate( &xbee->serport, at_new ? rate : old_rate);
+      xbee_ser_rx_flush( &xbee->serport);
+      if (_xbee_cmd_baud_request( xbee, FALSE, 0, &value, timeout_ms) == 0
+         && value == (at_new ? param : old_param))
+      {
+         return at_new;
+      }
+   }
+
+   #ifdef XBEE_ATCMD_VERBOSE
+      printf( "%s: no response at %" PRIu32 " or %" PRIu32 "\n",
+         __FUNCTION__, old_rate, rate);
+   #endif
+   xbee_ser_baudrate( &xbee->serport, old_rate);
+
+   return -EIO;
+}
+
+/// Number of ATBD queries that must succeed at a new rate before keeping it.
+#define XBEE_CMD_BAUD_TEST_FRAMES   3
+
+/**
+   @brief
+   Step the XBee module and the host's serial port up to the fastest baud
+   rate in a list that they can both use.
+
+   For each rate in \a rates faster than the current one, this function
+   checks that the host's serial port supports it, sets the XBee to it
+   with ATBD and switches the host over.  It then sends a few ATBD queries
+   (the loopback test) and keeps the rate if every response comes back
+   with the value it set.  Otherwise, it sends ATBD to restore the last
+   working rate, switches the host back and moves on to the next rate.
+
+   If the response to setting ATBD doesn't arrive (or restoring the last
+   working rate can't be confirmed), the XBee may or may not have changed
+   rates, so this function looks for it at both rates before going on.
+
+   This function blocks (ticking the device) until it completes, so call it
+   during startup, before the program has other requests outstanding.  The
+   device's frame handlers must include #XBEE_FRAME_HANDLE_LOCAL_AT.  The
+   new rate isn't saved to the XBee's flash (send ATWR to do that).
+
+   @param[in]  xbee        XBee device, with an open serial port at the
+                           rate the XBee currently uses
+   @param[in]  rates       candidate rates, in increasing order (rates
+                           other than the standard 1200 to 921600 are sent
+                           to the XBee as-is, e.g. 250000 for XBee 3)
+   @param[in]  count       number of entries in \a rates
+   @param[in]  timeout_ms  time to wait for each response
+
+   @retval  0           \c xbee->serport.baudrate is the fastest working
+                        rate (possibly unchanged)
+   @retval  -EINVAL     invalid parameter
+   @retval  -ETIMEDOUT  XBee didn't respond at the starting rate
+   @retval  -EIO        lost contact with the XBee at a new rate and
+                        couldn't restore the last working one (the XBee
+                        didn't answer at either rate, or only answered at
+                        the new rate, which is left in
+                        \c xbee->serport.baudrate)
+*/
+_xbee_atcmd_debug
+int xbee_cmd_negotiate_baudrate( xbee_dev_t *xbee, const uint32_t FAR *rates,
+   uint_fast8_t count, uint16_t timeout_ms)
+{
+   uint32_t rate, old_rate, param, old_param, value;
+   uint_fast8_t i, test, std;
+   int error;
+
+   if (xbee == NULL || (rates == NULL && count != 0))
+   {
+      return -EINVAL;
+   }
+
+   // make sure we can talk to the XBee, and learn its current setting
+   error = _xbee_cmd_baud_request( xbee, FALSE, 0, &old_param, timeout_ms);
+   if (error)
+   {
+      return error;
+   }
+
+   for (i = 0; i < count; ++i)
+   {
+      rate = rates[i];
+      old_rate = xbee->serport.baudrate;
+      if (rate <= old_rate)
+      {
+         continue;
+      }
+
+      // skip rates the host can't do before changing the XBee
+      if (xbee_ser_baudrate( &xbee->serport, rate)
+         || xbee_ser_baudrate( &xbee->serport, old_rate))
+      {
+         #ifdef XBEE_ATCMD_VERBOSE
+            printf( "%s: host doesn't support %" PRIu32 "\n",
+               __FUNCTION__, rate);
+         #endif
+         xbee_ser_baudrate( &xbee->serport, old_rate);
+         continue;
+      }
+
+      param = rate;
+      for (std = 0; std < _TABLE_ENTRIES( _xbee_cmd_baud_std); ++std)
+      {
+         if (_xbee_cmd_baud_std[std] == rate)
+         {
+            param = std;
+            break;
+         }
+      }
+
+      // XBee switches rates after sending its response
+      error = _xbee_cmd_baud_request( xbee, TRUE, param, NULL, timeout_ms);
+      if (error == -ETIMEDOUT)
+      {
+         // response was lost, and the XBee may have switched anyway
+         error = _xbee_cmd_baud_probe( xbee, old_rate, old_param, rate, param,
+            timeout_ms);
+         if (error < 0)
+         {
+            return error;
+         }
+         if (error == 0)
+         {
+            continue;            // still at the old rate
+         }
+      }
+      else if (error)
+      {
+         #ifdef XBEE_ATCMD_VERBOSE
+            printf( "%s: XBee rejected %" PRIu32 "\n", __FUNCTION__, rate);
+         #endif
+         continue;
+      }
+      else
+      {
+         xbee_ser_baudrate( &xbee->serport, rate);
+         xbee_ser_rx_flush( &xbee->serport);
+      }
+
+      for (test = 0; test < XBEE_CMD_BAUD_TEST_FRAMES; ++test)
+      {
+         if (_xbee_cmd_baud_request( xbee, FALSE, 0, &value, timeout_ms)
+            || value != param)
+         {
+            break;
+         }
+      }
+      if (test == XBEE_CMD_BAUD_TEST_FRAMES)
+      {
+         old_param = param;
+         continue;
+      }
+
+      #ifdef XBEE_ATCMD_VERBOSE
+         printf( "%s: loopback test failed at %" PRIu32 "\n",
+            __FUNCTION__, rate);
+      #endif
+
+      // Responses may be what's failing, so send the old setting even if
+      // its response doesn't arrive, and verify it at the old rate.
+      _xbee_cmd_baud_request( xbee, TRUE, old_param, NULL, timeout_ms);
+      if (_xbee_cmd_baud_probe( xbee, old_rate, old_param, rate, param,
+         timeout_ms) != 0)
+      {
+         return -EIO;
+      }
+   }
+
+   return 0;
+}
+
+/*** BeginHeader _xbee_cmd_cache, xbee_cmd_cache_read, xbee_cmd_cache_get,
+   xbee_cmd_cache_invalidate, xbee_cmd_cache_flush, _xbee_cmd_cache_written,
+   _xbee_cmd_cache_update */
+/*** EndHeader */
+#if XBEE_CMD_CACHE_SIZE
+/// Recent AT parameter values by device, node and command, and callbacks
+/// waiting on reads in flight.
+xbee_cmd_cache_t _xbee_cmd_cache;
+
+// Commands that perform an action instead of reading a setting.  Their
+// responses aren't cached, and sending one from _XBEE_CMD_CACHE_RESETS on
+// changes other settings.
+static const char _xbee_cmd_cache_actions[] = "NDASEDFNDNISCNCBDAWRACRENRFR";
+#define _XBEE_CMD_CACHE_RESETS   22       // offset of "RE"
+
+// Return offset of <command> in _xbee_cmd_cache_actions, or -1 if it isn't
+// listed (so it reads or writes a setting).
+static int _xbee_cmd_cache_action( uint16_t command)
+{
+   xbee_at_cmd_t at;
+   int i;
+
+   at.w = command;
+   for (i = 0; _xbee_cmd_cache_actions[i] != '\0'; i += 2)
+   {
+      if (at.str[0] == _xbee_cmd_cache_actions[i]
+         && at.str[1] == _xbee_cmd_cache_actions[i + 1])
+      {
+         return i;
+      }
+   }
+
+   return -1;
+}
+
+// Does <entry> hold <command> (any command if 0) from the local XBee on
+// <xbee> (<ieee> is NULL) or from node <ieee> (any node if <ieee> is
+// WPAN_IEEE_ADDR_UNDEFINED)?
+static bool_t _xbee_cmd_cache_match( const xbee_cmd_cache_entry_t *entry,
+   const xbee_dev_t *xbee, const addr64 FAR *ieee, uint16_t command)
+{
+   if (entry->device != xbee || (command != 0 && entry->command.w != command))
+   {
+      return FALSE;
+   }
+   if (ieee == NULL)
+   {
+      return ! (entry->flags & XBEE_CMD_CACHE_FLAG_REMOTE);
+   }
+
+   return (entry->flags & XBEE_CMD_CACHE_FLAG_REMOTE)
+      && (addr64_equal( ieee, WPAN_IEEE_ADDR_UNDEFINED)
+         || addr64_equal( ieee, &entry->ieee));
+}
+
+static xbee_cmd_cache_entry_t *_xbee_cmd_cache_find( const xbee_dev_t *xbee,
+   const addr64 FAR *ieee, uint16_t command)
+{
+   xbee_cmd_cache_entry_t *entry;
+   uint_fast8_t i;
+
+   for (entry = _xbee_cmd_cache.entry, i = XBEE_CMD_CACHE_SIZE; i;
+      ++entry, --i)
+   {
+      if (_xbee_cmd_cache_match( entry, xbee, ieee, command))
+      {
+         return entry;
+      }
+   }
+
+   return NULL;
+}
+
+// Take an unused entry, or the one with the oldest value, for a new key.
+// Entries with reads in flight are never taken.
+static xbee_cmd_cache_entry_t *_xbee_cmd_cache_alloc( xbee_dev_t *xbee,
+   const addr64 FAR *ieee, uint16_t command)
+{
+   xbee_cmd_cache_entry_t *entry, *oldest;
+   uint32_t now, age, oldest_age;
+   uint_fast8_t i;
+
+   now = xbee_millisecond_timer();
+   oldest = NULL;
+   oldest_age = 0;
+   for (entry = _xbee_cmd_cache.entry, i = XBEE_CMD_CACHE_SIZE; i;
+      ++entry, --i)
+   {
+      if (entry->device == NULL)
+      {
+         oldest = entry;
+         break;
+      }
+      if (entry->handle >= 0)
+      {
+         continue;
+      }
+      age = (entry->flags & XBEE_CMD_CACHE_FLAG_VALID)
+         ? now - entry->updated_ms : 0xFFFFFFFF;
+      if (oldest == NULL || age > oldest_age)
+      {
+         oldest = entry;
+         oldest_age = age;
+      }
+   }
+
+   if (oldest != NULL)
+   {
+      oldest->device = xbee;
+      oldest->handle = -1;
+      oldest->command.w = command;
+      oldest->value_length = 0;
+      oldest->flags = 0;
+      if (ieee != NULL)
+      {
+         oldest->ieee = *ieee;
+         oldest->flags = XBEE_CMD_CACHE_FLAG_REMOTE;
+      }
+   }
+
+   return oldest;
+}
+
+// Drop <entry>'s value.  An entry with a read in flight stays in use for
+// its waiters, but the read's response (sent before the change) isn't saved.
+static void _xbee_cmd_cache_drop( xbee_cmd_cache_entry_t *entry)
+{
+   if (entry->handle >= 0)
+   {
+      entry->flags = (entry->flags & XBEE_CMD_CACHE_FLAG_REMOTE)
+         | XBEE_CMD_CACHE_FLAG_DISCARD;
+   }
+   else
+   {
+      entry->device = NULL;
+      entry->flags = 0;
+   }
+}
+
+// Callback for reads started by xbee_cmd_cache_read(), passes the response
+// to every caller waiting on it.
+static int _xbee_cmd_cache_response( const xbee_cmd_response_t FAR *response)
+{
+   xbee_cmd_cache_entry_t *entry = response->context;
+   xbee_cmd_cache_waiter_t *waiter;
+   xbee_cmd_callback_fn callback[XBEE_CMD_CACHE_WAITERS];
+   void FAR *context[XBEE_CMD_CACHE_WAITERS];
+   xbee_cmd_response_t forward;
+   uint_fast8_t i, count;
+
+   // _xbee_cmd_cache_update() has already saved the value (unless the entry
+   // was written, or was dropped and taken for another command)
+   if (entry->handle == response->handle)
+   {
+      entry->handle = -1;
+      entry->flags &= ~XBEE_CMD_CACHE_FLAG_DISCARD;
+   }
+
+   // remove the waiters first, so their callbacks can start new reads
+   count = 0;
+   for (waiter = _xbee_cmd_cache.waiter, i = XBEE_CMD_CACHE_WAITERS; i;
+      ++waiter, --i)
+   {
+      if (waiter->callback != NULL && waiter->handle == response->handle)
+      {
+         callback[count] = waiter->callback;
+         context[count] = waiter->context;
+         ++count;
+         waiter->callback = NULL;
+      }
+   }
+
+   forward = *response;
+   for (i = 0; i < count; ++i)
+   {
+      forward.context = context[i];
+      callback[i]( &forward);
+   }
+
+   return XBEE_ATCMD_DONE;
+}
+#endif
+
+/**
+   @brief
+   Read an AT parameter through the cache.
+
+   Calls \a callback right away with the cached value if it's newer than
+   \a max_age_ms.  Otherwise, \a callback receives the response to a
+   request sent to the XBee.  Callers reading the same parameter while that
+   request is in flight share it, and all receive its response.
+
+   The cache also saves responses to requests sent with xbee_cmd_create()
+   and xbee_cmd_send() (e.g., from xbee_cmd_query_device()), and drops
+   values when they're written or the local XBee resets.
+
+   @param[in]  xbee        XBee device to read from.
+   @param[in]  ieee        Remote node to read from, or NULL for the local
+                           XBee.
+   @param[in]  command     AT command to read (e.g., "VR").
+   @param[in]  max_age_ms  Oldest cached value to accept, 0 to always read
+                           from the XBee.  See #XBEE_CMD_CACHE_TTL.
+   @param[in]  callback    Function to receive the value.  Its response has
+                           #XBEE_CMD_RESP_FLAG_CACHED set (and a \c handle
+                           of -1) for cached values.  The response's handle
+                           is released after the callback returns, so it
+                           shouldn't reuse it.
+   @param[in]  context     Context to pass to \a callback.
+
+   @retval  0        \a callback has been called with the cached value.
+   @retval  1        Request in flight, \a callback will receive its
+                     response.
+   @retval  -EINVAL  Invalid parameter.
+   @retval  -ENOSPC  Too many callbacks waiting (see
+                     #XBEE_CMD_CACHE_WAITERS), or every cache entry has a
+                     read in flight.
+   @retval  -ENOSYS  Cache disabled (XBEE_CMD_CACHE_SIZE is 0).
+   @retval  <0       Error from xbee_cmd_create() or xbee_cmd_send().
+*/
+_xbee_atcmd_debug
+int xbee_cmd_cache_read( xbee_dev_t *xbee, const addr64 FAR *ieee,
+   const char FAR command[3], uint32_t max_age_ms,
+   xbee_cmd_callback_fn callback, void FAR *context)
+{
+#if ! XBEE_CMD_CACHE_SIZE
+   XBEE_UNUSED_PARAMETER( ieee);
+   XBEE_UNUSED_PARAMETER( max_age_ms);
+   XBEE_UNUSED_PARAMETER( context);
+
+   return (xbee == NULL || command == NULL || callback == NULL)
+      ? -EINVAL : -ENOSYS;
+#else
+   xbee_cmd_cache_entry_t *entry;
+   xbee_cmd_cache_waiter_t *waiter;
+   xbee_cmd_response_t response;
+   wpan_address_t source;
+   uint16_t cmd;
+   int16_t request;
+   uint_fast8_t i;
+   int error;
+
+   if (xbee == NULL || command == NULL || callback == NULL
+      || (ieee != NULL && addr64_equal( ieee, WPAN_IEEE_ADDR_UNDEFINED)))
+   {
+      return -EINVAL;
+   }
+
+   cmd = xbee_get_unaligned16( command);
+   entry = _xbee_cmd_cache_find( xbee, ieee, cmd);
+   if (entry != NULL && (entry->flags & XBEE_CMD_CACHE_FLAG_VALID)
+      && xbee_millisecond_timer() - entry->updated_ms < max_age_ms)
+   {
+      memset( &response, 0, sizeof response);
+      response.device = xbee;
+      response.context = context;
+      response.handle = -1;
+      response.command.w = cmd;
+      response.flags = XBEE_AT_RESP_SUCCESS | XBEE_CMD_RESP_FLAG_CACHED;
+      response.value_length = entry->value_length;
+      response.value_bytes = entry->value;
+      response.value = _xbee_cmd_decode_value( entry->value,
+         entry->value_length);
+      if (ieee != NULL)
+      {
+         source.ieee = *ieee;
+         source.network = WPAN_NET_ADDR_UNDEFINED;
+         response.source = &source;
+      }
+      callback( &response);
+      return 0;
+   }
+
+   for (waiter = _xbee_cmd_cache.waiter, i = XBEE_CMD_CACHE_WAITERS;
+      i && waiter->callback != NULL; ++waiter, --i)
+   {
+   }
+   if (i == 0)
+   {
+      return -ENOSPC;
+   }
+   if (entry == NULL)
+   {
+      entry = _xbee_cmd_cache_alloc( xbee, ieee, cmd);
+      if (entry == NULL)
+      {
+         return -ENOSPC;
+      }
+   }
+
+   // Start a read unless one is in flight (and wasn't sent before a write).
+   if (entry->handle < 0 || (entry->flags & XBEE_CMD_CACHE_FLAG_DISCARD))
+   {
+      request = xbee_cmd_create( xbee, command);
+      if (request < 0)
+      {
+         return request;
+      }
+      error = 0;
+      if (ieee != NULL)
+      {
+         error = xbee_cmd_set_target( request, ieee, WPAN_NET_ADDR_UNDEFINED);
+      }
+      if (! error)
+      {
+         error = xbee_cmd_set_callback( request, _xbee_cmd_cache_response,
+            entry);
+      }
+      if (! error)
+      {
+         error = xbee_cmd_send( request);
+      }
+      if (error)
+      {
+         xbee_cmd_release_handle( request);
+         return error;
+      }
+      entry->handle = request;
+      entry->flags &= ~XBEE_CMD_CACHE_FLAG_DISCARD;
+   }
+
+   waiter->callback = callback;
+   waiter->context = context;
+   waiter->handle = entry->handle;
+
+   return 1;
+#endif
+}
+
+/**
+   @brief
+   Copy an AT parameter from the cache, without sending any requests.
+
+   @param[in]  xbee        XBee device the value was read from.
+   @param[in]  ieee        Remote node the value was read from, or NULL for
+                           the local XBee.
+   @param[in]  command     AT command (e.g., "VR").
+   @param[in]  max_age_ms  Oldest cached value to accept.
+   @param[out] buffer      Buffer to copy the (big-endian) value to.
+   @param[in]  buffer_size Size of \a buffer.
+
+   @retval  >=0      Number of bytes copied to \a buffer.
+   @retval  -EINVAL  Invalid parameter.
+   @retval  -ENOENT  No value cached, or it's older than \a max_age_ms.
+   @retval  -ENOSPC  Value doesn't fit in \a buffer.
+   @retval  -ENOSYS  Cache disabled (XBEE_CMD_CACHE_SIZE is 0).
+*/
+_xbee_atcmd_debug
+int xbee_cmd_cache_get( xbee_dev_t *xbee, const addr64 FAR *ieee,
+   const char FAR command[3], uint32_t max_age_ms,
+   void FAR *buffer, uint_fast8_t buffer_size)
+{
+#if ! XBEE_CMD_CACHE_SIZE
+   XBEE_UNUSED_PARAMETER( ieee);
+   XBEE_UNUSED_PARAMETER( max_age_ms);
+   XBEE_UNUSED_PARAMETER( buffer_size);
+
+   return (xbee == NULL || command == NULL || buffer == NULL)
+      ? -EINVAL : -ENOSYS;
+#else
+   const xbee_cmd_cache_entry_t *entry;
+
+   if (xbee == NULL || command == NULL || buffer == NULL)
+   {
+      return -EINVAL;
+   }
+
+   entry = _xbee_cmd_cache_find( xbee, ieee, xbee_get_unaligned16( command));
+   if (entry == NULL || ! (entry->flags & XBEE_CMD_CACHE_FLAG_VALID)
+      || xbee_millisecond_timer() - entry->updated_ms >= max_age_ms)
+   {
+      return -ENOENT;
+   }
+   if (entry->value_length > buffer_size)
+   {
+      return -ENOSPC;
+   }
+
+   _f_memcpy( buffer, entry->value, entry->value_length);
+   return entry->value_length;
+#endif
+}
+
+/**
+   @brief
+   Drop cached values, so the next read goes to the XBee.
+
+   Writes sent with xbee_cmd_send(), xbee_cmd_simple() and
+   xbee_cmd_execute() already drop the value written, and modem status
+   frames for a reset drop the local XBee's values.  Use this function for
+   changes the cache can't see (e.g., settings changed in AT command mode).
+
+   @param[in]  xbee     XBee device the values were read from.
+   @param[in]  ieee     Remote node the values were read from, or NULL for
+                        the local XBee.
+   @param[in]  command  AT command to drop (e.g., "NI"), or NULL for all
+                        of the target's values.
+
+   @retval  0        Values dropped.
+   @retval  -EINVAL  \a xbee is NULL.
+   @retval  -ENOSYS  Cache disabled (XBEE_CMD_CACHE_SIZE is 0).
+
+   @see xbee_cmd_cache_flush()
+*/
+_xbee_atcmd_debug
+int xbee_cmd_cache_invalidate( xbee_dev_t *xbee, const addr64 FAR *ieee,
+   const char FAR command[3])
+{
+#if ! XBEE_CMD_CACHE_SIZE
+   XBEE_UNUSED_PARAMETER( ieee);
+   XBEE_UNUSED_PARAMETER( command);
+
+   return xbee ? -ENOSYS : -EINVAL;
+#else
+   xbee_cmd_cache_entry_t *entry;
+   uint16_t cmd;
+   uint_fast8_t i;
+
+   if (xbee == NULL)
+   {
+      return -EINVAL;
+   }
+
+   cmd = (command == NULL) ? 0 : xbee_get_unaligned16( command);
+   for (entry = _xbee_cmd_cache.entry, i = XBEE_CMD_CACHE_SIZE; i;
+      ++entry, --i)
+   {
+      if (_xbee_cmd_cache_match( entry, xbee, ieee, cmd))
+      {
+         _xbee_cmd_cache_drop( entry);
+      }
+   }
+
+   return 0;
+#endif
+}
+
+/**
+   @brief
+   Drop every cached value read through a device, from the local XBee and
+   remote nodes.
+
+   @param[in]  xbee     XBee device the values were read from, or NULL for
+                        all devices.
+
+   @retval  0        Values dropped.
+   @retval  -ENOSYS  Cache disabled (XBEE_CMD_CACHE_SIZE is 0).
+*/
+_xbee_atcmd_debug
+int xbee_cmd_cache_flush( xbee_dev_t *xbee)
+{
+#if ! XBEE_CMD_CACHE_SIZE
+   XBEE_UNUSED_PARAMETER( xbee);
+
+   return -ENOSYS;
+#else
+   xbee_cmd_cache_entry_t *entry;
+   uint_fast8_t i;
+
+   for (entry = _xbee_cmd_cache.entry, i = XBEE_CMD_CACHE_SIZE; i;
+      ++entry, --i)
+   {
+      if (entry->device != NULL && (xbee == NULL || entry->device == xbee))
+      {
+         _xbee_cmd_cache_drop( entry);
+      }
+   }
+
+   return 0;
+#endif
+}
+
+/**
+   @internal
+   @brief
+   Called after sending an AT command, to drop the cached values it changes.
+
+   @param[in]  xbee        XBee device the command was sent on.
+   @param[in]  ieee        Remote node the command was sent to, or NULL for
+                           the local XBee.  Broadcasts (and commands sent
+                           to the coordinator's alias, or by network address
+                           alone) drop the values cached for every remote
+                           node.
+   @param[in]  command     AT command sent (xbee_at_cmd_t.w).
+   @param[in]  has_param   Was a parameter sent with the command?
+*/
+_xbee_atcmd_debug
+void _xbee_cmd_cache_written( xbee_dev_t *xbee, const addr64 FAR *ieee,
+   uint16_t command, bool_t has_param)
+{
+#if XBEE_CMD_CACHE_SIZE
+   xbee_cmd_cache_entry_t *entry;
+   uint_fast8_t i;
+
+   if (_xbee_cmd_cache_action( command) >= _XBEE_CMD_CACHE_RESETS)
+   {
+      command = 0;         // reset, any setting may change
+   }
+   else if (! has_param)
+   {
+      return;              // read, or an action that doesn't change settings
+   }
+
+   // values are cached under the address of the node that responded
+   if (ieee != NULL && (addr64_equal( ieee, WPAN_IEEE_ADDR_BROADCAST)
+      || addr64_equal( ieee, WPAN_IEEE_ADDR_COORDINATOR)))
+   {
+      ieee = WPAN_IEEE_ADDR_UNDEFINED;       // matches any remote node
+   }
+
+   for (entry = _xbee_cmd_cache.entry, i = XBEE_CMD_CACHE_SIZE; i;
+      ++entry, --i)
+   {
+      if (_xbee_cmd_cache_match( entry, xbee, ieee, command))
+      {
+         _xbee_cmd_cache_drop( entry);
+      }
+   }
+#else
+   XBEE_UNUSED_PARAMETER( xbee);
+   XBEE_UNUSED_PARAMETER( ieee);
+   XBEE_UNUSED_PARAMETER( command);
+   XBEE_UNUSED_PARAMETER( has_param);
+#endif
+}
+
+/**
+   @internal
+   @brief
+   Called by _xbee_cmd_handle_response() for each response matched to a
+   request, to save values read from the XBee.
+
+   @param[in]  request       Request the response matched.
+   @param[in]  ieee          Node that sent the response, or NULL for the
+                             local XBee.
+   @param[in]  status        Status from the response.
+   @param[in]  value         Value from the response.
+   @param[in]  value_length  Bytes at \a value.
+*/
+_xbee_atcmd_debug
+void _xbee_cmd_cache_update( const xbee_cmd_request_t FAR *request,
+   const addr64 FAR *ieee, uint_fast8_t status,
+   const uint8_t FAR *value, uint_fast8_t value_length)
+{
+#if XBEE_CMD_CACHE_SIZE
+   xbee_cmd_cache_entry_t *entry;
+
+   if (request->param_length != 0 || status != XBEE_AT_RESP_SUCCESS
+      || value_length == 0 || value_length > XBEE_CMD_CACHE_VALUE_MAX
+      || _xbee_cmd_cache_action( request->command.w) >= 0)
+   {
+      return;
+   }
+
+   entry = _xbee_cmd_cache_find( request->device, ieee, request->command.w);
+   if (entry == NULL)
+   {
+      entry = _xbee_cmd_cache_alloc( request->device, ieee,
+         request->command.w);
+      if (entry == NULL)
+      {
+         return;
+      }
+   }
+   else if ((entry->flags & XBEE_CMD_CACHE_FLAG_DISCARD)
+      || (entry->handle >= 0
+         && entry->handle != XBEE_CMD_REQUEST_HANDLE( request)))
+   {
+      // value may predate a write, or a newer read is in flight
+      return;
+   }
+
+   _f_memcpy( entry->value, value, value_length);
+   entry->value_length = (uint8_t) value_length;
+   entry->updated_ms = xbee_millisecond_timer();
+   entry->flags |= XBEE_CMD_CACHE_FLAG_VALID;
+#else
+   XBEE_UNUSED_PARAMETER( request);
+   XBEE_UNUSED_PARAMETER( ieee);
+   XBEE_UNUSED_PARAMETER( status);
+   XBEE_UNUSED_PARAMETER( value);
+   XBEE_UNUSED_PARAMETER( value_length);
+#endif
+}
+
 ///@}
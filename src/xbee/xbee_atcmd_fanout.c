@@ -0,0 +1,554 @@
+/*
+ * Copyright (c) 2019 Digi International Inc.,
+ * All rights not expressly granted are reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Digi International Inc. 11001 Bren Road East, Minnetonka, MN 55343
+ * =======================================================================
+ */
+
+/**
+   @addtogroup xbee_atcmd
+   @{
+   @file xbee_atcmd_fanout.c
+   Send a remote AT command to a list of nodes (see xbee/atcmd_fanout.h).
+*/
+
+/*** BeginHeader */
+#include <errno.h>
+#include <string.h>
+
+#include "xbee/platform.h"
+#include "xbee/atcmd_fanout.h"
+
+#ifndef __DC__
+   #define _xbee_atcmd_debug
+#elif defined XBEE_ATCMD_DEBUG
+   #define _xbee_atcmd_debug  __debug
+#else
+   #define _xbee_atcmd_debug  __nodebug
+#endif
+/*** EndHeader */
+
+/*** BeginHeader xbee_fanout_init */
+/*** EndHeader */
+/**
+   @brief
+   Set up a fan-out of a remote AT command, with default limits.
+
+   Change the limits in \a fanout (rate, in_flight_limit, route_limit,
+   retries and timeout) before calling xbee_fanout_start().
+
+   @param[out] fanout        Fan-out to set up.  Must remain valid until
+                              it's done, since responses refer to it.
+   @param[in]  xbee          Device to send requests with.
+   @param[in]  command       AT command to send (e.g., "DB").
+   @param[in]  param         Parameter to send with the command, or NULL.
+   @param[in]  param_length  Bytes at \a param.
+
+   @retval  0        Ready to start.
+   @retval  -EINVAL  Invalid parameter (including a \a param_length over
+                     XBEE_CMD_MAX_PARAM_LENGTH).
+*/
+_xbee_atcmd_debug
+int xbee_fanout_init( xbee_fanout_t FAR *fanout, xbee_dev_t *xbee,
+   const char FAR command[3], const void FAR *param, uint8_t param_length)
+{
+   if (fanout == NULL || xbee == NULL || command == NULL
+      || (param == NULL && param_length != 0)
+      || param_length > XBEE_CMD_MAX_PARAM_LENGTH)
+   {
+      return -EINVAL;
+   }
+
+   _f_memset( fanout, 0, sizeof *fanout);
+   fanout->rate = XBEE_FANOUT_DEFAULT_RATE;
+   fanout->in_flight_limit = XBEE_FANOUT_MAX_IN_FLIGHT;
+   fanout->route_limit = XBEE_FANOUT_DEFAULT_ROUTE_LIMIT;
+   fanout->retries = XBEE_FANOUT_DEFAULT_RETRIES;
+   fanout->timeout = XBEE_FANOUT_DEFAULT_TIMEOUT;
+
+   fanout->xbee = xbee;
+   fanout->command.str[0] = command[0];
+   fanout->command.str[1] = command[1];
+   if (param_length)
+   {
+      _f_memcpy( fanout->param, param, param_length);
+   }
+   fanout->param_length = param_length;
+
+   return 0;
+}
+
+/*** BeginHeader xbee_fanout_start, xbee_fanout_tick */
+/*** EndHeader */
+/**   @internal
+   Can another request start on \a route without going over
+   fanout->route_limit?
+*/
+_xbee_atcmd_debug
+bool_t _xbee_fanout_route_open( const xbee_fanout_t FAR *fanout,
+   uint16_t route)
+{
+   const xbee_fanout_slot_t FAR *slot;
+   uint_fast8_t i, count;
+
+   if (fanout->route_limit == 0)
+   {
+      return TRUE;
+   }
+
+   count = 0;
+   for (slot = fanout->slot, i = XBEE_FANOUT_MAX_IN_FLIGHT; i; ++slot, --i)
+   {
+      if (slot->state == XBEE_FANOUT_SLOT_SENT
+         && fanout->targets[slot->target].route == route)
+      {
+         ++count;
+      }
+   }
+
+   return count < fanout->route_limit;
+}
+
+/**   @internal
+   Pass a target's result to the callback, and free its slot.  Once it's the
+   last target, records the summary and calls the callback with a NULL
+   result.
+*/
+_xbee_atcmd_debug
+void _xbee_fanout_complete( xbee_fanout_t FAR *fanout,
+   xbee_fanout_slot_t FAR *slot, int status,
+   const xbee_cmd_response_t FAR *response)
+{
+   xbee_fanout_result_t result;
+
+   switch (status)
+   {
+      case 0:
+         ++fanout->summary.succeeded;
+         break;
+      case -ETIMEDOUT:
+         ++fanout->summary.timed_out;
+         break;
+      default:
+         ++fanout->summary.failed;
+         break;
+   }
+
+   result.target = slot->target;
+   result.attempts = slot->attempts;
+   result.status = status;
+   result.response = response;
+   slot->state = XBEE_FANOUT_SLOT_FREE;
+   --fanout->pending;
+
+   if (fanout->callback)
+   {
+      fanout->callback( fanout, &result);
+   }
+
+   if (fanout->pending == 0 && fanout->next == fanout->count
+      && fanout->status == -EBUSY)
+   {
+      fanout->summary.elapsed_ms = xbee_millisecond_timer() - fanout->start_ms;
+      fanout->status = 0;
+      if (fanout->callback)
+      {
+         fanout->callback( fanout, NULL);
+      }
+   }
+}
+
+/**   @internal
+   Callback registered with the requests sent by xbee_fanout_tick().
+
+   View function help for xbee_cmd_set_callback() for details on
+   xbee_cmd_response_t structure.
+*/
+_xbee_atcmd_debug
+int _xbee_fanout_response( const xbee_cmd_response_t FAR *response)
+{
+   xbee_fanout_t FAR *fanout = response->context;
+   xbee_fanout_slot_t FAR *slot;
+   uint_fast8_t i;
+   uint_fast8_t status;
+
+   for (slot = fanout->slot, i = XBEE_FANOUT_MAX_IN_FLIGHT; i; ++slot, --i)
+   {
+      if (slot->state == XBEE_FANOUT_SLOT_SENT
+         && slot->handle == response->handle)
+      {
+         break;
+      }
+   }
+   if (i == 0)
+   {
+      // not ours anymore (e.g., fan-out was cancelled)
+      return XBEE_ATCMD_DONE;
+   }
+
+   status = response->flags & XBEE_CMD_RESP_MASK_STATUS;
+   if ((response->flags & XBEE_CMD_RESP_FLAG_TIMEOUT)
+      || status == XBEE_AT_RESP_TX_FAIL)
+   {
+      if (slot->attempts <= fanout->retries)
+      {
+         // xbee_fanout_tick() sends it again when the limits allow
+         slot->state = XBEE_FANOUT_SLOT_RETRY;
+         ++fanout->summary.retries;
+      }
+      else
+      {
+         _xbee_fanout_complete( fanout, slot,
+            (response->flags & XBEE_CMD_RESP_FLAG_TIMEOUT) ? -ETIMEDOUT : -EIO,
+            response);
+      }
+   }
+   else
+   {
+      _xbee_fanout_complete( fanout, slot,
+         status == XBEE_AT_RESP_SUCCESS ? 0 : -EIO, response);
+   }
+
+   // The next xbee_fanout_tick() starts another request in its place.  It
+   // isn't safe to create requests from here, since the request pool and
+   // timer wheel are in the middle of dispatching this response.
+
+   return XBEE_ATCMD_DONE;
+}
+
+/**   @internal
+   Send a request to the target in \a slot.  Every call counts as an
+   attempt, even if the request can't be sent.
+
+   @retval  0     request sent
+   @retval  <0    couldn't create or send the request
+*/
+_xbee_atcmd_debug
+int _xbee_fanout_send( xbee_fanout_t FAR *fanout,
+   xbee_fanout_slot_t FAR *slot)
+{
+   const xbee_fanout_target_t FAR *target = &fanout->targets[slot->target];
+   int16_t request;
+   int error;
+
+   ++slot->attempts;
+   request = xbee_cmd_create( fanout->xbee, fanout->command.str);
+   if (request < 0)
+   {
+      return request;
+   }
+
+   error = xbee_cmd_set_target( request, &target->address.ieee,
+      target->address.network);
+   if (! error)
+   {
+      error = xbee_cmd_set_param_bytes( request, fanout->param,
+         fanout->param_length);
+   }
+   if (! error)
+   {
+      error = xbee_cmd_set_callback( request, _xbee_fanout_response, fanout);
+   }
+   if (! error)
+   {
+      error = xbee_cmd_send( request);
+   }
+   if (error)
+   {
+      xbee_cmd_release_handle( request);
+      return error;
+   }
+
+   // use the fan-out's timeout instead of XBEE_CMD_REMOTE_TIMEOUT
+   _xbee_cmd_set_timeout( _xbee_cmd_handle_to_address( request),
+      fanout->timeout * UINT32_C(1000));
+
+   slot->handle = request;
+   slot->state = XBEE_FANOUT_SLOT_SENT;
+
+   return 0;
+}
+
+/**
+   @brief
+   Start sending a fan-out's command to a list of targets.
+
+   @param[in,out] fanout  Fan-out set up with xbee_fanout_init().
+   @param[in]  targets    Nodes to send the command to.  Must remain valid
+                          until the fan-out is done.
+   @param[in]  count      Number of entries in \a targets.
+   @param[in]  callback   Function to receive each target's result, or NULL.
+   @param[in]  context    Context for \a callback (available as
+                          fanout->context).
+
+   @retval  0        Started (requests go out from xbee_fanout_tick()).
+   @retval  -EINVAL  Invalid parameter.
+   @retval  -EBUSY   Fan-out already running.
+*/
+_xbee_atcmd_debug
+int xbee_fanout_start( xbee_fanout_t FAR *fanout,
+   const xbee_fanout_target_t FAR *targets, uint16_t count,
+   xbee_fanout_result_fn callback, void FAR *context)
+{
+   if (fanout == NULL || fanout->xbee == NULL
+      || (targets == NULL && count != 0))
+   {
+      return -EINVAL;
+   }
+   if (fanout->status == -EBUSY)
+   {
+      return -EBUSY;
+   }
+
+   if (fanout->in_flight_limit == 0
+      || fanout->in_flight_limit > XBEE_FANOUT_MAX_IN_FLIGHT)
+   {
+      fanout->in_flight_limit = XBEE_FANOUT_MAX_IN_FLIGHT;
+   }
+
+   fanout->targets = targets;
+   fanout->count = count;
+   fanout->callback = callback;
+   fanout->context = context;
+   fanout->next = 0;
+   fanout->started = 0;
+   fanout->pending = 0;
+   _f_memset( fanout->slot, 0, sizeof fanout->slot);
+   _f_memset( &fanout->summary, 0, sizeof fanout->summary);
+   fanout->summary.targets = count;
+   fanout->start_ms = fanout->next_send_ms = xbee_millisecond_timer();
+
+   if (count == 0)
+   {
+      fanout->status = 0;
+      if (callback)
+      {
+         callback( fanout, NULL);
+      }
+      return 0;
+   }
+
+   fanout->status = -EBUSY;
+   xbee_fanout_tick( fanout);
+
+   return 0;
+}
+
+/**
+   @brief
+   Start as many of a fan-out's requests as its limits allow.
+
+   Call this from the main loop while xbee_fanout_status() returns -EBUSY.
+   Responses free up requests in flight, but new requests only start from
+   here.
+
+   A request that can't be created or sent (e.g., the request pool is
+   full) counts as an attempt, and is tried again after
+   XBEE_FANOUT_SEND_RETRY_MS.  The target completes with the error once
+   it runs out of retries.
+
+   @param[in,out] fanout  Fan-out started with xbee_fanout_start().
+
+   @retval  >=0      Number of requests started.
+   @retval  -EINVAL  \a fanout is NULL.
+*/
+_xbee_atcmd_debug
+int xbee_fanout_tick( xbee_fanout_t FAR *fanout)
+{
+   xbee_fanout_slot_t FAR *slot;
+   xbee_fanout_slot_t FAR *free_slot;
+   uint32_t now;
+   uint_fast8_t i, in_flight;
+   uint_fast8_t ahead;
+   int started = 0;
+   int error;
+
+   if (fanout == NULL)
+   {
+      return -EINVAL;
+   }
+
+   while (fanout->status == -EBUSY)
+   {
+      now = xbee_millisecond_timer();
+      if ((int32_t)(now - fanout->next_send_ms) < 0)
+      {
+         break;         // over the rate limit, or waiting after an error
+      }
+
+      // retry failed requests before starting new targets
+      in_flight = 0;
+      free_slot = NULL;
+      for (slot = fanout->slot, i = XBEE_FANOUT_MAX_IN_FLIGHT; i; ++slot, --i)
+      {
+         if (slot->state == XBEE_FANOUT_SLOT_SENT)
+         {
+            ++in_flight;
+         }
+         else if (slot->state == XBEE_FANOUT_SLOT_FREE)
+         {
+            if (free_slot == NULL)
+            {
+               free_slot = slot;
+            }
+         }
+         else if (_xbee_fanout_route_open( fanout,
+            fanout->targets[slot->target].route))
+         {
+            break;
+         }
+      }
+      if (in_flight >= fanout->in_flight_limit)
+      {
+         break;
+      }
+
+      if (i == 0)
+      {
+         // nothing to retry, find the next target with an open route
+         if (free_slot == NULL)
+         {
+            break;
+         }
+         slot = free_slot;
+         for (ahead = 0; ahead < XBEE_FANOUT_LOOKAHEAD
+            && fanout->next + ahead < fanout->count; ++ahead)
+         {
+            if (! (fanout->started & ((uint32_t)1 << ahead))
+               && _xbee_fanout_route_open( fanout,
+                  fanout->targets[fanout->next + ahead].route))
+            {
+               break;
+            }
+         }
+         if (ahead == XBEE_FANOUT_LOOKAHEAD
+            || fanout->next + ahead >= fanout->count)
+         {
+            break;      // all routes busy
+         }
+         slot->target = fanout->next + ahead;
+         slot->attempts = 0;
+      }
+
+      error = _xbee_fanout_send( fanout, slot);
+
+      if (slot == free_slot)
+      {
+         ++fanout->pending;
+         fanout->started |= (uint32_t)1 << (slot->target - fanout->next);
+         while (fanout->started & 1)
+         {
+            fanout->started >>= 1;
+            ++fanout->next;
+         }
+      }
+
+      if (error)
+      {
+         // request pool full or XBee busy, wait before trying again
+         if (slot->attempts <= fanout->retries)
+         {
+            slot->state = XBEE_FANOUT_SLOT_RETRY;
+            ++fanout->summary.retries;
+         }
+         else
+         {
+            _xbee_fanout_complete( fanout, slot, error, NULL);
+         }
+         fanout->next_send_ms = now + XBEE_FANOUT_SEND_RETRY_MS;
+         break;
+      }
+      ++started;
+
+      if (fanout->rate != 0)
+      {
+         if ((int32_t)(now - fanout->next_send_ms) > 1000)
+         {
+            // don't save up more than a second of requests while idle
+            fanout->next_send_ms = now - 1000;
+         }
+         fanout->next_send_ms += 1000 / fanout->rate;
+      }
+   }
+
+   return started;
+}
+
+/*** BeginHeader xbee_fanout_status */
+/*** EndHeader */
+/**
+   @brief
+   Check on a fan-out, and get a summary of its results.
+
+   @param[in]  fanout   Fan-out to check.
+   @param[out] summary  Summary of the results so far, or NULL.
+
+   @retval  0           Every target is done.
+   @retval  -EBUSY      Still running.
+   @retval  -ECANCELED  Stopped by xbee_fanout_cancel().
+   @retval  -EINVAL     \a fanout is NULL.
+*/
+_xbee_atcmd_debug
+int xbee_fanout_status( const xbee_fanout_t FAR *fanout,
+   xbee_fanout_summary_t FAR *summary)
+{
+   if (fanout == NULL)
+   {
+      return -EINVAL;
+   }
+
+   if (summary != NULL)
+   {
+      *summary = fanout->summary;
+   }
+
+   return fanout->status;
+}
+
+/*** BeginHeader xbee_fanout_cancel */
+/*** EndHeader */
+/**
+   @brief
+   Stop a fan-out, releasing its requests in flight.  Targets that aren't
+   done don't get results.
+
+   @param[in,out] fanout  Fan-out to stop.
+
+   @retval  0        Stopped (or wasn't running).
+   @retval  -EINVAL  \a fanout is NULL.
+*/
+_xbee_atcmd_debug
+int xbee_fanout_cancel( xbee_fanout_t FAR *fanout)
+{
+   xbee_fanout_slot_t FAR *slot;
+   uint_fast8_t i;
+
+   if (fanout == NULL)
+   {
+      return -EINVAL;
+   }
+
+   if (fanout->status == -EBUSY)
+   {
+      for (slot = fanout->slot, i = XBEE_FANOUT_MAX_IN_FLIGHT; i; ++slot, --i)
+      {
+         if (slot->state == XBEE_FANOUT_SLOT_SENT)
+         {
+            xbee_cmd_release_handle( slot->handle);
+         }
+         slot->state = XBEE_FANOUT_SLOT_FREE;
+      }
+      fanout->pending = 0;
+      fanout->summary.elapsed_ms = xbee_millisecond_timer() - fanout->start_ms;
+      fanout->status = -ECANCELED;
+   }
+
+   return 0;
+}
+
+///@}
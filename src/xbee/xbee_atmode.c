@@ -19,6 +19,14 @@
    For DigiMesh 900 modules, this is necessary when doing firmware updates
    (even when module is using API-mode firmware).
 
+   To save round trips, xbee_atmode_send_batch() sends several commands on
+   one line (e.g., "ATBD7,WR,AC") and xbee_atmode_read_batch() collects all
+   of their responses.
+
+   The driver tracks when the last byte it wrote to the XBee leaves the
+   serial port, so xbee_atmode_enter() only waits for the part of the
+   pre-escape guard time that hasn't already passed.
+
    Note that this mode is not very robust.  Once it AT mode, the XBee will
    return to idle mode after some amount of time (value of CT register * 100ms).
    If our calculation of that idle time doesn't match the XBee module's, our
@@ -57,6 +65,10 @@
    @brief   Attempt to enter AT command mode (delay 1 second, send +++,
          delay 1 second).
 
+         The first delay is the guard time (GT) after the last byte sent to
+         the XBee, so it's shorter (or skipped, with the escape sequence
+         sent right away) when the serial port has been idle.
+
          After calling xbee_atmode_enter(), you must
          continue to call xbee_atmode_tick() until it returns
          XBEE_MODE_COMMAND (successfully entered command mode) or
@@ -72,6 +84,9 @@
 _xbee_atmode_debug
 int xbee_atmode_enter( xbee_dev_t *xbee)
 {
+   uint32_t now;
+   uint32_t guard;
+
    if (xbee == NULL)
    {
       return -EINVAL;
@@ -97,8 +112,23 @@ int xbee_atmode_enter( xbee_dev_t *xbee)
          __FUNCTION__, xbee->guard_time, xbee->escape_char);
    #endif
 
+   // Start the pre-escape guard time when the serial port finishes sending
+   // the last byte we wrote, instead of now.
+   now = xbee_millisecond_timer();
+   guard = xbee->guard_time + 200;
+   if ((int32_t) (_xbee_dev_tx_idle_timer( xbee, now) - now) <= 0
+      && now - xbee->tx_idle_timer > guard)
+   {
+      // idle long enough, send the escape sequence on this tick
+      xbee->mode_timer = now - guard - 1;
+   }
+   else
+   {
+      xbee->mode_timer = xbee->tx_idle_timer;
+   }
    xbee->mode = XBEE_MODE_PRE_ESCAPE;
-   xbee->mode_timer = xbee_millisecond_timer();
+
+   xbee_atmode_tick( xbee);
 
    return 0;
 }
@@ -198,7 +228,8 @@ int xbee_atmode_tick( xbee_dev_t *xbee)
    switch (xbee->mode)
    {
       case XBEE_MODE_PRE_ESCAPE:
-         if (xbee_millisecond_timer() - xbee->mode_timer
+         // mode_timer may be in the future, while earlier bytes go out
+         if ((int32_t) (xbee_millisecond_timer() - xbee->mode_timer)
                                                    > xbee->guard_time + 200)
          {
             // guard time has passed, send escape sequence (def. "+++")
@@ -208,8 +239,9 @@ int xbee_atmode_tick( xbee_dev_t *xbee)
             #endif
             memset( escape, xbee->escape_char, sizeof escape);
             xbee_ser_write( &xbee->serport, escape, sizeof escape);
+            _xbee_dev_tx_note( xbee, sizeof escape);
             xbee->mode = XBEE_MODE_POST_ESCAPE;
-            xbee->mode_timer = xbee_millisecond_timer();
+            xbee->mode_timer = xbee->tx_idle_timer;
 
             // flush receive buffer (may be leftover frames from API mode)
             xbee_ser_rx_flush( &xbee->serport);
@@ -237,7 +269,7 @@ int xbee_atmode_tick( xbee_dev_t *xbee)
                xbee->mode = XBEE_MODE_IDLE;
             }
          }
-         else if (xbee_millisecond_timer() - xbee->mode_timer
+         else if ((int32_t) (xbee_millisecond_timer() - xbee->mode_timer)
                                                    > xbee->guard_time + 200)
          {
             #ifdef XBEE_ATMODE_VERBOSE
@@ -254,6 +286,7 @@ int xbee_atmode_tick( xbee_dev_t *xbee)
             #ifdef XBEE_ATMODE_VERBOSE
                printf( "%s: timed out waiting for response\n", __FUNCTION__);
             #endif
+            xbee->atmode_responses = 0;
             xbee->mode = XBEE_MODE_COMMAND;
          }
          break;
@@ -333,8 +366,93 @@ int xbee_atmode_send_request( xbee_dev_t *xbee, const char FAR *command)
    xbee_ser_write( serport, "AT", 2);
    xbee_ser_write( serport, command, cmdlen);
    xbee_ser_write( serport, "\r", 1);
+   _xbee_dev_tx_note( xbee, cmdlen + 3);
    xbee->mode = XBEE_MODE_WAIT_RESPONSE;
    xbee->mode_timer = xbee_millisecond_timer();
+   xbee->atmode_responses = 1;
+
+   return 0;
+}
+
+/*** BeginHeader xbee_atmode_send_batch */
+/*** EndHeader */
+/**
+   @brief      Send several AT requests on one line, and wait for their
+               responses.
+
+               Joins the commands with commas, prepends "AT" and adds the
+               trailing carriage-return (e.g., "ATBD7,WR,AC\r" for commands
+               "BD7", "WR" and "AC").  The XBee executes them in order and
+               sends a response line for each one, stopping at the first
+               command that responds with "ERROR".
+
+               Call xbee_atmode_read_batch() to collect all of the responses,
+               or xbee_atmode_read_response() once for each command.
+
+   @param[in]  xbee     XBee device
+
+   @param[in]  commands Commands to send (each without leading AT or
+                        trailing \r)
+
+   @param[in]  count    Number of entries in \a commands (1 to 255).
+
+   @retval  0        Commands sent
+   @retval  -EINVAL  Invalid parameter passed to function.
+   @retval  -ENOSPC  Not enough room in transmit buffer to send request.
+
+   @sa xbee_atmode_read_batch, xbee_atmode_send_request
+*/
+_xbee_atmode_debug
+int xbee_atmode_send_batch( xbee_dev_t *xbee,
+   const char FAR * const FAR *commands, int count)
+{
+   xbee_serial_t  *serport;
+   int linelen;
+   int i;
+
+   if (xbee == NULL || commands == NULL || count < 1 || count > 255)
+   {
+      return -EINVAL;
+   }
+   serport = &xbee->serport;
+
+   // "AT" + commands separated by commas + "\r"
+   linelen = 2 + count;
+   for (i = 0; i < count; ++i)
+   {
+      if (commands[i] == NULL)
+      {
+         return -EINVAL;
+      }
+      linelen += strlen( commands[i]);
+   }
+
+   // Make sure there's enough room in the tx buffer to send the full line.
+   if (xbee_ser_tx_free( serport) < linelen)
+   {
+      return -ENOSPC;
+   }
+
+   xbee_ser_write( serport, "AT", 2);
+   for (i = 0; i < count; ++i)
+   {
+      if (i)
+      {
+         xbee_ser_write( serport, ",", 1);
+      }
+      xbee_ser_write( serport, commands[i], strlen( commands[i]));
+   }
+   xbee_ser_write( serport, "\r", 1);
+   _xbee_dev_tx_note( xbee, linelen);
+
+   #ifdef XBEE_ATMODE_VERBOSE
+      printf( "%s: sent %d commands in %d bytes\n", __FUNCTION__, count,
+         linelen);
+   #endif
+
+   xbee->mode = XBEE_MODE_WAIT_RESPONSE;
+   xbee->mode_timer = xbee_millisecond_timer();
+   xbee->atmode_responses = (uint8_t) count;
 
    return 0;
 }
@@ -367,6 +485,10 @@ int xbee_atmode_send_request( xbee_dev_t *xbee, const char FAR *command)
                   printf( "response is %s\n", response);
 @endcode
 
+               After xbee_atmode_send_batch(), returns each command's response
+               in turn, and the XBee stays in XBEE_MODE_WAIT_RESPONSE until
+               the last one (or an "ERROR" response) arrives.
+
    @param[in]     xbee        XBee device
 
    @param[out]    response    Buffer to hold the response.  Since this function
@@ -450,19 +572,131 @@ int xbee_atmode_read_response( xbee_dev_t *xbee, char FAR *response,
       {
          xbee->mode = XBEE_MODE_IDLE;     // response to ATCN, now in idle mode
       }
+      else if (retval == 0 && xbee->atmode_responses > 1
+         && strcmp( response, "ERROR") != 0)
+      {
+         // more responses to come from a batch, each gets the full timeout
+         --xbee->atmode_responses;
+         xbee->mode_timer = xbee_millisecond_timer();
+      }
       else if (xbee->mode == XBEE_MODE_WAIT_RESPONSE)
       {
+         xbee->atmode_responses = 0;
          xbee->mode = XBEE_MODE_COMMAND;  // got response, still in command mode
       }
       #ifdef XBEE_ATMODE_VERBOSE
          printf( "%s: %s waiting for response, now in %s mode\n", __FUNCTION__,
             retval ? "timeout" : "success",
-            (xbee->mode == XBEE_MODE_IDLE) ? "idle" : "command");
+            (xbee->mode == XBEE_MODE_IDLE) ? "idle" :
+            (xbee->mode == XBEE_MODE_COMMAND) ? "command" : "wait response");
       #endif
    }
 
    return retval;
 }
+
+/*** BeginHeader xbee_atmode_read_batch */
+/*** EndHeader */
+/**
+   @brief      Non-blocking function reads all of the responses to commands
+               sent with xbee_atmode_send_batch().
+
+               Stores the responses one after the other in \a buffer, each
+               null-terminated, in the order of the commands.
+
+               Sample code for using this function:
+@code
+               static const char *commands[] = { "BD7", "WR", "AC" };
+               char buffer[40];
+               const char *p;
+               int bytesread, retval, i;
+
+               xbee_atmode_send_batch( xbee, commands, 3);
+               bytesread = 0;
+               do {
+                  retval = xbee_atmode_read_batch( xbee, buffer,
+                                       sizeof( buffer), &bytesread);
+               } while (retval == -EAGAIN);
+
+               for (p = buffer, i = 0; i < retval; p += strlen( p) + 1, ++i)
+                  printf( "AT%s: %s\n", commands[i], p);
+@endcode
+
+   @param[in]     xbee        XBee device
+
+   @param[out]    buffer      Buffer to hold the responses, including partial
+               responses between calls.
+
+   @param[in]     bufsize     Size of \a buffer.
+
+   @param[in,out] bytesread   Pointer to an integer that is tracking the number
+               of bytes already stored in \a buffer (set to 0 before the first
+               call), including the null terminators of complete responses.
+
+   @retval  >0          received all responses, returns the number of
+                        responses in \a buffer (fewer than the number of
+                        commands if one failed, with "ERROR" as the last)
+   @retval  -EINVAL     Invalid parameter passed to function.
+   @retval  -EPERM      XBee isn't waiting for a response
+   @retval  -ENOSPC     buffer filled before receiving all responses
+   @retval  -EAGAIN     haven't read all responses yet, call function again
+   @retval  -ETIMEDOUT  timed out waiting for a response
+
+   @sa   xbee_atmode_send_batch, xbee_atmode_read_response
+*/
+_xbee_atmode_debug
+int xbee_atmode_read_batch( xbee_dev_t *xbee, char FAR *buffer, int bufsize,
+   int FAR *bytesread)
+{
+   int start, partial, count;
+   int retval;
+
+   if (xbee == NULL || buffer == NULL || bytesread == NULL
+      || *bytesread < 0 || *bytesread >= bufsize)
+   {
+      return -EINVAL;
+   }
+
+   for (;;)
+   {
+      // current response starts after the last complete one
+      for (start = *bytesread; start > 0 && buffer[start - 1] != '\0';
+         --start)
+      {
+      }
+      partial = *bytesread - start;
+
+      retval = xbee_atmode_read_response( xbee, &buffer[start],
+         bufsize - start, &partial);
+      *bytesread = start + partial;
+      if (retval != 0)
+      {
+         return retval;
+      }
+
+      // keep the null terminator, it separates this response from the next
+      ++*bytesread;
+      if (xbee->mode != XBEE_MODE_WAIT_RESPONSE)
+      {
+         break;
+      }
+      if (*bytesread >= bufsize)
+      {
+         return -ENOSPC;
+      }
+   }
+
+   for (count = 0, start = 0; start < *bytesread; ++start)
+   {
+      if (buffer[start] == '\0')
+      {
+         ++count;
+      }
+   }
+
+   return count;
+}
+
 /*** BeginHeader */
 #endif /* XBEE_DEVICE_ENABLE_ATMODE */
 /*** EndHeader */
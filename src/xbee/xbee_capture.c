@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2019 Digi International Inc.,
+ * All rights not expressly granted are reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Digi International Inc. 11001 Bren Road East, Minnetonka, MN 55343
+ * =======================================================================
+ */
+
+/**
+   @addtogroup xbee_device
+   @{
+   @file xbee_capture.c
+
+   Capture frames sent and received by an xbee_dev_t, and replay them
+   (see xbee/capture.h).  Frames are appended to a capture by
+   _xbee_capture_frame() in xbee_device.c.
+*/
+
+/*** BeginHeader */
+#include <string.h>
+
+#include "xbee/platform.h"
+#include "xbee/byteorder.h"
+#include "xbee/capture.h"
+/*** EndHeader */
+
+/*** BeginHeader xbee_capture_init */
+/*** EndHeader */
+/**
+   @brief
+   Start a new capture in a buffer by writing the capture's header.
+
+   @param[out] capture  Capture to initialize.
+   @param[in]  buffer   Memory for the capture, which must remain valid
+                        until the capture is stopped.
+   @param[in]  size     Bytes available at \a buffer.
+
+   @retval  0        Capture ready for xbee_capture_start().
+   @retval  -EINVAL  Invalid parameter, or \a size is too small for the
+                     capture's header.
+*/
+int xbee_capture_init( xbee_capture_t *capture, void FAR *buffer,
+   uint32_t size)
+{
+   xbee_capture_header_t FAR *header = buffer;
+
+   if (capture == NULL || buffer == NULL || size < sizeof *header)
+   {
+      return -EINVAL;
+   }
+
+   memset( capture, 0, sizeof *capture);
+   capture->buffer = buffer;
+   capture->size = size;
+   capture->used = sizeof *header;
+   capture->handle = -1;
+
+   _f_memcpy( header->magic, XBEE_CAPTURE_MAGIC, sizeof header->magic);
+   header->version_le = htole16( XBEE_CAPTURE_VERSION);
+   header->reserved_le = 0;
+
+   return 0;
+}
+
+/*** BeginHeader xbee_capture_start */
+/*** EndHeader */
+/**
+   @brief
+   Record every frame sent and received by an XBee device in a capture,
+   or stop recording.
+
+   @param[in]  xbee     XBee device to capture frames from.
+   @param[in]  capture  Capture set up with xbee_capture_init() (or
+                        xbee_capture_open()), or NULL to stop capturing.
+
+   @retval  0        Capture started (or stopped).
+   @retval  -EINVAL  \a xbee is NULL.
+   @retval  -ENOSYS  Platform doesn't define XBEE_DEV_CAPTURE.
+*/
+int xbee_capture_start( xbee_dev_t *xbee, xbee_capture_t *capture)
+{
+   if (xbee == NULL)
+   {
+      return -EINVAL;
+   }
+
+#if XBEE_DEV_CAPTURE
+   xbee->capture = capture;
+
+   return 0;
+#else
+   XBEE_UNUSED_PARAMETER( capture);
+
+   return -ENOSYS;
+#endif
+}
+
+/*** BeginHeader xbee_capture_next */
+/*** EndHeader */
+/**
+   @brief
+   Walk through the records of a capture.
+
+   @param[in]     log      Capture, starting with its header.
+   @param[in]     length   Bytes available at \a log.
+   @param[in,out] offset   Position in \a log; set to 0 to start with the
+                           first record.  Updated to the next record.
+
+   @return  Next record (with the frame's bytes following it), or NULL at
+            the end of the capture, or if \a log doesn't start with a
+            valid header.
+*/
+const xbee_capture_record_t FAR *xbee_capture_next( const void FAR *log,
+   uint32_t length, uint32_t *offset)
+{
+   const xbee_capture_header_t FAR *header = log;
+   const xbee_capture_record_t FAR *record;
+   uint16_t frame_length;
+
+   if (log == NULL || offset == NULL)
+   {
+      return NULL;
+   }
+
+   if (*offset == 0)
+   {
+      if (length < sizeof *header
+         || memcmp( header->magic, XBEE_CAPTURE_MAGIC, sizeof header->magic)
+         || le16toh( header->version_le) != XBEE_CAPTURE_VERSION)
+      {
+         return NULL;
+      }
+      *offset = sizeof *header;
+   }
+
+   if (*offset > length || length - *offset < sizeof *record)
+   {
+      return NULL;
+   }
+
+   record = (const xbee_capture_record_t FAR *)
+                                    ((const uint8_t FAR *) log + *offset);
+   frame_length = le16toh( record->length_le);
+   if (frame_length == 0 || length - *offset - sizeof *record < frame_length)
+   {
+      // end of the log, or a record cut short while it was written
+      return NULL;
+   }
+
+   *offset += sizeof *record + frame_length;
+
+   return record;
+}
+
+/*** BeginHeader xbee_capture_replay */
+/*** EndHeader */
+/**
+   @brief
+   Pass the received frames in a capture to _xbee_frame_dispatch(), as if
+   \a xbee had just read them.
+
+   Frames the device sent are skipped.  With XBEE_CAPTURE_REPLAY_REALTIME,
+   this function spins on XBEE_DEV_STATS_TIMER() between frames to
+   reproduce the gaps between them, starting with the first frame right
+   away.
+
+   @param[in]  xbee     XBee device to dispatch frames to.
+   @param[in]  log      Capture to replay, starting with its header.
+   @param[in]  length   Bytes available at \a log.
+   @param[in]  flags    XBEE_CAPTURE_REPLAY_FAST or
+                        XBEE_CAPTURE_REPLAY_REALTIME.
+
+   @retval  >=0      Number of frames dispatched.
+   @retval  -EINVAL  Invalid parameter, or \a log isn't a capture.
+*/
+int xbee_capture_replay( xbee_dev_t *xbee, const void FAR *log,
+   uint32_t length, uint16_t flags)
+{
+   const xbee_capture_record_t FAR *record;
+   uint32_t offset, timestamp, due;
+   int frames = 0;
+
+   offset = 0;
+   record = xbee_capture_next( log, length, &offset);
+   if (xbee == NULL || (record == NULL && offset == 0))
+   {
+      return -EINVAL;
+   }
+
+   timestamp = due = 0;
+   for (; record != NULL; record = xbee_capture_next( log, length, &offset))
+   {
+      if (record->direction != XBEE_CAPTURE_DIR_RX)
+      {
+         continue;
+      }
+
+      if (flags & XBEE_CAPTURE_REPLAY_REALTIME)
+      {
+         if (frames == 0)
+         {
+            due = XBEE_DEV_STATS_TIMER();
+         }
+         else
+         {
+            // timestamps wrap, so only use the gap since the last frame
+            due += le32toh( record->timestamp_le) - timestamp;
+            while ((int32_t)(XBEE_DEV_STATS_TIMER() - due) < 0)
+            {
+               // wait for frame's original offset from the first frame
+            }
+         }
+         timestamp = le32toh( record->timestamp_le);
+      }
+
+      _xbee_frame_dispatch( xbee, record + 1, le16toh( record->length_le));
+      ++frames;
+   }
+
+   return frames;
+}
+
+///@}
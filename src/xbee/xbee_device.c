@@ -29,6 +29,7 @@
 
 #include "xbee/platform.h"
 #include "xbee/device.h"
+#include "xbee/capture.h"
 
 #ifndef __DC__
    #define _xbee_device_debug
@@ -38,6 +39,63 @@
    #define _xbee_device_debug __nodebug
 #endif
 
+// update a counter in xbee->stats, if the platform keeps them
+#if XBEE_DEV_STATS
+   #define _XBEE_STATS_ADD(xbee, field, n)   ((xbee)->stats.field += (n))
+#else
+   #define _XBEE_STATS_ADD(xbee, field, n)   ((void) 0)
+#endif
+
+// Access a field shared with the frame parser, which may be running on a
+// reader thread (see xbee_dev_rx_thread_start()).
+//
+// Count a frame (or error) seen by the frame parser.  A reader thread
+// filling the frame queue keeps its own counts, merged into xbee->stats and
+// xbee->rx.skipped by _xbee_rx_counts_merge().
+#if XBEE_DEV_RX_QUEUE_SIZE
+   #define _XBEE_RX_SHARED_LOAD(ptr)         XBEE_ATOMIC_LOAD( ptr)
+   #define _XBEE_RX_SHARED_STORE(ptr, val)   XBEE_ATOMIC_STORE( ptr, val)
+
+   #define _XBEE_RX_COUNT_QUEUED(xbee, field, n) \
+      XBEE_ATOMIC_STORE( &(xbee)->rx_queue.counted.field, \
+                                    (xbee)->rx_queue.counted.field + (n))
+   #define _XBEE_RX_SKIPPED(xbee, n) \
+      ((xbee)->rx_queue.enabled ? _XBEE_RX_COUNT_QUEUED( xbee, skipped, n) \
+                                : (void) ((xbee)->rx.skipped += (n)))
+   #if XBEE_DEV_STATS
+      #define _XBEE_RX_STATS_ADD(xbee, field, n) \
+         ((xbee)->rx_queue.enabled ? _XBEE_RX_COUNT_QUEUED( xbee, field, n) \
+                                   : (void) _XBEE_STATS_ADD( xbee, field, n))
+   #else
+      #define _XBEE_RX_STATS_ADD(xbee, field, n)   ((void) 0)
+   #endif
+#else
+   #define _XBEE_RX_SHARED_LOAD(ptr)         (*(ptr))
+   #define _XBEE_RX_SHARED_STORE(ptr, val)   (*(ptr) = (val))
+   #define _XBEE_RX_SKIPPED(xbee, n)         ((xbee)->rx.skipped += (n))
+   #define _XBEE_RX_STATS_ADD(xbee, field, n)   _XBEE_STATS_ADD( xbee, field, n)
+#endif
+
+// record a frame in xbee->capture, if the platform supports captures and
+// one was started with xbee_capture_start()
+#if XBEE_DEV_CAPTURE
+   #define _XBEE_CAPTURE(xbee, dir, time, header, headerlen, data, datalen) \
+      do { if ((xbee)->capture != NULL) {                                  \
+         _xbee_capture_frame( (xbee)->capture, dir, time,                  \
+                              header, headerlen, data, datalen);           \
+      } } while (0)
+#else
+   #define _XBEE_CAPTURE(xbee, dir, time, header, headerlen, data, datalen) \
+      ((void) 0)
+#endif
+
+// note bytes written to the serial port, for AT mode's pre-escape guard time
+#ifdef XBEE_DEVICE_ENABLE_ATMODE
+   #define _XBEE_TX_NOTE(xbee, bytes)     _xbee_dev_tx_note( xbee, bytes)
+#else
+   #define _XBEE_TX_NOTE(xbee, bytes)     ((void) 0)
+#endif
+
 // Load library for sending and receiving frames over serial port.
 #include "xbee/serial.h"
 #include "wpan/aps.h"
@@ -45,12 +103,47 @@
 
 
 /*** BeginHeader xbee_next_frame_id */
+uint_fast8_t _xbee_frame_id_next_free( xbee_dev_t *xbee);
 /*** EndHeader */
+#if XBEE_DEV_FRAME_ID_TRACKING
+// Return the first frame ID after the last one used that isn't in flight,
+// or 0 if all 255 are in use.
+_xbee_device_debug
+uint_fast8_t _xbee_frame_id_next_free( xbee_dev_t *xbee)
+{
+   const uint32_t *inuse = xbee->frame_ids.inuse;
+   uint_fast16_t id = xbee->frame_id;
+   uint_fast16_t tries;
+
+   for (tries = 0; tries < 255; ++tries)
+   {
+      if (++id > 255)
+      {
+         id = 1;
+      }
+      if (inuse[id >> 5] == 0xFFFFFFFF)
+      {
+         // skip the rest of a full word
+         tries += 31 - (id & 31);
+         id |= 31;
+      }
+      else if (! (inuse[id >> 5] & (UINT32_C(1) << (id & 31))))
+      {
+         return (uint_fast8_t) id;
+      }
+   }
+
+   return 0;
+}
+#endif
+
 /**
    @brief
    Increment and return current frame ID for a given XBee device.
 
-   Frame IDs go from 1 to 255 and then back to 1.
+   Frame IDs go from 1 to 255 and then back to 1.  With
+   XBEE_DEV_FRAME_ID_TRACKING, IDs allocated with xbee_frame_id_alloc() are
+   skipped until they're released (unless all 255 are in flight).
 
    @param[in] xbee   XBee device.
 
@@ -65,6 +158,18 @@ uint8_t xbee_next_frame_id( xbee_dev_t *xbee)
       return 0;
    }
 
+#if XBEE_DEV_FRAME_ID_TRACKING
+   {
+      uint_fast8_t id = _xbee_frame_id_next_free( xbee);
+
+      if (id)
+      {
+         xbee->frame_id = (uint8_t) id;
+         return xbee->frame_id;
+      }
+   }
+#endif
+
    // frame_id ranges from 1 to 255; if incremented to 0, wrap to 1
    if (! ++xbee->frame_id)
    {
@@ -74,6 +179,145 @@ uint8_t xbee_next_frame_id( xbee_dev_t *xbee)
    return xbee->frame_id;
 }
 
+/*** BeginHeader xbee_frame_id_alloc, xbee_frame_id_release */
+/*** EndHeader */
+#if XBEE_DEV_FRAME_ID_TRACKING
+#define _XBEE_FRAME_ID_BIT(id)   (UINT32_C(1) << ((id) & 31))
+
+// Timer callback for a frame ID whose response didn't arrive in time.
+static void _xbee_frame_id_expired( xbee_timer_t FAR *timer)
+{
+   xbee_dev_t *xbee = timer->context;
+   const xbee_dev_frame_id_t *slot = (const xbee_dev_frame_id_t *)
+      ((const char *) timer - offsetof( xbee_dev_frame_id_t, timer));
+   xbee_dev_frame_id_t expired = *slot;
+
+   // release first, so the handler can reuse the ID
+   xbee_frame_id_release( xbee, (uint_fast8_t) (slot - xbee->frame_ids.slot));
+   if (expired.handler != NULL)
+   {
+      expired.handler( xbee, NULL, 0, expired.context);
+   }
+}
+#endif
+
+/**
+   @brief
+   Allocate a frame ID that isn't in flight, and route responses with that
+   ID to \a handler.
+
+   _xbee_frame_dispatch() passes responses that echo a request's frame ID
+   (e.g., AT Command Response, Transmit Status and socket responses) with
+   this ID to \a handler, before the dispatch table and registry (which
+   skip their entries for \a handler).  The ID stays allocated, so a request
+   can get several responses (e.g., ATND), until its owner calls
+   xbee_frame_id_release().
+
+   If \a timeout_ms is not 0 and the ID is still allocated when it
+   elapses, xbee_dev_tick() releases the ID and calls \a handler with a
+   NULL frame and a length of 0 (from a timer on the device's timer wheel).
+
+   @param[in]  xbee        XBee device that will send the request.
+   @param[in]  handler     Function to receive responses, or NULL to only
+                           reserve the ID (responses go through the dispatch
+                           table as usual).
+   @param[in]  context     \a context parameter passed to \a handler.
+   @param[in]  timeout_ms  Milliseconds to wait for a response, or 0 to
+                           wait until released.
+
+   @retval  1-255    Frame ID to use in the request.
+   @retval  -EINVAL  \a xbee is NULL.
+   @retval  -ENOSPC  All 255 frame IDs are in flight.
+   @retval  -ENOSYS  Not compiled with XBEE_DEV_FRAME_ID_TRACKING.
+
+   @sa xbee_frame_id_release(), xbee_next_frame_id()
+*/
+_xbee_device_debug
+int xbee_frame_id_alloc( xbee_dev_t *xbee, xbee_frame_handler_fn handler,
+   void FAR *context, uint32_t timeout_ms)
+{
+#if ! XBEE_DEV_FRAME_ID_TRACKING
+   XBEE_UNUSED_PARAMETER( handler);
+   XBEE_UNUSED_PARAMETER( context);
+   XBEE_UNUSED_PARAMETER( timeout_ms);
+
+   return xbee ? -ENOSYS : -EINVAL;
+#else
+   struct xbee_dev_frame_ids *ids;
+   xbee_dev_frame_id_t *slot;
+   uint_fast8_t id;
+
+   if (xbee == NULL)
+   {
+      return -EINVAL;
+   }
+
+   id = _xbee_frame_id_next_free( xbee);
+   if (! id)
+   {
+      return -ENOSPC;
+   }
+
+   xbee->frame_id = (uint8_t) id;
+   ids = &xbee->frame_ids;
+   ids->inuse[id >> 5] |= _XBEE_FRAME_ID_BIT( id);
+   slot = &ids->slot[id];
+   slot->handler = handler;
+   slot->context = context;
+   if (timeout_ms != 0)
+   {
+      xbee_timer_init( &slot->timer, _xbee_frame_id_expired, xbee);
+      xbee_timer_start( &xbee->wpan_dev.timers, &slot->timer, timeout_ms);
+   }
+
+   return id;
+#endif
+}
+
+/**
+   @brief
+   Release a frame ID allocated with xbee_frame_id_alloc(), once its owner
+   doesn't expect more responses.
+
+   Safe to call from the ID's handler.
+
+   @param[in]  xbee        XBee device the ID was allocated on.
+   @param[in]  frame_id    ID to release.
+
+   @retval  0        Released the ID.
+   @retval  -EINVAL  \a xbee is NULL or \a frame_id is 0.
+   @retval  -ENOENT  \a frame_id wasn't allocated.
+   @retval  -ENOSYS  Not compiled with XBEE_DEV_FRAME_ID_TRACKING.
+*/
+_xbee_device_debug
+int xbee_frame_id_release( xbee_dev_t *xbee, uint_fast8_t frame_id)
+{
+#if ! XBEE_DEV_FRAME_ID_TRACKING
+   XBEE_UNUSED_PARAMETER( frame_id);
+
+   return xbee ? -ENOSYS : -EINVAL;
+#else
+   struct xbee_dev_frame_ids *ids;
+
+   if (xbee == NULL || frame_id == 0 || frame_id > 255)
+   {
+      return -EINVAL;
+   }
+
+   ids = &xbee->frame_ids;
+   if (! (ids->inuse[frame_id >> 5] & _XBEE_FRAME_ID_BIT( frame_id)))
+   {
+      return -ENOENT;
+   }
+
+   ids->inuse[frame_id >> 5] &= ~_XBEE_FRAME_ID_BIT( frame_id);
+   xbee_timer_cancel( &ids->slot[frame_id].timer);
+   memset( &ids->slot[frame_id], 0, sizeof ids->slot[frame_id]);
+
+   return 0;
+#endif
+}
+
 /*** BeginHeader xbee_dev_init */
 /*** EndHeader */
 /**
@@ -143,6 +387,7 @@ int xbee_dev_init( xbee_dev_t *xbee, const xbee_serial_t *serport,
    // set xbee to all zeros, then
    // set up serial port and attempt communications with module
    memset( xbee, 0, sizeof( xbee_dev_t));
+   xbee_timer_wheel_init( &xbee->wpan_dev.timers);
 
    // configuration for serial XBee
    xbee->is_awake = is_awake; // function to read XBee's "ON" pin
@@ -152,6 +397,13 @@ int xbee_dev_init( xbee_dev_t *xbee, const xbee_serial_t *serport,
       reset( xbee, 0);        // take XBee out of reset state
    }
 
+   #if XBEE_DEV_DISPATCH_INDEX_SIZE
+      // index xbee_frame_handlers[] by frame type (once, it's shared by all
+      // devices); _xbee_frame_dispatch() falls back to a linear scan if the
+      // table doesn't fit in the index.
+      _xbee_dispatch_index_build();
+   #endif
+
    xbee->serport = *serport;
    error = xbee_ser_open( &xbee->serport, serport->baudrate);
    if (! error)
@@ -166,6 +418,9 @@ int xbee_dev_init( xbee_dev_t *xbee, const xbee_serial_t *serport,
       xbee->guard_time = 1000;
       xbee->escape_char = '+';
       xbee->idle_timeout = 100;
+
+      // don't know what was sent before we opened the port
+      xbee->tx_idle_timer = xbee_millisecond_timer();
    #endif
 
    return error;
@@ -202,6 +457,59 @@ void xbee_dev_flowcontrol( xbee_dev_t *xbee, bool_t enabled)
 }
 
 
+/*** BeginHeader xbee_dev_api_mode */
+/*** EndHeader */
+/**
+   @brief Select the API mode (the XBee's ATAP setting) used to send and
+         receive frames.
+
+   Unescaped API mode (ATAP=1) is the default set by xbee_dev_init().  Use
+   escaped API mode (ATAP=2) on serial links with software flow control.
+   Change the mode after changing ATAP on the XBee, and before sending
+   another frame.
+
+   @param[in,out]    xbee     XBee to configure
+   @param[in]        mode     XBEE_DEV_API_MODE_UNESCAPED or
+                              XBEE_DEV_API_MODE_ESCAPED
+
+   @retval  0        Mode changed.
+   @retval  -EINVAL  \a xbee is NULL or invalid \a mode.
+   @retval  -ENOSYS  Platform doesn't define XBEE_DEV_API_ESCAPED.
+
+   @sa xbee_dev_init(), xbee_frame_write()
+*/
+_xbee_device_debug
+int xbee_dev_api_mode( xbee_dev_t *xbee, uint_fast8_t mode)
+{
+   if (xbee == NULL || (mode != XBEE_DEV_API_MODE_UNESCAPED
+                        && mode != XBEE_DEV_API_MODE_ESCAPED))
+   {
+      return -EINVAL;
+   }
+
+   if (mode == XBEE_DEV_API_MODE_UNESCAPED)
+   {
+      xbee->flags &= ~XBEE_DEV_FLAG_API_ESCAPED;
+   }
+   else
+   {
+#if XBEE_DEV_API_ESCAPED
+      xbee->flags |= XBEE_DEV_FLAG_API_ESCAPED;
+#else
+      return -ENOSYS;
+#endif
+   }
+#if XBEE_DEV_API_ESCAPED
+   // the parser (possibly on a reader thread) has its own copy, and clears
+   // rx.escape while unescaped
+   _XBEE_RX_SHARED_STORE( &xbee->rx.escaped,
+      (uint8_t) (mode == XBEE_DEV_API_MODE_ESCAPED));
+#endif
+
+   return 0;
+}
+
+
 /*** BeginHeader xbee_dev_dump_settings */
 /*** EndHeader */
 /**
@@ -283,13 +591,16 @@ int xbee_dev_reset( xbee_dev_t *xbee)
    return 0;
 }
 
-/*** BeginHeader xbee_dev_tick */
+/*** BeginHeader xbee_dev_tick, xbee_dev_tick_budget */
 /*** EndHeader */
 /**
    @brief
    Check for newly received frames on an XBee device and dispatch
    them to registered frame handlers.
 
+   Dispatches up to XBEE_DEV_MAX_DISPATCH_PER_TICK frames per call, see
+   xbee_dev_tick_budget() to limit each call by time or bytes instead.
+
    A program with an XBee
    interface needs to call this function often enough to keep up
    with inbound bytes.
@@ -297,6 +608,9 @@ int xbee_dev_reset( xbee_dev_t *xbee)
    Execution time depends greatly on how long each frame handler
    takes to process its frame.
 
+   On platforms with a transmit queue (see XBEE_DEV_TX_QUEUE_SIZE), also
+   sends any queued frames the XBee can now accept.
+
 @warning       This function is NOT re-entrant and will return -EBUSY if it is
                called when already running.
 
@@ -311,6 +625,35 @@ int xbee_dev_reset( xbee_dev_t *xbee)
 */
 _xbee_device_debug
 int xbee_dev_tick( xbee_dev_t *xbee)
+{
+   return xbee_dev_tick_budget( xbee, NULL);
+}
+
+/**
+   @brief
+   Version of xbee_dev_tick() that dispatches frames until it has used up
+   a time and/or byte budget, instead of a fixed number of frames.
+
+   Stops after the first frame that reaches either limit, so always makes
+   progress.  While more than \c budget->high_water bytes are waiting to
+   be parsed (see _xbee_rx_backlog()), it keeps dispatching regardless of
+   the budget, to catch up before the serial port's buffer overflows.  A
+   cooperative scheduler can pass a small budget to bound the time spent
+   in each call when the XBee is quiet.
+
+   @param[in]  xbee     XBee device to check for, and then dispatch, new
+                        frames.
+   @param[in]  budget   Limits for this call, or NULL to stop after
+                        XBEE_DEV_MAX_DISPATCH_PER_TICK frames.  Leave all
+                        limits at 0 to dispatch every complete frame
+                        available.
+
+   @return  Same values as xbee_dev_tick().
+
+   @see xbee_dev_budget_t
+*/
+_xbee_device_debug
+int xbee_dev_tick_budget( xbee_dev_t *xbee, const xbee_dev_budget_t *budget)
 {
    int frames;
 
@@ -334,280 +677,2351 @@ int xbee_dev_tick( xbee_dev_t *xbee)
 
    INTERRUPT_ENABLE;
 
-   frames = _xbee_frame_load( xbee);
+#if XBEE_DEV_TX_QUEUE_SIZE
+   // send frames that the XBee couldn't accept earlier
+   _xbee_frame_queue_send( xbee);
+#endif
+
+#if XBEE_DEV_RX_QUEUE_SIZE
+   if (xbee->rx_queue.enabled)
+   {
+      // reader thread has already read and validated frames
+      frames = _xbee_frame_drain( xbee, budget);
+   }
+   else
+#endif
+   {
+      frames = _xbee_frame_load_budget( xbee, budget);
+   }
+
+   // after dispatching, in case responses just arrived
+   xbee_timer_wheel_run( &xbee->wpan_dev.timers);
    xbee->flags &= ~XBEE_DEV_FLAG_IN_TICK;
 
    return frames;
 }
 
 
-/*** BeginHeader _xbee_dispatch_table_dump */
+/*** BeginHeader xbee_ser_wait */
+/*** EndHeader */
+#ifndef XBEE_SER_HAS_WAIT
+// see xbee/serial.h for documentation
+// Generic version for platforms that can't sleep on the serial port, reports
+// data as ready so the caller goes right back to polling.
+_xbee_device_debug
+int xbee_ser_wait( xbee_serial_t *serial, int32_t timeout_ms)
+{
+   XBEE_UNUSED_PARAMETER( timeout_ms);
+
+   return xbee_ser_invalid( serial) ? -EINVAL : 1;
+}
+#endif
+
+/*** BeginHeader xbee_ser_tx_wait */
+/*** EndHeader */
+#ifndef XBEE_SER_HAS_WAIT
+// see xbee/serial.h for documentation
+// Generic version for platforms that can't sleep on the serial port, reports
+// the port as ready so the caller goes right back to writing.
+_xbee_device_debug
+int xbee_ser_tx_wait( xbee_serial_t *serial, int32_t timeout_ms)
+{
+   XBEE_UNUSED_PARAMETER( timeout_ms);
+
+   return xbee_ser_invalid( serial) ? -EINVAL : 1;
+}
+#endif
+
+/*** BeginHeader xbee_ser_low_latency */
+/*** EndHeader */
+#ifndef XBEE_SER_HAS_LOW_LATENCY
+// see xbee/serial.h for documentation
+// Generic version for platforms without a low-latency setting.
+_xbee_device_debug
+int xbee_ser_low_latency( xbee_serial_t *serial, bool_t enabled)
+{
+   XBEE_UNUSED_PARAMETER( enabled);
+
+   return xbee_ser_invalid( serial) ? -EINVAL : -ENOSYS;
+}
+#endif
+
+/*** BeginHeader xbee_dev_wait */
 /*** EndHeader */
 /**
-   @internal
-   Dump the contents of the frame dispatch table for XBee
-   device \a xbee.  Must have XBEE_DEVICE_VERBOSE defined.
+   @brief
+   Sleep until there are bytes for xbee_dev_tick() to process, or until
+   \a timeout_ms milliseconds have elapsed.
 
-   @param[in]  xbee  XBee device of table to dump.
+   Programs can call this function between ticks instead of spinning on
+   xbee_dev_tick() or wpan_tick().  Pass the shortest of the next timeouts
+   reported by xbee_cmd_next_timeout() and wpan_next_timeout() (see
+   XBEE_WAIT_MIN()) so pending requests still expire on time.
+
+   Programs with their own event loop can instead watch the serial port's
+   file descriptor (\c xbee->serport.fd on POSIX).  They should call
+   xbee_dev_wait() with a timeout of 0 before sleeping, since xbee_dev_tick()
+   may have read more bytes from the serial port than it dispatched.
+
+@param[in]  xbee        XBee device to wait on.
+@param[in]  timeout_ms  Maximum time to wait, or XBEE_WAIT_FOREVER.
+
+@retval  1        Bytes are available, call xbee_dev_tick().
+@retval  0        Timeout elapsed without any bytes arriving.
+@retval  -EINVAL  If \a xbee isn't a valid device structure.
+@retval  -EIO     Error waiting on serial port.
+
+@sa xbee_ser_wait(), xbee_cmd_next_timeout(), wpan_next_timeout()
 */
 _xbee_device_debug
-void _xbee_dispatch_table_dump( const xbee_dev_t *xbee)
+int xbee_dev_wait( xbee_dev_t *xbee, int32_t timeout_ms)
 {
-#ifndef XBEE_DEVICE_VERBOSE
-   // empty/ignored function unless VERBOSE output enabled
-   XBEE_UNUSED_PARAMETER( xbee);
-#else
-   uint_fast8_t i;
-   const xbee_dispatch_table_entry_t *entry;
-
    if (! xbee)
    {
-      return;
+      return -EINVAL;
    }
 
-   puts( "Index\tType\tID\tHandler\tContext");
-   entry = xbee_frame_handlers;
-   for (i = 0; entry->frame_type != 0xFF; ++i, ++entry)
+#if XBEE_DEV_RX_QUEUE_SIZE
+   if (xbee->rx_queue.enabled)
    {
-      if (entry->frame_type)
+      // Frames waiting in the queue?  If not, the serial port becoming
+      // readable means the reader thread will have a frame shortly.
+      if (xbee->rx_queue.head != XBEE_ATOMIC_LOAD( &xbee->rx_queue.tail))
       {
-         printf( "%3d:\t0x%02x\t0x%02x\t0x%p\t%" PRIpFAR "\n", i,
-            entry->frame_type, entry->frame_id, entry->handler, entry->context);
-      }
-      else
-      {
-         printf( "%3d:\t[empty]\n", i);
+         return 1;
       }
+      return xbee_ser_wait( &xbee->serport, timeout_ms);
+   }
+#endif
+
+#if XBEE_DEV_RX_STAGING_SIZE
+   // bytes already read from the serial port, but not yet processed
+   if (xbee->staging.head != xbee->staging.tail)
+   {
+      return 1;
    }
 #endif
+
+   return xbee_ser_wait( &xbee->serport, timeout_ms);
 }
 
-/*** BeginHeader _xbee_checksum */
+
+/*** BeginHeader xbee_dev_stats_snapshot, xbee_dev_stats_reset,
+   xbee_dev_stats_dump, xbee_dev_histogram_percentile, _xbee_histogram_add,
+   _xbee_rx_counts_merge */
 /*** EndHeader */
+#if XBEE_DEV_RX_QUEUE_SIZE
+// add the reader thread's count of <field> since the last merge to <total>
+#define _XBEE_RX_MERGE(xbee, total, field)                                 \
+   do {                                                                    \
+      uint32_t counted = XBEE_ATOMIC_LOAD( &(xbee)->rx_queue.counted.field); \
+      (total) += counted - (xbee)->rx_queue.merged.field;                  \
+      (xbee)->rx_queue.merged.field = counted;                             \
+   } while (0)
+
 /**
    @internal
    @brief
-   Calculate the checksum for an XBee frame.
+   Add the frames and errors counted by a reader thread (see
+   xbee_dev_rx_thread_start()) since the last merge to \c xbee->stats and
+   \c xbee->rx.skipped.
 
-               This function actually
-               subtracts bytes from 0xFF, in order to determine the proper
-               checksum byte so all bytes added together result in 0x00.
+   Call from the thread that dispatches the queued frames.  The reader
+   thread only writes its own counters, so it never races with code
+   reading or clearing the device's statistics.
 
-               Frame checksums start with the frame type (first byte after
-               frame length).
+   @param[in]  xbee  XBee device with a frame queue.
+*/
+_xbee_device_debug
+void _xbee_rx_counts_merge( xbee_dev_t *xbee)
+{
+   _XBEE_RX_MERGE( xbee, xbee->rx.skipped, skipped);
+#if XBEE_DEV_STATS
+   _XBEE_RX_MERGE( xbee, xbee->stats.frames_in, frames_in);
+   _XBEE_RX_MERGE( xbee, xbee->stats.bytes_in, bytes_in);
+   _XBEE_RX_MERGE( xbee, xbee->stats.checksum_errors, checksum_errors);
+   _XBEE_RX_MERGE( xbee, xbee->stats.bad_lengths, bad_lengths);
+#endif
+}
+#endif
 
-               If calculating a checksum for an outgoing packet, sum all of the
-               bytes using this function, and send the low byte of the result.
+/**
+   @internal
+   @brief
+   Record a time in a histogram.
 
-               If verifying a received packet, summing all of the bytes after
-               the length, including the packet's checksum byte, should result
-               in 0x00.
+   @param[in,out] hist  Histogram to update.
+   @param[in]     usec  Time in microseconds.
+*/
+_xbee_device_debug
+void _xbee_histogram_add( xbee_dev_histogram_t FAR *hist, uint32_t usec)
+{
+   uint_fast8_t index;
+   uint32_t value;
 
-               Should only be used internally by this library.
+   // bucket is the number of significant bits in <usec>
+   for (index = 0, value = usec; value && index < XBEE_DEV_HISTOGRAM_BUCKETS - 1;
+      value >>= 1)
+   {
+      ++index;
+   }
+   ++hist->bucket[index];
+   if (usec > hist->max)
+   {
+      hist->max = usec;
+   }
+}
 
-   @param[in]  bytes    Buffer of bytes to add to sum, assumed non-NULL.
+/**
+   @brief
+   Copy a device's statistics.
 
-   @param[in]  length   Number of bytes to add.
+   Call from the thread that calls xbee_dev_tick().  Counts from a reader
+   thread (see xbee_dev_rx_thread_start()) include frames it has queued but
+   xbee_dev_tick() hasn't dispatched yet.  Programs sampling the statistics
+   at intervals can follow each snapshot with xbee_dev_stats_reset().
 
-   @param[in]  initial  Starting checksum value.  Use 0xFF to start or the
-                        result  of the previous call if summing multiple
-                        blocks of data.
+   @param[in]  xbee   XBee device to read.
+   @param[out] stats  Copy of the device's statistics.
 
-   @return  Value from 0x00 to 0xFF that, when added to all bytes previously
-               checksummed, results in a low byte of 0x00.
+   @retval  0        Copied statistics.
+   @retval  -EINVAL  Invalid parameter.
+   @retval  -ENOSYS  Platform doesn't define XBEE_DEV_STATS.
 
+   @sa xbee_dev_stats_dump()
 */
-// Function name in parenthesis so platforms can provide an inline assembly
-// version as a replacement, and include a function macro to override this
-// function in their platform.h.  See Rabbit
 _xbee_device_debug
-uint8_t (_xbee_checksum)( const void FAR *bytes, uint16_t length,
-   uint_fast8_t initial)
+int xbee_dev_stats_snapshot( xbee_dev_t *xbee, xbee_dev_stats_t FAR *stats)
 {
-   uint16_t i;
-   uint8_t checksum;
-   const char FAR *p;
-
-   checksum = initial;
-   for (p = (const char FAR *)bytes, i = length; i; ++p, --i)
+   if (xbee == NULL || stats == NULL)
    {
-      checksum -= *p;
+      return -EINVAL;
    }
 
-   return checksum;
+#if XBEE_DEV_STATS
+   #if XBEE_DEV_RX_QUEUE_SIZE
+      _xbee_rx_counts_merge( xbee);
+   #endif
+   _f_memcpy( stats, &xbee->stats, sizeof *stats);
+   stats->skipped = xbee->rx.skipped;
+
+   return 0;
+#else
+   return -ENOSYS;
+#endif
 }
 
-/*** BeginHeader xbee_frame_write */
-/*** EndHeader */
 /**
    @brief
-   Copies a frame into the transmit serial buffer to send to an
-   XBee module.
+   Clear a device's statistics.  Call from the thread that calls
+   xbee_dev_tick().
 
-   Header should include bytes as they will be sent to the XBee.  Function
-   accepts separate header and data to limit the amount of copying necessary
-   to send requests.
+   @param[in]  xbee   XBee device to reset.
 
-   This function should only be called after \a xbee has been initialized by
-   calling xbee_dev_init().
+   @retval  0        Statistics cleared.
+   @retval  -EINVAL  Invalid parameter.
+   @retval  -ENOSYS  Platform doesn't define XBEE_DEV_STATS.
+*/
+_xbee_device_debug
+int xbee_dev_stats_reset( xbee_dev_t *xbee)
+{
+   if (xbee == NULL)
+   {
+      return -EINVAL;
+   }
 
-   By default, xbee_frame_write() checks the /CTS signal from the XBee before
-   attempting to send, and will return -EBUSY if the XBee has deasserted CTS.
-   Use xbee_dev_flowcontrol() to disable this check (necessary on a system
-   without a connection to the XBee module's /CTS signal).
+#if XBEE_DEV_STATS
+   #if XBEE_DEV_RX_QUEUE_SIZE
+      // drop the reader thread's counts so far too
+      _xbee_rx_counts_merge( xbee);
+   #endif
+   xbee->rx.skipped = 0;
+   _f_memset( &xbee->stats, 0, sizeof xbee->stats);
 
-   @param[in]  xbee        XBee device to send to.
+   return 0;
+#else
+   return -ENOSYS;
+#endif
+}
 
-   @param[in]  header      Pointer to the header to send.  Header starts with
-                           the frame type (this function will pre-pend the
-                           0x7E start-of-frame and 16-bit length).
-                           Pass \c NULL if there isn't a header and the entire
-                           frame is in the payload (\a data and \a datalen).
+/**
+   @brief
+   Estimate a percentile of the times in a histogram.
 
-   @param[in]  headerlen   Number of header bytes to send (starting with
-                           address passed in \a header).  Ignored if
-                           \a header is \c NULL.
+   @param[in]  hist     Histogram to check.
+   @param[in]  percent  Percentile to find (1 to 100).
 
-   @param[in]  data        Address of frame payload or \c NULL if the entire
-                           frame content is stored in the header bytes
-                           (\a header and \a headerlen).
+   @return  Upper bound of the bucket holding the percentile, in
+            microseconds (capped at the longest time recorded), or 0 if the
+            histogram is empty.
+*/
+_xbee_device_debug
+uint32_t xbee_dev_histogram_percentile( const xbee_dev_histogram_t FAR *hist,
+   uint_fast8_t percent)
+{
+   uint_fast8_t index;
+   uint32_t total, count, limit;
 
-   @param[in]  datalen     Number of payload bytes to send (starting with
-                           address passed in \a data).  Ignored if \a data
-                           is \c NULL.
+   for (total = 0, index = 0; index < XBEE_DEV_HISTOGRAM_BUCKETS; ++index)
+   {
+      total += hist->bucket[index];
+   }
+   if (total == 0)
+   {
+      return 0;
+   }
 
-   @param[in]  flags       Optional flags
-               - XBEE_WRITE_FLAG_NONE
+   // rank of the percentile, rounding up (done in 2 parts to avoid overflow)
+   limit = total / 100 * percent
+                           + ((total % 100) * percent + 99) / 100;
+   for (count = 0, index = 0; index < XBEE_DEV_HISTOGRAM_BUCKETS - 1; ++index)
+   {
+      count += hist->bucket[index];
+      if (count >= limit)
+      {
+         break;
+      }
+   }
 
-   @retval  0           Successfully queued frame in transmit serial buffer.
-   @retval  -EINVAL     \a xbee is \c NULL or invalid flags passed
-   @retval  -ENODATA    No data to send (\a headerlen + \a datalen == 0).
-   @retval  -EBUSY      Transmit serial buffer is full, or XBee is not
-                        accepting serial data (deasserting /CTS signal).
-   @retval  -EMSGSIZE   Serial buffer can't ever send a frame this large.
+   // last bucket has no upper bound
+   if (index == XBEE_DEV_HISTOGRAM_BUCKETS - 1
+      || ((UINT32_C(1) << index) - 1) > hist->max)
+   {
+      return hist->max;
+   }
+   return (UINT32_C(1) << index) - 1;
+}
 
-   @sa xbee_dev_init(), xbee_serial_write(), xbee_dev_flowcontrol()
-*/
-#include "xbee/byteorder.h"
+/**
+   @brief
+   Print statistics copied by xbee_dev_stats_snapshot() to stdout.
 
+   @param[in]  stats  Statistics to print.
+*/
 _xbee_device_debug
-int xbee_frame_write( xbee_dev_t *xbee, const void FAR *header,
-   uint16_t headerlen, const void FAR *data, uint16_t datalen, uint16_t flags)
+void xbee_dev_stats_dump( const xbee_dev_stats_t FAR *stats)
 {
-   XBEE_PACKED(, {
-      uint8_t  start;
-      uint16_t length_be;
-   }) prefix;
+   static const struct {
+      const char *name;
+      size_t      offset;
+   } hist[] = {
+      { "handler time", offsetof( xbee_dev_stats_t, handler_time) },
+      { "rx latency", offsetof( xbee_dev_stats_t, rx_latency) },
+      { "tx latency", offsetof( xbee_dev_stats_t, tx_latency) },
+   };
+   const xbee_dev_histogram_t FAR *h;
+   uint_fast8_t i;
+   unsigned type;
+
+   printf( "frames in: %" PRIu32 " (%" PRIu32 " bytes)  out: %" PRIu32
+      " (%" PRIu32 " bytes)\n", stats->frames_in, stats->bytes_in,
+      stats->frames_out, stats->bytes_out);
+   printf( "bad checksum: %" PRIu32 "  bad length: %" PRIu32
+      "  skipped: %" PRIu32 " bytes\n", stats->checksum_errors,
+      stats->bad_lengths, stats->skipped);
+   printf( "dispatch limited: %" PRIu32 "  tx busy: %" PRIu32
+      "  tx dropped: %" PRIu32 "\n", stats->dispatch_limited,
+      stats->tx_busy, stats->tx_dropped);
+
+   for (i = 0; i < _TABLE_ENTRIES( hist); ++i)
+   {
+      h = (const xbee_dev_histogram_t FAR *)
+                                 ((const char FAR *)stats + hist[i].offset);
+      printf( "%s (us): p50 %" PRIu32 "  p90 %" PRIu32 "  p99 %" PRIu32
+         "  max %" PRIu32 "\n", hist[i].name,
+         xbee_dev_histogram_percentile( h, 50),
+         xbee_dev_histogram_percentile( h, 90),
+         xbee_dev_histogram_percentile( h, 99), h->max);
+   }
 
-   int cts, free, used, framesize;
-   uint8_t checksum = 0xFF;
-   #ifdef XBEE_DEVICE_VERBOSE
-      uint8_t type, id;       // for debug messages
-   #endif
+   for (type = 0; type < 256; ++type)
+   {
+      if (stats->handler[type].frames)
+      {
+         printf( "type 0x%02X: %" PRIu32 " frames, %" PRIu32 " us avg\n",
+            type, stats->handler[type].frames,
+            stats->handler[type].time / stats->handler[type].frames);
+      }
+   }
+}
 
-   // flags parameter included in API for future expansion; unused for now
-   XBEE_UNUSED_PARAMETER( flags);
 
-   if (xbee == NULL || xbee_ser_invalid( &xbee->serport))
+/*** BeginHeader _xbee_capture_frame */
+/*** EndHeader */
+/**
+   @internal
+   @brief
+   Append a frame to a capture, as a header and data like
+   xbee_frame_write().  Counts the frame in \c capture->dropped if it
+   doesn't fit.
+
+   @param[in,out] capture     Capture to append to.
+   @param[in]     direction   XBEE_CAPTURE_DIR_RX or XBEE_CAPTURE_DIR_TX.
+   @param[in]     timestamp   XBEE_DEV_STATS_TIMER() value for the frame.
+   @param[in]     header      First part of the frame, starting with the
+                              frame type.  Ignored if \a headerlen is 0.
+   @param[in]     headerlen   Number of bytes in \a header.
+   @param[in]     data        Rest of the frame.  Ignored if \a datalen
+                              is 0.
+   @param[in]     datalen     Number of bytes in \a data.
+*/
+_xbee_device_debug
+void _xbee_capture_frame( xbee_capture_t *capture, uint_fast8_t direction,
+   uint32_t timestamp, const void FAR *header, uint16_t headerlen,
+   const void FAR *data, uint16_t datalen)
+{
+   xbee_capture_record_t FAR *record;
+   uint8_t FAR *p;
+
+   if (capture->size - capture->used
+                        < sizeof *record + (uint32_t) headerlen + datalen)
    {
-      cts = -EINVAL;
+      ++capture->dropped;
+      return;
    }
-   else if (xbee->flags & XBEE_DEV_FLAG_USE_FLOWCONTROL)
+
+   record = (xbee_capture_record_t FAR *) &capture->buffer[capture->used];
+   record->timestamp_le = htole32( timestamp);
+   record->direction = (uint8_t) direction;
+   record->reserved = 0;
+   p = (uint8_t FAR *) (record + 1);
+   if (headerlen)
    {
-      cts = xbee_ser_get_cts( &xbee->serport);
+      _f_memcpy( p, header, headerlen);
+      p += headerlen;
    }
-   else
+   if (datalen)
    {
-      cts = 1;
+      _f_memcpy( p, data, datalen);
+      p += datalen;
    }
 
-   if (cts == -EINVAL)
-   {
-      // <xbee> is NULL, or xbee->serport is not valid
-      #ifdef XBEE_DEVICE_VERBOSE
-         printf( "%s: return -EINVAL (xbee = 0x%p, cts = %d)\n",
-            __FUNCTION__, xbee, cts);
-      #endif
-      return -EINVAL;
-   }
+   // Set the length last, so a reader of a mapped capture that's still
+   // being written only sees complete records.
+   record->length_le = htole16( headerlen + datalen);
+   capture->used = (uint32_t) (p - capture->buffer);
+}
 
-   if (! header)
+
+/*** BeginHeader _xbee_dispatch_table_dump */
+/*** EndHeader */
+/**
+   @internal
+   Dump the contents of the frame dispatch table for XBee
+   device \a xbee.  Must have XBEE_DEVICE_VERBOSE defined.
+
+   @sa _xbee_dispatch_index_dump()
+
+   @param[in]  xbee  XBee device of table to dump.
+*/
+_xbee_device_debug
+void _xbee_dispatch_table_dump( const xbee_dev_t *xbee)
+{
+#ifndef XBEE_DEVICE_VERBOSE
+   // empty/ignored function unless VERBOSE output enabled
+   XBEE_UNUSED_PARAMETER( xbee);
+#else
+   uint_fast8_t i;
+   const xbee_dispatch_table_entry_t *entry;
+
+   if (! xbee)
    {
-      headerlen = 0;    // if header is NULL, set headerlen to 0
+      return;
    }
-   if (! data)
+
+   puts( "Index\tType\tID\tHandler\tContext");
+   entry = xbee_frame_handlers;
+   for (i = 0; entry->frame_type != 0xFF; ++i, ++entry)
    {
-      datalen = 0;      // if data is NULL, set datalen to 0
+      if (entry->frame_type)
+      {
+         printf( "%3d:\t0x%02x\t0x%02x\t0x%p\t%" PRIpFAR "\n", i,
+            entry->frame_type, entry->frame_id, entry->handler, entry->context);
+      }
+      else
+      {
+         printf( "%3d:\t[empty]\n", i);
+      }
    }
-   if (! (headerlen || datalen))
+#endif
+}
+
+/*** BeginHeader _xbee_dispatch_index_build, _xbee_dispatch_index_dump */
+#if XBEE_DEV_DISPATCH_INDEX_SIZE
+/// Index of xbee_frame_handlers[] used by _xbee_frame_dispatch().
+typedef struct xbee_dispatch_index_t {
+   bool_t   built;               ///< index is valid
+   uint16_t used;                ///< entries of \c handler[] in use
+   /// For each frame type, offset in \c handler[] of matching handlers...
+   uint8_t  start[256];
+   /// ...and number of matching handlers (including wildcard entries).
+   uint8_t  count[256];
+   /// Offsets in xbee_frame_handlers[] of handlers, in table order.
+   uint8_t  handler[XBEE_DEV_DISPATCH_INDEX_SIZE];
+} xbee_dispatch_index_t;
+extern xbee_dispatch_index_t _xbee_dispatch_index;
+#endif
+/*** EndHeader */
+#if XBEE_DEV_DISPATCH_INDEX_SIZE
+xbee_dispatch_index_t _xbee_dispatch_index;
+
+// Append handlers for <frame_type> (and wildcard handlers) to the index.
+// Returns -ENOSPC if the index is full.
+_xbee_device_debug
+int _xbee_dispatch_index_span( uint_fast8_t frame_type)
+{
+   xbee_dispatch_index_t *index = &_xbee_dispatch_index;
+   const xbee_dispatch_table_entry_t *entry;
+   uint_fast8_t offset;
+   uint16_t start = index->used;
+
+   for (entry = xbee_frame_handlers, offset = 0; entry->frame_type != 0xFF;
+      ++entry, ++offset)
    {
-      #ifdef XBEE_DEVICE_VERBOSE
-         printf( "%s: return -ENODATA (headerlen = %u, datalen = %u)\n",
-            __FUNCTION__, headerlen, datalen);
-      #endif
-      return -ENODATA;
+      if (! entry->frame_type || entry->frame_type == frame_type)
+      {
+         if (index->used == XBEE_DEV_DISPATCH_INDEX_SIZE)
+         {
+            return -ENOSPC;
+         }
+         index->handler[index->used++] = offset;
+      }
    }
+   index->start[frame_type] = (uint8_t) start;
+   index->count[frame_type] = (uint8_t) (index->used - start);
 
-   // Make sure XBee is asserting CTS and verify that the transmit serial buffer
-   // has enough room for the frame (payload + 3-byte header + 1-byte checksum).
-   free = xbee_ser_tx_free( &xbee->serport);
-   used = xbee_ser_tx_used( &xbee->serport);
-   framesize = headerlen + datalen + 3 + 1;
-   if (! cts || free < framesize)
+   return 0;
+}
+#endif
+
+/**
+   @internal
+   Build the per-frame-type index of xbee_frame_handlers[] used by
+   _xbee_frame_dispatch().  Called by xbee_dev_init(), only builds the index
+   once since all devices share the table.
+
+   Each frame type maps to a span of handler references, in table order,
+   that includes the wildcard (frame type 0) entries.  Frame types without
+   specific handlers share a single span of the wildcard entries.
+
+   @retval  0        index is ready
+   @retval  -ENOSPC  table is too large for XBEE_DEV_DISPATCH_INDEX_SIZE;
+                     _xbee_frame_dispatch() will scan the table
+   @retval  -ENOSYS  not compiled with XBEE_DEV_DISPATCH_INDEX_SIZE
+*/
+_xbee_device_debug
+int _xbee_dispatch_index_build( void)
+{
+#if ! XBEE_DEV_DISPATCH_INDEX_SIZE
+   return -ENOSYS;
+#else
+   xbee_dispatch_index_t *index = &_xbee_dispatch_index;
+   const xbee_dispatch_table_entry_t *entry;
+   uint_fast8_t wild_start, wild_count;
+   uint16_t type;
+   int error;
+
+   if (index->built)
    {
-      #ifdef XBEE_DEVICE_VERBOSE
-         printf( "%s: return -EBUSY (cts = %s, free = %d, framesize = %d)\n",
-            __FUNCTION__, cts ? "yes" : "no", free, framesize);
-      #endif
-      return (framesize - free > used) ? -EMSGSIZE : -EBUSY;
+      return 0;
    }
 
-   #ifdef XBEE_DEVICE_VERBOSE
-      type = *(const char FAR *) (headerlen ? header : data);
-      if (headerlen < 2)
+   // offsets into the table are stored as uint8_t
+   for (entry = xbee_frame_handlers, type = 0; entry->frame_type != 0xFF;
+      ++entry)
+   {
+      if (++type > 255)
       {
-         // if headerlen is 1, id is first byte of data, otherwise second byte
-         id = ((const char FAR *)data)[headerlen ? 0 : 1];
+         return -ENOSPC;
       }
-      else
+   }
+
+   // Start with the wildcard-only span (as if for frame type 0), shared by
+   // frame types that don't have any specific handlers.
+   index->used = 0;
+   error = _xbee_dispatch_index_span( 0);
+   wild_start = index->start[0];
+   wild_count = index->count[0];
+
+   for (type = 1; ! error && type < 256; ++type)
+   {
+      index->start[type] = wild_start;
+      index->count[type] = wild_count;
+      for (entry = xbee_frame_handlers; entry->frame_type != 0xFF; ++entry)
       {
-         id = ((const char FAR *)header)[1];
+         if (entry->frame_type == type)
+         {
+            error = _xbee_dispatch_index_span( (uint_fast8_t) type);
+            break;
+         }
       }
-      printf( "%s: frame type 0x%02x, id 0x%02x (%u-byte payload)\n",
-         __FUNCTION__, type, id, headerlen + datalen);
+   }
+
+   #ifdef XBEE_DEVICE_VERBOSE
+      printf( "%s: %s (%u of %u entries used)\n", __FUNCTION__,
+         error ? "table too large" : "built", index->used,
+         XBEE_DEV_DISPATCH_INDEX_SIZE);
    #endif
 
-   // Send 0x7E (start frame marker) and 16-bit length
-   prefix.start = 0x7E;
-   prefix.length_be = htobe16( headerlen + datalen);
-   xbee_ser_write( &xbee->serport, &prefix, 3);
+   index->built = (error == 0);
+   return error;
+#endif
+}
 
-   // Send <headerlen> bytes from <header> if it is not NULL
-   if (headerlen)
+/**
+   @internal
+   Dump the per-frame-type index of xbee_frame_handlers[] built by
+   _xbee_dispatch_index_build().  Must have XBEE_DEVICE_VERBOSE defined.
+*/
+_xbee_device_debug
+void _xbee_dispatch_index_dump( void)
+{
+#if defined XBEE_DEVICE_VERBOSE && XBEE_DEV_DISPATCH_INDEX_SIZE
+   const xbee_dispatch_index_t *index = &_xbee_dispatch_index;
+   uint16_t type;
+   uint_fast8_t i;
+
+   if (! index->built)
    {
-      xbee_ser_write( &xbee->serport, header, headerlen);
-      checksum = _xbee_checksum( header, headerlen, checksum);
+      puts( "Dispatch index not built.");
+      return;
    }
 
-   // Send <datalen> bytes from <data> if it is not NULL
-   if (datalen)
+   printf( "Dispatch index: %u of %u entries used\n", index->used,
+      XBEE_DEV_DISPATCH_INDEX_SIZE);
+   puts( "Type\tStart\tCount\tTable Indexes");
+   for (type = 0; type < 256; ++type)
    {
-      xbee_ser_write( &xbee->serport, data, datalen);
-      checksum = _xbee_checksum( data, datalen, checksum);
+      // skip frame types that only have the wildcard span
+      if (type && index->start[type] == index->start[0]
+         && index->count[type] == index->count[0])
+      {
+         continue;
+      }
+      printf( "0x%02x\t%3u\t%3u\t", type, index->start[type],
+         index->count[type]);
+      for (i = 0; i < index->count[type]; ++i)
+      {
+         printf( " %u", index->handler[index->start[type] + i]);
+      }
+      putchar( '\n');
    }
+#endif
+}
+
+/*** BeginHeader _xbee_checksum */
+/*** EndHeader */
+/**
+   @internal
+   @brief
+   Calculate the checksum for an XBee frame.
+
+               This function actually
+               subtracts bytes from 0xFF, in order to determine the proper
+               checksum byte so all bytes added together result in 0x00.
+
+               Frame checksums start with the frame type (first byte after
+               frame length).
+
+               If calculating a checksum for an outgoing packet, sum all of the
+               bytes using this function, and send the low byte of the result.
+
+               If verifying a received packet, summing all of the bytes after
+               the length, including the packet's checksum byte, should result
+               in 0x00.
+
+               Should only be used internally by this library.
+
+   @param[in]  bytes    Buffer of bytes to add to sum, assumed non-NULL.
 
-   // Send 1-byte checksum of bytes in payload
-   xbee_ser_write( &xbee->serport, &checksum, 1);
+   @param[in]  length   Number of bytes to add.
+
+   @param[in]  initial  Starting checksum value.  Use 0xFF to start or the
+                        result  of the previous call if summing multiple
+                        blocks of data.
+
+   @return  Value from 0x00 to 0xFF that, when added to all bytes previously
+               checksummed, results in a low byte of 0x00.
+
+*/
+// Function name in parenthesis so platforms can provide an inline assembly
+// version as a replacement, and include a function macro to override this
+// function in their platform.h.  See Rabbit
+_xbee_device_debug
+uint8_t (_xbee_checksum)( const void FAR *bytes, uint16_t length,
+   uint_fast8_t initial)
+{
+   uint16_t i;
+   uint8_t checksum;
+   const char FAR *p;
+
+   checksum = initial;
+   for (p = (const char FAR *)bytes, i = length; i; ++p, --i)
+   {
+      checksum -= *p;
+   }
+
+   return checksum;
+}
+
+/*** BeginHeader _xbee_checksum_copy */
+/*** EndHeader */
+/**
+   @internal
+   @brief
+   Copy bytes for an XBee frame and update its checksum in a single pass.
+
+   Same as a memcpy() of \a src to \a dest, followed by
+   _xbee_checksum( src, length, initial), but only reads the data once.
+   Used when staging frames in the transmit queue and when copying received
+   frames out of the staging ring.
+
+   @param[out] dest     Buffer to copy \a length bytes to.
+   @param[in]  src      Buffer of bytes to copy and add to sum.
+   @param[in]  length   Number of bytes to copy and add.
+   @param[in]  initial  Starting checksum value (see _xbee_checksum()).
+
+   @return  Updated checksum (see _xbee_checksum()).
+*/
+// Function name in parenthesis so platforms can provide a vectorized
+// replacement along with their version of _xbee_checksum().  See POSIX.
+_xbee_device_debug
+uint8_t (_xbee_checksum_copy)( void FAR *dest, const void FAR *src,
+   uint16_t length, uint_fast8_t initial)
+{
+   uint16_t i;
+   uint8_t checksum;
+   const char FAR *s;
+   char FAR *d;
+
+   checksum = initial;
+   for (s = (const char FAR *)src, d = (char FAR *)dest, i = length; i;
+      ++s, ++d, --i)
+   {
+      checksum -= (*d = *s);
+   }
+
+   return checksum;
+}
+
+/*** BeginHeader _xbee_escape, _xbee_unescape, _xbee_frame_escape */
+/*** EndHeader */
+/**
+   @internal
+   @brief
+   Escape bytes for escaped API mode (ATAP=2).
+
+   @param[out] dest     Buffer for the escaped bytes, with room for
+                        2 * \a length bytes.
+   @param[in]  src      Bytes to escape.
+   @param[in]  length   Number of bytes at \a src.
+
+   @return  Number of bytes written to \a dest.
+*/
+// Function name in parenthesis so platforms can provide a vectorized
+// replacement along with _xbee_unescape().  See POSIX.
+_xbee_device_debug
+uint16_t (_xbee_escape)( void FAR *dest, const void FAR *src,
+   uint16_t length)
+{
+   const uint8_t FAR *s;
+   uint8_t FAR *d;
+
+   for (s = src, d = dest; length; ++s, --length)
+   {
+      if (_XBEE_API_NEEDS_ESCAPE( *s))
+      {
+         *d++ = _XBEE_API_ESCAPE;
+         *d++ = *s ^ _XBEE_API_ESCAPE_XOR;
+      }
+      else
+      {
+         *d++ = *s;
+      }
+   }
+
+   return (uint16_t)(d - (uint8_t FAR *) dest);
+}
+
+/**
+   @internal
+   @brief
+   Remove the escaping from bytes read in escaped API mode (ATAP=2).
+
+   Unescaped XON and XOFF bytes can only be software flow control, and are
+   dropped.  An unescaped 0x7E is always a start-of-frame, and cancels an
+   escape before it.
+
+   @param[out]    dest     Buffer for the unescaped bytes, with room for
+                           \a length bytes.  Can be the same as \a src.
+   @param[in]     src      Bytes read from the XBee.
+   @param[in]     length   Number of bytes at \a src.
+   @param[in,out] escape   State kept between calls: non-zero if the last
+                           byte of the previous call was an escape.
+
+   @return  Number of bytes written to \a dest.
+*/
+_xbee_device_debug
+uint16_t (_xbee_unescape)( void FAR *dest, const void FAR *src,
+   uint16_t length, uint8_t *escape)
+{
+   const uint8_t FAR *s;
+   uint8_t FAR *d;
+   uint8_t ch;
+
+   for (s = src, d = dest; length; --length)
+   {
+      ch = *s++;
+      if (ch == _XBEE_API_ESCAPE)
+      {
+         *escape = 1;
+      }
+      else if (ch == 0x11 || ch == 0x13)
+      {
+         // XON/XOFF, not part of the frame
+      }
+      else if (*escape && ch != 0x7E)
+      {
+         *escape = 0;
+         *d++ = ch ^ _XBEE_API_ESCAPE_XOR;
+      }
+      else
+      {
+         *escape = 0;
+         *d++ = ch;
+      }
+   }
+
+   return (uint16_t)(d - (uint8_t FAR *) dest);
+}
+
+/**
+   @internal
+   @brief
+   Build a complete frame for escaped API mode (ATAP=2) in a buffer.
+
+   @param[out] dest        Buffer for the frame, with room for
+                           _XBEE_ESCAPED_FRAME_SIZE( \a headerlen +
+                           \a datalen) bytes.
+   @param[in]  header      Frame header, starting with the frame type.
+   @param[in]  headerlen   Number of bytes in \a header (can be 0).
+   @param[in]  data        Frame payload, sent after \a header.
+   @param[in]  datalen     Number of bytes in \a data (can be 0).
+
+   @return  Number of bytes in the frame, from its start-of-frame through
+            its (escaped) checksum.
+*/
+_xbee_device_debug
+uint16_t _xbee_frame_escape( void FAR *dest, const void FAR *header,
+   uint16_t headerlen, const void FAR *data, uint16_t datalen)
+{
+   uint8_t FAR *p = dest;
+   uint8_t prefix[2];
+   uint8_t checksum = 0xFF;
+
+   *p++ = 0x7E;
+   prefix[0] = (uint8_t)((headerlen + datalen) >> 8);
+   prefix[1] = (uint8_t)(headerlen + datalen);
+   p += _xbee_escape( p, prefix, 2);
+   if (headerlen)
+   {
+      p += _xbee_escape( p, header, headerlen);
+      checksum = _xbee_checksum( header, headerlen, checksum);
+   }
+   if (datalen)
+   {
+      p += _xbee_escape( p, data, datalen);
+      checksum = _xbee_checksum( data, datalen, checksum);
+   }
+   p += _xbee_escape( p, &checksum, 1);
+
+   return (uint16_t)(p - (uint8_t FAR *) dest);
+}
+
+/*** BeginHeader _xbee_dev_tx_note, _xbee_dev_tx_idle_timer */
+/*** EndHeader */
+#ifdef XBEE_DEVICE_ENABLE_ATMODE
+/**
+   @internal
+   @brief
+   Return \c tx_idle_timer, the time the serial port finishes sending the
+   bytes written to it.
+
+   A stamp more than XBEE_DEV_TX_IDLE_LEAD_MAX milliseconds ahead of \a now
+   is from writes so long ago that the timer wrapped around, so it's moved
+   back to the oldest time that still compares as being in the past.
+
+   @param[in]  xbee     XBee device.
+   @param[in]  now      Current xbee_millisecond_timer().
+
+   @return  Updated value of \c xbee->tx_idle_timer.
+*/
+_xbee_device_debug
+uint32_t _xbee_dev_tx_idle_timer( xbee_dev_t *xbee, uint32_t now)
+{
+   if ((int32_t) (xbee->tx_idle_timer - now) > XBEE_DEV_TX_IDLE_LEAD_MAX)
+   {
+      xbee->tx_idle_timer = now - UINT32_C(0x7FFFFFFF);
+   }
+
+   return xbee->tx_idle_timer;
+}
+
+/**
+   @internal
+   @brief
+   Update \c tx_idle_timer after writing bytes to the XBee's serial port.
+
+   Models the port as sending each byte (10 bits, with start and stop bits)
+   at its baud rate after the bytes written before it, so the estimate holds
+   up when writes are queued faster than the port can send them.
+
+   @param[in]  xbee     XBee device.
+   @param[in]  bytes    Number of bytes just written.
+*/
+_xbee_device_debug
+void _xbee_dev_tx_note( xbee_dev_t *xbee, uint16_t bytes)
+{
+   uint32_t now = xbee_millisecond_timer();
+   uint32_t baudrate = xbee->serport.baudrate;
+
+   if ((int32_t) (_xbee_dev_tx_idle_timer( xbee, now) - now) < 0)
+   {
+      // port had finished sending everything written earlier
+      xbee->tx_idle_timer = now;
+   }
+   if (baudrate != 0)
+   {
+      xbee->tx_idle_timer += (bytes * UINT32_C(10000) + baudrate - 1)
+                                                               / baudrate;
+   }
+}
+#endif
+
+/*** BeginHeader xbee_ser_writev */
+/*** EndHeader */
+#ifndef XBEE_SER_HAS_WRITEV
+// see xbee/serial.h for documentation
+// Generic version for platforms without a native vectored write, sends each
+// block with a separate call to xbee_ser_write().
+_xbee_device_debug
+int xbee_ser_writev( xbee_serial_t *serial, const xbee_ser_iovec_t *iov,
+   int iovcnt)
+{
+   int i, result, total;
+
+   if (iov == NULL || iovcnt < 0 || iovcnt > XBEE_SER_IOV_MAX)
+   {
+      return -EINVAL;
+   }
+
+   total = 0;
+   for (i = 0; i < iovcnt; ++i)
+   {
+      result = xbee_ser_write( serial, iov[i].base, iov[i].length);
+      if (result < 0)
+      {
+         return total ? total : result;
+      }
+      total += result;
+      if (result < iov[i].length)
+      {
+         break;         // short write, don't send the remaining blocks
+      }
+   }
+
+   return total;
+}
+#endif
+
+/*** BeginHeader xbee_frame_write */
+/*** EndHeader */
+/**
+   @brief
+   Copies a frame into the transmit serial buffer to send to an
+   XBee module.
+
+   Header should include bytes as they will be sent to the XBee.  Function
+   accepts separate header and data to limit the amount of copying necessary
+   to send requests.  The entire frame (start byte, length, header, data and
+   checksum) goes to the serial driver with a single call to
+   xbee_ser_writev(), so frames from concurrent writers can't interleave on
+   platforms with a native vectored write.  If the driver only takes part of
+   the frame, this function keeps writing until the rest goes out.
+
+   This function should only be called after \a xbee has been initialized by
+   calling xbee_dev_init().
+
+   By default, xbee_frame_write() checks the /CTS signal from the XBee before
+   attempting to send, and will return -EBUSY if the XBee has deasserted CTS.
+   Use xbee_dev_flowcontrol() to disable this check (necessary on a system
+   without a connection to the XBee module's /CTS signal).
+
+   On platforms with a transmit queue (see XBEE_DEV_TX_QUEUE_SIZE), frames
+   the XBee can't accept yet are queued instead, and sent by xbee_dev_tick().
+   This function only returns -EBUSY if the queue is full.  Use
+   xbee_frame_queue() to be notified when a queued frame is sent.
+
+   In escaped API mode (see xbee_dev_api_mode()), the frame is escaped into
+   a buffer on the stack and sent from there (queued frames are escaped as
+   they're sent), so it can't be larger than XBEE_MAX_TX_FRAME_LEN.
+
+   @param[in]  xbee        XBee device to send to.
+
+   @param[in]  header      Pointer to the header to send.  Header starts with
+                           the frame type (this function will pre-pend the
+                           0x7E start-of-frame and 16-bit length).
+                           Pass \c NULL if there isn't a header and the entire
+                           frame is in the payload (\a data and \a datalen).
+
+   @param[in]  headerlen   Number of header bytes to send (starting with
+                           address passed in \a header).  Ignored if
+                           \a header is \c NULL.
+
+   @param[in]  data        Address of frame payload or \c NULL if the entire
+                           frame content is stored in the header bytes
+                           (\a header and \a headerlen).
+
+   @param[in]  datalen     Number of payload bytes to send (starting with
+                           address passed in \a data).  Ignored if \a data
+                           is \c NULL.
+
+   @param[in]  flags       Optional flags
+               - XBEE_WRITE_FLAG_NONE
+               - XBEE_WRITE_FLAG_NOQUEUE: return -EBUSY instead of queueing
+               - XBEE_WRITE_FLAG_PRIORITY: queue ahead of data frames
+
+   @retval  0           Successfully queued frame in transmit serial buffer
+                        (or the device's transmit queue).
+   @retval  -EINVAL     \a xbee is \c NULL or invalid flags passed
+   @retval  -ENODATA    No data to send (\a headerlen + \a datalen == 0).
+   @retval  -EBUSY      Transmit serial buffer is full, or XBee is not
+                        accepting serial data (deasserting /CTS signal), and
+                        the frame couldn't be queued.
+   @retval  -EMSGSIZE   Serial buffer can't ever send a frame this large.
+   @retval  -EIO        Serial driver stopped taking bytes partway through
+                        the frame (see XBEE_DEV_TX_STALL_TIMEOUT).
+   @retval  <0          Other error from the serial driver.
+
+   @sa xbee_dev_init(), xbee_ser_writev(), xbee_dev_flowcontrol(),
+      xbee_frame_queue()
+*/
+_xbee_device_debug
+int xbee_frame_write( xbee_dev_t *xbee, const void FAR *header,
+   uint16_t headerlen, const void FAR *data, uint16_t datalen, uint16_t flags)
+{
+   return xbee_frame_queue( xbee, header, headerlen, data, datalen, flags,
+      NULL, NULL);
+}
+
+/*** BeginHeader xbee_frame_queue, xbee_frame_queue_pending,
+   xbee_frame_queue_flush, _xbee_frame_queue_send */
+/*** EndHeader */
+#include "xbee/byteorder.h"
+
+#if XBEE_DEV_TX_QUEUE_SIZE
+// Reserve <need> contiguous bytes at the tail of <q>, wrapping to the start
+// of the buffer if necessary.  Returns the offset, or -1 if there isn't room.
+_xbee_device_debug
+int _xbee_tx_reserve( struct xbee_dev_tx_queue *q, uint16_t need)
+{
+   static const uint16_t wrap = 0;
+
+   if (q->count == 0)
+   {
+      q->head = q->tail = 0;
+   }
+   if (q->count == 0 || q->tail > q->head)
+   {
+      // free space is after the tail and before the head
+      if (need <= XBEE_DEV_TX_QUEUE_SIZE - q->tail)
+      {
+         return q->tail;
+      }
+      if (need > q->head)
+      {
+         return -1;
+      }
+      // mark the unused end of the buffer so _xbee_tx_head() skips it
+      if (XBEE_DEV_TX_QUEUE_SIZE - q->tail >= sizeof wrap)
+      {
+         _f_memcpy( &q->buf[q->tail], &wrap, sizeof wrap);
+      }
+      q->tail = 0;
+      return 0;
+   }
+
+   // tail has wrapped, free space is between the tail and the head
+   return (need <= q->head - q->tail) ? q->tail : -1;
+}
+
+// Copy the first entry's header out of <q> (which must not be empty),
+// skipping over a wrap marker.  Returns a pointer to the entry's frame.
+_xbee_device_debug
+const uint8_t *_xbee_tx_head( struct xbee_dev_tx_queue *q,
+   xbee_dev_tx_entry_t *entry)
+{
+   if (XBEE_DEV_TX_QUEUE_SIZE - q->head < sizeof entry->size)
+   {
+      q->head = 0;
+   }
+   else
+   {
+      _f_memcpy( &entry->size, &q->buf[q->head], sizeof entry->size);
+      if (entry->size == 0)
+      {
+         q->head = 0;
+      }
+   }
+   _f_memcpy( entry, &q->buf[q->head], sizeof *entry);
+
+   return &q->buf[q->head + sizeof *entry];
+}
+
+// Remove the first entry, whose header was read by _xbee_tx_head().
+_xbee_device_debug
+void _xbee_tx_pop( struct xbee_dev_tx_queue *q,
+   const xbee_dev_tx_entry_t *entry)
+{
+   q->head += sizeof *entry + entry->size;
+   if (--q->count == 0)
+   {
+      q->head = q->tail = 0;
+   }
+}
+
+// Is anything waiting in <priority> or a higher priority class?
+_xbee_device_debug
+bool_t _xbee_tx_waiting( const xbee_dev_t *xbee, uint_fast8_t priority)
+{
+   uint_fast8_t i;
+
+   for (i = 0; i <= priority; ++i)
+   {
+      if (xbee->tx_queue[i].count)
+      {
+         return TRUE;
+      }
+   }
+
+   return FALSE;
+}
+
+// Build a complete frame in the tail of the transmit queue for <priority>.
+_xbee_device_debug
+int _xbee_tx_enqueue( xbee_dev_t *xbee, uint_fast8_t priority,
+   const void FAR *header, uint16_t headerlen, const void FAR *data,
+   uint16_t datalen, xbee_frame_sent_fn callback, void FAR *context)
+{
+   struct xbee_dev_tx_queue *q = &xbee->tx_queue[priority];
+   xbee_dev_tx_entry_t entry;
+   uint16_t length_be;
+   uint8_t checksum;
+   uint8_t *p;
+   int offset;
+
+   entry.size = headerlen + datalen + 3 + 1;
+   entry.callback = callback;
+   entry.context = context;
+   #if XBEE_DEV_STATS
+      entry.queued = XBEE_DEV_STATS_TIMER();
+   #endif
+   if (sizeof entry + entry.size > XBEE_DEV_TX_QUEUE_SIZE)
+   {
+      return -EMSGSIZE;
+   }
+   offset = _xbee_tx_reserve( q, sizeof entry + entry.size);
+   if (offset < 0)
+   {
+      #ifdef XBEE_DEVICE_VERBOSE
+         printf( "%s: return -EBUSY (queue %u full, %u frames)\n",
+            __FUNCTION__, priority, q->count);
+      #endif
+      _XBEE_STATS_ADD( xbee, tx_dropped, 1);
+      return -EBUSY;
+   }
+
+   p = &q->buf[offset];
+   _f_memcpy( p, &entry, sizeof entry);
+   p += sizeof entry;
+   *p++ = 0x7E;
+   length_be = htobe16( headerlen + datalen);
+   _f_memcpy( p, &length_be, 2);
+   p += 2;
+   checksum = 0xFF;
+   if (headerlen)
+   {
+      checksum = _xbee_checksum_copy( p, header, headerlen, checksum);
+      p += headerlen;
+   }
+   if (datalen)
+   {
+      checksum = _xbee_checksum_copy( p, data, datalen, checksum);
+      p += datalen;
+   }
+   *p = checksum;
+
+   q->tail = (uint16_t) offset + sizeof entry + entry.size;
+   ++q->count;
+
+   #ifdef XBEE_DEVICE_VERBOSE
+      printf( "%s: queued %u-byte frame (priority %u, %u frames)\n",
+         __FUNCTION__, entry.size, priority, q->count);
+   #endif
+
+   return 0;
+}
+#endif // XBEE_DEV_TX_QUEUE_SIZE
+
+/**
+   @internal
+   @brief
+   Finish writing a frame that the serial driver only took part of.  Once
+   part of a frame is out, the rest has to follow it, so this function
+   waits for the serial driver to take the remaining bytes, sleeping in
+   xbee_ser_tx_wait() while it doesn't take any.
+
+   @param[in]     xbee     XBee device to send to.
+   @param[in,out] iov      Blocks of bytes in the frame (updated to skip
+                           the bytes written).
+   @param[in]     iovcnt   Number of entries in \a iov.
+   @param[in]     written  Number of bytes already written.
+
+   @retval  >0    Size of the frame, all of it has been written.
+   @retval  -EIO  Serial driver didn't take any bytes for
+                  XBEE_DEV_TX_STALL_TIMEOUT milliseconds, the XBee received
+                  an incomplete frame.
+   @retval  <0    Error from xbee_ser_writev().
+*/
+_xbee_device_debug
+int _xbee_frame_write_rest( xbee_dev_t *xbee, xbee_ser_iovec_t *iov,
+   int iovcnt, int written)
+{
+   uint32_t stalled = xbee_millisecond_timer();
+   uint32_t elapsed;
+   int result, total = written;
+
+   for (;;)
+   {
+      // skip the blocks (and the part of a block) already written
+      while (iovcnt && written >= iov->length)
+      {
+         written -= iov->length;
+         ++iov;
+         --iovcnt;
+      }
+      if (iovcnt == 0)
+      {
+         return total;
+      }
+      iov->base = (const uint8_t FAR *) iov->base + written;
+      iov->length -= written;
+
+      result = xbee_ser_writev( &xbee->serport, iov, iovcnt);
+      if (result > 0)
+      {
+         total += result;
+         written = result;
+         stalled = xbee_millisecond_timer();
+      }
+      else if (result != 0 && result != -EAGAIN)
+      {
+         return result;
+      }
+      else
+      {
+         elapsed = xbee_millisecond_timer() - stalled;
+         if (elapsed >= XBEE_DEV_TX_STALL_TIMEOUT)
+         {
+            #ifdef XBEE_DEVICE_VERBOSE
+               printf( "%s: serial driver stalled after %d bytes\n",
+                  __FUNCTION__, total);
+            #endif
+            return -EIO;
+         }
+         result = xbee_ser_tx_wait( &xbee->serport,
+            (int32_t) (XBEE_DEV_TX_STALL_TIMEOUT - elapsed));
+         if (result < 0)
+         {
+            return result;
+         }
+         written = 0;
+      }
+   }
+}
+
+#if XBEE_DEV_API_ESCAPED
+// Frame bytes escaped at a time by _xbee_frame_write_escaped(), which needs
+// twice that on the stack for the escaped bytes.
+#define _XBEE_ESCAPE_BLOCK    64
+
+// Split a frame for escaped API mode into the blocks that get escaped: its
+// 16-bit length, <header>, <data> and <checksum>.  Returns the number of
+// entries used in <src> (always 4).
+_xbee_device_debug
+int _xbee_frame_escape_blocks( xbee_ser_iovec_t src[4], uint8_t length_be[2],
+   uint8_t *checksum, const void FAR *header, uint16_t headerlen,
+   const void FAR *data, uint16_t datalen)
+{
+   length_be[0] = (uint8_t)((headerlen + datalen) >> 8);
+   length_be[1] = (uint8_t)(headerlen + datalen);
+   *checksum = 0xFF;
+   if (headerlen)
+   {
+      *checksum = _xbee_checksum( header, headerlen, *checksum);
+   }
+   if (datalen)
+   {
+      *checksum = _xbee_checksum( data, datalen, *checksum);
+   }
+
+   src[0].base = length_be;
+   src[0].length = 2;
+   src[1].base = header;
+   src[1].length = headerlen;
+   src[2].base = data;
+   src[2].length = datalen;
+   src[3].base = checksum;
+   src[3].length = 1;
+
+   return 4;
+}
+
+// Return the size of a frame in escaped API mode (ATAP=2), from its
+// start-of-frame through its escaped checksum.
+_xbee_device_debug
+int _xbee_frame_escaped_size( const void FAR *header, uint16_t headerlen,
+   const void FAR *data, uint16_t datalen)
+{
+   xbee_ser_iovec_t src[4];
+   const uint8_t FAR *s;
+   uint8_t length_be[2], checksum;
+   uint16_t length;
+   int i, count, size = 1;
+
+   count = _xbee_frame_escape_blocks( src, length_be, &checksum, header,
+      headerlen, data, datalen);
+   for (i = 0; i < count; ++i)
+   {
+      size += src[i].length;
+      for (s = src[i].base, length = src[i].length; length; ++s, --length)
+      {
+         if (_XBEE_API_NEEDS_ESCAPE( *s))
+         {
+            ++size;
+         }
+      }
+   }
+
+   return size;
+}
+
+// Write escaped bytes at <block>, part of a frame that already has <total>
+// bytes out.  Returns 0 or -EAGAIN if the serial driver didn't take any of
+// the frame's first block, the bytes written, or an error.
+_xbee_device_debug
+int _xbee_frame_write_block( xbee_dev_t *xbee, const uint8_t *block,
+   uint16_t length, int total)
+{
+   xbee_ser_iovec_t iov;
+   int result;
+
+   result = xbee_ser_write( &xbee->serport, block, length);
+   if (result == 0 || result == -EAGAIN)
+   {
+      if (total == 0)
+      {
+         return result;
+      }
+      result = 0;
+   }
+   if (result >= 0 && result < length)
+   {
+      // once part of the frame is out, the rest has to follow it
+      iov.base = block;
+      iov.length = length;
+      result = _xbee_frame_write_rest( xbee, &iov, 1, result);
+   }
+
+   return result;
+}
+
+/**
+   @internal
+   @brief
+   Write a frame in escaped API mode (ATAP=2), escaping it a block at a time
+   instead of building the whole escaped frame in a buffer.
+
+   Like xbee_ser_writev(), check that the serial driver has room for the
+   frame (see _xbee_frame_escaped_size()) before calling.
+
+   @param[in]  xbee        XBee device to send to.
+   @param[in]  header      Frame header, starting with the frame type.
+   @param[in]  headerlen   Number of bytes in \a header (can be 0).
+   @param[in]  data        Frame payload, sent after \a header.
+   @param[in]  datalen     Number of bytes in \a data (can be 0).
+
+   @retval  >0       Size of the escaped frame, all of it has been written.
+   @retval  0        Serial driver didn't take any of the frame.
+   @retval  -EAGAIN  Serial driver didn't take any of the frame.
+   @retval  <0       Error from the serial driver, or from
+                     _xbee_frame_write_rest() once part of the frame is out.
+*/
+_xbee_device_debug
+int _xbee_frame_write_escaped( xbee_dev_t *xbee, const void FAR *header,
+   uint16_t headerlen, const void FAR *data, uint16_t datalen)
+{
+   xbee_ser_iovec_t src[4];
+   const uint8_t FAR *s;
+   uint8_t length_be[2], checksum;
+   uint8_t block[2 * _XBEE_ESCAPE_BLOCK];
+   uint16_t length, chunk, used;
+   int i, count, result, total = 0;
+
+   count = _xbee_frame_escape_blocks( src, length_be, &checksum, header,
+      headerlen, data, datalen);
+
+   block[0] = 0x7E;
+   used = 1;
+   for (i = 0; i < count; ++i)
+   {
+      s = src[i].base;
+      for (length = src[i].length; length; length -= chunk, s += chunk)
+      {
+         if (sizeof block - used < 2)
+         {
+            result = _xbee_frame_write_block( xbee, block, used, total);
+            if (result <= 0)
+            {
+               return result;
+            }
+            total += result;
+            used = 0;
+         }
+         chunk = (sizeof block - used) / 2;
+         if (chunk > length)
+         {
+            chunk = length;
+         }
+         used += _xbee_escape( block + used, s, chunk);
+      }
+   }
+
+   result = _xbee_frame_write_block( xbee, block, used, total);
+
+   return result <= 0 ? result : total + result;
+}
+#endif // XBEE_DEV_API_ESCAPED
+
+/**
+   @brief
+   Send a frame to the XBee module, queueing it if the XBee can't accept it
+   yet, and call \a callback once it's sent.
+
+   Works like xbee_frame_write() (see that function for details on the
+   parameters), with a callback for programs that need to know when a
+   queued frame actually went out.
+
+   Queued frames are sent by xbee_dev_tick(), in order, as the XBee asserts
+   CTS and the serial driver has room for them.  Frames for local and remote
+   AT commands (and frames written with XBEE_WRITE_FLAG_PRIORITY) go ahead
+   of other queued frames.
+
+   On platforms without a transmit queue (XBEE_DEV_TX_QUEUE_SIZE of 0), this
+   function either sends the frame immediately (calling \a callback before
+   returning) or returns -EBUSY.
+
+   @param[in]  xbee        XBee device to send to.
+   @param[in]  header      Frame header, starting with the frame type.
+   @param[in]  headerlen   Number of bytes in \a header.
+   @param[in]  data        Frame payload, sent after \a header.
+   @param[in]  datalen     Number of bytes in \a data.
+   @param[in]  flags       XBEE_WRITE_FLAG_xxx (see xbee_frame_write()).
+   @param[in]  callback    Optional function to call after the frame has
+                           gone to the serial driver, or NULL.  Not called
+                           if this function returns an error.
+   @param[in]  context     Passed to \a callback.
+
+   @retval  0           Sent or queued frame.
+   @retval  -EINVAL     \a xbee is \c NULL or invalid.
+   @retval  -ENODATA    No data to send (\a headerlen + \a datalen == 0).
+   @retval  -EBUSY      XBee can't accept the frame and the queue is full.
+   @retval  -EMSGSIZE   Frame is too large for the serial buffer or queue.
+   @retval  -EIO        Serial driver stopped taking bytes partway through
+                        the frame.
+   @retval  <0          Other error from the serial driver.
+
+   @sa xbee_frame_write(), xbee_frame_queue_pending(), xbee_frame_queue_flush()
+*/
+_xbee_device_debug
+int xbee_frame_queue( xbee_dev_t *xbee, const void FAR *header,
+   uint16_t headerlen, const void FAR *data, uint16_t datalen,
+   uint16_t flags, xbee_frame_sent_fn callback, void FAR *context)
+{
+   XBEE_PACKED(, {
+      uint8_t  start;
+      uint16_t length_be;
+   }) prefix;
+
+   xbee_ser_iovec_t iov[4];
+   int iovcnt, result;
+   int cts, free, used, framesize;
+   uint_fast8_t type;
+   bool_t busy;
+   uint8_t checksum = 0xFF;
+   #ifdef XBEE_DEVICE_VERBOSE
+      uint8_t id;             // for debug messages
+   #endif
+   #if XBEE_DEV_TX_QUEUE_SIZE
+      uint_fast8_t priority;
+   #endif
+
+   if (xbee == NULL || xbee_ser_invalid( &xbee->serport))
+   {
+      cts = -EINVAL;
+   }
+   else if (xbee->flags & XBEE_DEV_FLAG_USE_FLOWCONTROL)
+   {
+      cts = xbee_ser_get_cts( &xbee->serport);
+   }
+   else
+   {
+      cts = 1;
+   }
+
+   if (cts == -EINVAL)
+   {
+      // <xbee> is NULL, or xbee->serport is not valid
+      #ifdef XBEE_DEVICE_VERBOSE
+         printf( "%s: return -EINVAL (xbee = 0x%p, cts = %d)\n",
+            __FUNCTION__, xbee, cts);
+      #endif
+      return -EINVAL;
+   }
+
+   if (! header)
+   {
+      headerlen = 0;    // if header is NULL, set headerlen to 0
+   }
+   if (! data)
+   {
+      datalen = 0;      // if data is NULL, set datalen to 0
+   }
+   if (! (headerlen || datalen))
+   {
+      #ifdef XBEE_DEVICE_VERBOSE
+         printf( "%s: return -ENODATA (headerlen = %u, datalen = %u)\n",
+            __FUNCTION__, headerlen, datalen);
+      #endif
+      return -ENODATA;
+   }
+
+   type = *(const uint8_t FAR *) (headerlen ? header : data);
+
+   // Make sure XBee is asserting CTS and verify that the transmit serial buffer
+   // has enough room for the frame (payload + 3-byte header + 1-byte checksum).
+   free = xbee_ser_tx_free( &xbee->serport);
+   used = xbee_ser_tx_used( &xbee->serport);
+   framesize = headerlen + datalen + 3 + 1;
+#if XBEE_DEV_API_ESCAPED
+   if (xbee->flags & XBEE_DEV_FLAG_API_ESCAPED)
+   {
+      // the serial buffer needs room for the frame once it's escaped
+      framesize = _xbee_frame_escaped_size( header, headerlen, data,
+         datalen);
+   }
+#endif
+   busy = (! cts || free < framesize);
+   if (busy)
+   {
+      #ifdef XBEE_DEVICE_VERBOSE
+         printf( "%s: busy (cts = %s, free = %d, framesize = %d)\n",
+            __FUNCTION__, cts ? "yes" : "no", free, framesize);
+      #endif
+      if (framesize - free > used)
+      {
+         return -EMSGSIZE;
+      }
+   }
+
+#if XBEE_DEV_TX_QUEUE_SIZE
+   if ((flags & XBEE_WRITE_FLAG_PRIORITY) || type == XBEE_FRAME_LOCAL_AT_CMD
+      || type == XBEE_FRAME_LOCAL_AT_CMD_Q || type == XBEE_FRAME_REMOTE_AT_CMD)
+   {
+      priority = XBEE_TX_PRIORITY_HIGH;
+   }
+   else
+   {
+      priority = XBEE_TX_PRIORITY_NORMAL;
+   }
+
+   // stay behind frames already waiting in this (or a higher) priority class
+   if (! busy && _xbee_tx_waiting( xbee, priority))
+   {
+      busy = TRUE;
+   }
+#endif
+
+   if (! busy)
+   {
+      #ifdef XBEE_DEVICE_VERBOSE
+         if (headerlen < 2)
+         {
+            // if headerlen is 1, id is first byte of data, otherwise second
+            id = ((const char FAR *)data)[headerlen ? 0 : 1];
+         }
+         else
+         {
+            id = ((const char FAR *)header)[1];
+         }
+         printf( "%s: frame type 0x%02x, id 0x%02x (%u-byte payload)\n",
+            __FUNCTION__, type, id, headerlen + datalen);
+      #endif
+
+#if XBEE_DEV_API_ESCAPED
+      if (xbee->flags & XBEE_DEV_FLAG_API_ESCAPED)
+      {
+         result = _xbee_frame_write_escaped( xbee, header, headerlen, data,
+            datalen);
+      }
+      else
+#endif
+      {
+         // 0x7E (start frame marker) and 16-bit length
+         prefix.start = 0x7E;
+         prefix.length_be = htobe16( headerlen + datalen);
+         iov[0].base = &prefix;
+         iov[0].length = 3;
+         iovcnt = 1;
+
+         // <headerlen> bytes from <header> if it is not NULL
+         if (headerlen)
+         {
+            iov[iovcnt].base = header;
+            iov[iovcnt].length = headerlen;
+            ++iovcnt;
+            checksum = _xbee_checksum( header, headerlen, checksum);
+         }
+
+         // <datalen> bytes from <data> if it is not NULL
+         if (datalen)
+         {
+            iov[iovcnt].base = data;
+            iov[iovcnt].length = datalen;
+            ++iovcnt;
+            checksum = _xbee_checksum( data, datalen, checksum);
+         }
+
+         // 1-byte checksum of bytes in payload
+         iov[iovcnt].base = &checksum;
+         iov[iovcnt].length = 1;
+         ++iovcnt;
+
+         result = xbee_ser_writev( &xbee->serport, iov, iovcnt);
+         if (result > 0 && result < framesize)
+         {
+            // serial driver only took part of the frame
+            result = _xbee_frame_write_rest( xbee, iov, iovcnt, result);
+         }
+      }
+      if (result < 0 && result != -EAGAIN)
+      {
+         #ifdef XBEE_DEVICE_VERBOSE
+            printf( "%s: error %d writing frame\n", __FUNCTION__, result);
+         #endif
+         return result;
+      }
+      if (result > 0)
+      {
+         _XBEE_STATS_ADD( xbee, frames_out, 1);
+         _XBEE_STATS_ADD( xbee, bytes_out, framesize);
+         _XBEE_TX_NOTE( xbee, framesize);
+         _XBEE_CAPTURE( xbee, XBEE_CAPTURE_DIR_TX, XBEE_DEV_STATS_TIMER(),
+            header, headerlen, data, datalen);
+         if (callback != NULL)
+         {
+            callback( xbee, 0, context);
+         }
+         return 0;
+      }
+
+      // serial driver didn't take any of the frame
+      busy = TRUE;
+   }
+
+   _XBEE_STATS_ADD( xbee, tx_busy, 1);
+
+#if XBEE_DEV_TX_QUEUE_SIZE
+   if (! (flags & XBEE_WRITE_FLAG_NOQUEUE))
+   {
+      return _xbee_tx_enqueue( xbee, priority, header, headerlen, data,
+         datalen, callback, context);
+   }
+#else
+   XBEE_UNUSED_PARAMETER( flags);
+   XBEE_UNUSED_PARAMETER( type);
+#endif
+
+   return -EBUSY;
+}
+
+/**
+   @brief
+   Report the number of frames waiting in a device's transmit queue.
+
+   @param[in]  xbee  XBee device to check.
+
+   @retval  >=0      Number of queued frames (always 0 on platforms without
+                     a transmit queue).
+   @retval  -EINVAL  \a xbee is \c NULL.
+*/
+_xbee_device_debug
+int xbee_frame_queue_pending( const xbee_dev_t *xbee)
+{
+#if XBEE_DEV_TX_QUEUE_SIZE
+   uint_fast8_t i;
+   int count;
+#endif
+
+   if (xbee == NULL)
+   {
+      return -EINVAL;
+   }
+
+#if XBEE_DEV_TX_QUEUE_SIZE
+   for (count = 0, i = 0; i < XBEE_TX_PRIORITY_COUNT; ++i)
+   {
+      count += xbee->tx_queue[i].count;
+   }
+   return count;
+#else
+   return 0;
+#endif
+}
+
+/**
+   @brief
+   Drop all frames waiting in a device's transmit queue, calling their
+   callbacks with a status of -ECANCELED.
+
+   Use after resetting the XBee, or before closing its serial port.
+
+   @param[in]  xbee  XBee device to flush.
+
+   @retval  >=0      Number of frames dropped.
+   @retval  -EINVAL  \a xbee is \c NULL.
+*/
+_xbee_device_debug
+int xbee_frame_queue_flush( xbee_dev_t *xbee)
+{
+#if XBEE_DEV_TX_QUEUE_SIZE
+   struct xbee_dev_tx_queue *q;
+   xbee_dev_tx_entry_t entry;
+   uint_fast8_t i;
+   int dropped = 0;
+#endif
+
+   if (xbee == NULL)
+   {
+      return -EINVAL;
+   }
+
+#if XBEE_DEV_TX_QUEUE_SIZE
+   for (i = 0; i < XBEE_TX_PRIORITY_COUNT; ++i)
+   {
+      q = &xbee->tx_queue[i];
+      while (q->count)
+      {
+         _xbee_tx_head( q, &entry);
+         _xbee_tx_pop( q, &entry);
+         ++dropped;
+         if (entry.callback != NULL)
+         {
+            entry.callback( xbee, -ECANCELED, entry.context);
+         }
+      }
+   }
+   return dropped;
+#else
+   return 0;
+#endif
+}
+
+/**
+   @internal
+   @brief
+   Send frames from the device's transmit queue, highest priority class
+   first, for as long as the XBee will accept them.  Called by
+   xbee_dev_tick().
+
+   @param[in]  xbee  XBee device with queued frames.
+
+   @retval  >=0      Number of frames sent.
+   @retval  -ENOSYS  Platform doesn't support a transmit queue.
+*/
+_xbee_device_debug
+int _xbee_frame_queue_send( xbee_dev_t *xbee)
+{
+#if XBEE_DEV_TX_QUEUE_SIZE
+   struct xbee_dev_tx_queue *q;
+   xbee_dev_tx_entry_t entry;
+   const uint8_t *frame;
+   xbee_ser_iovec_t iov;
+   uint_fast8_t i;
+   int result, framesize, sent = 0;
+
+   for (i = 0; i < XBEE_TX_PRIORITY_COUNT; ++i)
+   {
+      q = &xbee->tx_queue[i];
+      while (q->count)
+      {
+         frame = _xbee_tx_head( q, &entry);
+         if ((xbee->flags & XBEE_DEV_FLAG_USE_FLOWCONTROL)
+            && ! xbee_ser_get_cts( &xbee->serport))
+         {
+            return sent;
+         }
+
+         framesize = entry.size;
+         #if XBEE_DEV_API_ESCAPED
+            // frames are queued unescaped, escape them on the way out
+            if (xbee->flags & XBEE_DEV_FLAG_API_ESCAPED)
+            {
+               framesize = _xbee_frame_escaped_size( frame + 3,
+                  entry.size - 4, NULL, 0);
+            }
+         #endif
+         if (framesize > xbee_ser_tx_free( &xbee->serport)
+            + xbee_ser_tx_used( &xbee->serport))
+         {
+            // queued before switching to escaped mode, and too large for it
+            result = -EMSGSIZE;
+         }
+         else if (xbee_ser_tx_free( &xbee->serport) < framesize)
+         {
+            return sent;
+         }
+         #if XBEE_DEV_API_ESCAPED
+         else if (xbee->flags & XBEE_DEV_FLAG_API_ESCAPED)
+         {
+            result = _xbee_frame_write_escaped( xbee, frame + 3,
+               entry.size - 4, NULL, 0);
+         }
+         #endif
+         else
+         {
+            result = xbee_ser_write( &xbee->serport, frame, framesize);
+            if (result > 0 && result < framesize)
+            {
+               // serial driver only took part of the frame
+               iov.base = frame;
+               iov.length = framesize;
+               result = _xbee_frame_write_rest( xbee, &iov, 1, result);
+            }
+         }
+         if (result == 0 || result == -EAGAIN)
+         {
+            return sent;
+         }
+
+         if (result > 0)
+         {
+            _XBEE_TX_NOTE( xbee, framesize);
+            // skip the start-of-frame and length, and the checksum
+            _XBEE_CAPTURE( xbee, XBEE_CAPTURE_DIR_TX, XBEE_DEV_STATS_TIMER(),
+               frame + 3, entry.size - 4, NULL, 0);
+         }
+
+         // pop before calling the callback, in case it queues another frame
+         _xbee_tx_pop( q, &entry);
+         ++sent;
+         #if XBEE_DEV_STATS
+            if (result > 0)
+            {
+               ++xbee->stats.frames_out;
+               xbee->stats.bytes_out += framesize;
+               _xbee_histogram_add( &xbee->stats.tx_latency,
+                  XBEE_DEV_STATS_TIMER() - entry.queued);
+            }
+         #endif
+         #ifdef XBEE_DEVICE_VERBOSE
+            printf( "%s: sent queued %u-byte frame (priority %u)\n",
+               __FUNCTION__, entry.size, i);
+         #endif
+         if (entry.callback != NULL)
+         {
+            entry.callback( xbee, result < 0 ? result : 0, entry.context);
+         }
+      }
+   }
+
+   return sent;
+#else
+   XBEE_UNUSED_PARAMETER( xbee);
+
+   return -ENOSYS;
+#endif
+}
+
+
+/*** BeginHeader _xbee_rx_backlog, _xbee_tick_budget_spent */
+/*** EndHeader */
+/**
+   @internal
+   @brief
+   Count received bytes waiting to be parsed or dispatched, for comparing
+   against the \c high_water mark of an xbee_dev_budget_t.
+
+   Counts frames in the reader thread's queue if it's running, otherwise
+   bytes in the staging ring (see XBEE_DEV_RX_STAGING_SIZE) or the serial
+   port's receive buffer.
+
+   @param[in]  xbee  XBee device to check.
+
+   @return  Number of bytes waiting.
+*/
+_xbee_device_debug
+uint32_t _xbee_rx_backlog( xbee_dev_t *xbee)
+{
+   uint32_t backlog = 0;
+#if XBEE_DEV_RX_QUEUE_SIZE
+   uint16_t head, tail;
+
+   if (xbee->rx_queue.enabled)
+   {
+      tail = XBEE_ATOMIC_LOAD( &xbee->rx_queue.tail);
+      for (head = xbee->rx_queue.head; head != tail; ++head)
+      {
+         backlog +=
+            xbee->rx_queue.slot[head & (XBEE_DEV_RX_QUEUE_SIZE - 1)].length + 4;
+      }
+      return backlog;
+   }
+#endif
+#if XBEE_DEV_RX_STAGING_SIZE
+   // bytes beyond the ring are only read once it's empty
+   backlog = (uint16_t)(xbee->staging.tail - xbee->staging.head);
+#else
+   {
+      int used = xbee_ser_rx_used( &xbee->serport);
+
+      if (used > 0)
+      {
+         backlog = used;
+      }
+   }
+#endif
+
+   return backlog;
+}
+
+/**
+   @internal
+   @brief
+   Check whether a tick should stop after dispatching a frame.
+
+   @param[in]  xbee        XBee device being ticked.
+   @param[in]  budget      Budget passed to xbee_dev_tick_budget(), or NULL
+                           for XBEE_DEV_MAX_DISPATCH_PER_TICK frames.
+   @param[in]  start       XBEE_DEV_STATS_TIMER() at start of tick, only
+                           used if \c budget->usec is set.
+   @param[in]  frames      Frames dispatched so far.
+   @param[in]  bytes       Bytes in those frames, including framing.
+
+   @retval  TRUE     Budget is spent, return from the tick.
+   @retval  FALSE    Keep dispatching frames.
+*/
+_xbee_device_debug
+bool_t _xbee_tick_budget_spent( xbee_dev_t *xbee,
+   const xbee_dev_budget_t *budget, uint32_t start, int frames,
+   uint32_t bytes)
+{
+   if (budget == NULL)
+   {
+      return frames >= XBEE_DEV_MAX_DISPATCH_PER_TICK;
+   }
+
+   if (budget->high_water && _xbee_rx_backlog( xbee) > budget->high_water)
+   {
+      // falling behind, ignore the budget until we catch up
+      return FALSE;
+   }
+
+   if (budget->bytes && bytes >= budget->bytes)
+   {
+      return TRUE;
+   }
+
+   return budget->usec && XBEE_DEV_STATS_TIMER() - start >= budget->usec;
+}
+
+
+/*** BeginHeader _xbee_frame_load, _xbee_frame_load_budget */
+/*** EndHeader */
+#ifdef __XBEE_PLATFORM_HCS08
+   #pragma MESSAGE DISABLE C5909    // Assignment in condition is OK
+#endif
+
+/**
+   @internal
+   @brief
+   Read bytes for the frame parser from the serial port, removing the
+   escaping if the device is in escaped API mode (see xbee_dev_api_mode()).
+
+   In escaped mode, bytes are unescaped in place as they're read, so the
+   rest of the parser only sees unescaped frames.  Since unescaping can
+   leave fewer bytes than were read, reads again for as long as the serial
+   port fills the rest of \a buffer.
+
+   Same parameters and return values as xbee_ser_read().
+*/
+_xbee_device_debug
+int _xbee_rx_read_serial( xbee_dev_t *xbee, void FAR *buffer, int bufsize)
+{
+#if XBEE_DEV_API_ESCAPED
+   uint8_t FAR *p = buffer;
+   int ser_read, total, want;
+
+   if (_XBEE_RX_SHARED_LOAD( &xbee->rx.escaped))
+   {
+      total = 0;
+      do {
+         want = bufsize - total;
+         ser_read = xbee_ser_read( &xbee->serport, p + total, want);
+         if (ser_read <= 0)
+         {
+            return total ? total : ser_read;
+         }
+         total += _xbee_unescape( p + total, p + total, ser_read,
+            &xbee->rx.escape);
+      } while (ser_read == want && total < bufsize);
+
+      return total;
+   }
+   xbee->rx.escape = 0;
+#endif
+
+   return xbee_ser_read( &xbee->serport, buffer, bufsize);
+}
+
+#if XBEE_DEV_RX_STAGING_SIZE
+#define _XBEE_STAGING_MASK    (XBEE_DEV_RX_STAGING_SIZE - 1)
+
+/**
+   @internal
+   @brief
+   Refill the staging ring from the serial port with a single read of as
+   many bytes as will fit contiguously.
+
+   @param[in]  xbee  XBee device to read from.
+
+   @retval  >=0   Number of bytes added to the staging ring.
+   @retval  <0    Error from xbee_ser_read().
+*/
+_xbee_device_debug
+int _xbee_rx_fill( xbee_dev_t *xbee)
+{
+   uint16_t tail, room;
+   int ser_read;
+
+   if (xbee->staging.tail == xbee->staging.head)
+   {
+      // empty, so start over at the beginning for the longest possible read
+      xbee->staging.tail = xbee->staging.head = 0;
+   }
+   tail = xbee->staging.tail & _XBEE_STAGING_MASK;
+   room = XBEE_DEV_RX_STAGING_SIZE - (uint16_t)(xbee->staging.tail
+                                                      - xbee->staging.head);
+   if (room > XBEE_DEV_RX_STAGING_SIZE - tail)
+   {
+      // only read up to the end of the buffer, next fill will wrap
+      room = XBEE_DEV_RX_STAGING_SIZE - tail;
+   }
+   if (room == 0)
+   {
+      return 0;
+   }
+
+   ser_read = _xbee_rx_read_serial( xbee, &xbee->staging.buf[tail], room);
+   if (ser_read > 0)
+   {
+      xbee->staging.tail += ser_read;
+   }
+
+   return ser_read;
+}
+
+/**
+   @internal
+   @brief
+   Read bytes for the frame parser, refilling the staging ring from the
+   serial port only when it's empty.
+
+   Same parameters and return values as xbee_ser_read(), plus an optional
+   running checksum (see _xbee_checksum()) to update with the bytes read,
+   or NULL.
+*/
+_xbee_device_debug
+int _xbee_rx_read( xbee_dev_t *xbee, void FAR *buffer, int bufsize,
+   uint8_t *checksum)
+{
+   uint16_t used, head, chunk;
+   int ser_read, total;
+   uint8_t FAR *p = buffer;
+
+   total = 0;
+   while (bufsize > 0)
+   {
+      used = xbee->staging.tail - xbee->staging.head;
+      if (used == 0)
+      {
+         ser_read = _xbee_rx_fill( xbee);
+         if (ser_read <= 0)
+         {
+            return total ? total : ser_read;
+         }
+         used = ser_read;
+      }
+
+      // copy the contiguous run of bytes starting at head
+      head = xbee->staging.head & _XBEE_STAGING_MASK;
+      chunk = XBEE_DEV_RX_STAGING_SIZE - head;
+      if (chunk > used)
+      {
+         chunk = used;
+      }
+      if (chunk > bufsize)
+      {
+         chunk = bufsize;
+      }
+      if (checksum != NULL)
+      {
+         *checksum = _xbee_checksum_copy( p, &xbee->staging.buf[head], chunk,
+            *checksum);
+      }
+      else
+      {
+         _f_memcpy( p, &xbee->staging.buf[head], chunk);
+      }
+      xbee->staging.head += chunk;
+      p += chunk;
+      bufsize -= chunk;
+      total += chunk;
+   }
+
+   return total;
+}
+
+/**
+   @internal
+   @brief
+   Discard staged bytes up to and including the next start-of-frame (0x7E),
+   refilling the staging ring from the serial port as necessary.
+
+   @param[in]  xbee  XBee device to read from.
+
+   @retval  1     Found (and consumed) a start-of-frame byte.
+   @retval  0     No start-of-frame byte available.
+   @retval  <0    Error from xbee_ser_read().
+*/
+_xbee_device_debug
+int _xbee_rx_scan_start( xbee_dev_t *xbee)
+{
+   uint16_t used, head, chunk;
+   const uint8_t *found;
+   int ser_read;
+
+   for (;;)
+   {
+      used = xbee->staging.tail - xbee->staging.head;
+      if (used == 0)
+      {
+         ser_read = _xbee_rx_fill( xbee);
+         if (ser_read <= 0)
+         {
+            return ser_read;
+         }
+         used = ser_read;
+      }
+
+      // scan the contiguous run of bytes starting at head
+      head = xbee->staging.head & _XBEE_STAGING_MASK;
+      chunk = XBEE_DEV_RX_STAGING_SIZE - head;
+      if (chunk > used)
+      {
+         chunk = used;
+      }
+      found = memchr( &xbee->staging.buf[head], 0x7E, chunk);
+      if (found != NULL)
+      {
+         xbee->staging.head += (uint16_t)(found - &xbee->staging.buf[head]) + 1;
+         return 1;
+      }
+      xbee->staging.head += chunk;
+   }
+}
+
+#if XBEE_DEV_RX_ZERO_COPY
+/**
+   @internal
+   @brief
+   Wait for the next \a need bytes to be staged contiguously at the head of
+   the staging ring, so _xbee_frame_load() can use them in place.
+
+   Staged bytes never wrap around the end of the ring in this mode.  If
+   there isn't room for \a need bytes between the head and the end of the
+   ring, the staged bytes are moved to the start of the ring first.
+
+   @param[in]  xbee  XBee device to read from.
+   @param[in]  need  Number of bytes required, no more than
+                     XBEE_DEV_RX_STAGING_SIZE.
+
+   @retval  1     \a need bytes start at
+                  \c xbee->staging.buf[xbee->staging.head].
+   @retval  0     Still waiting for bytes from the serial port.
+   @retval  <0    Error from xbee_ser_read().
+*/
+_xbee_device_debug
+int _xbee_rx_peek( xbee_dev_t *xbee, uint16_t need)
+{
+   uint16_t used;
+   int ser_read;
+
+   for (;;)
+   {
+      used = xbee->staging.tail - xbee->staging.head;
+      if (used >= need)
+      {
+         return 1;
+      }
+
+      if ((uint_fast32_t) xbee->staging.head + need > XBEE_DEV_RX_STAGING_SIZE)
+      {
+         // frame would run past the end of the ring, linearise it
+         memmove( xbee->staging.buf, &xbee->staging.buf[xbee->staging.head],
+            used);
+         xbee->staging.head = 0;
+         xbee->staging.tail = used;
+      }
+
+      ser_read = _xbee_rx_fill( xbee);
+      if (ser_read <= 0)
+      {
+         return ser_read;
+      }
+   }
+}
+#endif
+
+/**
+   @internal
+   @brief
+   After a frame fails its checksum, put the bytes that followed its
+   start-of-frame back into the staging ring, starting with the next 0x7E,
+   so _xbee_frame_load() can parse them again without another serial read.
+
+   A lost or corrupted byte often means the "bad" frame swallowed the start
+   of one or more good frames that followed it.
+
+   With XBEE_DEV_RX_ZERO_COPY, the frame was checked in place, and this
+   function only has to move the ring's head back over its bytes.
+
+   @param[in]  xbee        XBee device that read the frame.
+   @param[in]  frame_data  Bytes of the failed frame, including checksum.
+
+   @return  Number of bytes discarded, including the failed frame's
+            start-of-frame and length bytes.
+*/
+_xbee_device_debug
+uint16_t _xbee_rx_resync( xbee_dev_t *xbee, const uint8_t FAR *frame_data)
+{
+   uint16_t length, unread, skipped;
+#if ! XBEE_DEV_RX_ZERO_COPY
+   uint16_t pos, index, chunk;
+#endif
+   const uint8_t FAR *found;
+   bool_t lsb_start;
+
+   length = xbee->rx.bytes_in_frame + 1;
+
+   // The MSB of the length can't be 0x7E (see XBEE_RX_STATE_LENGTH_MSB),
+   // but the LSB could be the real start-of-frame.
+   lsb_start = ((xbee->rx.bytes_in_frame & 0xFF) == 0x7E);
+   if (lsb_start)
+   {
+      unread = length;
+   }
+   else
+   {
+      found = memchr( frame_data, 0x7E, length);
+      unread = (found == NULL) ? 0 : length - (uint16_t)(found - frame_data);
+   }
+
+#if ! XBEE_DEV_RX_ZERO_COPY
+   if (unread > XBEE_DEV_RX_STAGING_SIZE
+                  - (uint16_t)(xbee->staging.tail - xbee->staging.head))
+   {
+      // ring refilled since we read the frame, no room to put bytes back
+      unread = 0;
+   }
+#endif
+
+   // start-of-frame, two length bytes and the frame (with checksum)
+   skipped = 3 + length - unread;
+   if (unread)
+   {
+      if (lsb_start)
+      {
+         // the LSB was a start-of-frame, and the frame's bytes its length
+         xbee->rx.state = XBEE_RX_STATE_LENGTH_MSB;
+         --skipped;
+      }
+      xbee->staging.head -= unread;
+#if ! XBEE_DEV_RX_ZERO_COPY
+      pos = xbee->staging.head;
+      frame_data += length - unread;
+      while (unread)
+      {
+         index = pos & _XBEE_STAGING_MASK;
+         chunk = XBEE_DEV_RX_STAGING_SIZE - index;
+         if (chunk > unread)
+         {
+            chunk = unread;
+         }
+         _f_memcpy( &xbee->staging.buf[index], frame_data, chunk);
+         frame_data += chunk;
+         pos += chunk;
+         unread -= chunk;
+      }
+#endif
+   }
+
+   return skipped;
+}
+#else
+/**
+   @internal
+   @brief
+   Read frame bytes directly from the serial port, and add them to the
+   frame's running checksum.
+
+   Same parameters and return values as xbee_ser_read().
+*/
+_xbee_device_debug
+int _xbee_rx_read_sum( xbee_dev_t *xbee, void FAR *buffer, int bufsize)
+{
+   int ser_read;
+
+   ser_read = _xbee_rx_read_serial( xbee, buffer, bufsize);
+   if (ser_read > 0)
+   {
+      xbee->rx.checksum = _xbee_checksum( buffer, ser_read, xbee->rx.checksum);
+   }
 
-   return 0;
+   return ser_read;
 }
+#endif // XBEE_DEV_RX_STAGING_SIZE
 
-
-/*** BeginHeader _xbee_frame_load */
-/*** EndHeader */
-#ifdef __XBEE_PLATFORM_HCS08
-   #pragma MESSAGE DISABLE C5909    // Assignment in condition is OK
-#endif
 /**
    @internal
    @brief
@@ -617,19 +3031,59 @@ int xbee_frame_write( xbee_dev_t *xbee, const void FAR *header,
    Should only be called after \a xbee has been initialized by calling
    xbee_dev_init().  Typically called by xbee_dev_tick().
 
+   If the platform defines XBEE_DEV_RX_STAGING_SIZE, bytes are read from
+   the serial port in large chunks into a staging ring, start-of-frame bytes
+   are located with memchr(), and all complete frames in the ring are
+   parsed (up to XBEE_DEV_MAX_DISPATCH_PER_TICK) without further reads.
+   The ring also lets the parser resync after a checksum failure by
+   reparsing the failed frame's bytes from the next 0x7E.  Otherwise, the
+   state machine reads directly from the serial port.
+
+   In escaped API mode (see xbee_dev_api_mode()), bytes are unescaped as
+   they're read from the serial port, before they reach the staging ring.
+
+   With XBEE_DEV_RX_ZERO_COPY, each frame is checked and dispatched where
+   it sits in the staging ring.  Handlers must not keep pointers into the
+   frame after returning.
+
+   When a reader thread started by xbee_dev_rx_thread_start() calls this
+   function, frames are read directly into the tail of the device's frame
+   queue (for _xbee_frame_drain() to dispatch) instead of being dispatched.
+
+   Processes up to XBEE_DEV_MAX_DISPATCH_PER_TICK frames, see
+   _xbee_frame_load_budget() for other limits.
+
    @param[in]  xbee  XBee device to read from.
 
-   @retval  0     No new frames waiting.
-   @retval  >0    Number of frames processed.
-   @retval  <0    Error.
+   @retval  0        No new frames waiting.
+   @retval  >0       Number of frames processed.
+   @retval  -ENOSPC  Frame queue is full, no frames processed.
+   @retval  <0       Error.
 
    @see xbee_dev_init(), _xbee_frame_dispatch()
 */
 _xbee_device_debug
 int _xbee_frame_load( xbee_dev_t *xbee)
 {
-   // Use xbee_serial API to load multiple bytes at a time.
+   return _xbee_frame_load_budget( xbee, NULL);
+}
+
+/**
+   @internal
+   @brief
+   Version of _xbee_frame_load() that stops once it has used up a budget
+   (see xbee_dev_tick_budget()).
 
+   @param[in]  xbee     XBee device to read from.
+   @param[in]  budget   Limits on frames processed, or NULL to stop after
+                        XBEE_DEV_MAX_DISPATCH_PER_TICK frames.
+
+   @return  Same values as _xbee_frame_load().
+*/
+_xbee_device_debug
+int _xbee_frame_load_budget( xbee_dev_t *xbee,
+   const xbee_dev_budget_t *budget)
+{
    // Based on state, do one of the following:
 
    // 1) Waiting for start of frame:
@@ -647,10 +3101,11 @@ int _xbee_frame_load( xbee_dev_t *xbee)
    uint8_t ch;
    uint16_t length;
    int bytes_left, ser_read;
-   uint_fast8_t dispatched;
-   xbee_serial_t  *serport;
+   int dispatched;
+   uint32_t start, bytes;
+   uint8_t FAR *frame_data;
 
-   if (xbee == NULL || xbee_ser_invalid( (serport = &xbee->serport) ))
+   if (xbee == NULL || xbee_ser_invalid( &xbee->serport))
    {
       #ifdef XBEE_DEVICE_VERBOSE
          printf( "%s: return -EINVAL (xbee is %p)\n", __FUNCTION__, xbee);
@@ -658,13 +3113,62 @@ int _xbee_frame_load( xbee_dev_t *xbee)
       return -EINVAL;
    }
 
+#if XBEE_DEV_RX_STAGING_SIZE
+   // read through the staging ring instead of directly from serial port,
+   // summing frame bytes as they're copied out of the ring
+   #define _XBEE_RX_READ(buf, len)  _xbee_rx_read( xbee, buf, len, NULL)
+   #define _XBEE_RX_READ_SUM(buf, len) \
+      _xbee_rx_read( xbee, buf, len, &xbee->rx.checksum)
+#else
+   #define _XBEE_RX_READ(buf, len)  _xbee_rx_read_serial( xbee, buf, len)
+   #define _XBEE_RX_READ_SUM(buf, len) \
+      _xbee_rx_read_sum( xbee, buf, len)
+#endif
+
+#if XBEE_DEV_RX_QUEUE_SIZE
+   // reader thread reads frames into the queue's tail slot
+   #define _XBEE_RX_QUEUEING  (xbee->rx_queue.enabled)
+   #define _XBEE_RX_SLOT   \
+      xbee->rx_queue.slot[xbee->rx_queue.tail & (XBEE_DEV_RX_QUEUE_SIZE - 1)]
+#else
+   #define _XBEE_RX_QUEUEING  0
+#endif
+#if XBEE_DEV_RX_ZERO_COPY
+   // set to the frame's location in the staging ring once it's all there
+   frame_data = NULL;
+#elif XBEE_DEV_RX_QUEUE_SIZE
+   frame_data = xbee->rx_queue.enabled ? _XBEE_RX_SLOT.frame
+                                       : xbee->rx.frame_data;
+#else
+   frame_data = xbee->rx.frame_data;
+#endif
+
    dispatched = 0;      // counter to keep track of frames processed
+   bytes = 0;           // and bytes in those frames
+   start = (budget != NULL && budget->usec) ? XBEE_DEV_STATS_TIMER() : 0;
 
    for (;;)
    {
       switch (xbee->rx.state)
       {
          case XBEE_RX_STATE_WAITSTART:    // waiting for initial 0x7E
+#if XBEE_DEV_RX_QUEUE_SIZE
+            if (xbee->rx_queue.enabled
+               && (uint16_t)(xbee->rx_queue.tail
+                  - XBEE_ATOMIC_LOAD( &xbee->rx_queue.head))
+                                                   == XBEE_DEV_RX_QUEUE_SIZE)
+            {
+               // no room for another frame until xbee_dev_tick() drains one
+               ser_read = dispatched ? 0 : -ENOSPC;
+               goto _exit_loop;
+            }
+#endif
+#if XBEE_DEV_RX_STAGING_SIZE
+            ser_read = _xbee_rx_scan_start( xbee);
+            if (ser_read != 1) {
+               goto _exit_loop;
+            }
+#else
             /*
                It may seem inefficient to read one byte at a time while looking
                for the 0x7E start byte, but in reality we almost always read it
@@ -672,20 +3176,30 @@ int _xbee_frame_load( xbee_dev_t *xbee)
                start with 0x7E).
             */
             do {
-               ser_read = xbee_ser_read( serport, &ch, 1);
+               ser_read = _xbee_rx_read_serial( xbee, &ch, 1);
                if (ser_read != 1) {
                   goto _exit_loop;
                }
             } while (ch != 0x7E);
+#endif
             #ifdef XBEE_DEVICE_VERBOSE
                printf( "%s: got start-of-frame\n", __FUNCTION__);
             #endif
+            #if _XBEE_DEV_RX_STARTED
+               xbee->rx.started = XBEE_DEV_STATS_TIMER();
+            #endif
+#if XBEE_DEV_RX_QUEUE_SIZE
+            if (xbee->rx_queue.enabled)
+            {
+               _XBEE_RX_SLOT.timestamp = xbee_millisecond_timer();
+            }
+#endif
             xbee->rx.state = XBEE_RX_STATE_LENGTH_MSB;
             // fall through to next state
 
          case XBEE_RX_STATE_LENGTH_MSB:
             // try to read a character from the serial port
-            ser_read = xbee_ser_read( serport, &ch, 1);
+            ser_read = _XBEE_RX_READ( &ch, 1);
             if (ser_read != 1) {
                goto _exit_loop;
             }
@@ -705,11 +3219,10 @@ int _xbee_frame_load( xbee_dev_t *xbee)
             // fall through to trying to read LSB of length
          case XBEE_RX_STATE_LENGTH_LSB:
             // try to read a character from the serial port
-            ser_read = xbee_ser_read( serport, &ch, 1);
+            ser_read = _XBEE_RX_READ( &ch, 1);
             if (ser_read != 1) {
                goto _exit_loop;
             }
-
             // set LSB of frame length, make local copy for range check
             length = (xbee->rx.bytes_in_frame += ch);
             if (length > XBEE_MAX_RX_FRAME_LEN || length < 2)
@@ -719,6 +3232,7 @@ int _xbee_frame_load( xbee_dev_t *xbee)
                   printf( "%s: read bad frame length (%u ! [2 .. %u])\n",
                      __FUNCTION__, length, XBEE_MAX_RX_FRAME_LEN);
                #endif
+               _XBEE_RX_STATS_ADD( xbee, bad_lengths, 1);
                if (ch == 0x7E)
                {
                   // Handle case of 0x7E 0xXX 0x7E where second 0x7E is actual
@@ -736,12 +3250,24 @@ int _xbee_frame_load( xbee_dev_t *xbee)
             #endif
             xbee->rx.state = XBEE_RX_STATE_RXFRAME;
             xbee->rx.bytes_read = 0;
+            xbee->rx.checksum = 0xFF;
             // fall through to next state
 
          case XBEE_RX_STATE_RXFRAME:      // receiving frame & trailing checksum
+#if XBEE_DEV_RX_ZERO_COPY
+            // wait for the whole frame, then checksum and consume it in place
+            bytes_left = xbee->rx.bytes_in_frame + 1;
+            ser_read = _xbee_rx_peek( xbee, bytes_left);
+            if (ser_read != 1) {
+               goto _exit_loop;
+            }
+            frame_data = &xbee->staging.buf[xbee->staging.head];
+            xbee->staging.head += bytes_left;
+            xbee->rx.checksum = _xbee_checksum( frame_data, bytes_left, 0xFF);
+#else
             bytes_left = xbee->rx.bytes_in_frame - xbee->rx.bytes_read + 1;
-            ser_read = xbee_ser_read( serport,
-                     xbee->rx.frame_data + xbee->rx.bytes_read, bytes_left);
+            ser_read = _XBEE_RX_READ_SUM( frame_data + xbee->rx.bytes_read,
+                                                                  bytes_left);
             if (ser_read != bytes_left)
             {
                // Not enough bytes to finish reading current frame, record
@@ -752,45 +3278,86 @@ int _xbee_frame_load( xbee_dev_t *xbee)
                }
                goto _exit_loop;
             }
+#endif
 
             // ready to load more frames on next pass
             xbee->rx.state = XBEE_RX_STATE_WAITSTART;
 
-            if (_xbee_checksum( xbee->rx.frame_data,
-                                          xbee->rx.bytes_in_frame + 1, 0xFF))
+            // checksum includes the frame's checksum byte, so should be 0
+            if (xbee->rx.checksum)
             {
                // checksum failed, throw out the frame
                #ifdef XBEE_DEVICE_VERBOSE
                   printf( "%s: checksum failed\n", __FUNCTION__);
-                  hex_dump( xbee->rx.frame_data, xbee->rx.bytes_in_frame + 1,
+                  hex_dump( frame_data, xbee->rx.bytes_in_frame + 1,
                      HEX_DUMP_FLAG_OFFSET);
                #endif
+               _XBEE_RX_STATS_ADD( xbee, checksum_errors, 1);
 
-               /* At this point, we *could* look through the frame data for
-                  another start-of-frame (0x7E) marker, including considering
-                  the LSB of the length field.  We shouldn't have to though --
-                  assuming a good serial connection, we should stay in sync
-                  with XBee frames and not have to work too hard at resyncing.
-
-                  Also, we only sync to a select range of 3-byte sequences --
-                  0x7E followed by two-byte length of 0 to about 300.
-               */
-
+#if XBEE_DEV_RX_STAGING_SIZE
+               // Rescan the frame (and the LSB of its length) for another
+               // start-of-frame, the LENGTH states check that it's followed
+               // by a plausible length before reading that frame.
+               _XBEE_RX_SKIPPED( xbee, _xbee_rx_resync( xbee, frame_data));
+#else
+               // no way to put bytes back, wait for the next start-of-frame
+               _XBEE_RX_SKIPPED( xbee, 3 + xbee->rx.bytes_in_frame + 1);
+#endif
                break;
             }
             else
             {
                // frame is ready for dispatch
                ++dispatched;
-               #ifdef XBEE_DEVICE_VERBOSE
-                  printf( "%s: dispatch frame #%d\n", __FUNCTION__,
-                     dispatched);
-               #endif
-               _xbee_frame_dispatch( xbee, xbee->rx.frame_data,
+               bytes += xbee->rx.bytes_in_frame + 4;
+               _XBEE_RX_STATS_ADD( xbee, frames_in, 1);
+               _XBEE_RX_STATS_ADD( xbee, bytes_in,
+                                             xbee->rx.bytes_in_frame + 4);
+#if XBEE_DEV_RX_QUEUE_SIZE
+               if (xbee->rx_queue.enabled)
+               {
+                  // publish the frame to xbee_dev_tick(), move to next slot
+                  #if XBEE_DEV_RX_ZERO_COPY
+                     _f_memcpy( _XBEE_RX_SLOT.frame, frame_data,
+                                                   xbee->rx.bytes_in_frame);
+                  #endif
+                  _XBEE_RX_SLOT.length = xbee->rx.bytes_in_frame;
+                  #if _XBEE_DEV_RX_STARTED
+                     _XBEE_RX_SLOT.started = xbee->rx.started;
+                  #endif
+                  XBEE_ATOMIC_STORE( &xbee->rx_queue.tail,
+                                             xbee->rx_queue.tail + 1);
+                  #if ! XBEE_DEV_RX_ZERO_COPY
+                     frame_data = _XBEE_RX_SLOT.frame;
+                  #endif
+               }
+               else
+#endif
+               {
+                  #ifdef XBEE_DEVICE_VERBOSE
+                     printf( "%s: dispatch frame #%d\n", __FUNCTION__,
+                        dispatched);
+                  #endif
+                  #if XBEE_DEV_STATS
+                     _xbee_histogram_add( &xbee->stats.rx_latency,
+                        XBEE_DEV_STATS_TIMER() - xbee->rx.started);
+                  #endif
+                  _XBEE_CAPTURE( xbee, XBEE_CAPTURE_DIR_RX, xbee->rx.started,
+                     frame_data, xbee->rx.bytes_in_frame, NULL, 0);
+                  _xbee_frame_dispatch( xbee, frame_data,
                                                    xbee->rx.bytes_in_frame);
+               }
 
-               if (dispatched == XBEE_DEV_MAX_DISPATCH_PER_TICK)
+               if (_xbee_tick_budget_spent( xbee, budget, start, dispatched,
+                                                                     bytes))
                {
+                  #if XBEE_DEV_STATS
+                     if (! _XBEE_RX_QUEUEING && xbee_dev_wait( xbee, 0) > 0)
+                     {
+                        // leaving bytes for the next tick
+                        ++xbee->stats.dispatch_limited;
+                     }
+                  #endif
                   goto _exit_loop;
                }
             }
@@ -805,6 +3372,10 @@ int _xbee_frame_load( xbee_dev_t *xbee)
       }
    }
    _exit_loop:
+   #undef _XBEE_RX_READ
+   #undef _XBEE_RX_READ_SUM
+   #undef _XBEE_RX_SLOT
+   #undef _XBEE_RX_QUEUEING
    return ser_read < 0 ? ser_read : dispatched;
 }
 #ifdef __XBEE_PLATFORM_HCS08
@@ -812,8 +3383,414 @@ int _xbee_frame_load( xbee_dev_t *xbee)
 #endif
 
 
+/*** BeginHeader _xbee_frame_drain */
+/*** EndHeader */
+/**
+   @internal
+   @brief
+   Dispatch frames queued by the reader thread started with
+   xbee_dev_rx_thread_start().  Typically called by xbee_dev_tick().
+
+   @param[in]  xbee     XBee device with queued frames.
+   @param[in]  budget   Limits on frames dispatched (see
+                        xbee_dev_tick_budget()), or NULL to stop after
+                        XBEE_DEV_MAX_DISPATCH_PER_TICK frames.
+
+   @retval  0        No frames waiting.
+   @retval  >0       Number of frames dispatched.
+   @retval  -ENOSYS  Platform doesn't support a frame queue.
+
+   @see _xbee_frame_load(), _xbee_frame_dispatch()
+*/
+_xbee_device_debug
+int _xbee_frame_drain( xbee_dev_t *xbee, const xbee_dev_budget_t *budget)
+{
+#if XBEE_DEV_RX_QUEUE_SIZE
+   const struct xbee_dev_rx_slot FAR *slot;
+   uint16_t head, tail;
+   uint32_t start, bytes = 0;
+   int dispatched = 0;
+
+   _xbee_rx_counts_merge( xbee);
+
+   start = (budget != NULL && budget->usec) ? XBEE_DEV_STATS_TIMER() : 0;
+   head = xbee->rx_queue.head;
+   tail = XBEE_ATOMIC_LOAD( &xbee->rx_queue.tail);
+   while (head != tail)
+   {
+      slot = &xbee->rx_queue.slot[head & (XBEE_DEV_RX_QUEUE_SIZE - 1)];
+      ++dispatched;
+      #ifdef XBEE_DEVICE_VERBOSE
+         printf( "%s: dispatch queued frame #%d\n", __FUNCTION__,
+            dispatched);
+      #endif
+      xbee->rx_queue.received = slot->timestamp;
+      #if XBEE_DEV_STATS
+         _xbee_histogram_add( &xbee->stats.rx_latency,
+            XBEE_DEV_STATS_TIMER() - slot->started);
+      #endif
+      _XBEE_CAPTURE( xbee, XBEE_CAPTURE_DIR_RX, slot->started,
+         slot->frame, slot->length, NULL, 0);
+      _xbee_frame_dispatch( xbee, slot->frame, slot->length);
+      bytes += slot->length + 4;
+
+      // hand the slot back to the reader thread
+      XBEE_ATOMIC_STORE( &xbee->rx_queue.head, ++head);
+
+      if (_xbee_tick_budget_spent( xbee, budget, start, dispatched, bytes))
+      {
+         break;
+      }
+   }
+   if (head != tail)
+   {
+      _XBEE_STATS_ADD( xbee, dispatch_limited, 1);
+   }
+
+   return dispatched;
+#else
+   return -ENOSYS;
+#endif
+}
+
+
+/*** BeginHeader xbee_frame_handler_add, xbee_frame_handler_remove,
+   _xbee_frame_registry_dispatch */
+int _xbee_frame_registry_dispatch( xbee_dev_t *xbee, const void FAR *frame,
+   uint16_t length, xbee_frame_handler_fn skip);
+/*** EndHeader */
+#if XBEE_DEV_HANDLER_REGISTRY_SIZE
+// registry bucket for a given frame type and frame ID
+#define _XBEE_REGISTRY_BUCKET(type, id) \
+   (((type) ^ ((type) >> 4) ^ ((id) * 5u)) & (XBEE_DEV_HANDLER_BUCKETS - 1))
+
+// Unlink entry <index> (1-based) from its bucket and mark it as free.
+_xbee_device_debug
+void _xbee_registry_unlink( struct xbee_dev_registry *reg, uint_fast8_t index)
+{
+   xbee_dev_handler_t *entry = &reg->entry[index - 1];
+   uint8_t *link;
+
+   link = &reg->bucket[_XBEE_REGISTRY_BUCKET( entry->frame_type,
+                                                         entry->frame_id)];
+   while (*link && *link != index)
+   {
+      link = &reg->entry[*link - 1].next;
+   }
+   if (*link)
+   {
+      *link = entry->next;
+   }
+   memset( entry, 0, sizeof *entry);
+}
+#endif
+
+/**
+   @brief
+   Register a frame handler with a single XBee device at runtime.
+
+   Handlers in the static xbee_frame_handlers[] table apply to all devices,
+   and are called first.  Handlers registered with this function are then
+   called in order of \a priority (highest first), and in order of
+   registration for equal priorities.
+
+   Frame types and IDs use the same matching rules as
+   xbee_dispatch_table_entry_t:  a \a frame_type or \a frame_id of 0 matches
+   all frames.  The registry is hashed by frame type and ID, so dispatching
+   a frame only visits the handlers that could match it.
+
+   A handler can remove itself by returning XBEE_FRAME_HANDLER_DONE, useful
+   for handlers waiting for a single response or status frame.
+
+   Since xbee_dev_init() clears the registry, register handlers after
+   initializing the device.
+
+   @param[in,out] xbee        device to receive frames from
+   @param[in]     frame_type  frame type to match, or 0 for all types
+   @param[in]     frame_id    frame ID to match, or 0 for all IDs
+   @param[in]     handler     function to call with matching frames
+   @param[in]     context     \a context parameter passed to \a handler
+   @param[in]     priority    higher values are called before lower values
+
+   @retval  >0       handle to pass to xbee_frame_handler_remove()
+   @retval  -EINVAL  \a xbee or \a handler is NULL
+   @retval  -ENOSPC  registry is full (see XBEE_DEV_HANDLER_REGISTRY_SIZE)
+   @retval  -ENOSYS  not compiled with XBEE_DEV_HANDLER_REGISTRY_SIZE
+
+   @sa xbee_frame_handler_remove(), xbee_frame_handler_fn()
+*/
+_xbee_device_debug
+int xbee_frame_handler_add( xbee_dev_t *xbee, uint8_t frame_type,
+   uint8_t frame_id, xbee_frame_handler_fn handler, void FAR *context,
+   int8_t priority)
+{
+#if ! XBEE_DEV_HANDLER_REGISTRY_SIZE
+   XBEE_UNUSED_PARAMETER( xbee);
+   XBEE_UNUSED_PARAMETER( frame_type);
+   XBEE_UNUSED_PARAMETER( frame_id);
+   XBEE_UNUSED_PARAMETER( handler);
+   XBEE_UNUSED_PARAMETER( context);
+   XBEE_UNUSED_PARAMETER( priority);
+
+   return -ENOSYS;
+#else
+   struct xbee_dev_registry *reg;
+   xbee_dev_handler_t *entry;
+   uint8_t *link;
+   uint_fast8_t index;
+
+   if (xbee == NULL || handler == NULL)
+   {
+      return -EINVAL;
+   }
+
+   reg = &xbee->registry;
+   for (index = 1; index <= XBEE_DEV_HANDLER_REGISTRY_SIZE; ++index)
+   {
+      if (! (reg->entry[index - 1].flags & XBEE_DEV_HANDLER_FLAG_INUSE))
+      {
+         break;
+      }
+   }
+   if (index > XBEE_DEV_HANDLER_REGISTRY_SIZE)
+   {
+      #ifdef XBEE_DEVICE_VERBOSE
+         printf( "%s: registry full\n", __FUNCTION__);
+      #endif
+      return -ENOSPC;
+   }
+
+   entry = &reg->entry[index - 1];
+   entry->handler = handler;
+   entry->context = context;
+   entry->frame_type = frame_type;
+   entry->frame_id = frame_id;
+   entry->priority = priority;
+   entry->flags = XBEE_DEV_HANDLER_FLAG_INUSE;
+
+   // keep bucket sorted by priority, after entries of equal priority
+   link = &reg->bucket[_XBEE_REGISTRY_BUCKET( frame_type, frame_id)];
+   while (*link && reg->entry[*link - 1].priority >= priority)
+   {
+      link = &reg->entry[*link - 1].next;
+   }
+   entry->next = *link;
+   *link = (uint8_t) index;
+
+   return index;
+#endif
+}
+
+/**
+   @brief
+   Remove a frame handler registered with xbee_frame_handler_add().
+
+   Safe to call from a frame handler; the handler won't be called again
+   and the entry is unlinked once dispatching completes.
+
+   @param[in,out] xbee     device the handler was registered with
+   @param[in]     handle   value returned from xbee_frame_handler_add()
+
+   @retval  0        handler removed
+   @retval  -EINVAL  \a xbee is NULL or \a handle is invalid
+   @retval  -ENOENT  \a handle isn't registered
+   @retval  -ENOSYS  not compiled with XBEE_DEV_HANDLER_REGISTRY_SIZE
+
+   @sa xbee_frame_handler_add()
+*/
+_xbee_device_debug
+int xbee_frame_handler_remove( xbee_dev_t *xbee, int handle)
+{
+#if ! XBEE_DEV_HANDLER_REGISTRY_SIZE
+   XBEE_UNUSED_PARAMETER( xbee);
+   XBEE_UNUSED_PARAMETER( handle);
+
+   return -ENOSYS;
+#else
+   struct xbee_dev_registry *reg;
+   xbee_dev_handler_t *entry;
+
+   if (xbee == NULL || handle < 1 || handle > XBEE_DEV_HANDLER_REGISTRY_SIZE)
+   {
+      return -EINVAL;
+   }
+
+   reg = &xbee->registry;
+   entry = &reg->entry[handle - 1];
+   if (entry->flags != XBEE_DEV_HANDLER_FLAG_INUSE)
+   {
+      return -ENOENT;            // unused, or already removed
+   }
+
+   if (reg->dispatching)
+   {
+      // don't change links out from under _xbee_frame_registry_dispatch()
+      entry->flags |= XBEE_DEV_HANDLER_FLAG_REMOVED;
+      reg->removed = TRUE;
+   }
+   else
+   {
+      _xbee_registry_unlink( reg, handle);
+   }
+
+   return 0;
+#endif
+}
+
+/**
+   @internal
+   @brief
+   Called by _xbee_frame_dispatch() to pass a frame to matching handlers in
+   the device's runtime registry.
+
+   Merges the (up to) four bucket chains that could hold a matching handler,
+   one for each combination of exact or wildcard frame type and frame ID,
+   calling handlers in priority order.
+
+   @param[in]  xbee     XBee device that received the frame.
+   @param[in]  frame    Frame, starting with the frame type.
+   @param[in]  length   Number of bytes in frame.
+   @param[in]  skip     Handler that already received the frame (the owner
+                        of its frame ID), or NULL.  Entries for it aren't
+                        called again.
+
+   @return  number of handlers the frame was dispatched to
+*/
+_xbee_device_debug
+int _xbee_frame_registry_dispatch( xbee_dev_t *xbee, const void FAR *frame,
+   uint16_t length, xbee_frame_handler_fn skip)
+{
+#if ! XBEE_DEV_HANDLER_REGISTRY_SIZE
+   XBEE_UNUSED_PARAMETER( xbee);
+   XBEE_UNUSED_PARAMETER( frame);
+   XBEE_UNUSED_PARAMETER( length);
+   XBEE_UNUSED_PARAMETER( skip);
+
+   return 0;
+#else
+   struct xbee_dev_registry *reg = &xbee->registry;
+   const xbee_dev_handler_t *entry;
+   uint8_t key_type[4], key_id[4], cursor[4];
+   uint_fast8_t frametype, frameid, type, id, index;
+   int k, keys, best, dispatched;
+
+   frametype = ((const uint8_t FAR *)frame)[0];
+   frameid = length > 1 ? ((const uint8_t FAR *)frame)[1] : 0;
+
+   keys = 0;
+   for (k = 0; k < 4; ++k)
+   {
+      type = (k & 2) ? 0 : frametype;
+      id = (k & 1) ? 0 : frameid;
+      if ((type == 0 && ! (k & 2)) || (id == 0 && ! (k & 1)))
+      {
+         continue;         // same key as a wildcard combination
+      }
+      key_type[keys] = type;
+      key_id[keys] = id;
+      cursor[keys] = reg->bucket[_XBEE_REGISTRY_BUCKET( type, id)];
+      ++keys;
+   }
+
+   dispatched = 0;
+   ++reg->dispatching;
+   for (;;)
+   {
+      // advance each cursor to its next live entry with an exact key match,
+      // and pick the one with the highest priority
+      best = -1;
+      for (k = 0; k < keys; ++k)
+      {
+         while (cursor[k])
+         {
+            entry = &reg->entry[cursor[k] - 1];
+            if (entry->frame_type == key_type[k]
+               && entry->frame_id == key_id[k]
+               && ! (entry->flags & XBEE_DEV_HANDLER_FLAG_REMOVED))
+            {
+               break;
+            }
+            cursor[k] = entry->next;
+         }
+         if (cursor[k] && (best < 0 || reg->entry[cursor[k] - 1].priority
+                                    > reg->entry[cursor[best] - 1].priority))
+         {
+            best = k;
+         }
+      }
+      if (best < 0)
+      {
+         break;
+      }
+
+      index = cursor[best];
+      entry = &reg->entry[index - 1];
+      cursor[best] = entry->next;
+      if (entry->handler == skip)
+      {
+         continue;
+      }
+      ++dispatched;
+      #ifdef XBEE_DEVICE_VERBOSE
+         printf( "%s: calling registered handler %u @%p, w/context %" \
+            PRIpFAR "\n", __FUNCTION__, index, entry->handler,
+            entry->context);
+      #endif
+      if (entry->handler( xbee, frame, length, entry->context)
+         == XBEE_FRAME_HANDLER_DONE)
+      {
+         xbee_frame_handler_remove( xbee, index);
+      }
+   }
+
+   if (--reg->dispatching == 0 && reg->removed)
+   {
+      reg->removed = FALSE;
+      for (index = 1; index <= XBEE_DEV_HANDLER_REGISTRY_SIZE; ++index)
+      {
+         if (reg->entry[index - 1].flags & XBEE_DEV_HANDLER_FLAG_REMOVED)
+         {
+            _xbee_registry_unlink( reg, index);
+         }
+      }
+   }
+
+   return dispatched;
+#endif
+}
+
+
 /*** BeginHeader _xbee_frame_dispatch */
 /*** EndHeader */
+#if XBEE_DEV_FRAME_ID_TRACKING
+// Is <frametype> a response that echoes the frame ID of its request?
+_xbee_device_debug
+bool_t _xbee_frame_id_response( uint_fast8_t frametype)
+{
+   switch (frametype)
+   {
+      case XBEE_FRAME_LOCAL_AT_RESPONSE:
+      case 0x89:                             // TX Status (IP devices)
+      case XBEE_FRAME_TRANSMIT_STATUS:
+      case XBEE_FRAME_REMOTE_AT_RESPONSE:
+      case XBEE_FRAME_REG_JOINING_DEV_STATUS:
+      case 0xBB:                             // File System Response
+      case 0xBC:                             // Remote File System Response
+      case 0xBD:                             // GNSS Start/Stop Response
+      case 0xBE:                             // GNSS Raw NMEA Response
+      case 0xBF:                             // GNSS One Shot Response
+      case 0xC0:                             // Socket Create Response
+      case 0xC1:                             // Socket Option Response
+      case 0xC2:                             // Socket Connect Response
+      case 0xC3:                             // Socket Close Response
+      case 0xC6:                             // Socket Listen Response
+         return TRUE;
+   }
+
+   return FALSE;
+}
+#endif
+
 /**
    @internal
    @brief
@@ -868,10 +3845,20 @@ void _xbee_dev_modem_status( wpan_dev_t *wpan, uint_fast8_t status)
    @brief
    Function called by _xbee_frame_load() to dispatch any frames read.
 
-   Scans through xbee->frame_handlers, matching
+   Scans through xbee_frame_handlers, matching
    the frame_type and frame_id (if frame_id is not zero).  Passes
    the frame and context (from the frame handler table) to each
-   matching handler.
+   matching handler.  If xbee_dev_init() built an index of the table
+   (see XBEE_DEV_DISPATCH_INDEX_SIZE), only visits the entries for the
+   frame's type and the wildcard entries.
+
+   Then passes the frame to matching handlers registered with the device
+   by xbee_frame_handler_add().
+
+   With XBEE_DEV_FRAME_ID_TRACKING, a response with a frame ID allocated
+   by xbee_frame_id_alloc() goes to the handler for that ID first, and then
+   to the table and registry as usual.  Entries with the same handler as
+   the ID's owner are skipped, so the owner only sees the frame once.
 
    @param[in]  xbee     XBee device that received the frames.
 
@@ -895,8 +3882,16 @@ int _xbee_frame_dispatch( xbee_dev_t *xbee, const void FAR *frame,
    uint16_t length)
 {
    uint_fast8_t frametype, frameid;
-   bool_t dispatched;
+   int dispatched;
+   xbee_frame_handler_fn owner = NULL;
    const xbee_dispatch_table_entry_t *entry;
+   #if XBEE_DEV_DISPATCH_INDEX_SIZE
+      const uint8_t *offset = NULL;
+      uint_fast8_t count = 0;
+   #endif
+   #if XBEE_DEV_STATS
+      uint32_t started, elapsed;
+   #endif
 
    if (! (xbee && frame && length))
    {
@@ -906,6 +3901,10 @@ int _xbee_frame_dispatch( xbee_dev_t *xbee, const void FAR *frame,
       return -EINVAL;
    }
 
+   #if XBEE_DEV_STATS
+      started = XBEE_DEV_STATS_TIMER();
+   #endif
+
    // first byte of <frame> is the frametype, second is frame ID
    frametype = ((const uint8_t FAR *)frame)[0];
    frameid = ((const uint8_t FAR *)frame)[1];
@@ -922,12 +3921,35 @@ int _xbee_frame_dispatch( xbee_dev_t *xbee, const void FAR *frame,
    #endif
 
    dispatched = 0;
-   for (entry = xbee_frame_handlers; entry->frame_type != 0xFF; ++entry)
+   entry = xbee_frame_handlers;
+   #if XBEE_DEV_FRAME_ID_TRACKING
+      if (frameid && _xbee_frame_id_response( frametype)
+         && xbee->frame_ids.slot[frameid].handler != NULL)
+      {
+         // response goes to the owner of its frame ID first, with the
+         // owner's context, then to the other handlers for its type
+         dispatched = 1;
+         owner = xbee->frame_ids.slot[frameid].handler;
+         owner( xbee, frame, length, xbee->frame_ids.slot[frameid].context);
+      }
+   #endif
+   #if XBEE_DEV_DISPATCH_INDEX_SIZE
+      if (entry != NULL && _xbee_dispatch_index.built)
+      {
+         // only walk the handlers indexed for this frame type
+         offset = &_xbee_dispatch_index.handler[
+                                    _xbee_dispatch_index.start[frametype]];
+         count = _xbee_dispatch_index.count[frametype];
+         entry = count ? &xbee_frame_handlers[*offset] : NULL;
+      }
+   #endif
+   while (entry != NULL && entry->frame_type != 0xFF)
    {
       if (! entry->frame_type || entry->frame_type == frametype)
       {
          // entry matches all frame types (0) or matches this frame's type
-         if (! entry->frame_id || entry->frame_id == frameid)
+         if ((! entry->frame_id || entry->frame_id == frameid)
+            && entry->handler != owner)
          {
             ++dispatched;
             // entry matches all frame IDs (0) or matches this frame's ID
@@ -938,8 +3960,26 @@ int _xbee_frame_dispatch( xbee_dev_t *xbee, const void FAR *frame,
             entry->handler( xbee, frame, length, entry->context);
          }
       }
+
+      #if XBEE_DEV_DISPATCH_INDEX_SIZE
+         if (offset != NULL)
+         {
+            entry = --count ? &xbee_frame_handlers[*++offset] : NULL;
+            continue;
+         }
+      #endif
+      ++entry;
    }
 
+   dispatched += _xbee_frame_registry_dispatch( xbee, frame, length, owner);
+
+   #if XBEE_DEV_STATS
+      elapsed = XBEE_DEV_STATS_TIMER() - started;
+      ++xbee->stats.handler[frametype].frames;
+      xbee->stats.handler[frametype].time += elapsed;
+      _xbee_histogram_add( &xbee->stats.handler_time, elapsed);
+   #endif
+
    #ifdef XBEE_DEVICE_VERBOSE
       if (! dispatched)
       {
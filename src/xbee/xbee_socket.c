@@ -133,9 +133,45 @@ static socket_t *_lookup_socket_id(xbee_dev_t *xbee, uint8_t socket_id)
 /// Free an entry allocated from the socket table with _socket_alloc().
 static void _socket_free(socket_t *s)
 {
+#if XBEE_DEV_FRAME_ID_TRACKING
+    // stop routing responses to this entry (see _socket_frame_id())
+    if (s->type == XBEE_SOCK_SOCKET_TYPE_PENDING && s->create_frame_id) {
+        xbee_frame_id_release(s->xbee, s->create_frame_id);
+    }
+    if (s->tx_frame_id) {
+        xbee_frame_id_release(s->xbee, s->tx_frame_id);
+    }
+#endif
     memset(s, 0, sizeof(*s));
 }
 
+/// Frame ID for a Socket Create or Send request from <s>.  If the device
+/// tracks frame IDs, the response goes to xbee_sock_frame_handler() with
+/// <s> as its context (and not through the dispatch table entry), and the
+/// ID stays allocated until the response arrives or the socket is freed.
+static uint8_t _socket_frame_id(socket_t *s)
+{
+#if XBEE_DEV_FRAME_ID_TRACKING
+    int id = xbee_frame_id_alloc(s->xbee, xbee_sock_frame_handler, s, 0);
+    if (id > 0) {
+        return (uint8_t)id;
+    }
+#endif
+    // matched by searching the socket table
+    return xbee_next_frame_id(s->xbee);
+}
+
+/// Release a frame ID from _socket_frame_id() that won't get a response.
+static void _socket_frame_id_release(socket_t *s, uint8_t frame_id)
+{
+#if XBEE_DEV_FRAME_ID_TRACKING
+    xbee_frame_id_release(s->xbee, frame_id);
+#else
+    XBEE_UNUSED_PARAMETER(s);
+    XBEE_UNUSED_PARAMETER(frame_id);
+#endif
+}
+
 /// Returns a pointer to an open entry in the sockets table, with its state
 /// updated to PENDING.
 static socket_t *_socket_alloc(xbee_dev_t *xbee)
@@ -186,12 +222,13 @@ xbee_sock_t xbee_sock_create(xbee_dev_t *xbee,
 
     xbee_frame_sock_create_t frame;
     frame.frame_type = XBEE_FRAME_SOCK_CREATE;
-    frame.frame_id = xbee_next_frame_id(xbee);
+    frame.frame_id = _socket_frame_id(s);
     frame.protocol = protocol;
     retval = xbee_frame_write(xbee, &frame, sizeof(frame),
                               NULL, 0, XBEE_WRITE_FLAG_NONE);
 
     if (retval) {                       // Unable to send frame to XBee module.
+        _socket_frame_id_release(s, frame.frame_id);
         _socket_free(s);
         return retval;
     }
@@ -382,7 +419,7 @@ int xbee_sock_send(xbee_sock_t socket, uint8_t tx_options,
 
     xbee_header_sock_send_t header;
     header.frame_type = XBEE_FRAME_SOCK_SEND;
-    header.frame_id = xbee_next_frame_id(s->xbee);
+    header.frame_id = _socket_frame_id(s);
     header.socket_id = s->socket_id;
     header.options = tx_options;
 
@@ -393,7 +430,13 @@ int xbee_sock_send(xbee_sock_t socket, uint8_t tx_options,
                  __FUNCTION__, (unsigned)payload_len, header.frame_id,
                  s->socket_id, retval);
 
-    if (retval == 0) {
+    if (retval != 0) {
+        _socket_frame_id_release(s, header.frame_id);
+    } else {
+        if (s->tx_frame_id) {
+            // no longer waiting for the previous send's TX Status
+            _socket_frame_id_release(s, s->tx_frame_id);
+        }
         s->tx_frame_id = header.frame_id;
     }
 
@@ -423,7 +466,7 @@ int xbee_sock_sendto(xbee_sock_t socket, uint8_t tx_options,
 
     xbee_header_sock_sendto_t header;
     header.frame_type = XBEE_FRAME_SOCK_SENDTO;
-    header.frame_id = xbee_next_frame_id(s->xbee);
+    header.frame_id = _socket_frame_id(s);
     header.socket_id = s->socket_id;
     header.options = tx_options;
     header.remote_addr_be = htobe32(remote_addr);
@@ -436,7 +479,13 @@ int xbee_sock_sendto(xbee_sock_t socket, uint8_t tx_options,
                  __FUNCTION__, (unsigned)payload_len, header.frame_id,
                  s->socket_id, retval);
 
-    if (retval == 0) {
+    if (retval != 0) {
+        _socket_frame_id_release(s, header.frame_id);
+    } else {
+        if (s->tx_frame_id) {
+            // no longer waiting for the previous send's TX Status
+            _socket_frame_id_release(s, s->tx_frame_id);
+        }
         s->tx_frame_id = header.frame_id;
     }
 
@@ -596,25 +645,32 @@ int xbee_sock_close_all(xbee_dev_t *xbee)
 
     @param[in]  xbee            XBee device that received the frame.
     @param[in]  frame           Received frame.
+    @param[in]  sock            Socket that owns the frame ID (when routed
+                                by frame ID), or NULL to search the table.
 
     @retval     0               Matched entry in socket table and called
                                 the Notify handler.
     @retval     -ENOENT         Couldn't find matching entry in socket table.
 */
 static int handle_tx_status(xbee_dev_t *xbee,
-                            const xbee_frame_tx_status_t FAR *frame)
+                            const xbee_frame_tx_status_t FAR *frame,
+                            socket_t *sock)
 {
+    socket_t *s = sock ? sock : &socket_table[0];
+    socket_t *end = sock ? sock + 1 : &socket_table[XBEE_SOCK_SOCKET_COUNT];
+
     // Search socket table for matching socket and notify user.
-    socket_t *s;
-    for (s = &socket_table[0]; s < &socket_table[XBEE_SOCK_SOCKET_COUNT]; ++s) {
+    for (; s < end; ++s) {
         if (s->xbee == xbee && s->tx_frame_id == frame->frame_id) {
-            s->notify_handler(_xbee_sock_t(s), XBEE_FRAME_TX_STATUS,
-                              frame->delivery);
-
             // After successfully matching frame_id, clear it so we don't
-            // accidentally match another TX Status frame.
+            // accidentally match another TX Status frame (and so the
+            // Notify handler can send again).
+            _socket_frame_id_release(s, s->tx_frame_id);
             s->tx_frame_id = 0;
 
+            s->notify_handler(_xbee_sock_t(s), XBEE_FRAME_TX_STATUS,
+                              frame->delivery);
+
             return 0;
         }
     }
@@ -631,26 +687,34 @@ static int handle_tx_status(xbee_dev_t *xbee,
 
     @param[in]  xbee            XBee device that received the frame.
     @param[in]  frame           Received frame.
+    @param[in]  sock            Socket that owns the frame ID (when routed
+                                by frame ID), or NULL to search the table.
 
     @retval     0               Matched entry in socket table, updated status
                                 and called the Notify handler.
     @retval     -ENOENT         Couldn't find matching entry in socket table.
 */
 static int handle_create_resp(xbee_dev_t *xbee,
-                              const xbee_frame_sock_shared_resp_t FAR *frame)
+                              const xbee_frame_sock_shared_resp_t FAR *frame,
+                              socket_t *sock)
 {
     debug_printf("%s: type 0x%02X  frame 0x%02X  sock 0x%02X  status 0x%02X\n",
                  __FUNCTION__, frame->frame_type, frame->frame_id,
                  frame->socket_id, frame->status);
 
     // match response based on frame_id
-    socket_t *s;
-    for (s = &socket_table[0]; s < &socket_table[XBEE_SOCK_SOCKET_COUNT]; ++s) {
+    socket_t *s = sock ? sock : &socket_table[0];
+    socket_t *end = sock ? sock + 1 : &socket_table[XBEE_SOCK_SOCKET_COUNT];
+    for (; s < end; ++s) {
         if (s->type == XBEE_SOCK_SOCKET_TYPE_PENDING
             && s->xbee == xbee
             && s->create_frame_id == frame->frame_id)
         {
             if (frame->status == XBEE_SOCK_STATUS_SUCCESS) {
+                // create_frame_id stays in the xbee_sock_t, but the frame
+                // ID itself is free for other requests (_socket_free()
+                // releases it on failure)
+                _socket_frame_id_release(s, s->create_frame_id);
                 s->socket_id = frame->socket_id;
                 s->type = XBEE_SOCK_SOCKET_TYPE_CREATED;
             }
@@ -1019,8 +1083,8 @@ static int handle_sock_state(xbee_dev_t *xbee,
 /*
     Single handler for all frames, reduces number of entries in frame handler
     table and can use a simpler API for each frame type (length only necessary
-    for variable-length frames, drop unused context, cast the void pointer
-    to the correct frame type).
+    for variable-length frames, context only set for responses routed by
+    frame ID, cast the void pointer to the correct frame type).
 
     API documented in xbee/socket.h.
 */
@@ -1030,11 +1094,12 @@ int xbee_sock_frame_handler(xbee_dev_t *xbee, const void FAR *rawframe,
     // Switch on frame_type, always teh first byte of the frame.
     switch (*(const uint8_t *)rawframe)
     {
+    // <context> is the socket for responses routed by _socket_frame_id()
     case XBEE_FRAME_TX_STATUS:
-        return handle_tx_status(xbee, rawframe);
+        return handle_tx_status(xbee, rawframe, context);
 
     case XBEE_FRAME_SOCK_CREATE_RESP:
-        return handle_create_resp(xbee, rawframe);
+        return handle_create_resp(xbee, rawframe, context);
 
     case XBEE_FRAME_SOCK_CONNECT_RESP:
     case XBEE_FRAME_SOCK_LISTEN_RESP:
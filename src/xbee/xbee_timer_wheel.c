@@ -0,0 +1,593 @@
+/*
+ * Copyright (c) 2019 Digi International Inc.,
+ * All rights not expressly granted are reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Digi International Inc. 11001 Bren Road East, Minnetonka, MN 55343
+ * =======================================================================
+ */
+
+/**
+   @addtogroup xbee_timer_wheel
+   @{
+   @file xbee_timer_wheel.c
+
+   Hierarchical timer wheel (see xbee/timer_wheel.h).
+
+   A timer due in less than 2^(XBEE_TIMER_WHEEL_BITS * (n + 1)) milliseconds
+   goes in level n, in the slot for its expiration time at that level's
+   resolution.  When level 0 wraps (every XBEE_TIMER_WHEEL_SLOTS
+   milliseconds), the timers in the next slot of level 1 move down, and so
+   on up the levels.  xbee_timer_wheel_advance() skips over time that has
+   no timers to expire or move.
+*/
+
+/*** BeginHeader */
+#include <errno.h>
+#include <string.h>
+
+#include "xbee/platform.h"
+#include "xbee/timer_wheel.h"
+
+#ifndef __DC__
+   #define _xbee_timer_wheel_debug
+#elif defined XBEE_TIMER_WHEEL_DEBUG
+   #define _xbee_timer_wheel_debug  __debug
+#else
+   #define _xbee_timer_wheel_debug  __nodebug
+#endif
+/*** EndHeader */
+
+/*** BeginHeader xbee_timer_wheel_init, xbee_timer_init, xbee_timer_start,
+   xbee_timer_start_at, xbee_timer_cancel, xbee_timer_wheel_advance,
+   xbee_timer_wheel_run, xbee_timer_wheel_next, xbee_timer_wheel_attach,
+   xbee_timer_tick, xbee_timer_next_timeout */
+/*** EndHeader */
+#define _XBEE_TIMER_MASK         (XBEE_TIMER_WHEEL_SLOTS - 1)
+#define _XBEE_TIMER_SHIFT(level) ((level) * XBEE_TIMER_WHEEL_BITS)
+// timers further out than this wait in the top level
+#define _XBEE_TIMER_RANGE        ((UINT32_C(1) << _XBEE_TIMER_SHIFT( \
+                                    XBEE_TIMER_WHEEL_LEVELS)) - 1)
+
+// wheels passed to xbee_timer_wheel_attach() that still have timers pending
+static xbee_timer_wheel_t FAR *_xbee_timer_attached = NULL;
+
+// Add <timer> to the slot for its expiration time.
+static void _xbee_timer_link( xbee_timer_wheel_t FAR *wheel,
+   xbee_timer_t FAR *timer)
+{
+   xbee_timer_t FAR * FAR *head;
+   uint32_t expires = timer->expires;
+   uint32_t delta = expires - wheel->now;
+   uint_fast8_t level;
+
+   if ((int32_t) delta < 0)
+   {
+      head = &wheel->overdue;
+   }
+   else
+   {
+      if (delta > _XBEE_TIMER_RANGE)
+      {
+         delta = _XBEE_TIMER_RANGE;
+         expires = wheel->now + _XBEE_TIMER_RANGE;
+      }
+      for (level = 0; level < XBEE_TIMER_WHEEL_LEVELS - 1
+         && (delta >> _XBEE_TIMER_SHIFT( level + 1)) != 0; ++level)
+      {
+      }
+      head = &wheel->slot[level]
+                  [(expires >> _XBEE_TIMER_SHIFT( level)) & _XBEE_TIMER_MASK];
+   }
+
+   timer->next = *head;
+   if (*head != NULL)
+   {
+      (*head)->pprev = &timer->next;
+   }
+   timer->pprev = head;
+   *head = timer;
+}
+
+// Take <timer> out of its slot, leaving it pending.
+static void _xbee_timer_unlink( xbee_timer_t FAR *timer)
+{
+   *timer->pprev = timer->next;
+   if (timer->next != NULL)
+   {
+      timer->next->pprev = timer->pprev;
+   }
+}
+
+// Move the list at <head> to <list>, so timers can be unlinked from it.
+static void _xbee_timer_detach( xbee_timer_t FAR * FAR *head,
+   xbee_timer_t FAR * FAR *list)
+{
+   *list = *head;
+   *head = NULL;
+   if (*list != NULL)
+   {
+      (*list)->pprev = list;
+   }
+}
+
+// Remove <wheel> from the list of attached wheels.
+static void _xbee_timer_wheel_detach( xbee_timer_wheel_t FAR *wheel)
+{
+   *wheel->attached_pprev = wheel->attached_next;
+   if (wheel->attached_next != NULL)
+   {
+      wheel->attached_next->attached_pprev = wheel->attached_pprev;
+   }
+   wheel->attached_next = NULL;
+   wheel->attached_pprev = NULL;
+}
+
+// Take <timer> off its wheel before calling it or in xbee_timer_cancel().
+static void _xbee_timer_remove( xbee_timer_t FAR *timer)
+{
+   xbee_timer_wheel_t FAR *wheel = timer->wheel;
+
+   _xbee_timer_unlink( timer);
+   timer->wheel = NULL;
+   if (--wheel->count == 0 && wheel->attached_pprev != NULL)
+   {
+      _xbee_timer_wheel_detach( wheel);
+   }
+}
+
+// Call each timer in <list>, returning the number called.
+static int _xbee_timer_fire( xbee_timer_t FAR * FAR *list)
+{
+   xbee_timer_t FAR *timer;
+   int count = 0;
+
+   // callbacks may cancel other timers in the list
+   while ((timer = *list) != NULL)
+   {
+      _xbee_timer_remove( timer);
+      ++count;
+      if (timer->callback != NULL)
+      {
+         timer->callback( timer);
+      }
+   }
+
+   return count;
+}
+
+// Range of slots on <level> to check, in time order, for timers to call or
+// move down a level.  Slot <base> + k of the level (masked) is reached at
+// time (<base> + k) << shift, for <first> <= k <= <last>.
+static void _xbee_timer_slot_range( const xbee_timer_wheel_t FAR *wheel,
+   uint_fast8_t level, uint32_t *base, uint_fast16_t *first,
+   uint_fast16_t *last)
+{
+   uint32_t now = wheel->now;
+   uint_fast8_t shift = _XBEE_TIMER_SHIFT( level);
+
+   *base = now >> shift;
+
+   // A slot moves down when <now> reaches its start, so the current slot
+   // is next if <now> is at its start, and otherwise is a full turn away.
+   if (now & ((UINT32_C(1) << shift) - 1))
+   {
+      *first = 1;
+      *last = XBEE_TIMER_WHEEL_SLOTS;
+   }
+   else
+   {
+      *first = 0;
+      *last = XBEE_TIMER_WHEEL_SLOTS - 1;
+   }
+}
+
+// Time of the next slot with timers to call or move down a level.
+static uint32_t _xbee_timer_next_event( const xbee_timer_wheel_t FAR *wheel)
+{
+   uint32_t now = wheel->now;
+   uint32_t best = now + _XBEE_TIMER_RANGE;
+   uint32_t base;
+   uint_fast8_t level, shift;
+   uint_fast16_t k, last;
+
+   if (wheel->overdue != NULL)
+   {
+      return now;
+   }
+
+   for (level = 0; level < XBEE_TIMER_WHEEL_LEVELS; ++level)
+   {
+      shift = _XBEE_TIMER_SHIFT( level);
+      _xbee_timer_slot_range( wheel, level, &base, &k, &last);
+      for (; k <= last; ++k)
+      {
+         if (wheel->slot[level][(base + k) & _XBEE_TIMER_MASK] != NULL)
+         {
+            if ((int32_t) (((base + k) << shift) - best) < 0)
+            {
+               best = (base + k) << shift;
+            }
+            break;
+         }
+      }
+   }
+
+   return best;
+}
+
+// Time the first pending timer expires (the wheel has timers pending, none
+// of them overdue).
+static uint32_t _xbee_timer_next_expires( const xbee_timer_wheel_t FAR *wheel)
+{
+   const xbee_timer_t FAR *timer;
+   uint32_t best = wheel->now + _XBEE_TIMER_RANGE;
+   uint32_t base;
+   uint_fast8_t level, shift;
+   uint_fast16_t k, last;
+   bool_t found = FALSE;
+
+   for (level = 0; level < XBEE_TIMER_WHEEL_LEVELS; ++level)
+   {
+      shift = _XBEE_TIMER_SHIFT( level);
+      _xbee_timer_slot_range( wheel, level, &base, &k, &last);
+
+      // Timers don't expire before their slot is reached, so stop at the
+      // first slot reached after <best>.  That's usually the first slot
+      // with timers, but timers past the top level's range can wait in a
+      // later slot than one holding timers that expire after them.
+      for (; k <= last
+         && (! found || (int32_t) (((base + k) << shift) - best) < 0); ++k)
+      {
+         for (timer = wheel->slot[level][(base + k) & _XBEE_TIMER_MASK];
+            timer != NULL; timer = timer->next)
+         {
+            if (! found || (int32_t) (timer->expires - best) < 0)
+            {
+               best = timer->expires;
+               found = TRUE;
+            }
+         }
+      }
+   }
+
+   return best;
+}
+
+/**
+   @brief
+   Set up an empty timer wheel.
+
+   Don't call on a wheel with timers pending.
+
+   @param[out] wheel    Wheel to set up.
+*/
+_xbee_timer_wheel_debug
+void xbee_timer_wheel_init( xbee_timer_wheel_t FAR *wheel)
+{
+   if (wheel != NULL)
+   {
+      _f_memset( wheel, 0, sizeof *wheel);
+      wheel->now = xbee_millisecond_timer();
+   }
+}
+
+/**
+   @brief
+   Set up a timer, before starting it for the first time.
+
+   Don't call on a pending timer.
+
+   @param[out] timer    Timer to set up.
+   @param[in]  callback Function to call when the timer expires.
+   @param[in]  context  Stored in \a timer for \a callback to use.
+*/
+_xbee_timer_wheel_debug
+void xbee_timer_init( xbee_timer_t FAR *timer, xbee_timer_fn callback,
+   void FAR *context)
+{
+   if (timer != NULL)
+   {
+      _f_memset( timer, 0, sizeof *timer);
+      timer->callback = callback;
+      timer->context = context;
+   }
+}
+
+/**
+   @brief
+   Start (or restart) a timer, to expire at a given time.
+
+   If the time has already passed, the timer expires on the next call to
+   xbee_timer_wheel_advance() or xbee_timer_wheel_run().
+
+   @param[in]  wheel    Wheel to add the timer to, usually the \c timers
+                        member of a device's wpan_dev_t.
+   @param[in]  timer    Timer set up with xbee_timer_init().  If it's
+                        pending (on any wheel), it's cancelled first.
+   @param[in]  expires  xbee_millisecond_timer() value to expire at.
+
+   @retval  0        Started timer.
+   @retval  -EINVAL  \a wheel or \a timer is NULL.
+*/
+_xbee_timer_wheel_debug
+int xbee_timer_start_at( xbee_timer_wheel_t FAR *wheel,
+   xbee_timer_t FAR *timer, uint32_t expires)
+{
+   if (wheel == NULL || timer == NULL)
+   {
+      return -EINVAL;
+   }
+
+   if (xbee_timer_pending( timer))
+   {
+      _xbee_timer_remove( timer);
+   }
+
+   if (wheel->count == 0)
+   {
+      // an empty wheel can catch up without visiting the time in between
+      wheel->now = xbee_millisecond_timer();
+   }
+   ++wheel->count;
+   timer->wheel = wheel;
+   timer->expires = expires;
+   _xbee_timer_link( wheel, timer);
+
+   return 0;
+}
+
+/**
+   @brief
+   Start (or restart) a timer, to expire after a delay.
+
+   @param[in]  wheel    Wheel to add the timer to.
+   @param[in]  timer    Timer set up with xbee_timer_init().
+   @param[in]  delay_ms Milliseconds until the timer expires.
+
+   @retval  0        Started timer.
+   @retval  -EINVAL  \a wheel or \a timer is NULL.
+
+   @sa xbee_timer_start_at()
+*/
+_xbee_timer_wheel_debug
+int xbee_timer_start( xbee_timer_wheel_t FAR *wheel, xbee_timer_t FAR *timer,
+   uint32_t delay_ms)
+{
+   return xbee_timer_start_at( wheel, timer,
+      xbee_millisecond_timer() + delay_ms);
+}
+
+/**
+   @brief
+   Stop a timer, without calling its callback.
+
+   @param[in]  timer    Timer to stop.
+
+   @retval  0        Stopped timer.
+   @retval  -EINVAL  \a timer is NULL.
+   @retval  -ENOENT  \a timer wasn't pending.
+*/
+_xbee_timer_wheel_debug
+int xbee_timer_cancel( xbee_timer_t FAR *timer)
+{
+   if (timer == NULL)
+   {
+      return -EINVAL;
+   }
+
+   if (! xbee_timer_pending( timer))
+   {
+      return -ENOENT;
+   }
+
+   _xbee_timer_remove( timer);
+
+   return 0;
+}
+
+/**
+   @brief
+   Call the callbacks of timers that expire at or before a given time.
+
+   Most programs use xbee_timer_wheel_run() (from xbee_dev_tick() or
+   wpan_tick()) instead.
+
+   @param[in]  wheel    Wheel to advance.
+   @param[in]  until    xbee_millisecond_timer() value to advance to.
+
+   @retval  >=0      Number of timers that expired.
+   @retval  -EINVAL  \a wheel is NULL.
+*/
+_xbee_timer_wheel_debug
+int xbee_timer_wheel_advance( xbee_timer_wheel_t FAR *wheel, uint32_t until)
+{
+   xbee_timer_t FAR *list;
+   xbee_timer_t FAR *timer;
+   uint32_t t, next;
+   uint_fast8_t level, index;
+   int count;
+
+   if (wheel == NULL)
+   {
+      return -EINVAL;
+   }
+
+   _xbee_timer_detach( &wheel->overdue, &list);
+   count = _xbee_timer_fire( &list);
+
+   while ((int32_t) (until - wheel->now) >= 0)
+   {
+      if (wheel->count == 0)
+      {
+         wheel->now = until + 1;
+         break;
+      }
+
+      t = wheel->now;
+      index = (uint_fast8_t) (t & _XBEE_TIMER_MASK);
+      if (index == 0)
+      {
+         // move timers down from each level that's starting a new slot
+         for (level = 1; level < XBEE_TIMER_WHEEL_LEVELS; ++level)
+         {
+            index = (uint_fast8_t)
+                     ((t >> _XBEE_TIMER_SHIFT( level)) & _XBEE_TIMER_MASK);
+            _xbee_timer_detach( &wheel->slot[level][index], &list);
+            while ((timer = list) != NULL)
+            {
+               _xbee_timer_unlink( timer);
+               _xbee_timer_link( wheel, timer);
+            }
+            if (index != 0)
+            {
+               break;
+            }
+         }
+         index = 0;
+      }
+
+      // timers started by the callbacks go in later slots
+      wheel->now = t + 1;
+      _xbee_timer_detach( &wheel->slot[0][index], &list);
+      count += _xbee_timer_fire( &list);
+
+      if (wheel->count != 0)
+      {
+         next = _xbee_timer_next_event( wheel);
+         if ((int32_t) (next - wheel->now) > 0)
+         {
+            // nothing to do until <next>
+            wheel->now = (int32_t) (next - until) > 0 ? until + 1 : next;
+         }
+      }
+   }
+
+   return count;
+}
+
+/**
+   @brief
+   Call the callbacks of timers that have expired.
+
+   @param[in]  wheel    Wheel to check.
+
+   @retval  >=0      Number of timers that expired.
+   @retval  -EINVAL  \a wheel is NULL.
+*/
+_xbee_timer_wheel_debug
+int xbee_timer_wheel_run( xbee_timer_wheel_t FAR *wheel)
+{
+   return xbee_timer_wheel_advance( wheel, xbee_millisecond_timer());
+}
+
+/**
+   @brief
+   Report how long a program can wait before a wheel needs to run.
+
+   @param[in]  wheel    Wheel to check.
+
+   @return  Milliseconds until the wheel's next timer expires (0 if one
+            already has), or XBEE_WAIT_FOREVER if it doesn't have any
+            timers pending.
+*/
+_xbee_timer_wheel_debug
+int32_t xbee_timer_wheel_next( const xbee_timer_wheel_t FAR *wheel)
+{
+   int32_t remaining;
+
+   if (wheel == NULL || wheel->count == 0)
+   {
+      return XBEE_WAIT_FOREVER;
+   }
+
+   if (wheel->overdue != NULL)
+   {
+      return 0;
+   }
+
+   remaining = (int32_t) (_xbee_timer_next_expires( wheel)
+                                    - xbee_millisecond_timer());
+
+   return remaining < 0 ? 0 : remaining;
+}
+
+/**
+   @brief
+   Have xbee_timer_tick() and xbee_timer_next_timeout() cover a wheel until
+   it no longer has timers pending.
+
+   Used by layers that share state between devices (e.g., the AT command
+   request pool) so programs can service all of their timeouts without
+   ticking each device.
+
+   @param[in]  wheel    Wheel with timers pending.
+*/
+_xbee_timer_wheel_debug
+void xbee_timer_wheel_attach( xbee_timer_wheel_t FAR *wheel)
+{
+   if (wheel != NULL && wheel->count != 0 && wheel->attached_pprev == NULL)
+   {
+      wheel->attached_next = _xbee_timer_attached;
+      if (_xbee_timer_attached != NULL)
+      {
+         _xbee_timer_attached->attached_pprev = &wheel->attached_next;
+      }
+      wheel->attached_pprev = &_xbee_timer_attached;
+      _xbee_timer_attached = wheel;
+   }
+}
+
+/**
+   @brief
+   Run every wheel passed to xbee_timer_wheel_attach() that still has
+   timers pending.
+
+   @return  Number of timers that expired.
+*/
+_xbee_timer_wheel_debug
+int xbee_timer_tick( void)
+{
+   xbee_timer_wheel_t FAR *wheel;
+   xbee_timer_wheel_t FAR *next;
+   int count = 0;
+
+   for (wheel = _xbee_timer_attached; wheel != NULL; wheel = next)
+   {
+      // running the wheel may detach it
+      next = wheel->attached_next;
+      count += xbee_timer_wheel_run( wheel);
+   }
+
+   return count;
+}
+
+/**
+   @brief
+   Report how long a program can wait before xbee_timer_tick() needs to
+   run one of the attached wheels.
+
+   @return  Milliseconds until the first attached wheel needs to run (0 if
+            one does now), or XBEE_WAIT_FOREVER if there aren't any.
+*/
+_xbee_timer_wheel_debug
+int32_t xbee_timer_next_timeout( void)
+{
+   const xbee_timer_wheel_t FAR *wheel;
+   int32_t timeout = XBEE_WAIT_FOREVER;
+   int32_t remaining;
+
+   for (wheel = _xbee_timer_attached; wheel != NULL;
+      wheel = wheel->attached_next)
+   {
+      remaining = xbee_timer_wheel_next( wheel);
+      timeout = XBEE_WAIT_MIN( timeout, remaining);
+   }
+
+   return timeout;
+}
+
+///@}
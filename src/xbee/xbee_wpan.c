@@ -20,6 +20,7 @@
 /*** BeginHeader */
 #include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "xbee/platform.h"
 #include "xbee/device.h"
@@ -106,18 +107,34 @@ int _xbee_endpoint_send( const wpan_envelope_t FAR *envelope, uint16_t flags);
 */
 xbee_wpan_debug
 int _xbee_endpoint_send( const wpan_envelope_t FAR *envelope, uint16_t flags)
+{
+   // note that wpan_envelope_send() verifies that envelope is not NULL
+   return _xbee_endpoint_send_id( envelope, flags,
+      xbee_next_frame_id( (xbee_dev_t *) envelope->dev));
+}
+
+/*** BeginHeader _xbee_endpoint_send_id */
+/*** EndHeader */
+/**
+   @internal
+
+   Send a Transmit Explicit frame for \a envelope, using \a frame_id for
+   the XBee's Transmit Status.  Shared by _xbee_endpoint_send() and
+   xbee_wpan_send().
+*/
+xbee_wpan_debug
+int _xbee_endpoint_send_id( const wpan_envelope_t FAR *envelope,
+   uint16_t flags, uint8_t frame_id)
 {
    xbee_dev_t *xbee;
    xbee_header_transmit_explicit_t  header;
    int error;
 
-   // note that wpan_envelope_send() verifies that envelope is not NULL
-
    xbee = (xbee_dev_t *) envelope->dev;
 
    // Convert envelope to the necessary frame type and call xbee_frame_send
    header.frame_type = (uint8_t) XBEE_FRAME_TRANSMIT_EXPLICIT;
-   header.frame_id = xbee_next_frame_id( xbee);
+   header.frame_id = frame_id;
    header.ieee_address = envelope->ieee_address;
    header.network_address_be = htobe16( envelope->network_address);
    header.source_endpoint = envelope->source_endpoint;
@@ -196,21 +213,240 @@ int xbee_wpan_init( xbee_dev_t *xbee,
 }
 
 
-/*** BeginHeader _xbee_handle_transmit_status */
+/*** BeginHeader xbee_wpan_send, xbee_wpan_send_cancel, xbee_wpan_tx_pending,
+   _xbee_handle_transmit_status */
 /*** EndHeader */
-// see xbee/device.h for documentation
+/// An xbee_wpan_send() request waiting for its Transmit Status.
+typedef struct xbee_wpan_tx_t {
+   xbee_dev_t              *xbee;      ///< NULL if entry is available
+   xbee_wpan_tx_done_fn    callback;
+   void              FAR   *context;
+   xbee_timer_t            timer;      ///< XBEE_WPAN_TX_TIMEOUT
+   uint8_t                 frame_id;
+   uint8_t                 sequence;   ///< changed on release, for handles
+} xbee_wpan_tx_t;
+
+static xbee_wpan_tx_t _xbee_wpan_tx_table[XBEE_WPAN_TX_PENDING];
+
+// Handles are 1-based index in the upper byte and sequence in the lower
+// byte, so they're always positive.
+#define _XBEE_WPAN_TX_HANDLE(tx)                                        \
+   ((int) (((tx) - _xbee_wpan_tx_table + 1) << 8) | (tx)->sequence)
+
+// Free a table entry, and its frame ID if the device is tracking it.
+static void _xbee_wpan_tx_release( xbee_wpan_tx_t *tx)
+{
+#if XBEE_DEV_FRAME_ID_TRACKING
+   xbee_frame_id_release( tx->xbee, tx->frame_id);
+#endif
+   xbee_timer_cancel( &tx->timer);
+   tx->xbee = NULL;
+   ++tx->sequence;
+}
+
+// Timer callback for a request that didn't get a Transmit Status in time.
+static void _xbee_wpan_tx_expired( xbee_timer_t FAR *timer)
+{
+   xbee_wpan_tx_t *tx = timer->context;
+   xbee_wpan_tx_status_t status;
+
+   memset( &status, 0, sizeof status);
+   status.xbee = tx->xbee;
+   status.handle = _XBEE_WPAN_TX_HANDLE( tx);
+   status.flags = XBEE_WPAN_TX_FLAG_TIMEOUT;
+
+   _xbee_wpan_tx_release( tx);
+   tx->callback( &status, tx->context);
+}
+
+/**
+   @brief
+   Send \a envelope (like wpan_envelope_send()) and have \a callback
+   report its delivery status.
+
+   Requests don't wait for each other, so an application can pipeline
+   sends, keeping up to XBEE_WPAN_TX_PENDING requests in flight and
+   sending the next frame from \a callback.  The callback is called from
+   wpan_tick() (which also times out requests after XBEE_WPAN_TX_TIMEOUT
+   seconds).
+
+   Without XBEE_DEV_FRAME_ID_TRACKING, the device's frame handler table must
+   include XBEE_FRAME_HANDLE_TRANSMIT_STATUS.
+
+   @param[in]  envelope    Envelope to send, on a device configured with
+                           xbee_wpan_init().
+   @param[in]  callback    Function to call with the request's status.
+   @param[in]  context     Passed to \a callback.
+
+   @retval  >0       Handle for the request (also in the status passed to
+                     \a callback).
+   @retval  -EINVAL  Invalid parameter.
+   @retval  -ENOSPC  XBEE_WPAN_TX_PENDING requests already in flight (or no
+                     free frame IDs), wait for one to complete.
+   @retval  <0       Error from xbee_frame_write().
+
+   @sa xbee_wpan_send_cancel(), xbee_wpan_tx_pending()
+*/
+xbee_wpan_debug
+int xbee_wpan_send( const wpan_envelope_t FAR *envelope,
+   xbee_wpan_tx_done_fn callback, void FAR *context)
+{
+   xbee_wpan_tx_t *tx;
+   int error;
+
+   if (envelope == NULL || callback == NULL || envelope->dev == NULL
+      || envelope->dev->endpoint_send != _xbee_endpoint_send)
+   {
+      return -EINVAL;
+   }
+
+   for (tx = _xbee_wpan_tx_table; tx->xbee != NULL; )
+   {
+      if (++tx == &_xbee_wpan_tx_table[XBEE_WPAN_TX_PENDING])
+      {
+         return -ENOSPC;
+      }
+   }
+
+   tx->xbee = (xbee_dev_t *) envelope->dev;
+#if XBEE_DEV_FRAME_ID_TRACKING
+   // route the Transmit Status straight to this entry
+   error = xbee_frame_id_alloc( tx->xbee, _xbee_handle_transmit_status, tx,
+      0);
+   if (error < 0)
+   {
+      tx->xbee = NULL;
+      return error;
+   }
+   tx->frame_id = (uint8_t) error;
+#else
+   tx->frame_id = xbee_next_frame_id( tx->xbee);
+#endif
+
+   // same flags as wpan_envelope_send()
+   error = _xbee_endpoint_send_id( envelope,
+      (envelope->options & WPAN_CLUST_FLAG_ENCRYPT)
+      ? WPAN_SEND_FLAG_ENCRYPTED : WPAN_SEND_FLAG_NONE, tx->frame_id);
+   if (error)
+   {
+      _xbee_wpan_tx_release( tx);
+      return error;
+   }
+
+   tx->callback = callback;
+   tx->context = context;
+   xbee_timer_init( &tx->timer, _xbee_wpan_tx_expired, tx);
+   xbee_timer_start( &tx->xbee->wpan_dev.timers, &tx->timer,
+      XBEE_WPAN_TX_TIMEOUT * UINT32_C(1000));
+
+   return _XBEE_WPAN_TX_HANDLE( tx);
+}
+
+/**
+   @brief
+   Stop waiting for the Transmit Status of an xbee_wpan_send() request,
+   without calling its callback.
+
+   @param[in]  handle   Handle returned by xbee_wpan_send().
+
+   @retval  0        Request cancelled.
+   @retval  -ENOENT  \a handle isn't a request in flight (it may have
+                     already completed).
+*/
+xbee_wpan_debug
+int xbee_wpan_send_cancel( int handle)
+{
+   int index = (handle >> 8) - 1;
+   xbee_wpan_tx_t *tx;
+
+   if (index < 0 || index >= XBEE_WPAN_TX_PENDING)
+   {
+      return -ENOENT;
+   }
+
+   tx = &_xbee_wpan_tx_table[index];
+   if (tx->xbee == NULL || tx->sequence != (uint8_t) handle)
+   {
+      return -ENOENT;
+   }
+
+   _xbee_wpan_tx_release( tx);
+
+   return 0;
+}
+
+/**
+   @brief
+   Count xbee_wpan_send() requests waiting for a Transmit Status.
+
+   Applications can use this to keep a smaller in-flight window than
+   XBEE_WPAN_TX_PENDING on a device.
+
+   @param[in]  xbee     Device to count requests for, or NULL for all devices.
+
+   @return  Number of requests in flight.
+*/
+xbee_wpan_debug
+int xbee_wpan_tx_pending( const xbee_dev_t *xbee)
+{
+   const xbee_wpan_tx_t *tx;
+   int count = 0;
+
+   for (tx = _xbee_wpan_tx_table;
+      tx < &_xbee_wpan_tx_table[XBEE_WPAN_TX_PENDING]; ++tx)
+   {
+      if (tx->xbee != NULL && (xbee == NULL || tx->xbee == xbee))
+      {
+         ++count;
+      }
+   }
+
+   return count;
+}
+
+// see xbee/wpan.h for documentation
 xbee_wpan_debug
 int _xbee_handle_transmit_status( xbee_dev_t *xbee,
    const void FAR *payload, uint16_t length, void FAR *context)
 {
-   // standard XBee frame handler; stub isn't using any parameters yet
-   XBEE_UNUSED_PARAMETER( xbee);
-   XBEE_UNUSED_PARAMETER( payload);
-   XBEE_UNUSED_PARAMETER( length);
-   XBEE_UNUSED_PARAMETER( context);
+   const xbee_frame_transmit_status_t FAR *frame = payload;
+   xbee_wpan_tx_t *tx, *end;
+   xbee_wpan_tx_status_t status;
+
+   if (frame == NULL || length < sizeof *frame)
+   {
+      return -EINVAL;
+   }
 
-   // it may be necessary to push information up to user code so they know when
-   // a packet has been received or if it didn't make it out
+   if (context != NULL)
+   {
+      // routed by frame ID, only check that request
+      tx = context;
+      end = tx + 1;
+   }
+   else
+   {
+      tx = _xbee_wpan_tx_table;
+      end = &_xbee_wpan_tx_table[XBEE_WPAN_TX_PENDING];
+   }
+   for (; tx < end; ++tx)
+   {
+      if (tx->xbee == xbee && tx->frame_id == frame->frame_id)
+      {
+         status.xbee = xbee;
+         status.handle = _XBEE_WPAN_TX_HANDLE( tx);
+         status.network_address = be16toh( frame->network_address_be);
+         status.retries = frame->retries;
+         status.delivery = frame->delivery;
+         status.discovery = frame->discovery;
+         status.flags = 0;
+
+         // release first, so the callback can send again
+         _xbee_wpan_tx_release( tx);
+         tx->callback( &status, tx->context);
+         break;
+      }
+   }
 
    return 0;
 }
@@ -84,8 +84,15 @@ wpan_ep_state_t FAR *zdo_endpoint_state( wpan_dev_t *dev)
    const wpan_endpoint_table_entry_t *ep;
 
    ep = _zdo_endpoint_of( dev);
+   if (ep == NULL)
+   {
+      return NULL;
+   }
+
+   // conversations registered on the state time out on dev's timer wheel
+   _wpan_endpoint_set_dev( ep->ep_state, dev);
 
-   return ep ? ep->ep_state : NULL;
+   return ep->ep_state;
 }
 
 
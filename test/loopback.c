@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2019 Digi International Inc.,
+ * All rights not expressly granted are reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Digi International Inc. 11001 Bren Road East, Minnetonka, MN 55343
+ * =======================================================================
+ */
+
+/*
+   loopback.c
+
+   See loopback.h for documentation.
+*/
+
+#include <string.h>
+
+#include "xbee/platform.h"
+#include "xbee/device.h"
+#include "xbee/serial_loopback.h"
+#include "loopback.h"
+
+// bytes drained from the loopback port, up to the end of a partial frame
+static uint8_t pending[512];
+static int pending_used;
+
+// Fill in <sent> from an API frame of <length> bytes, starting with its type.
+static void loopback_parse( sent_t *sent, const uint8_t *frame, int length)
+{
+   int offset;
+
+   memset( sent, 0, sizeof *sent);
+   sent->frame_type = frame[0];
+   sent->frame_id = (length > 1) ? frame[1] : 0;
+   switch (frame[0])
+   {
+      case XBEE_FRAME_LOCAL_AT_CMD:
+      case XBEE_FRAME_LOCAL_AT_CMD_Q:
+         offset = 2;
+         break;
+
+      case XBEE_FRAME_REMOTE_AT_CMD:
+         memcpy( sent->ieee.b, &frame[2], 8);
+         sent->network = (frame[10] << 8) | frame[11];
+         offset = 13;
+         break;
+
+      default:
+         return;
+   }
+
+   memcpy( sent->command, &frame[offset], 2);
+   offset += 2;
+   sent->param_length = (uint8_t) (length - offset);
+   memcpy( sent->param, &frame[offset],
+      sent->param_length < LOOPBACK_PARAM_MAX
+         ? sent->param_length : LOOPBACK_PARAM_MAX);
+}
+
+int loopback_collect( xbee_dev_t *xbee, sent_t *sent, int max)
+{
+   int read, length, count = 0;
+
+   while ((read = xbee_ser_loopback_drain( &xbee->serport,
+      &pending[pending_used], sizeof pending - pending_used)) > 0)
+   {
+      pending_used += read;
+
+      // the host doesn't escape frames, so this only needs to find 0x7E
+      while (pending_used >= 4)
+      {
+         if (pending[0] != 0x7E)
+         {
+            memmove( pending, &pending[1], --pending_used);
+            continue;
+         }
+         length = (pending[1] << 8) | pending[2];
+         if (pending_used < length + 4)
+         {
+            break;
+         }
+         if (count < max)
+         {
+            loopback_parse( &sent[count], &pending[3], length);
+         }
+         ++count;
+         pending_used -= length + 4;
+         memmove( pending, &pending[length + 4], pending_used);
+      }
+   }
+
+   return count;
+}
+
+void loopback_reset( xbee_dev_t *xbee)
+{
+   while (xbee_ser_loopback_drain( &xbee->serport, pending,
+      sizeof pending) > 0)
+   {
+   }
+   pending_used = 0;
+}
+
+void loopback_feed_frame( xbee_dev_t *xbee, const void *frame, int length)
+{
+   uint8_t prefix[3];
+   uint8_t checksum;
+
+   prefix[0] = 0x7E;
+   prefix[1] = (uint8_t) (length >> 8);
+   prefix[2] = (uint8_t) length;
+   checksum = _xbee_checksum( frame, length, 0xFF);
+   xbee_ser_loopback_feed( &xbee->serport, prefix, 3);
+   xbee_ser_loopback_feed( &xbee->serport, frame, length);
+   xbee_ser_loopback_feed( &xbee->serport, &checksum, 1);
+}
+
+void loopback_feed_response( xbee_dev_t *xbee, const sent_t *cmd,
+   uint8_t status, const void *value, int value_length)
+{
+   uint8_t frame[128];
+   uint8_t *p;
+
+   p = frame;
+   if (cmd->frame_type == XBEE_FRAME_REMOTE_AT_CMD)
+   {
+      *p++ = XBEE_FRAME_REMOTE_AT_RESPONSE;
+      *p++ = cmd->frame_id;
+      memcpy( p, cmd->ieee.b, 8);
+      p[8] = (uint8_t) (cmd->network >> 8);
+      p[9] = (uint8_t) cmd->network;
+      p += 10;
+   }
+   else
+   {
+      *p++ = XBEE_FRAME_LOCAL_AT_RESPONSE;
+      *p++ = cmd->frame_id;
+   }
+   *p++ = cmd->command[0];
+   *p++ = cmd->command[1];
+   *p++ = status;
+   if (value_length > (int) (sizeof frame - (p - frame)))
+   {
+      value_length = (int) (sizeof frame - (p - frame));
+   }
+   if (value_length)
+   {
+      memcpy( p, value, value_length);
+      p += value_length;
+   }
+   loopback_feed_frame( xbee, frame, (int) (p - frame));
+}
+
+void loopback_respond( xbee_dev_t *xbee, const sent_t *cmd,
+   uint8_t status, const void *value, int value_length)
+{
+   loopback_feed_response( xbee, cmd, status, value, value_length);
+   while (xbee_dev_tick( xbee) > 0);
+}
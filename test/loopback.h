@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2019 Digi International Inc.,
+ * All rights not expressly granted are reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Digi International Inc. 11001 Bren Road East, Minnetonka, MN 55343
+ * =======================================================================
+ */
+
+/** @file loopback.h
+   Fake XBee for unit tests that use the loopback serial driver (see
+   xbee/serial_loopback.h): read the frames the host sent and feed back
+   responses.  Link loopback.o along with unittest.o.
+*/
+
+#ifndef __TEST_LOOPBACK_H
+#define __TEST_LOOPBACK_H
+
+#include "xbee/platform.h"
+#include "xbee/device.h"
+
+/// Parameter bytes of an AT command kept in a sent_t.
+#define LOOPBACK_PARAM_MAX    16
+
+/// API frame sent by the host, as read by loopback_collect().
+typedef struct sent_t {
+   uint8_t  frame_type;
+   uint8_t  frame_id;
+   /// Local and remote AT command frames only: the command, its parameter
+   /// (first LOOPBACK_PARAM_MAX bytes of \c param_length) and, for remote
+   /// commands, the destination addresses.
+   char     command[2];
+   uint8_t  param_length;
+   uint8_t  param[LOOPBACK_PARAM_MAX];
+   addr64   ieee;
+   uint16_t network;
+} sent_t;
+
+/**
+   @brief Read the frames the host sent.
+
+   Keeps a partial frame until the rest of it arrives, so a thread playing
+   the part of the XBee can call it while the host is writing.
+
+   @param[in]  xbee  device using the loopback serial driver
+   @param[out] sent  buffer for the frames read
+   @param[in]  max   number of entries in \a sent
+
+   @return  Number of frames read, including any past \a max that didn't
+            fit in \a sent.
+*/
+int loopback_collect( xbee_dev_t *xbee, sent_t *sent, int max);
+
+/**
+   @brief Drop the frames the host sent that haven't been read yet.
+
+   @param[in]  xbee  device using the loopback serial driver
+*/
+void loopback_reset( xbee_dev_t *xbee);
+
+/**
+   @brief Feed an API frame to the host, adding the start-of-frame, length
+   and checksum.
+
+   @param[in]  xbee     device using the loopback serial driver
+   @param[in]  frame    frame payload, starting with the frame type
+   @param[in]  length   number of bytes at \a frame
+*/
+void loopback_feed_frame( xbee_dev_t *xbee, const void *frame, int length);
+
+/**
+   @brief Feed the response to a local or remote AT command the host sent.
+
+   Remote responses come from the address \a cmd was sent to.
+
+   @param[in]  xbee           device using the loopback serial driver
+   @param[in]  cmd            command to respond to
+   @param[in]  status         XBEE_AT_RESP_xxx status
+   @param[in]  value          value to respond with
+   @param[in]  value_length   number of bytes at \a value
+*/
+void loopback_feed_response( xbee_dev_t *xbee, const sent_t *cmd,
+   uint8_t status, const void *value, int value_length);
+
+/**
+   @brief Respond to a local or remote AT command the host sent, and let
+   the host process the response.
+
+   Calls loopback_feed_response(), then xbee_dev_tick() until it's idle.
+*/
+void loopback_respond( xbee_dev_t *xbee, const sent_t *cmd,
+   uint8_t status, const void *value, int value_length);
+
+#endif
@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2019 Digi International Inc.,
+ * All rights not expressly granted are reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Digi International Inc. 11001 Bren Road East, Minnetonka, MN 55343
+ * =======================================================================
+ */
+
+// Receive throughput benchmark.  Feeds Receive Explicit (0x91) frames with
+// a mix of payload sizes through the in-memory loopback serial driver and
+// times xbee_dev_tick() parsing them and passing each one through
+// _xbee_frame_dispatch(), _xbee_handle_receive_explicit() and
+// wpan_envelope_dispatch() to a cluster handler.
+//
+// Usage: bench_frames [seconds [api_mode]]
+//
+// Use an api_mode of 2 to time escaped API mode (ATAP=2).
+//
+// Build with "make clean bench OPTIMIZE=-O2" for numbers that reflect a
+// release build; compare runs built with the same options.
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "xbee/platform.h"
+#include "xbee/byteorder.h"
+#include "xbee/device.h"
+#include "xbee/serial_loopback.h"
+#include "xbee/wpan.h"
+#include "wpan/aps.h"
+
+// payload sizes, weighted towards the short frames typical of sensors
+static const uint16_t payload_size[] =
+   { 2, 4, 8, 8, 12, 16, 16, 24, 32, 48, 64, 84, 128, 255 };
+
+#define BLOCK_REPEAT    16       // passes through payload_size[] per block
+#define BLOCK_FRAMES    (BLOCK_REPEAT * _TABLE_ENTRIES( payload_size))
+
+// frames and payload bytes seen by the cluster handlers
+static uint32_t frames_received;
+static uint64_t bytes_received;
+
+int count_envelope( const wpan_envelope_t FAR *envelope, void FAR *context)
+{
+   ++frames_received;
+   bytes_received += envelope->length;
+
+   return 0;
+}
+
+int ignore_frame( xbee_dev_t *xbee, const void FAR *frame, uint16_t length,
+   void FAR *context)
+{
+   return 0;
+}
+
+// A typical application's handlers, so dispatch has a realistic table to
+// search on builds without XBEE_DEV_DISPATCH_INDEX_SIZE.
+const xbee_dispatch_table_entry_t xbee_frame_handlers[] =
+{
+   { XBEE_FRAME_LOCAL_AT_RESPONSE, 0, ignore_frame, NULL },
+   { XBEE_FRAME_MODEM_STATUS, 0, ignore_frame, NULL },
+   { XBEE_FRAME_TRANSMIT_STATUS, 0, ignore_frame, NULL },
+   { XBEE_FRAME_REMOTE_AT_RESPONSE, 0, ignore_frame, NULL },
+   XBEE_FRAME_HANDLE_RX_EXPLICIT,
+   XBEE_FRAME_TABLE_END
+};
+
+#define CLUSTER_COUNT   4
+#define CLUSTER_FLAGS   (WPAN_CLUST_FLAG_INOUT | WPAN_CLUST_FLAG_NOT_ZCL)
+const wpan_cluster_table_entry_t digi_data_clusters[] =
+{
+   { 0x0010, count_envelope, NULL, CLUSTER_FLAGS },
+   { DIGI_CLUST_SERIAL, count_envelope, NULL, CLUSTER_FLAGS },
+   { 0x0012, count_envelope, NULL, CLUSTER_FLAGS },
+   { 0x0013, count_envelope, NULL, CLUSTER_FLAGS },
+   WPAN_CLUST_ENTRY_LIST_END
+};
+
+const wpan_endpoint_table_entry_t endpoints[] =
+{
+   { WPAN_ENDPOINT_DIGI_DATA, WPAN_PROFILE_DIGI, NULL, NULL, 0, 0,
+      digi_data_clusters },
+   WPAN_ENDPOINT_TABLE_END
+};
+
+// Build BLOCK_FRAMES complete API frames in <block>, escaped if <escaped>
+// is set, returns its length and sets <payload_total> to the number of
+// payload bytes in the block.
+int build_block( uint8_t *block, uint32_t *payload_total, bool_t escaped)
+{
+   uint8_t unescaped[XBEE_MAX_RX_FRAME_LEN];
+   xbee_frame_receive_explicit_t *frame;
+   uint16_t length;
+   uint8_t *p = block;
+   unsigned i, n;
+
+   *payload_total = 0;
+   for (n = 0; n < BLOCK_FRAMES; ++n)
+   {
+      length = payload_size[n % _TABLE_ENTRIES( payload_size)];
+      *payload_total += length;
+      length += offsetof( xbee_frame_receive_explicit_t, payload);
+
+      frame = (xbee_frame_receive_explicit_t *) unescaped;
+      frame->frame_type = XBEE_FRAME_RECEIVE_EXPLICIT;
+      memset( &frame->ieee_address, 0x11 * (n % 8),
+         sizeof frame->ieee_address);
+      frame->network_address_be = htobe16( 0x1000 + n);
+      frame->source_endpoint = WPAN_ENDPOINT_DIGI_DATA;
+      frame->dest_endpoint = WPAN_ENDPOINT_DIGI_DATA;
+      frame->cluster_id_be = htobe16( 0x0010 + n % CLUSTER_COUNT);
+      frame->profile_id_be = htobe16( WPAN_PROFILE_DIGI);
+      frame->options = 0;
+      for (i = 0; i < length - offsetof( xbee_frame_receive_explicit_t,
+         payload); ++i)
+      {
+         frame->payload[i] = (uint8_t) (n + i);
+      }
+      if (escaped)
+      {
+         p += _xbee_frame_escape( p, unescaped, length, NULL, 0);
+      }
+      else
+      {
+         p[0] = 0x7E;
+         p[1] = length >> 8;
+         p[2] = length & 0xFF;
+         memcpy( &p[3], unescaped, length);
+         p[3 + length] = _xbee_checksum( unescaped, length, 0xFF);
+         p += length + 4;
+      }
+   }
+
+   return (int) (p - block);
+}
+
+static double elapsed( const struct timespec *start)
+{
+   struct timespec now;
+
+   clock_gettime( CLOCK_MONOTONIC, &now);
+   return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main( int argc, char *argv[])
+{
+   static uint8_t block[XBEE_SER_LOOPBACK_SIZE];
+   xbee_serial_t serport;
+   xbee_dev_t xbee;
+   struct timespec start;
+   double seconds, total;
+   uint32_t payload_per_block, frames_sent;
+   uint64_t bytes_sent;
+   int block_length, result, api_mode;
+
+   seconds = (argc > 1) ? atof( argv[1]) : 2.0;
+   api_mode = (argc > 2) ? atoi( argv[2]) : XBEE_DEV_API_MODE_UNESCAPED;
+
+   memset( &serport, 0, sizeof serport);
+   result = xbee_dev_init( &xbee, &serport, NULL, NULL);
+   if (result == 0)
+   {
+      result = xbee_dev_api_mode( &xbee, api_mode);
+   }
+   if (result == 0)
+   {
+      result = xbee_wpan_init( &xbee, endpoints);
+   }
+   if (result != 0)
+   {
+      printf( "bench_frames: init failed (%d)\n", result);
+      return EXIT_FAILURE;
+   }
+
+   block_length = build_block( block, &payload_per_block,
+      api_mode == XBEE_DEV_API_MODE_ESCAPED);
+   printf( "bench_frames: %u frames/block (%d bytes, %.1f payload bytes/"
+      "frame), staging=%u index=%u stats=%u ap=%d\n",
+      (unsigned) BLOCK_FRAMES, block_length,
+      (double) payload_per_block / BLOCK_FRAMES, XBEE_DEV_RX_STAGING_SIZE,
+      XBEE_DEV_DISPATCH_INDEX_SIZE, XBEE_DEV_STATS, api_mode);
+
+   frames_sent = bytes_sent = 0;
+   total = 0;
+   do {
+      if (xbee_ser_loopback_feed( &xbee.serport, block, block_length)
+         != block_length)
+      {
+         printf( "bench_frames: loopback ring too small for block\n");
+         return EXIT_FAILURE;
+      }
+      frames_sent += BLOCK_FRAMES;
+      bytes_sent += payload_per_block;
+
+      // only time the library, not building and feeding the frames
+      clock_gettime( CLOCK_MONOTONIC, &start);
+      while (xbee_dev_tick( &xbee) > 0);
+      total += elapsed( &start);
+   } while (total < seconds);
+
+   if (frames_received != frames_sent || bytes_received != bytes_sent)
+   {
+      printf( "bench_frames: FAILED, sent %" PRIu32 " frames (%" PRIu64
+         " bytes), received %" PRIu32 " (%" PRIu64 " bytes)\n",
+         frames_sent, bytes_sent, frames_received, bytes_received);
+      return EXIT_FAILURE;
+   }
+
+   printf( "%" PRIu32 " frames in %.3f s: %.0f frames/s, %.1f ns/frame, "
+      "%.2f MB/s of payload\n", frames_received, total,
+      frames_received / total, total * 1e9 / frames_received,
+      bytes_received / total / 1e6);
+
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,430 @@
+/*
+ * Copyright (c) 2019 Digi International Inc.,
+ * All rights not expressly granted are reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Digi International Inc. 11001 Bren Road East, Minnetonka, MN 55343
+ * =======================================================================
+ */
+
+// Unit tests for the AT parameter cache, using the loopback serial driver
+// to capture the requests sent and feed back responses.
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "xbee/platform.h"
+#include "xbee/atcmd.h"
+#include "../loopback.h"
+#include "../unittest.h"
+
+static xbee_dev_t xbee;
+static addr64 node;
+
+// command frames sent by the host
+static sent_t sent[8];
+
+// responses passed to record()
+typedef struct got_t {
+   uint16_t flags;
+   uint32_t value;
+   bool_t   remote;
+} got_t;
+
+static got_t got[8];
+static int got_count;
+
+const xbee_dispatch_table_entry_t xbee_frame_handlers[] =
+{
+   XBEE_FRAME_HANDLE_LOCAL_AT,
+   XBEE_FRAME_HANDLE_REMOTE_AT,
+   XBEE_FRAME_TABLE_END
+};
+
+int record( const xbee_cmd_response_t FAR *response)
+{
+   if (got_count < _TABLE_ENTRIES( got))
+   {
+      got[got_count].flags = response->flags;
+      got[got_count].value = response->value;
+      got[got_count].remote = (response->source != NULL);
+      ++got_count;
+   }
+
+   return XBEE_ATCMD_DONE;
+}
+
+// Read the command frames the host sent, return the number read.
+int collect( void)
+{
+   return loopback_collect( &xbee, sent, _TABLE_ENTRIES( sent));
+}
+
+// Respond to a command the host sent with a 2-byte <value>.
+void respond( const sent_t *cmd, uint16_t value)
+{
+   uint8_t value_be[2];
+
+   value_be[0] = (uint8_t) (value >> 8);
+   value_be[1] = (uint8_t) value;
+   loopback_respond( &xbee, cmd, XBEE_AT_RESP_SUCCESS, value_be, 2);
+}
+
+void modem_status( uint8_t status)
+{
+   uint8_t frame[2] = { XBEE_FRAME_MODEM_STATUS };
+
+   frame[1] = status;
+   loopback_feed_frame( &xbee, frame, sizeof frame);
+   while (xbee_dev_tick( &xbee) > 0);
+}
+
+// Is <command> from the local XBee (or <node>) in the cache?
+bool_t cached( const addr64 *ieee, const char *command)
+{
+   uint8_t value[XBEE_CMD_CACHE_VALUE_MAX];
+
+   return xbee_cmd_cache_get( &xbee, ieee, command, XBEE_CMD_CACHE_TTL,
+      value, sizeof value) >= 0;
+}
+
+void reset( void)
+{
+   xbee_cmd_cache_flush( NULL);
+   got_count = 0;
+   loopback_reset( &xbee);
+}
+
+#if XBEE_CMD_CACHE_SIZE
+void t_shared_read( void)
+{
+   uint8_t value[4];
+
+   test_compare( xbee_cmd_cache_read( NULL, NULL, "VR", 0, record, NULL),
+      -EINVAL, NULL, "accepted NULL device");
+
+   // two readers share one request
+   reset();
+   test_compare( xbee_cmd_cache_read( &xbee, NULL, "VR", XBEE_CMD_CACHE_TTL,
+      record, NULL), 1, NULL, "read not started");
+   test_compare( xbee_cmd_cache_read( &xbee, NULL, "VR", XBEE_CMD_CACHE_TTL,
+      record, NULL), 1, NULL, "second read not queued");
+   test_compare( collect(), 1, NULL, "read not shared");
+   test_compare( got_count, 0, NULL, "callback before response");
+   respond( &sent[0], 0x1234);
+   test_compare( got_count, 2, NULL, "response not shared");
+   test_compare( got[1].value, 0x1234, NULL, "wrong value");
+   test_bool( ! (got[0].flags & XBEE_CMD_RESP_FLAG_CACHED),
+      "response marked as cached");
+   test_compare( _xbee_cmd_pool.in_use, 0, NULL, "request not released");
+
+   // served from cache, without a request
+   test_compare( xbee_cmd_cache_read( &xbee, NULL, "VR", XBEE_CMD_CACHE_TTL,
+      record, NULL), 0, NULL, "not served from cache");
+   test_compare( collect(), 0, NULL, "cached value read again");
+   test_compare( got_count, 3, NULL, "callback not called");
+   test_compare( got[2].value, 0x1234, NULL, "wrong cached value");
+   test_bool( got[2].flags & XBEE_CMD_RESP_FLAG_CACHED,
+      "cached value not flagged");
+
+   test_compare( xbee_cmd_cache_get( &xbee, NULL, "VR", XBEE_CMD_CACHE_TTL,
+      value, sizeof value), 2, NULL, "wrong value length");
+   test_compare( value[0], 0x12, NULL, "wrong value copied");
+   test_compare( xbee_cmd_cache_get( &xbee, NULL, "VR", XBEE_CMD_CACHE_TTL,
+      value, 1), -ENOSPC, NULL, "overflowed buffer");
+   test_compare( xbee_cmd_cache_get( &xbee, NULL, "HV", XBEE_CMD_CACHE_TTL,
+      value, sizeof value), -ENOENT, NULL, "found missing value");
+}
+
+void t_ttl( void)
+{
+   reset();
+   xbee_cmd_cache_read( &xbee, NULL, "VR", XBEE_CMD_CACHE_TTL, record, NULL);
+   collect();
+   respond( &sent[0], 1);
+
+   // older than max_age_ms, so read again
+   usleep( 30000);
+   test_compare( xbee_cmd_cache_read( &xbee, NULL, "VR", 10, record, NULL),
+      1, NULL, "stale value used");
+   test_compare( collect(), 1, NULL, "stale value not read again");
+   respond( &sent[0], 2);
+   test_compare( got[1].value, 2, NULL, "wrong value");
+   test_compare( xbee_cmd_cache_read( &xbee, NULL, "VR", 10, record, NULL),
+      0, NULL, "refreshed value not cached");
+   test_compare( got[2].value, 2, NULL, "old value cached");
+   test_compare( xbee_cmd_cache_read( &xbee, NULL, "VR", 0, record, NULL),
+      1, NULL, "max_age_ms of 0 used cache");
+   collect();
+   respond( &sent[0], 2);
+}
+
+// Read <command> with a request of its own, and respond with <value>.
+void prime( const char *command, uint16_t value)
+{
+   int16_t request;
+
+   collect();
+   request = xbee_cmd_create( &xbee, command);
+   xbee_cmd_set_callback( request, record, NULL);
+   xbee_cmd_send( request);
+   collect();
+   respond( &sent[0], value);
+}
+
+void t_passive( void)
+{
+   // responses to other requests fill the cache, but not responses to
+   // actions
+   reset();
+   prime( "SH", 0x0013);
+   test_bool( cached( NULL, "SH"), "response not cached");
+   prime( "ND", 0x0013);
+   test_bool( ! cached( NULL, "ND"), "action cached");
+}
+
+void t_invalidate( void)
+{
+   int16_t request;
+
+   reset();
+   prime( "ID", 0x2345);
+   prime( "CH", 0x0C);
+   test_bool( cached( NULL, "ID") && cached( NULL, "CH"), "not cached");
+
+   // writes drop the value written
+   xbee_cmd_simple( &xbee, "ID", 0x1111);
+   test_bool( ! cached( NULL, "ID"), "xbee_cmd_simple() write kept");
+   test_bool( cached( NULL, "CH"), "other value dropped");
+   request = xbee_cmd_create( &xbee, "CH");
+   xbee_cmd_set_param( request, 0x0D);
+   xbee_cmd_send( request);
+   test_bool( ! cached( NULL, "CH"), "xbee_cmd_send() write kept");
+
+   // restoring defaults drops everything
+   prime( "CH", 0x0D);
+   xbee_cmd_execute( &xbee, "RE", NULL, 0);
+   test_bool( ! cached( NULL, "CH"), "kept value after ATRE");
+
+   // and so does a modem status for a reset
+   prime( "CH", 0x0D);
+   modem_status( XBEE_MODEM_STATUS_DISASSOC);
+   test_bool( cached( NULL, "CH"), "dropped value after leaving network");
+   modem_status( XBEE_MODEM_STATUS_WATCHDOG);
+   test_bool( ! cached( NULL, "CH"), "kept value after reset");
+
+   test_compare( xbee_cmd_cache_invalidate( NULL, NULL, NULL), -EINVAL,
+      NULL, "accepted NULL device");
+   collect();
+}
+
+void t_write_during_read( void)
+{
+   sent_t first;
+
+   reset();
+   xbee_cmd_cache_read( &xbee, NULL, "NI", XBEE_CMD_CACHE_TTL, record, NULL);
+   collect();
+   first = sent[0];
+
+   // value changes while the read is in flight, so the next reader doesn't
+   // share it, and its (old) response isn't saved
+   xbee_cmd_simple( &xbee, "NI", 0x4142);
+   collect();
+   test_compare( xbee_cmd_cache_read( &xbee, NULL, "NI", XBEE_CMD_CACHE_TTL,
+      record, NULL), 1, NULL, "read not started");
+   test_compare( collect(), 1, NULL, "shared read sent before write");
+   respond( &first, 0x5A5A);
+   test_compare( got_count, 1, NULL, "old response not passed on");
+   test_bool( ! cached( NULL, "NI"), "old response saved");
+   respond( &sent[0], 0x4142);
+   test_compare( got_count, 2, NULL, "new response not passed on");
+   test_compare( got[1].value, 0x4142, NULL, "wrong response");
+   test_bool( cached( NULL, "NI"), "new response not saved");
+}
+
+void t_remote( void)
+{
+   reset();
+   test_compare( xbee_cmd_cache_read( &xbee, WPAN_IEEE_ADDR_UNDEFINED, "VR",
+      XBEE_CMD_CACHE_TTL, record, NULL), -EINVAL, NULL,
+      "accepted undefined address");
+   test_compare( xbee_cmd_cache_read( &xbee, &node, "VR", XBEE_CMD_CACHE_TTL,
+      record, NULL), 1, NULL, "remote read not started");
+   test_compare( collect(), 1, NULL, "remote read not sent");
+   test_bool( sent[0].frame_type == XBEE_FRAME_REMOTE_AT_CMD,
+      "not sent to remote");
+   respond( &sent[0], 0x2002);
+   test_bool( cached( &node, "VR"), "remote value not cached");
+   test_bool( ! cached( NULL, "VR"), "remote value cached as local");
+
+   xbee_cmd_cache_read( &xbee, &node, "VR", XBEE_CMD_CACHE_TTL, record,
+      NULL);
+   test_bool( got[1].remote && (got[1].flags & XBEE_CMD_RESP_FLAG_CACHED),
+      "cached remote value missing source");
+
+   // local reset doesn't affect remote values, flushing the device does
+   modem_status( XBEE_MODEM_STATUS_HW_RESET);
+   test_bool( cached( &node, "VR"), "local reset dropped remote value");
+   xbee_cmd_cache_flush( &xbee);
+   test_bool( ! cached( &node, "VR"), "flush kept remote value");
+}
+
+void t_broadcast_write( void)
+{
+   addr64 first;
+   int16_t request;
+
+   // values from two nodes
+   reset();
+   first = node;
+   xbee_cmd_cache_read( &xbee, &node, "ID", XBEE_CMD_CACHE_TTL, record,
+      NULL);
+   collect();
+   respond( &sent[0], 0x2345);
+   node.b[7] = 0x22;
+   xbee_cmd_cache_read( &xbee, &node, "ID", XBEE_CMD_CACHE_TTL, record,
+      NULL);
+   collect();
+   respond( &sent[0], 0x2345);
+   test_bool( cached( &first, "ID") && cached( &node, "ID"), "not cached");
+
+   // broadcast write reaches both of them
+   request = xbee_cmd_create( &xbee, "ID");
+   xbee_cmd_set_target( request, WPAN_IEEE_ADDR_BROADCAST,
+      WPAN_NET_ADDR_UNDEFINED);
+   xbee_cmd_set_param( request, 0x1111);
+   xbee_cmd_send( request);
+   collect();
+   test_bool( ! cached( &first, "ID"), "broadcast write kept first node");
+   test_bool( ! cached( &node, "ID"), "broadcast write kept second node");
+   xbee_cmd_release_handle( request);
+   node = first;
+}
+
+// Answer each command xbee_cmd_query_device() sends with <value>, return the
+// first command sent.
+const char *run_query( uint16_t value)
+{
+   static char first[3];
+   int i, count;
+
+   first[0] = '\0';
+   while ((count = collect()) > 0)
+   {
+      if (first[0] == '\0')
+      {
+         memcpy( first, sent[0].command, 2);
+      }
+      for (i = 0; i < count; ++i)
+      {
+         respond( &sent[i], value);
+      }
+   }
+
+   return first;
+}
+
+void t_query_device( void)
+{
+   bool_t identity;
+
+   reset();
+   test_compare( xbee_cmd_query_device( &xbee, 0), 0, NULL,
+      "query failed");
+   test_string( run_query( 0x2100), "HV", "query skipped HV");
+   test_compare( xbee_cmd_query_status( &xbee), 0, NULL,
+      "query incomplete");
+   test_compare( xbee.hardware_version, 0x2100, NULL, "HV not saved");
+
+   // identity values from the cache, unless it's too small to hold them
+   identity = cached( NULL, "HV");
+   xbee.hardware_version = 0;
+   test_compare( xbee_cmd_query_device( &xbee, 0), 0, NULL,
+      "second query failed");
+   test_string( run_query( 0x2100), identity ? "EO" : "HV",
+      "wrong first command");
+   test_compare( xbee_cmd_query_status( &xbee), 0, NULL,
+      "second query incomplete");
+   test_compare( xbee.hardware_version, 0x2100, NULL, "HV not restored");
+
+   // reset drops the cached values, so the query sends everything
+   modem_status( XBEE_MODEM_STATUS_HW_RESET);
+   run_query( 0x2100);
+   test_compare( xbee_cmd_query_device( &xbee, 0), 0, NULL,
+      "query after reset failed");
+   test_string( run_query( 0x2100), "HV", "sent cached HV after reset");
+}
+
+void t_timeout( void)
+{
+   int i;
+
+   reset();
+   xbee_cmd_cache_read( &xbee, NULL, "VR", XBEE_CMD_CACHE_TTL, record, NULL);
+   xbee_cmd_cache_read( &xbee, NULL, "VR", XBEE_CMD_CACHE_TTL, record, NULL);
+   for (i = 0; _xbee_cmd_cache.entry[i].device == NULL
+      || _xbee_cmd_cache.entry[i].handle < 0; ++i)
+   {
+   }
+   _xbee_cmd_set_timeout( _xbee_cmd_handle_to_address(
+      _xbee_cmd_cache.entry[i].handle), 0);
+   for (i = 0; i < 12 && xbee_cmd_tick() == 0; ++i)
+   {
+      usleep( 100000);
+   }
+   test_compare( got_count, 2, NULL, "timeout not passed to waiters");
+   test_bool( got[1].flags & XBEE_CMD_RESP_FLAG_TIMEOUT, "timeout not flagged");
+   test_bool( ! cached( NULL, "VR"), "timeout cached");
+
+   // waiter slots were freed
+   for (i = 0; i < XBEE_CMD_CACHE_WAITERS; ++i)
+   {
+      test_compare( xbee_cmd_cache_read( &xbee, NULL, "VR", 0, record, NULL),
+         1, NULL, "waiter not available");
+   }
+   test_compare( xbee_cmd_cache_read( &xbee, NULL, "VR", 0, record, NULL),
+      -ENOSPC, NULL, "too many waiters");
+   collect();
+   respond( &sent[0], 1);
+}
+
+#endif
+
+int main( int argc, char *argv[])
+{
+   xbee_serial_t serport;
+   int failures = 0;
+
+   memset( &serport, 0, sizeof serport);
+   serport.baudrate = 9600;
+   if (xbee_dev_init( &xbee, &serport, NULL, NULL))
+   {
+      printf( "t_atcmd_cache: xbee_dev_init failed\n");
+      return 1;
+   }
+   // skip the queries xbee_cmd_init_device() sends
+   xbee.flags |= XBEE_DEV_FLAG_CMD_INIT;
+   memset( node.b, 0x11, sizeof node.b);
+
+#if XBEE_CMD_CACHE_SIZE
+   failures += DO_TEST( t_shared_read);
+   failures += DO_TEST( t_ttl);
+   failures += DO_TEST( t_passive);
+   failures += DO_TEST( t_invalidate);
+   failures += DO_TEST( t_write_during_read);
+   failures += DO_TEST( t_remote);
+   failures += DO_TEST( t_broadcast_write);
+   failures += DO_TEST( t_query_device);
+   failures += DO_TEST( t_timeout);
+#else
+   test_compare( xbee_cmd_cache_read( &xbee, NULL, "VR", 0, record, NULL),
+      -ENOSYS, NULL, "cache not disabled");
+#endif
+
+   return test_exit( failures);
+}
@@ -0,0 +1,384 @@
+/*
+ * Copyright (c) 2019 Digi International Inc.,
+ * All rights not expressly granted are reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Digi International Inc. 11001 Bren Road East, Minnetonka, MN 55343
+ * =======================================================================
+ */
+
+// Unit tests for sending a remote AT command to a list of nodes, using the
+// loopback serial driver to capture the requests and feed back responses.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "xbee/platform.h"
+#include "xbee/atcmd_fanout.h"
+#include "../loopback.h"
+#include "../unittest.h"
+
+#define TARGET_COUNT    10
+
+static xbee_dev_t xbee;
+static xbee_fanout_t fanout;
+static xbee_fanout_target_t targets[TARGET_COUNT];
+
+// remote command frames sent by the host, each target's number is the last
+// byte of its IEEE address
+static sent_t sent[16];
+
+// results passed to record_result()
+static int result_count[TARGET_COUNT];
+static int result_status[TARGET_COUNT];
+static int result_attempts[TARGET_COUNT];
+static int final_count;
+
+const xbee_dispatch_table_entry_t xbee_frame_handlers[] =
+{
+   XBEE_FRAME_HANDLE_LOCAL_AT,
+   XBEE_FRAME_HANDLE_REMOTE_AT,
+   XBEE_FRAME_TABLE_END
+};
+
+void record_result( xbee_fanout_t FAR *f, const xbee_fanout_result_t *result)
+{
+   if (result == NULL)
+   {
+      ++final_count;
+   }
+   else if (result->target < TARGET_COUNT)
+   {
+      ++result_count[result->target];
+      result_status[result->target] = result->status;
+      result_attempts[result->target] = result->attempts;
+   }
+}
+
+// Start requests from the main loop, then read the remote command frames
+// the host sent.  Returns the number read.
+int collect( void)
+{
+   xbee_fanout_tick( &fanout);
+
+   return loopback_collect( &xbee, sent, _TABLE_ENTRIES( sent));
+}
+
+// Respond to a request the host sent, with <status> and a 1-byte value.
+void respond( const sent_t *cmd, uint8_t status)
+{
+   static const uint8_t value = 0x28;
+
+   loopback_respond( &xbee, cmd, status, &value, 1);
+}
+
+// Expire the request sent to <target>, return the number of requests expired.
+int expire( int target)
+{
+   xbee_fanout_slot_t *slot;
+   int i, count;
+
+   for (slot = fanout.slot, i = 0; i < XBEE_FANOUT_MAX_IN_FLIGHT; ++slot, ++i)
+   {
+      if (slot->state == XBEE_FANOUT_SLOT_SENT && slot->target == target)
+      {
+         _xbee_cmd_set_timeout( _xbee_cmd_handle_to_address( slot->handle),
+            0);
+         break;
+      }
+   }
+
+   for (i = 0; i < 12; ++i)
+   {
+      count = xbee_cmd_tick();
+      if (count)
+      {
+         return count;
+      }
+      usleep( 100000);
+   }
+
+   return 0;
+}
+
+// Set up the fan-out and targets, with each target on its own route
+// unless <shared> are on route 0.
+void reset( int shared)
+{
+   int i;
+
+   xbee_fanout_init( &fanout, &xbee, "DB", NULL, 0);
+   fanout.rate = 0;
+   memset( targets, 0, sizeof targets);
+   for (i = 0; i < TARGET_COUNT; ++i)
+   {
+      targets[i].address.ieee.b[7] = (uint8_t) i;
+      targets[i].address.network = WPAN_NET_ADDR_UNDEFINED;
+      targets[i].route = (i < shared) ? 0 : (uint16_t) (i + 1);
+   }
+   memset( result_count, 0, sizeof result_count);
+   memset( result_status, 0, sizeof result_status);
+   memset( result_attempts, 0, sizeof result_attempts);
+   final_count = 0;
+   collect();
+}
+
+void t_init( void)
+{
+   uint8_t param[XBEE_CMD_MAX_PARAM_LENGTH + 1] = { 0 };
+   xbee_fanout_summary_t summary;
+
+   test_compare( xbee_fanout_init( NULL, &xbee, "DB", NULL, 0), -EINVAL,
+      NULL, "accepted NULL fanout");
+   test_compare( xbee_fanout_init( &fanout, &xbee, "NI", NULL, 1), -EINVAL,
+      NULL, "accepted NULL param");
+   test_compare( xbee_fanout_init( &fanout, &xbee, "NI", param,
+      sizeof param), -EINVAL, NULL, "accepted long param");
+   test_compare( xbee_fanout_init( &fanout, &xbee, "DB", NULL, 0), 0,
+      NULL, "init failed");
+   test_compare( fanout.rate, XBEE_FANOUT_DEFAULT_RATE, NULL,
+      "wrong default rate");
+   test_compare( fanout.in_flight_limit, XBEE_FANOUT_MAX_IN_FLIGHT, NULL,
+      "wrong default in-flight limit");
+
+   // empty list is done right away
+   final_count = 0;
+   test_compare( xbee_fanout_start( &fanout, NULL, 0, record_result, NULL),
+      0, NULL, "start failed");
+   test_compare( xbee_fanout_status( &fanout, &summary), 0, NULL,
+      "empty list not done");
+   test_compare( final_count, 1, NULL, "final callback not called");
+}
+
+void t_limits( void)
+{
+   xbee_fanout_summary_t summary;
+   int count, i, rounds, total;
+
+   // targets 0-3 share a route, so 2 and 3 wait while 4 and 5 go out
+   reset( 4);
+   fanout.in_flight_limit = 4;
+   fanout.route_limit = 2;
+   test_compare( xbee_fanout_start( &fanout, targets, TARGET_COUNT,
+      record_result, NULL), 0, NULL, "start failed");
+   count = collect();
+   test_compare( count, 4, NULL, "in-flight limit not honored");
+   test_compare( sent[0].ieee.b[7], 0, NULL, "wrong first target");
+   test_compare( sent[1].ieee.b[7], 1, NULL, "wrong second target");
+   test_compare( sent[2].ieee.b[7], 4, NULL, "busy route not skipped");
+   test_compare( sent[3].ieee.b[7], 5, NULL, "busy route not skipped");
+   test_compare( xbee_fanout_tick( &fanout), 0, NULL, "started too many");
+   test_compare( xbee_fanout_status( &fanout, NULL), -EBUSY, NULL,
+      "not running");
+
+   // each response lets another request start, from the next tick
+   respond( &sent[0], XBEE_AT_RESP_SUCCESS);
+   test_compare( fanout.pending, 3, NULL, "request started from callback");
+   test_compare( collect(), 1, NULL, "response didn't start request");
+   test_compare( sent[0].ieee.b[7], 2, NULL, "waiting target not started");
+
+   total = 5;
+   respond( &sent[0], XBEE_AT_RESP_SUCCESS);
+   for (rounds = 0; rounds < 10 && (count = collect()) > 0; ++rounds)
+   {
+      total += count;
+      for (i = 0; i < count; ++i)
+      {
+         respond( &sent[i], XBEE_AT_RESP_SUCCESS);
+      }
+   }
+   // targets 1, 4 and 5 are still waiting
+   test_compare( xbee_fanout_status( &fanout, NULL), -EBUSY, NULL,
+      "done before all responses");
+   test_compare( final_count, 0, NULL, "final callback too soon");
+   test_compare( total, TARGET_COUNT, NULL, "wrong number of requests");
+
+   // answer the remaining requests by frame ID
+   for (i = 0; i < XBEE_FANOUT_MAX_IN_FLIGHT; ++i)
+   {
+      if (fanout.slot[i].state == XBEE_FANOUT_SLOT_SENT)
+      {
+         sent[0].ieee.b[7] = (uint8_t) fanout.slot[i].target;
+         sent[0].frame_id = _xbee_cmd_handle_to_address(
+            fanout.slot[i].handle)->frame_id;
+         respond( &sent[0], XBEE_AT_RESP_SUCCESS);
+      }
+   }
+
+   test_compare( xbee_fanout_status( &fanout, &summary), 0, NULL,
+      "not done");
+   test_compare( final_count, 1, NULL, "final callback not called once");
+   for (i = 0; i < TARGET_COUNT; ++i)
+   {
+      test_compare( result_count[i], 1, NULL, "target not reported once");
+      test_compare( result_status[i], 0, NULL, "target failed");
+   }
+   test_compare( summary.targets, TARGET_COUNT, NULL, "wrong target count");
+   test_compare( summary.succeeded, TARGET_COUNT, NULL,
+      "wrong success count");
+   test_compare( summary.retries, 0, NULL, "unexpected retries");
+   test_compare( _xbee_cmd_pool.in_use, 0, NULL, "requests not released");
+}
+
+void t_rate( void)
+{
+   int count;
+
+   // 10 requests per second
+   reset( 0);
+   fanout.rate = 10;
+   xbee_fanout_start( &fanout, targets, 3, record_result, NULL);
+   test_compare( collect(), 1, NULL, "rate not honored");
+   test_compare( xbee_fanout_tick( &fanout), 0, NULL, "rate not honored");
+   usleep( 110000);
+   test_compare( xbee_fanout_tick( &fanout), 1, NULL, "not sent after delay");
+   usleep( 110000);
+   test_compare( xbee_fanout_tick( &fanout), 1, NULL, "not sent after delay");
+
+   for (count = collect(); count--; )
+   {
+      respond( &sent[count], XBEE_AT_RESP_SUCCESS);
+   }
+   test_compare( xbee_fanout_cancel( &fanout), 0, NULL, "cancel failed");
+}
+
+void t_retry( void)
+{
+   xbee_fanout_summary_t summary;
+
+   // target 0 times out twice, target 1 fails to transmit and then
+   // succeeds, target 2 returns an error
+   reset( 0);
+   fanout.retries = 1;
+   xbee_fanout_start( &fanout, targets, 3, record_result, NULL);
+   test_compare( collect(), 3, NULL, "requests not sent");
+   respond( &sent[1], XBEE_AT_RESP_TX_FAIL);
+   respond( &sent[2], XBEE_AT_RESP_ERROR);
+   test_compare( result_status[2], -EIO, NULL, "error not reported");
+   test_compare( result_attempts[2], 1, NULL, "error retried");
+   test_compare( collect(), 1, NULL, "transmit failure not retried");
+   test_compare( sent[0].ieee.b[7], 1, NULL, "wrong target retried");
+   respond( &sent[0], XBEE_AT_RESP_SUCCESS);
+   test_compare( result_status[1], 0, NULL, "retry failed");
+   test_compare( result_attempts[1], 2, NULL, "wrong attempts");
+
+   test_compare( expire( 0), 1, NULL, "request didn't time out");
+   test_compare( collect(), 1, NULL, "timeout not retried");
+   test_compare( result_count[0], 0, NULL, "reported before retry");
+   test_compare( expire( 0), 1, NULL, "retry didn't time out");
+   test_compare( result_status[0], -ETIMEDOUT, NULL, "timeout not reported");
+   test_compare( result_attempts[0], 2, NULL, "wrong attempts");
+
+   test_compare( xbee_fanout_status( &fanout, &summary), 0, NULL,
+      "not done");
+   test_compare( final_count, 1, NULL, "final callback not called once");
+   test_compare( summary.succeeded, 1, NULL, "wrong success count");
+   test_compare( summary.failed, 1, NULL, "wrong failure count");
+   test_compare( summary.timed_out, 1, NULL, "wrong timeout count");
+   test_compare( summary.retries, 2, NULL, "wrong retry count");
+   test_compare( _xbee_cmd_pool.in_use, 0, NULL, "requests not released");
+}
+
+void t_send_error( void)
+{
+   xbee_fanout_summary_t summary;
+   int16_t *handles;
+   int count, i;
+
+   // fill the request pool, so target 0 can't be sent
+   reset( 0);
+   fanout.retries = 1;
+   handles = malloc( (XBEE_CMD_REQUEST_MAX + 32) * sizeof *handles);
+   for (count = 0; count < XBEE_CMD_REQUEST_MAX + 32; ++count)
+   {
+      handles[count] = xbee_cmd_create( &xbee, "VR");
+      if (handles[count] < 0)
+      {
+         break;
+      }
+   }
+   xbee_fanout_start( &fanout, targets, 2, record_result, NULL);
+   test_compare( collect(), 0, NULL, "request sent from full pool");
+   test_compare( fanout.pending, 1, NULL, "target not started");
+   usleep( (XBEE_FANOUT_SEND_RETRY_MS + 20) * 1000L);
+   test_compare( collect(), 0, NULL, "request sent from full pool");
+   test_compare( result_count[0], 1, NULL, "retries not limited");
+   test_compare( result_status[0], -ENOSPC, NULL, "error not reported");
+   test_compare( result_attempts[0], 2, NULL, "wrong attempts");
+
+   // target 1 goes out once the pool has room
+   for (i = 0; i < count; ++i)
+   {
+      xbee_cmd_release_handle( handles[i]);
+   }
+   free( handles);
+   test_compare( collect(), 0, NULL, "didn't wait after error");
+   usleep( (XBEE_FANOUT_SEND_RETRY_MS + 20) * 1000L);
+   test_compare( collect(), 1, NULL, "request not sent");
+   respond( &sent[0], XBEE_AT_RESP_SUCCESS);
+
+   test_compare( xbee_fanout_status( &fanout, &summary), 0, NULL,
+      "not done");
+   test_compare( final_count, 1, NULL, "final callback not called once");
+   test_compare( summary.succeeded, 1, NULL, "wrong success count");
+   test_compare( summary.failed, 1, NULL, "wrong failure count");
+   test_compare( summary.retries, 1, NULL, "wrong retry count");
+   test_compare( _xbee_cmd_pool.in_use, 0, NULL, "requests not released");
+}
+
+void t_cancel( void)
+{
+   int count;
+
+   reset( 0);
+   xbee_fanout_start( &fanout, targets, TARGET_COUNT, record_result, NULL);
+   count = collect();
+   test_compare( xbee_fanout_start( &fanout, targets, TARGET_COUNT,
+      record_result, NULL), -EBUSY, NULL, "started twice");
+   test_compare( xbee_fanout_cancel( &fanout), 0, NULL, "cancel failed");
+   test_compare( xbee_fanout_status( &fanout, NULL), -ECANCELED, NULL,
+      "cancel not reported");
+   test_compare( _xbee_cmd_pool.in_use, 0, NULL, "requests not released");
+
+   // late responses are ignored
+   while (count--)
+   {
+      respond( &sent[count], XBEE_AT_RESP_SUCCESS);
+   }
+   test_compare( result_count[0], 0, NULL, "result after cancel");
+   test_compare( final_count, 0, NULL, "final callback after cancel");
+   test_compare( collect(), 0, NULL, "request sent after cancel");
+}
+
+int main( int argc, char *argv[])
+{
+   static xbee_cmd_request_t requests[16];
+   xbee_serial_t serport;
+   int failures = 0;
+
+   memset( &serport, 0, sizeof serport);
+   serport.baudrate = 9600;
+   if (xbee_dev_init( &xbee, &serport, NULL, NULL))
+   {
+      printf( "t_atcmd_fanout: xbee_dev_init failed\n");
+      return 1;
+   }
+   // skip the queries xbee_cmd_init_device() sends
+   xbee.flags |= XBEE_DEV_FLAG_CMD_INIT;
+   // enough requests for XBEE_FANOUT_MAX_IN_FLIGHT without XBEE_CMD_REQUEST_GROW
+   xbee_cmd_request_pool_add( requests, _TABLE_ENTRIES( requests));
+
+   failures += DO_TEST( t_init);
+   failures += DO_TEST( t_limits);
+   failures += DO_TEST( t_rate);
+   failures += DO_TEST( t_retry);
+   failures += DO_TEST( t_send_error);
+   failures += DO_TEST( t_cancel);
+
+   return test_exit( failures);
+}
@@ -0,0 +1,329 @@
+/*
+ * Copyright (c) 2019 Digi International Inc.,
+ * All rights not expressly granted are reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Digi International Inc. 11001 Bren Road East, Minnetonka, MN 55343
+ * =======================================================================
+ */
+
+// Unit tests for pipelined AT command lists, using the loopback serial
+// driver to capture the commands sent and feed back responses in any order.
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "xbee/platform.h"
+#include "xbee/atcmd.h"
+#include "../loopback.h"
+#include "../unittest.h"
+
+static xbee_dev_t xbee;
+static xbee_command_list_context_t clc;
+
+static sent_t sent[XBEE_CMD_LIST_WINDOW_MAX + 2];
+
+typedef struct values_t {
+   uint16_t a, b, c, d, e, f;
+   uint8_t  id;
+   char     ni[48];
+} values_t;
+
+static values_t values;
+
+// order entries completed in (their callback flags), and final callbacks
+static char order[16];
+static int final_count;
+static bool_t final_reg_null;
+
+const xbee_dispatch_table_entry_t xbee_frame_handlers[] =
+{
+   XBEE_FRAME_HANDLE_LOCAL_AT,
+   XBEE_FRAME_HANDLE_REMOTE_AT,
+   XBEE_FRAME_TABLE_END
+};
+
+void record_entry( const xbee_cmd_response_t FAR *response,
+   const struct xbee_atcmd_reg_t FAR *reg, void FAR *base)
+{
+   size_t length = strlen( order);
+
+   if (length < sizeof order - 1)
+   {
+      order[length] = (char) reg->flags;
+      order[length + 1] = '\0';
+   }
+}
+
+void record_end( const xbee_cmd_response_t FAR *response,
+   const struct xbee_atcmd_reg_t FAR *reg, void FAR *base)
+{
+   ++final_count;
+   final_reg_null = (reg == NULL);
+}
+
+const xbee_atcmd_reg_t query_list[] = {
+   XBEE_ATCMD_REG_MOVE_THEN_CB( 'A', 'A', XBEE_CLT_COPY_BE, values_t, a,
+      record_entry, 'a'),
+   XBEE_ATCMD_REG_MOVE_THEN_CB( 'B', 'B', XBEE_CLT_COPY_BE, values_t, b,
+      record_entry, 'b'),
+   XBEE_ATCMD_REG_MOVE_THEN_CB( 'C', 'C', XBEE_CLT_COPY_BE, values_t, c,
+      record_entry, 'c'),
+   XBEE_ATCMD_REG_MOVE_THEN_CB( 'N', 'I', XBEE_CLT_COPY, values_t, ni,
+      record_entry, 'n'),
+   XBEE_ATCMD_REG_MOVE_THEN_CB( 'D', 'D', XBEE_CLT_COPY_BE, values_t, d,
+      record_entry, 'd'),
+   XBEE_ATCMD_REG_MOVE_THEN_CB( 'E', 'E', XBEE_CLT_COPY_BE, values_t, e,
+      record_entry, 'e'),
+   XBEE_ATCMD_REG_END_CB( record_end, 0)
+};
+
+const xbee_atcmd_reg_t remote_list[] = {
+   XBEE_ATCMD_REG( 'A', 'A', XBEE_CLT_COPY_BE, values_t, a),
+   XBEE_ATCMD_REG( 'B', 'B', XBEE_CLT_COPY_BE, values_t, b),
+   XBEE_ATCMD_REG( 'I', 'D', XBEE_CLT_SET_BE, values_t, id),
+   XBEE_ATCMD_REG( 'C', 'C', XBEE_CLT_COPY_BE, values_t, c),
+   XBEE_ATCMD_REG( 'D', 'D', XBEE_CLT_COPY_BE, values_t, d),
+   XBEE_ATCMD_REG( 'F', 'F', XBEE_CLT_COPY_BE, values_t, f),
+   XBEE_ATCMD_REG_END_CB( record_end, 0)
+};
+
+// first entry's callback closes the serial port, so sending the next
+// entry (with the first entry's request) fails
+static int saved_fd;
+void break_port( const xbee_cmd_response_t FAR *response,
+   const struct xbee_atcmd_reg_t FAR *reg, void FAR *base)
+{
+   record_entry( response, reg, base);
+   saved_fd = xbee.serport.fd;
+   xbee.serport.fd = 0;
+}
+
+const xbee_atcmd_reg_t broken_list[] = {
+   XBEE_ATCMD_REG_MOVE_THEN_CB( 'A', 'A', XBEE_CLT_COPY_BE, values_t, a,
+      break_port, 'a'),
+   XBEE_ATCMD_REG_MOVE_THEN_CB( 'B', 'B', XBEE_CLT_COPY_BE, values_t, b,
+      record_entry, 'b'),
+   XBEE_ATCMD_REG_END_CB( record_end, 0)
+};
+
+// Read the command frames the host sent, return the number read.
+int collect( void)
+{
+   return loopback_collect( &xbee, sent, _TABLE_ENTRIES( sent));
+}
+
+// Respond to a command the host sent, with a <value_length>-byte value
+// derived from its command.
+void respond( const sent_t *cmd, int value_length)
+{
+   uint8_t value[64] = { 0 };
+
+   if (value_length)
+   {
+      value[value_length - 1] = cmd->command[0];
+   }
+   loopback_respond( &xbee, cmd, XBEE_AT_RESP_SUCCESS, value, value_length);
+}
+
+void reset( void)
+{
+   memset( &values, 0, sizeof values);
+   order[0] = '\0';
+   final_count = 0;
+   final_reg_null = FALSE;
+   loopback_reset( &xbee);
+}
+
+int expected_window( int window, int remaining)
+{
+   return window < remaining ? window : remaining;
+}
+
+void t_in_order( void)
+{
+   int count, i, total, rounds;
+
+   reset();
+   test_compare( xbee_cmd_list_execute( &xbee, &clc, query_list, &values,
+      NULL), 0, NULL, "execute failed");
+   count = collect();
+   test_compare( count, expected_window( XBEE_CMD_LIST_WINDOW_LOCAL, 6),
+      NULL, "wrong number of commands in flight");
+
+   // answer everything in flight each round, like a fast local XBee
+   total = rounds = 0;
+   while (count > 0 && rounds < 10)
+   {
+      ++rounds;
+      total += count;
+      for (i = 0; i < count; ++i)
+      {
+         respond( &sent[i], sent[i].command[0] == 'N' ? 8 : 2);
+      }
+      count = collect();
+   }
+   test_compare( total, 6, NULL, "wrong number of commands sent");
+   test_compare( rounds, (6 + XBEE_CMD_LIST_WINDOW_LOCAL - 1)
+      / XBEE_CMD_LIST_WINDOW_LOCAL, NULL, "window didn't cut round trips");
+   test_compare( xbee_cmd_list_status( &clc), XBEE_COMMAND_LIST_DONE, NULL,
+      "list not done");
+   test_string( order, "abcnde", "wrong completion order");
+   test_compare( final_count, 1, NULL, "final callback not called once");
+   test_compare( values.a, 'A', NULL, "AA not copied");
+   test_compare( values.e, 'E', NULL, "EE not copied");
+   test_compare( values.ni[7], 'N', NULL, "NI not copied");
+   test_compare( _xbee_cmd_pool.in_use, 0, NULL, "requests not released");
+}
+
+void t_out_of_order( void)
+{
+#if XBEE_CMD_LIST_WINDOW_MAX >= 6
+   int count, i;
+
+   // answer newest first, with an NI response too long to save so it's
+   // sent again once the entries before it complete
+   reset();
+   xbee_cmd_list_execute_window( &xbee, &clc, query_list, &values, NULL, 6);
+   count = collect();
+   test_compare( count, 6, NULL, "window not honored");
+   for (i = count; i--; )
+   {
+      respond( &sent[i], sent[i].command[0] == 'N'
+         ? XBEE_CMD_LIST_VALUE_MAX + 4 : 2);
+   }
+   test_string( order, "abc", "entries completed before NI");
+   count = collect();
+   test_compare( count, 1, NULL, "NI not sent again");
+   test_bool( sent[0].command[0] == 'N', "wrong command sent again");
+   respond( &sent[0], XBEE_CMD_LIST_VALUE_MAX + 4);
+
+   test_compare( xbee_cmd_list_status( &clc), XBEE_COMMAND_LIST_DONE, NULL,
+      "list not done");
+   test_string( order, "abcnde", "wrong completion order");
+   test_compare( final_count, 1, NULL, "final callback not called once");
+   test_compare( values.d, 'D', NULL, "saved DD response not copied");
+   test_compare( values.ni[sizeof values.ni - 1], 0, NULL,
+      "NI overflowed field");
+   test_compare( _xbee_cmd_pool.in_use, 0, NULL, "requests not released");
+#endif
+}
+
+void t_remote( void)
+{
+   wpan_address_t address;
+   int count;
+
+   memset( &address.ieee, 0x11, sizeof address.ieee);
+   address.network = 0x1234;
+
+   // window starts at 1 and grows, and ATID waits for (and holds off)
+   // the other commands
+   reset();
+   values.id = 0x42;
+   xbee_cmd_list_execute( &xbee, &clc, remote_list, &values, &address);
+   test_compare( collect(), 1, NULL, "remote window didn't start at 1");
+   test_bool( sent[0].frame_type == XBEE_FRAME_REMOTE_AT_CMD,
+      "not sent to remote");
+   respond( &sent[0], 2);
+   test_compare( collect(), 1, NULL, "ATBB not sent alone");
+   respond( &sent[0], 2);
+   test_compare( collect(), 1, NULL, "ATID not sent alone");
+   test_bool( sent[0].command[0] == 'I' && sent[0].param_length == 1,
+      "ATID not sent with parameter");
+   respond( &sent[0], 0);
+   count = collect();
+   test_compare( count, expected_window( XBEE_CMD_LIST_WINDOW_REMOTE, 3),
+      NULL, "window didn't grow after ATID");
+   for (; count; count = collect())
+   {
+      while (count--)
+      {
+         respond( &sent[count], 2);
+      }
+   }
+   test_compare( xbee_cmd_list_status( &clc), XBEE_COMMAND_LIST_DONE, NULL,
+      "list not done");
+   test_compare( values.f, 'F', NULL, "ATFF not copied");
+   test_compare( _xbee_cmd_pool.in_use, 0, NULL, "requests not released");
+}
+
+void t_timeout( void)
+{
+   int count, i;
+
+   // one command timing out stops the list and releases the rest
+   reset();
+   xbee_cmd_list_execute( &xbee, &clc, query_list, &values, NULL);
+   count = collect();
+   respond( &sent[0], 2);
+   collect();
+   _xbee_cmd_set_timeout( _xbee_cmd_handle_to_address(
+      clc.slot[clc.index % XBEE_CMD_LIST_WINDOW_MAX].handle), 0);
+   for (i = 0; i < 12 && xbee_cmd_tick() == 0; ++i)
+   {
+      usleep( 100000);
+   }
+   test_compare( xbee_cmd_list_status( &clc), XBEE_COMMAND_LIST_TIMEOUT,
+      NULL, "timeout didn't stop list");
+   test_compare( final_count, 1, NULL, "final callback not called once");
+   test_bool( ! final_reg_null, "final callback got NULL reg");
+   test_compare( _xbee_cmd_pool.in_use, 0, NULL, "requests not released");
+
+   // late responses are ignored
+   for (i = 1; i < count; ++i)
+   {
+      respond( &sent[i], 2);
+   }
+   test_string( order, "a", "completed entries after timeout");
+   test_compare( final_count, 1, NULL, "final callback called again");
+}
+
+void t_send_error( void)
+{
+   // failing to send the next entry ends the list instead of waiting
+   // for a response that won't come
+   reset();
+   xbee_cmd_list_execute_window( &xbee, &clc, broken_list, &values, NULL, 1);
+   test_compare( collect(), 1, NULL, "first entry not sent");
+   respond( &sent[0], 2);
+   xbee.serport.fd = saved_fd;
+   test_compare( collect(), 0, NULL, "second entry sent");
+   test_compare( xbee_cmd_list_status( &clc), XBEE_COMMAND_LIST_ERROR, NULL,
+      "send error didn't stop list");
+   test_string( order, "a", "wrong completion order");
+   test_compare( final_count, 1, NULL, "final callback not called once");
+   test_bool( final_reg_null, "final callback didn't get NULL reg");
+   test_compare( _xbee_cmd_pool.in_use, 0, NULL, "requests not released");
+}
+
+int main( int argc, char *argv[])
+{
+   static xbee_cmd_request_t requests[16];
+   xbee_serial_t serport;
+   int failures = 0;
+
+   memset( &serport, 0, sizeof serport);
+   serport.baudrate = 9600;
+   if (xbee_dev_init( &xbee, &serport, NULL, NULL))
+   {
+      printf( "t_atcmd_list: xbee_dev_init failed\n");
+      return 1;
+   }
+   // skip the queries xbee_cmd_init_device() sends
+   xbee.flags |= XBEE_DEV_FLAG_CMD_INIT;
+   // enough requests for the largest window, even without XBEE_CMD_REQUEST_GROW
+   xbee_cmd_request_pool_add( requests, _TABLE_ENTRIES( requests));
+
+   failures += DO_TEST( t_in_order);
+   failures += DO_TEST( t_out_of_order);
+   failures += DO_TEST( t_remote);
+   failures += DO_TEST( t_timeout);
+   failures += DO_TEST( t_send_error);
+
+   return test_exit( failures);
+}
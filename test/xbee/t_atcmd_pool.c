@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2019 Digi International Inc.,
+ * All rights not expressly granted are reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Digi International Inc. 11001 Bren Road East, Minnetonka, MN 55343
+ * =======================================================================
+ */
+
+// Unit tests for the AT command request pool: growing it past
+// xbee_cmd_request_table, handle lookups, and expiring requests in order
+// from their device's timer wheel.
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "xbee/platform.h"
+#include "xbee/atcmd.h"
+#include "xbee/serial_loopback.h"
+#include "../unittest.h"
+
+#define HANDLE_COUNT    200
+
+static xbee_dev_t xbee;
+static int16_t handle[HANDLE_COUNT];
+
+// handles passed to record_timeout(), in order
+static int16_t expired[8];
+static int expired_count;
+
+const xbee_dispatch_table_entry_t xbee_frame_handlers[] =
+{
+   XBEE_FRAME_HANDLE_LOCAL_AT,
+   XBEE_FRAME_TABLE_END
+};
+
+int record_timeout( const xbee_cmd_response_t FAR *response)
+{
+   if (expired_count < _TABLE_ENTRIES( expired))
+   {
+      expired[expired_count++] = response->handle;
+   }
+
+   // context of "reuse" keeps the request without resending it
+   return response->context == NULL ? XBEE_ATCMD_DONE : XBEE_ATCMD_REUSE;
+}
+
+// call xbee_cmd_tick() until it expires something, return the number of
+// requests expired
+int tick_until_expired( void)
+{
+   int i, count;
+
+   for (i = 0; i < 12; ++i)
+   {
+      count = xbee_cmd_tick();
+      if (count)
+      {
+         return count;
+      }
+      usleep( 100000);
+   }
+
+   return 0;
+}
+
+void t_pool_add( void)
+{
+   static xbee_cmd_request_t block[64];
+   uint16_t count;
+
+   test_compare( xbee_cmd_request_pool_add( NULL, 10), -EINVAL, NULL,
+      "accepted NULL block");
+   test_compare( xbee_cmd_request_pool_add( block, 0), -EINVAL, NULL,
+      "accepted empty block");
+
+   count = _xbee_cmd_pool.count;
+   test_compare( xbee_cmd_request_pool_add( block, _TABLE_ENTRIES( block)),
+      _TABLE_ENTRIES( block) < XBEE_CMD_REQUEST_MAX - count
+         ? _TABLE_ENTRIES( block) : XBEE_CMD_REQUEST_MAX - count,
+      NULL, "wrong number of requests added");
+   test_bool( _xbee_cmd_pool.count >= XBEE_CMD_REQUEST_TABLESIZE,
+      "static table not in pool");
+}
+
+void t_handles( void)
+{
+   xbee_cmd_request_t FAR *request;
+   int created, i;
+   int16_t stale;
+
+   for (created = 0; created < HANDLE_COUNT; ++created)
+   {
+      handle[created] = xbee_cmd_create( &xbee, "VR");
+      if (handle[created] < 0)
+      {
+         break;
+      }
+   }
+#if XBEE_CMD_REQUEST_GROW
+   test_compare( created, HANDLE_COUNT, NULL, "pool didn't grow");
+#else
+   test_compare( handle[created], -ENOSPC, NULL, "full pool not reported");
+#endif
+   test_compare( _xbee_cmd_pool.in_use, created, NULL,
+      "requests missing from pool");
+
+   // every handle maps to its own request
+   for (i = 0; i < created; ++i)
+   {
+      request = _xbee_cmd_handle_to_address( handle[i]);
+      test_bool( request != NULL, "lookup failed");
+      if (request != NULL)
+      {
+         test_compare( XBEE_CMD_REQUEST_HANDLE( request), handle[i], NULL,
+            "lookup returned wrong request");
+      }
+   }
+
+   // stale handle rejected, and released request reused first
+   stale = handle[created / 2];
+   test_compare( xbee_cmd_release_handle( stale), 0, NULL, "release failed");
+   test_bool( _xbee_cmd_handle_to_address( stale) == NULL,
+      "stale handle accepted");
+   test_compare( xbee_cmd_release_handle( stale), -EINVAL, NULL,
+      "released twice");
+   handle[created / 2] = xbee_cmd_create( &xbee, "VR");
+   test_compare( handle[created / 2] >> XBEE_CMD_HANDLE_SHIFT,
+      stale >> XBEE_CMD_HANDLE_SHIFT, NULL, "free request not reused");
+   test_bool( handle[created / 2] != stale, "reused stale handle");
+   test_bool( _xbee_cmd_handle_to_address( stale) == NULL,
+      "stale handle accepted after reuse");
+
+   test_bool( _xbee_cmd_handle_to_address( -1) == NULL,
+      "accepted negative handle");
+   test_bool( _xbee_cmd_handle_to_address(
+      (int16_t) (_xbee_cmd_pool.count << XBEE_CMD_HANDLE_SHIFT)) == NULL,
+      "accepted handle past end of pool");
+
+   for (i = 0; i < created; ++i)
+   {
+      xbee_cmd_release_handle( handle[i]);
+   }
+   test_compare( _xbee_cmd_pool.in_use, 0, NULL, "requests left in pool");
+   test_compare( xbee_cmd_next_timeout(), XBEE_WAIT_FOREVER, NULL,
+      "timeout without requests");
+}
+
+void t_timeouts( void)
+{
+   int16_t h[4];
+   int32_t next;
+   int i;
+
+   for (i = 0; i < 4; ++i)
+   {
+      h[i] = xbee_cmd_create( &xbee, "VR");
+      xbee_cmd_set_callback( h[i], record_timeout, i == 3 ? "reuse" : NULL);
+   }
+
+   // timer wheel orders requests by timeout, not by index
+   _xbee_cmd_set_timeout( _xbee_cmd_handle_to_address( h[0]), 30000);
+   _xbee_cmd_set_timeout( _xbee_cmd_handle_to_address( h[1]), 10000);
+   _xbee_cmd_set_timeout( _xbee_cmd_handle_to_address( h[2]), 20000);
+   _xbee_cmd_set_timeout( _xbee_cmd_handle_to_address( h[3]), 40000);
+   next = xbee_cmd_next_timeout();
+   test_bool( next > 8000 && next <= 10000, "wrong next timeout");
+
+   // expire h[2] and h[0], oldest first
+   _xbee_cmd_set_timeout( _xbee_cmd_handle_to_address( h[2]), 3);
+   _xbee_cmd_set_timeout( _xbee_cmd_handle_to_address( h[0]), 1);
+   usleep( 10000);
+   test_compare( xbee_cmd_next_timeout(), 0, NULL, "expired request missed");
+   expired_count = 0;
+   test_compare( tick_until_expired(), 2, NULL, "wrong number expired");
+   test_compare( expired[0], h[0], NULL, "expired out of order");
+   test_compare( expired[1], h[2], NULL, "expired out of order");
+   test_compare( _xbee_cmd_pool.in_use, 2, NULL, "wrong requests in pool");
+   test_bool( _xbee_cmd_handle_to_address( h[0]) == NULL,
+      "expired request not released");
+
+   // request kept by its callback stays in use, and expires again
+   _xbee_cmd_set_timeout( _xbee_cmd_handle_to_address( h[3]), 0);
+   expired_count = 0;
+   test_compare( tick_until_expired(), 1, NULL, "kept request not expired");
+   test_compare( expired[0], h[3], NULL, "wrong request expired");
+   test_bool( _xbee_cmd_handle_to_address( h[3]) != NULL, "request freed");
+   next = xbee_cmd_next_timeout();
+   test_bool( next >= 0 && next <= 1000, "kept request not rescheduled");
+
+   xbee_cmd_release_handle( h[1]);
+   xbee_cmd_release_handle( h[3]);
+   test_compare( _xbee_cmd_pool.in_use, 0, NULL, "requests left in pool");
+}
+
+int main( int argc, char *argv[])
+{
+   xbee_serial_t serport;
+   int failures = 0;
+
+   memset( &serport, 0, sizeof serport);
+   serport.baudrate = 9600;
+   if (xbee_dev_init( &xbee, &serport, NULL, NULL))
+   {
+      printf( "t_atcmd_pool: xbee_dev_init failed\n");
+      return 1;
+   }
+   // skip the queries xbee_cmd_init_device() sends
+   xbee.flags |= XBEE_DEV_FLAG_CMD_INIT;
+
+   failures += DO_TEST( t_pool_add);
+   failures += DO_TEST( t_handles);
+   failures += DO_TEST( t_timeouts);
+
+   return test_exit( failures);
+}
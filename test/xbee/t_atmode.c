@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2019 Digi International Inc.,
+ * All rights not expressly granted are reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Digi International Inc. 11001 Bren Road East, Minnetonka, MN 55343
+ * =======================================================================
+ */
+
+// Unit tests for AT command mode: skipping the pre-escape guard time when
+// the serial port has been idle, and sending several commands on one line
+// with xbee_atmode_send_batch().
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "xbee/platform.h"
+#include "xbee/atmode.h"
+#include "xbee/serial_loopback.h"
+#include "../unittest.h"
+
+// short guard time (GT) to keep the tests quick
+#define GUARD_TIME      50
+
+static xbee_dev_t xbee;
+
+const xbee_dispatch_table_entry_t xbee_frame_handlers[] =
+{
+   XBEE_FRAME_TABLE_END
+};
+
+void feed( const char *text)
+{
+   xbee_ser_loopback_feed( &xbee.serport, text, strlen( text));
+}
+
+// return the bytes written to the XBee since the last call, as a string
+const char *drain( void)
+{
+   static char buffer[80];
+   int length;
+
+   length = xbee_ser_loopback_drain( &xbee.serport, buffer,
+      sizeof buffer - 1);
+   buffer[length < 0 ? 0 : length] = '\0';
+
+   return buffer;
+}
+
+// sleep past the pre-escape guard time (and its 200ms margin)
+void wait_guard( void)
+{
+   usleep( (GUARD_TIME + 250) * 1000);
+}
+
+void t_guard_time( void)
+{
+   uint32_t now;
+   int32_t pending;
+
+   // just opened, so wait the full guard time before the escape sequence
+   test_compare( xbee_atmode_enter( &xbee), 0, NULL, "enter failed");
+   test_compare( xbee.mode, XBEE_MODE_PRE_ESCAPE, NULL, "didn't wait");
+   test_string( drain(), "", "sent escape during guard time");
+   wait_guard();
+   test_compare( xbee_atmode_tick( &xbee), XBEE_MODE_POST_ESCAPE, NULL,
+      "escape not sent after guard time");
+   test_string( drain(), "+++", "wrong escape sequence");
+   feed( "OK\r");
+   test_compare( xbee_atmode_tick( &xbee), XBEE_MODE_COMMAND, NULL,
+      "not in command mode");
+
+   // line has been idle for the guard time, send the escape right away
+   xbee.mode = XBEE_MODE_IDLE;
+   wait_guard();
+   xbee_atmode_enter( &xbee);
+   test_compare( xbee.mode, XBEE_MODE_POST_ESCAPE, NULL,
+      "waited on idle line");
+   test_string( drain(), "+++", "escape not sent on idle line");
+   feed( "OK\r");
+   test_compare( xbee_atmode_tick( &xbee), XBEE_MODE_COMMAND, NULL,
+      "not in command mode");
+
+   // bytes still going out at 9600bps hold off the guard time
+   xbee.mode = XBEE_MODE_IDLE;
+   xbee.serport.baudrate = 9600;
+   now = xbee_millisecond_timer();
+   _xbee_dev_tx_note( &xbee, 480);
+   _xbee_dev_tx_note( &xbee, 480);
+   pending = (int32_t) (xbee.tx_idle_timer - now);
+   test_bool( pending >= 1000 && pending <= 1010, "wrong transmit estimate");
+   xbee_atmode_enter( &xbee);
+   wait_guard();
+   test_compare( xbee_atmode_tick( &xbee), XBEE_MODE_PRE_ESCAPE, NULL,
+      "escape sent before port was idle");
+   test_string( drain(), "", "escape sent before port was idle");
+   xbee.serport.baudrate = 115200;
+
+   // last write was about 33 days ago, so its stamp wrapped around and
+   // looks like it's in the future
+   xbee.mode = XBEE_MODE_IDLE;
+   xbee.tx_idle_timer = xbee_millisecond_timer() + UINT32_C(0x60000000);
+   xbee_atmode_enter( &xbee);
+   test_compare( xbee.mode, XBEE_MODE_POST_ESCAPE, NULL,
+      "waited on wrapped idle stamp");
+   test_string( drain(), "+++", "escape not sent after wrap");
+   now = xbee_millisecond_timer();
+   xbee.tx_idle_timer = now + UINT32_C(0x60000000);
+   _xbee_dev_tx_note( &xbee, 12);
+   pending = (int32_t) (xbee.tx_idle_timer - now);
+   test_bool( pending >= 0 && pending <= 10, "wrapped stamp extended");
+   xbee.mode = XBEE_MODE_COMMAND;
+}
+
+void t_single( void)
+{
+   char response[20];
+   int bytesread = 0;
+
+   test_compare( xbee_atmode_send_request( &xbee, "VR"), 0, NULL,
+      "send failed");
+   test_string( drain(), "ATVR\r", "wrong request");
+
+   // response split across reads
+   *response = '\0';
+   feed( "10");
+   test_compare( xbee_atmode_read_response( &xbee, response, sizeof response,
+      &bytesread), -EAGAIN, NULL, "partial response");
+   feed( "0A\r");
+   test_compare( xbee_atmode_read_response( &xbee, response, sizeof response,
+      &bytesread), 0, NULL, "response not read");
+   test_string( response, "100A", "wrong response");
+   test_compare( xbee.mode, XBEE_MODE_COMMAND, NULL, "not in command mode");
+}
+
+void t_batch( void)
+{
+   static const char *commands[] = { "BD7", "WR", "AC" };
+   static const char *bad[] = { "XX", "WR" };
+   char buffer[20];
+   int bytesread;
+
+   test_compare( xbee_atmode_send_batch( &xbee, commands, 0), -EINVAL, NULL,
+      "empty batch");
+   test_compare( xbee_atmode_send_batch( &xbee, commands, 3), 0, NULL,
+      "send failed");
+   test_string( drain(), "ATBD7,WR,AC\r", "wrong request");
+
+   bytesread = 0;
+   feed( "OK\rO");
+   test_compare( xbee_atmode_read_batch( &xbee, buffer, sizeof buffer,
+      &bytesread), -EAGAIN, NULL, "partial batch");
+   test_compare( xbee.mode, XBEE_MODE_WAIT_RESPONSE, NULL,
+      "stopped waiting early");
+   feed( "K\rOK\r");
+   test_compare( xbee_atmode_read_batch( &xbee, buffer, sizeof buffer,
+      &bytesread), 3, NULL, "wrong number of responses");
+   test_compare( bytesread, 9, NULL, "wrong length");
+   test_bool( memcmp( buffer, "OK\0OK\0OK\0", 9) == 0, "wrong responses");
+   test_compare( xbee.mode, XBEE_MODE_COMMAND, NULL, "not in command mode");
+
+   // single responses work too
+   xbee_atmode_send_batch( &xbee, commands, 2);
+   drain();
+   feed( "OK\rOK\r");
+   test_compare( xbee_atmode_read_response( &xbee, buffer, sizeof buffer,
+      NULL), 0, NULL, "first response");
+   test_compare( xbee.mode, XBEE_MODE_WAIT_RESPONSE, NULL,
+      "stopped waiting early");
+   *buffer = '\0';
+   test_compare( xbee_atmode_read_response( &xbee, buffer, sizeof buffer,
+      NULL), 0, NULL, "second response");
+   test_compare( xbee.mode, XBEE_MODE_COMMAND, NULL, "not in command mode");
+
+   // XBee stops at the first error
+   xbee_atmode_send_batch( &xbee, bad, 2);
+   test_string( drain(), "ATXX,WR\r", "wrong request");
+   feed( "ERROR\r");
+   bytesread = 0;
+   test_compare( xbee_atmode_read_batch( &xbee, buffer, sizeof buffer,
+      &bytesread), 1, NULL, "error didn't end batch");
+   test_string( buffer, "ERROR", "wrong response");
+   test_compare( xbee.mode, XBEE_MODE_COMMAND, NULL, "not in command mode");
+
+   // responses that don't fit
+   xbee_atmode_send_batch( &xbee, commands, 3);
+   drain();
+   feed( "OK\rOK\rOK\r");
+   bytesread = 0;
+   test_compare( xbee_atmode_read_batch( &xbee, buffer, 5, &bytesread),
+      -ENOSPC, NULL, "overflow not reported");
+   xbee_ser_rx_flush( &xbee.serport);
+   xbee.mode = XBEE_MODE_COMMAND;
+}
+
+int main( int argc, char *argv[])
+{
+   xbee_serial_t serport;
+   int failures = 0;
+
+   memset( &serport, 0, sizeof serport);
+   serport.baudrate = 115200;
+   if (xbee_dev_init( &xbee, &serport, NULL, NULL))
+   {
+      printf( "t_atmode: xbee_dev_init failed\n");
+      return 1;
+   }
+   xbee.guard_time = GUARD_TIME;
+
+   failures += DO_TEST( t_guard_time);
+   failures += DO_TEST( t_single);
+   failures += DO_TEST( t_batch);
+
+   return test_exit( failures);
+}
@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2019 Digi International Inc.,
+ * All rights not expressly granted are reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Digi International Inc. 11001 Bren Road East, Minnetonka, MN 55343
+ * =======================================================================
+ */
+
+// Unit tests for xbee_cmd_negotiate_baudrate(), with a thread playing the
+// part of the XBee on the other end of the loopback serial driver.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "xbee/platform.h"
+#include "xbee/atcmd.h"
+#include "../loopback.h"
+#include "../unittest.h"
+
+static xbee_dev_t xbee;
+
+// The fake XBee only hears frames sent at <module_rate> (0 for no XBee),
+// rejects rates above <module_max>, and its responses don't make it back
+// to the host at rates above <link_max>.  If <lose_set> is TRUE, responses
+// to setting ATBD are lost.
+static volatile uint32_t module_rate;
+static uint32_t module_param;
+static uint32_t module_max;
+static uint32_t link_max;
+static bool_t lose_set;
+static volatile bool_t module_running;
+
+static const uint32_t std_rate[] = {
+   1200, 2400, 4800, 9600, 19200, 38400, 57600, 115200,
+   230400, 460800, 921600
+};
+
+const xbee_dispatch_table_entry_t xbee_frame_handlers[] =
+{
+   XBEE_FRAME_HANDLE_LOCAL_AT,
+   XBEE_FRAME_TABLE_END
+};
+
+void module_respond( const sent_t *cmd, uint8_t status, const uint8_t *value,
+   int value_length)
+{
+   if (module_rate <= link_max)
+   {
+      loopback_feed_response( &xbee, cmd, status, value, value_length);
+   }
+}
+
+// Handle a frame sent by the host.
+void module_frame( const sent_t *cmd)
+{
+   uint8_t value[4];
+   uint32_t param, rate;
+   int i;
+
+   if (xbee.serport.baudrate != module_rate
+      || cmd->frame_type != XBEE_FRAME_LOCAL_AT_CMD
+      || cmd->command[0] != 'B' || cmd->command[1] != 'D')
+   {
+      // sent at the wrong rate, or a command we don't need to answer
+      return;
+   }
+
+   if (cmd->param_length == 0)
+   {
+      value[0] = (uint8_t) (module_param >> 24);
+      value[1] = (uint8_t) (module_param >> 16);
+      value[2] = (uint8_t) (module_param >> 8);
+      value[3] = (uint8_t) module_param;
+      module_respond( cmd, XBEE_AT_RESP_SUCCESS, value, 4);
+      return;
+   }
+
+   param = 0;
+   for (i = 0; i < cmd->param_length; ++i)
+   {
+      param = (param << 8) | cmd->param[i];
+   }
+   rate = (param < _TABLE_ENTRIES( std_rate)) ? std_rate[param] : param;
+   if (rate > module_max)
+   {
+      module_respond( cmd, XBEE_AT_RESP_BAD_PARAMETER, NULL, 0);
+      return;
+   }
+
+   // respond at the old rate, then switch
+   if (! lose_set)
+   {
+      module_respond( cmd, XBEE_AT_RESP_SUCCESS, NULL, 0);
+   }
+   module_param = param;
+   module_rate = rate;
+}
+
+void *module_thread( void *arg)
+{
+   static const struct timespec nap = { 0, 100000L };      // 100us
+   sent_t sent[8];
+   int count, i;
+
+   while (module_running)
+   {
+      count = loopback_collect( &xbee, sent, _TABLE_ENTRIES( sent));
+      if (count == 0)
+      {
+         nanosleep( &nap, NULL);
+         continue;
+      }
+      for (i = 0; i < count && i < _TABLE_ENTRIES( sent); ++i)
+      {
+         module_frame( &sent[i]);
+      }
+   }
+
+   return NULL;
+}
+
+void start_module( uint32_t rate, uint32_t max, uint32_t link)
+{
+   int i;
+
+   module_rate = rate;
+   module_max = max;
+   link_max = link;
+   lose_set = FALSE;
+   module_param = rate;
+   for (i = 0; i < _TABLE_ENTRIES( std_rate); ++i)
+   {
+      if (std_rate[i] == rate)
+      {
+         module_param = i;
+      }
+   }
+}
+
+void t_negotiate( void)
+{
+   static const uint32_t rates[] =
+      { 9600, 115200, 230400, 250000, 460800, 921600 };
+
+   test_compare( xbee_cmd_negotiate_baudrate( NULL, rates, 1, 50),
+      -EINVAL, NULL, "accepted NULL device");
+
+   // no XBee at all
+   start_module( 0, 0, 0);
+   test_compare( xbee_cmd_negotiate_baudrate( &xbee, rates,
+      _TABLE_ENTRIES( rates), 50), -ETIMEDOUT, NULL, "found missing XBee");
+   test_compare( xbee.serport.baudrate, 9600, NULL, "changed rate");
+
+   // XBee rejects 921600, host ends at 460800
+   start_module( 9600, 460800, 921600);
+   test_compare( xbee_cmd_negotiate_baudrate( &xbee, rates,
+      _TABLE_ENTRIES( rates), 50), 0, NULL, "negotiation failed");
+   test_compare( xbee.serport.baudrate, 460800, NULL, "wrong host rate");
+   test_compare( module_rate, 460800, NULL, "wrong XBee rate");
+   test_compare( module_param, 9, NULL, "sent wrong ATBD value");
+
+   // nothing faster to try
+   test_compare( xbee_cmd_negotiate_baudrate( &xbee, rates,
+      _TABLE_ENTRIES( rates), 50), 0, NULL, "negotiation failed");
+   test_compare( xbee.serport.baudrate, 460800, NULL, "rate changed");
+
+   xbee_ser_baudrate( &xbee.serport, 9600);
+}
+
+void t_negotiate_revert( void)
+{
+   static const uint32_t rates[] = { 115200, 250000, 460800 };
+
+   // XBee takes 460800 but its responses are lost, fall back to 250000
+   start_module( 9600, 921600, 250000);
+   test_compare( xbee_cmd_negotiate_baudrate( &xbee, rates,
+      _TABLE_ENTRIES( rates), 50), 0, NULL, "negotiation failed");
+   test_compare( xbee.serport.baudrate, 250000, NULL, "wrong host rate");
+   test_compare( module_rate, 250000, NULL, "XBee not restored");
+   test_compare( module_param, 250000, NULL, "sent wrong ATBD value");
+
+   xbee_ser_baudrate( &xbee.serport, 9600);
+}
+
+void t_negotiate_lost( void)
+{
+   static const uint32_t rates[] = { 115200 };
+
+   // XBee switches without its response getting back, find it at 115200
+   start_module( 9600, 921600, 921600);
+   lose_set = TRUE;
+   test_compare( xbee_cmd_negotiate_baudrate( &xbee, rates,
+      _TABLE_ENTRIES( rates), 50), 0, NULL, "negotiation failed");
+   test_compare( xbee.serport.baudrate, 115200, NULL, "wrong host rate");
+   test_compare( module_rate, 115200, NULL, "wrong XBee rate");
+   xbee_ser_baudrate( &xbee.serport, 9600);
+
+   // XBee switches and can't be heard at either rate
+   start_module( 9600, 921600, 9600);
+   lose_set = TRUE;
+   test_compare( xbee_cmd_negotiate_baudrate( &xbee, rates,
+      _TABLE_ENTRIES( rates), 50), -EIO, NULL, "lost XBee not reported");
+   test_compare( xbee.serport.baudrate, 9600, NULL, "host rate changed");
+}
+
+int main( int argc, char *argv[])
+{
+   xbee_serial_t serport;
+   pthread_t thread;
+   int failures = 0;
+
+   memset( &serport, 0, sizeof serport);
+   serport.baudrate = 9600;
+   if (xbee_dev_init( &xbee, &serport, NULL, NULL))
+   {
+      printf( "t_baudrate: xbee_dev_init failed\n");
+      return 1;
+   }
+
+   module_running = TRUE;
+   pthread_create( &thread, NULL, module_thread, NULL);
+
+   failures += DO_TEST( t_negotiate);
+   failures += DO_TEST( t_negotiate_revert);
+   failures += DO_TEST( t_negotiate_lost);
+
+   module_running = FALSE;
+   pthread_join( thread, NULL);
+
+   return test_exit( failures);
+}
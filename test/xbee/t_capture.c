@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2019 Digi International Inc.,
+ * All rights not expressly granted are reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Digi International Inc. 11001 Bren Road East, Minnetonka, MN 55343
+ * =======================================================================
+ */
+
+// Unit tests for frame captures and replay, with a device fed through a
+// pipe on POSIX.
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "xbee/platform.h"
+#include "xbee/byteorder.h"
+#include "xbee/device.h"
+#include "xbee/capture.h"
+#include "../unittest.h"
+
+static xbee_dev_t xbee;
+static int pipe_fd[2];
+
+// sum of the bytes of every frame dispatched, to compare replays
+static int frames_received;
+static uint32_t frame_sum;
+
+int sum_frame( xbee_dev_t *xbee, const void FAR *frame, uint16_t length,
+   void FAR *context)
+{
+   const uint8_t FAR *bytes = frame;
+
+   ++frames_received;
+   while (length--)
+   {
+      frame_sum = frame_sum * 31 + *bytes++;
+   }
+
+   return 0;
+}
+
+const xbee_dispatch_table_entry_t xbee_frame_handlers[] =
+{
+   { 0, 0, sum_frame, NULL },
+   XBEE_FRAME_TABLE_END
+};
+
+void reset_device( void)
+{
+   memset( &xbee, 0, sizeof xbee);
+   xbee.serport.fd = pipe_fd[0];
+   frames_received = 0;
+   frame_sum = 0;
+}
+
+// send frames of type 0x90 with <count> different lengths to the device,
+// and write one frame from it
+void exchange_frames( int count)
+{
+   static const uint8_t header[] = { 0x08, 0x01, 'V', 'R' };
+   uint8_t payload[64];
+   uint8_t buffer[sizeof payload + 4];
+   int i, length, loaded;
+
+   for (i = 0; i < count; ++i)
+   {
+      length = 2 + i * 5 % (sizeof payload - 2);
+      memset( payload, i, length);
+      payload[0] = 0x90;
+      buffer[0] = 0x7E;
+      buffer[1] = 0;
+      buffer[2] = length;
+      memcpy( &buffer[3], payload, length);
+      buffer[3 + length] = _xbee_checksum( payload, length, 0xFF);
+      test_compare( write( pipe_fd[1], buffer, length + 4), length + 4, NULL,
+         "write to pipe failed");
+   }
+   for (loaded = 0; (i = _xbee_frame_load( &xbee)) > 0; loaded += i);
+   test_compare( loaded, count, NULL, "frames not loaded");
+
+   // frame written by the device goes back into the pipe, read it too
+   xbee.serport.fd = pipe_fd[1];
+   test_compare( xbee_frame_write( &xbee, header, sizeof header, NULL, 0, 0),
+      0, NULL, "write failed");
+   xbee.serport.fd = pipe_fd[0];
+   test_compare( _xbee_frame_load( &xbee), 1, NULL, "frame not looped back");
+}
+
+void t_capture( void)
+{
+   static uint8_t log[2048];
+   xbee_capture_t capture;
+#if XBEE_DEV_CAPTURE
+   const xbee_capture_record_t *record;
+   uint32_t offset, sum;
+   int rx, tx;
+#endif
+
+   reset_device();
+   test_compare( xbee_capture_init( &capture, log, 4), -EINVAL, NULL,
+      "accepted buffer smaller than header");
+   test_compare( xbee_capture_init( &capture, log, sizeof log), 0, NULL,
+      "init failed");
+#if ! XBEE_DEV_CAPTURE
+   test_compare( xbee_capture_start( &xbee, &capture), -ENOSYS, NULL,
+      "capture not compiled in");
+#else
+   test_compare( xbee_capture_start( &xbee, &capture), 0, NULL,
+      "start failed");
+
+   exchange_frames( 10);
+   sum = frame_sum;
+   test_compare( xbee_capture_start( &xbee, NULL), 0, NULL, "stop failed");
+   exchange_frames( 3);
+
+   // walk the log: 10 received frames, one sent, and the sent frame again
+   // as it's received
+   offset = rx = tx = 0;
+   while ((record = xbee_capture_next( log, capture.used, &offset)) != NULL)
+   {
+      if (record->direction == XBEE_CAPTURE_DIR_TX)
+      {
+         ++tx;
+         test_compare( le16toh( record->length_le), 4, NULL,
+            "wrong length for sent frame");
+      }
+      else
+      {
+         ++rx;
+      }
+   }
+   test_compare( rx, 11, NULL, "wrong number of received frames");
+   test_compare( tx, 1, NULL, "wrong number of sent frames");
+   test_compare( offset, capture.used, NULL, "records don't fill capture");
+   test_compare( capture.dropped, 0, NULL, "dropped frames");
+
+   // replaying dispatches the same frames, without the ones received
+   // after the capture stopped
+   reset_device();
+   test_compare( xbee_capture_replay( &xbee, log, capture.used,
+      XBEE_CAPTURE_REPLAY_FAST), 11, NULL, "replay failed");
+   test_compare( frames_received, 11, NULL, "wrong frame count");
+   test_compare( frame_sum, sum, NULL, "replay didn't match original frames");
+
+   // bytes after the last record (e.g., rest of a mapped file) are ignored
+   test_compare( xbee_capture_replay( &xbee, log, sizeof log,
+      XBEE_CAPTURE_REPLAY_FAST), 11, NULL, "read past end of capture");
+   test_compare( xbee_capture_replay( &xbee, log + 1, capture.used - 1,
+      XBEE_CAPTURE_REPLAY_FAST), -EINVAL, NULL, "replayed without header");
+
+   // capture too small for all frames
+   reset_device();
+   xbee_capture_init( &capture, log, 100);
+   xbee_capture_start( &xbee, &capture);
+   exchange_frames( 10);
+   xbee_capture_start( &xbee, NULL);
+   test_bool( capture.dropped > 0, "didn't count dropped frames");
+   test_bool( capture.used <= 100, "overflowed capture");
+#endif
+}
+
+void t_replay_realtime( void)
+{
+   static const uint8_t frame[] = { 0x8A, 0x06 };
+   uint8_t log[64];
+   xbee_capture_t capture;
+   uint32_t start, elapsed;
+
+   // three frames 20ms apart, across the timestamp's wrap-around
+   xbee_capture_init( &capture, log, sizeof log);
+   _xbee_capture_frame( &capture, XBEE_CAPTURE_DIR_RX, 0xFFFFF000, frame,
+      sizeof frame, NULL, 0);
+   _xbee_capture_frame( &capture, XBEE_CAPTURE_DIR_TX, 0xFFFFF100, frame,
+      sizeof frame, NULL, 0);
+   _xbee_capture_frame( &capture, XBEE_CAPTURE_DIR_RX, 0xFFFFF000 + 20000,
+      frame, sizeof frame, NULL, 0);
+   _xbee_capture_frame( &capture, XBEE_CAPTURE_DIR_RX, 0xFFFFF000 + 40000,
+      frame, sizeof frame, NULL, 0);
+
+   reset_device();
+   start = xbee_millisecond_timer();
+   test_compare( xbee_capture_replay( &xbee, log, capture.used,
+      XBEE_CAPTURE_REPLAY_REALTIME), 3, NULL, "replay failed");
+   elapsed = xbee_millisecond_timer() - start;
+   test_bool( elapsed >= 39 && elapsed < 200, "didn't keep original timing");
+
+   start = xbee_millisecond_timer();
+   test_compare( xbee_capture_replay( &xbee, log, capture.used,
+      XBEE_CAPTURE_REPLAY_FAST), 3, NULL, "replay failed");
+   test_bool( xbee_millisecond_timer() - start < 20, "fast replay waited");
+}
+
+void t_capture_file( void)
+{
+#if XBEE_DEV_CAPTURE
+   char filename[64];
+   xbee_capture_t capture;
+   const void *log;
+   uint32_t length, sum;
+
+   snprintf( filename, sizeof filename, "/tmp/t_capture.%d", (int) getpid());
+
+   reset_device();
+   test_compare( xbee_capture_open( &capture, filename, 65536), 0, NULL,
+      "open failed");
+   xbee_capture_start( &xbee, &capture);
+   exchange_frames( 20);
+   xbee_capture_start( &xbee, NULL);
+   sum = frame_sum;
+   test_compare( xbee_capture_close( &capture), 0, NULL, "close failed");
+   test_compare( xbee_capture_close( &capture), -EINVAL, NULL,
+      "closed twice");
+
+   test_compare( xbee_capture_map( filename, &log, &length), 0, NULL,
+      "map failed");
+   test_bool( length < 65536, "file not trimmed to capture");
+   reset_device();
+   test_compare( xbee_capture_replay( &xbee, log, length,
+      XBEE_CAPTURE_REPLAY_FAST), 21, NULL, "replay from file failed");
+   test_compare( frame_sum, sum, NULL, "wrong frames replayed from file");
+   test_compare( xbee_capture_unmap( log, length), 0, NULL, "unmap failed");
+
+   unlink( filename);
+   test_bool( xbee_capture_map( filename, &log, &length) < 0,
+      "mapped missing file");
+#endif
+}
+
+int main( int argc, char *argv[])
+{
+   int failures = 0;
+
+   if (pipe( pipe_fd))
+   {
+      perror( "pipe");
+      return 1;
+   }
+   // match xbee_ser_open(), reads don't block when the pipe is empty
+   fcntl( pipe_fd[0], F_SETFL, O_NONBLOCK);
+
+   failures += DO_TEST( t_capture);
+   failures += DO_TEST( t_replay_realtime);
+   failures += DO_TEST( t_capture_file);
+
+   return test_exit( failures);
+}
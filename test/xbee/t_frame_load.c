@@ -0,0 +1,1216 @@
+/*
+ * Copyright (c) 2019 Digi International Inc.,
+ * All rights not expressly granted are reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Digi International Inc. 11001 Bren Road East, Minnetonka, MN 55343
+ * =======================================================================
+ */
+
+// Unit tests for _xbee_frame_load(), fed through a pipe on POSIX, and
+// _xbee_frame_dispatch().
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "xbee/platform.h"
+#include "xbee/device.h"
+#include "../unittest.h"
+
+static xbee_dev_t xbee;
+static int pipe_fd[2];
+
+// record of frames received by the frame handler
+static int frames_received;
+static uint16_t last_length;
+static uint8_t last_frame[XBEE_MAX_FRAME_LEN];
+static int frames_in_place;
+
+int record_frame( xbee_dev_t *xbee, const void FAR *frame, uint16_t length,
+   void FAR *context)
+{
+   ++frames_received;
+   last_length = length;
+   memcpy( last_frame, frame, length);
+#if XBEE_DEV_RX_ZERO_COPY
+   if ((const uint8_t FAR *) frame >= xbee->staging.buf
+      && (const uint8_t FAR *) frame + length
+                        <= xbee->staging.buf + XBEE_DEV_RX_STAGING_SIZE)
+   {
+      ++frames_in_place;
+   }
+#endif
+
+   return 0;
+}
+
+// order that count_handler() was called, by context
+static char call_order[16];
+
+int count_handler( xbee_dev_t *xbee, const void FAR *frame, uint16_t length,
+   void FAR *context)
+{
+   size_t len = strlen( call_order);
+
+   if (len < sizeof call_order - 1)
+   {
+      call_order[len] = *(const char *)context;
+      call_order[len + 1] = '\0';
+   }
+
+   return 0;
+}
+
+const xbee_dispatch_table_entry_t xbee_frame_handlers[] =
+{
+   { 0, 0, record_frame, NULL },
+   { 0x8A, 0, count_handler, "a" },
+   { 0x88, 1, count_handler, "b" },
+   { 0, 2, count_handler, "w" },
+   { 0x88, 0, count_handler, "c" },
+   XBEE_FRAME_TABLE_END
+};
+
+// build an API frame for <payload> in <buffer>, returns length of frame
+int build_frame( uint8_t *buffer, const void *payload, uint16_t length)
+{
+   buffer[0] = 0x7E;
+   buffer[1] = length >> 8;
+   buffer[2] = length & 0xFF;
+   memcpy( &buffer[3], payload, length);
+   buffer[3 + length] = _xbee_checksum( payload, length, 0xFF);
+
+   return length + 4;
+}
+
+void feed( const void *buffer, int length)
+{
+   test_compare( write( pipe_fd[1], buffer, length), length, NULL,
+      "write to pipe failed");
+}
+
+void reset_device( void)
+{
+   memset( &xbee, 0, sizeof xbee);
+   xbee.serport.fd = pipe_fd[0];
+   frames_received = 0;
+   frames_in_place = 0;
+}
+
+void t_checksum( void)
+{
+   uint8_t src[600], dest[600];
+   uint_fast8_t offset;
+   uint16_t length;
+   uint8_t expected;
+   int i;
+
+   for (i = 0; i < sizeof src; ++i)
+   {
+      src[i] = (uint8_t) (i * 7 + (i >> 3));
+   }
+
+   // compare platform's version (if any) against the portable versions, at
+   // all alignments and across vector-sized boundaries
+   for (offset = 0; offset < 33; ++offset)
+   {
+      for (length = 0; length < 100; ++length)
+      {
+         expected = (_xbee_checksum)( src + offset, length, 0xFF);
+         test_compare( _xbee_checksum( src + offset, length, 0xFF),
+            expected, NULL, "wrong checksum");
+         memset( dest, 0, sizeof dest);
+         test_compare( _xbee_checksum_copy( dest + 1, src + offset, length,
+            0xFF), expected, NULL, "wrong copy checksum");
+         test_bool( memcmp( dest + 1, src + offset, length) == 0
+            && dest[length + 1] == 0, "wrong copy");
+      }
+   }
+
+   expected = (_xbee_checksum)( src, sizeof src, 0x12);
+   test_compare( _xbee_checksum( src, sizeof src, 0x12), expected, NULL,
+      "wrong checksum for large buffer");
+   test_compare( (_xbee_checksum_copy)( dest, src, sizeof src, 0x12),
+      expected, NULL, "wrong portable copy checksum");
+}
+
+void t_escape( void)
+{
+   static const uint8_t specials[] = { 0x7E, 0x7D, 0x11, 0x13 };
+   static const uint8_t flow[] = { 0x11, 'A', 0x7D, 0x13, 0x5E, 0x13 };
+   uint8_t src[300], escaped[600], expected[600], dest[600];
+   uint16_t offset, length, count, split, part;
+   uint8_t escape;
+   int i;
+
+   // mix in a special byte every few bytes, with long runs without any
+   for (i = 0; i < sizeof src; ++i)
+   {
+      src[i] = (i % 37 < 20 && i % 5 == 0) ? specials[i / 5 % 4]
+                                           : (uint8_t) (i * 7 + 0x20);
+   }
+
+   // compare platform's versions (if any) against the portable versions,
+   // at all alignments and across vector-sized boundaries
+   for (offset = 0; offset < 33; ++offset)
+   {
+      for (length = 0; length < 100; ++length)
+      {
+         count = (_xbee_escape)( expected, src + offset, length);
+         test_compare( _xbee_escape( escaped, src + offset, length), count,
+            NULL, "wrong escaped length");
+         test_bool( memcmp( escaped, expected, count) == 0, "wrong escaping");
+
+         escape = 0;
+         test_compare( _xbee_unescape( dest, escaped, count, &escape),
+            length, NULL, "wrong unescaped length");
+         test_bool( memcmp( dest, src + offset, length) == 0 && ! escape,
+            "wrong unescaping");
+
+         // in place, as done in the staging ring
+         test_compare( _xbee_unescape( escaped, escaped, count, &escape),
+            length, NULL, "wrong length unescaping in place");
+         test_bool( memcmp( escaped, src + offset, length) == 0,
+            "wrong unescaping in place");
+      }
+   }
+
+   // escapes split across reads
+   count = _xbee_escape( escaped, src, 80);
+   for (split = 0; split <= count; ++split)
+   {
+      escape = 0;
+      part = _xbee_unescape( dest, escaped, split, &escape);
+      part += _xbee_unescape( dest + part, escaped + split, count - split,
+         &escape);
+      test_bool( part == 80 && memcmp( dest, src, 80) == 0,
+         "wrong unescaping across split");
+   }
+   escape = 0;
+   test_compare( (_xbee_unescape)( dest, escaped, count, &escape), 80, NULL,
+      "wrong portable unescaping");
+
+   // XON/XOFF dropped, and a start-of-frame cancels an escape
+   escape = 0;
+   test_compare( _xbee_unescape( dest, flow, sizeof flow, &escape), 2, NULL,
+      "didn't drop flow control");
+   test_bool( dest[0] == 'A' && dest[1] == 0x7E, "wrong flow control bytes");
+   escape = 0;
+   dest[0] = 0x7D;
+   dest[1] = 0x7E;
+   test_compare( _xbee_unescape( dest, dest, 2, &escape), 1, NULL,
+      "didn't drop escape before start-of-frame");
+   test_bool( dest[0] == 0x7E && ! escape, "escaped start-of-frame");
+}
+
+void t_single_frame( void)
+{
+   static const uint8_t payload[] = { 0x8A, 0x06 };
+   uint8_t buffer[32];
+   int length;
+
+   reset_device();
+   length = build_frame( buffer, payload, sizeof payload);
+   feed( buffer, length);
+
+   test_compare( _xbee_frame_load( &xbee), 1, NULL, "didn't load frame");
+   test_compare( frames_received, 1, NULL, "handler not called");
+   test_compare( last_length, sizeof payload, NULL, "wrong length");
+   test_bool( memcmp( last_frame, payload, sizeof payload) == 0,
+      "wrong frame contents");
+   test_compare( _xbee_frame_load( &xbee), 0, NULL, "extra frame loaded");
+}
+
+void t_garbage_and_partial( void)
+{
+   static const uint8_t payload[] = { 0x88, 0x01, 'V', 'R', 0x00, 0x12 };
+   static const uint8_t garbage[] = { 0x00, 0x11, 0x7D, 0x13 };
+   uint8_t buffer[32];
+   int length;
+
+   reset_device();
+   length = build_frame( buffer, payload, sizeof payload);
+
+   // leading garbage, then a frame split across two reads
+   feed( garbage, sizeof garbage);
+   feed( buffer, 5);
+   test_compare( _xbee_frame_load( &xbee), 0, NULL, "loaded partial frame");
+   feed( buffer + 5, length - 5);
+   test_compare( _xbee_frame_load( &xbee), 1, NULL, "didn't finish frame");
+   test_bool( memcmp( last_frame, payload, sizeof payload) == 0,
+      "wrong split frame contents");
+
+   // bad checksum is dropped, following frame still received
+   length = build_frame( buffer, payload, sizeof payload);
+   buffer[length - 1] ^= 0x55;
+   feed( buffer, length);
+   length = build_frame( buffer, payload, sizeof payload);
+   feed( buffer, length);
+   test_compare( _xbee_frame_load( &xbee), 1, NULL, "bad checksum accepted");
+   test_compare( frames_received, 2, NULL, "lost frame after bad checksum");
+}
+
+void t_resync( void)
+{
+   static const uint8_t lost[] = { 0x90, 0x01, 0x02, 0x03, 0x04, 0x05 };
+   static const uint8_t payload[] = { 0x88, 0x01, 'V', 'R', 0x00, 0x12 };
+   static const uint8_t noise[] = { 0x7E, 0x00 };
+   uint8_t buffer[32];
+   int i, length, total;
+
+   // Frame claims 20 bytes but only 6 arrive, so it swallows the next frame
+   // and the start of the one after that.
+   reset_device();
+   buffer[0] = 0x7E;
+   buffer[1] = 0x00;
+   buffer[2] = 20;
+   feed( buffer, 3);
+   feed( lost, sizeof lost);
+   length = build_frame( buffer, payload, sizeof payload);
+   feed( buffer, length);
+   feed( buffer, length);
+   for (total = 0; (i = _xbee_frame_load( &xbee)) > 0; total += i);
+#if XBEE_DEV_RX_STAGING_SIZE
+   test_compare( total, 2, NULL, "didn't recover swallowed frames");
+   test_compare( xbee.rx.skipped, 3 + sizeof lost, NULL,
+      "wrong count of skipped bytes");
+#else
+   test_compare( total, 0, NULL, "recovered frames without staging ring");
+   test_compare( xbee.rx.skipped, 3 + 21, NULL,
+      "wrong count of skipped bytes");
+#endif
+   test_compare( xbee.rx.state, XBEE_RX_STATE_WAITSTART, NULL,
+      "parser not waiting for next frame");
+
+   // Noise followed by 0x7E looks like a length of 0x007E; the real frames
+   // start at the LSB of that length.
+   reset_device();
+   feed( noise, sizeof noise);
+   for (i = 0; i < 14; ++i)
+   {
+      feed( buffer, length);
+   }
+   for (total = 0; (i = _xbee_frame_load( &xbee)) > 0; total += i);
+#if XBEE_DEV_RX_STAGING_SIZE
+   test_compare( total, 14, NULL, "didn't resync on LSB of length");
+   test_compare( xbee.rx.skipped, 2, NULL, "wrong count of skipped bytes");
+   test_bool( memcmp( last_frame, payload, sizeof payload) == 0,
+      "wrong frame contents after resync");
+#endif
+}
+
+void t_burst( void)
+{
+   uint8_t payload[200];
+   uint8_t buffer[sizeof payload + 4];
+   int i, length, loaded;
+
+   reset_device();
+   for (i = 0; i < sizeof payload; ++i)
+   {
+      payload[i] = (uint8_t) i;
+   }
+   payload[0] = 0x91;
+
+   // more frames than XBEE_DEV_MAX_DISPATCH_PER_TICK
+   for (i = 0; i < 12; ++i)
+   {
+      length = build_frame( buffer, payload, 20 + i * 10);
+      feed( buffer, length);
+   }
+
+   loaded = 0;
+   for (i = 0; i < 12; ++i)
+   {
+      length = _xbee_frame_load( &xbee);
+      test_bool( length <= XBEE_DEV_MAX_DISPATCH_PER_TICK,
+         "exceeded XBEE_DEV_MAX_DISPATCH_PER_TICK");
+      if (length <= 0)
+      {
+         break;
+      }
+      loaded += length;
+   }
+   test_compare( loaded, 12, NULL, "didn't load all frames in burst");
+   test_compare( last_length, 130, NULL, "wrong length for last frame");
+   test_bool( memcmp( last_frame, payload, 130) == 0,
+      "wrong contents for last frame");
+}
+
+void t_zero_copy( void)
+{
+#if XBEE_DEV_RX_ZERO_COPY
+   uint8_t payload[200];
+   uint8_t buffer[sizeof payload + 4];
+   int i, length, loaded, frames;
+
+   reset_device();
+   memset( payload, 0x5A, sizeof payload);
+   payload[0] = 0x91;
+
+   // enough frames to run past the end of the staging ring
+   frames = XBEE_DEV_RX_STAGING_SIZE / sizeof buffer * 2 + 1;
+   for (i = 0; i < frames; ++i)
+   {
+      payload[1] = (uint8_t) i;
+      length = build_frame( buffer, payload, sizeof payload);
+      feed( buffer, length);
+   }
+
+   for (loaded = 0; (i = _xbee_frame_load( &xbee)) > 0; loaded += i);
+   test_compare( loaded, frames, NULL, "lost frames");
+   test_compare( frames_in_place, frames, NULL, "frames not lent in place");
+   test_compare( last_length, sizeof payload, NULL, "wrong length");
+   test_bool( memcmp( last_frame, payload, sizeof payload) == 0,
+      "wrong contents for last frame");
+#endif
+}
+
+void t_frame_write( void)
+{
+   static const uint8_t header[] = { 0x08, 0x01, 'V', 'R' };
+   static const uint8_t data[] = { 0x12, 0x34, 0x56 };
+   uint8_t expected[sizeof header + sizeof data];
+
+   reset_device();
+   memcpy( expected, header, sizeof header);
+   memcpy( expected + sizeof header, data, sizeof data);
+
+   // write frames to the pipe, then read them back in
+   xbee.serport.fd = pipe_fd[1];
+   test_compare( xbee_frame_write( &xbee, header, sizeof header,
+      data, sizeof data, 0), 0, NULL, "header+data write failed");
+   test_compare( xbee_frame_write( &xbee, NULL, 0, expected, sizeof expected,
+      0), 0, NULL, "data-only write failed");
+   test_compare( xbee_frame_write( &xbee, NULL, 0, NULL, 0, 0), -ENODATA,
+      NULL, "empty write accepted");
+
+   xbee.serport.fd = pipe_fd[0];
+   test_compare( _xbee_frame_load( &xbee), 2, NULL, "frames not looped back");
+   test_compare( last_length, sizeof expected, NULL, "wrong looped length");
+   test_bool( memcmp( last_frame, expected, sizeof expected) == 0,
+      "wrong looped contents");
+}
+
+void t_escaped_mode( void)
+{
+#if XBEE_DEV_API_ESCAPED
+   static const uint8_t header[] = { 0x10, 0x7E, 0x7D, 0x11 };
+   static const uint8_t data[] = { 0x13, 0x12, 0x7E, 0x34 };
+   uint8_t frame[sizeof header + sizeof data];
+   uint8_t buffer[64], looped[64];
+   static uint8_t big[300], big_escaped[_XBEE_ESCAPED_FRAME_SIZE( 300)],
+      big_looped[sizeof big_escaped];
+   int i, length, split;
+#endif
+
+   reset_device();
+   test_compare( xbee_dev_api_mode( NULL, XBEE_DEV_API_MODE_ESCAPED),
+      -EINVAL, NULL, "accepted NULL device");
+   test_compare( xbee_dev_api_mode( &xbee, 0), -EINVAL, NULL,
+      "accepted invalid mode");
+#if ! XBEE_DEV_API_ESCAPED
+   test_compare( xbee_dev_api_mode( &xbee, XBEE_DEV_API_MODE_ESCAPED),
+      -ENOSYS, NULL, "escaped mode not compiled in");
+#else
+   test_compare( xbee_dev_api_mode( &xbee, XBEE_DEV_API_MODE_ESCAPED),
+      0, NULL, "couldn't select escaped mode");
+   memcpy( frame, header, sizeof header);
+   memcpy( frame + sizeof header, data, sizeof data);
+
+   // frame with an XON in the middle, fed in two parts to split each escape
+   length = _xbee_frame_escape( buffer + 1, frame, sizeof frame, NULL, 0);
+   buffer[0] = 0x11;
+   for (split = 1; split < length; ++split)
+   {
+      feed( buffer, split);
+      _xbee_frame_load( &xbee);
+      feed( buffer + split, length + 1 - split);
+      _xbee_frame_load( &xbee);
+      test_compare( frames_received, split, NULL, "didn't load frame");
+      test_bool( last_length == sizeof frame
+         && memcmp( last_frame, frame, sizeof frame) == 0,
+         "wrong escaped frame contents");
+   }
+
+   // xbee_frame_write() sends an escaped frame
+   xbee.serport.fd = pipe_fd[1];
+   test_compare( xbee_frame_write( &xbee, header, sizeof header,
+      data, sizeof data, 0), 0, NULL, "escaped write failed");
+   test_compare( read( pipe_fd[0], looped, sizeof looped), length, NULL,
+      "wrong escaped frame length");
+   test_bool( memcmp( looped, buffer + 1, length) == 0,
+      "wrong escaped frame");
+   test_bool( memchr( looped + 1, 0x7E, length - 1) == NULL
+      && memchr( looped, 0x11, length) == NULL
+      && memchr( looped, 0x13, length) == NULL,
+      "special bytes not escaped");
+
+   // frames are escaped a block at a time, check one that spans several
+   for (i = 0; i < (int) sizeof big; ++i)
+   {
+      big[i] = (i % 3) ? (uint8_t) i : 0x7D;
+   }
+   length = _xbee_frame_escape( big_escaped, big, 100, big + 100,
+      sizeof big - 100);
+   test_compare( xbee_frame_write( &xbee, big, 100, big + 100,
+      sizeof big - 100, 0), 0, NULL, "long escaped write failed");
+   test_compare( read( pipe_fd[0], big_looped, sizeof big_looped), length,
+      NULL, "wrong long escaped frame length");
+   test_bool( memcmp( big_looped, big_escaped, length) == 0,
+      "wrong long escaped frame");
+
+   xbee.serport.fd = pipe_fd[0];
+   test_compare( xbee_dev_api_mode( &xbee, XBEE_DEV_API_MODE_UNESCAPED),
+      0, NULL, "couldn't select unescaped mode");
+   length = build_frame( buffer, frame, sizeof frame);
+   feed( buffer, length);
+   test_compare( _xbee_frame_load( &xbee), 1, NULL,
+      "didn't load unescaped frame");
+   test_bool( memcmp( last_frame, frame, sizeof frame) == 0,
+      "wrong unescaped frame contents");
+#endif
+}
+
+void t_wait( void)
+{
+   static const uint8_t payload[] = { 0x8A, 0x02 };
+   uint8_t buffer[32];
+   uint32_t start;
+   int i, length;
+
+   reset_device();
+   test_compare( xbee_dev_wait( NULL, 0), -EINVAL, NULL, "accepted NULL");
+   test_compare( xbee_dev_wait( &xbee, 0), 0, NULL, "empty pipe ready");
+
+   start = xbee_millisecond_timer();
+   test_compare( xbee_dev_wait( &xbee, 50), 0, NULL, "empty pipe ready");
+   test_bool( xbee_millisecond_timer() - start >= 40, "didn't sleep");
+
+   length = build_frame( buffer, payload, sizeof payload);
+   for (i = 0; i < XBEE_DEV_MAX_DISPATCH_PER_TICK + 1; ++i)
+   {
+      feed( buffer, length);
+   }
+   test_compare( xbee_dev_wait( &xbee, XBEE_WAIT_FOREVER), 1, NULL,
+      "didn't see frames");
+   test_compare( _xbee_frame_load( &xbee), XBEE_DEV_MAX_DISPATCH_PER_TICK,
+      NULL, "wrong number of frames loaded");
+
+   // last frame is either in the pipe or the staging buffer
+   test_compare( xbee_dev_wait( &xbee, 0), 1, NULL, "lost pending frame");
+   test_compare( _xbee_frame_load( &xbee), 1, NULL, "didn't load last frame");
+   test_compare( xbee_dev_wait( &xbee, 0), 0, NULL, "extra bytes pending");
+
+   test_compare( XBEE_WAIT_MIN( XBEE_WAIT_FOREVER, 20), 20, NULL, "min");
+   test_compare( XBEE_WAIT_MIN( 30, XBEE_WAIT_FOREVER), 30, NULL, "min");
+   test_compare( XBEE_WAIT_MIN( 30, 20), 20, NULL, "min");
+}
+
+void t_tick_budget( void)
+{
+   uint8_t payload[30];
+   uint8_t buffer[sizeof payload + 4];
+   xbee_dev_budget_t budget;
+   int i, length;
+
+   reset_device();
+   memset( payload, 0, sizeof payload);
+   payload[0] = 0x90;
+   length = build_frame( buffer, payload, sizeof payload);
+   for (i = 0; i < 20; ++i)
+   {
+      feed( buffer, length);
+   }
+
+   // stops after the frame that reaches the byte budget
+   memset( &budget, 0, sizeof budget);
+   budget.bytes = 3 * length - 1;
+   test_compare( xbee_dev_tick_budget( &xbee, &budget), 3, NULL,
+      "ignored byte budget");
+
+   // a generous time budget alone doesn't stop at
+   // XBEE_DEV_MAX_DISPATCH_PER_TICK
+   budget.bytes = 0;
+   budget.usec = 1000000;
+   test_compare( xbee_dev_tick_budget( &xbee, &budget), 17, NULL,
+      "didn't dispatch all frames");
+   test_compare( frames_received, 20, NULL, "wrong frame count");
+
+   // above the high-water mark, drains until it's caught up
+   for (i = 0; i < 20; ++i)
+   {
+      feed( buffer, length);
+   }
+   budget.usec = 0;
+   budget.bytes = 1;
+   budget.high_water = 8 * length;
+   test_compare( xbee_dev_tick_budget( &xbee, &budget), 12, NULL,
+      "didn't drain down to high-water mark");
+   test_compare( xbee_dev_tick_budget( &xbee, &budget), 1, NULL,
+      "ignored byte budget below high-water mark");
+
+   test_compare( xbee_dev_tick_budget( &xbee, NULL), 5, NULL,
+      "NULL budget isn't XBEE_DEV_MAX_DISPATCH_PER_TICK");
+   test_compare( xbee_dev_tick( &xbee), 2, NULL, "lost frames");
+}
+
+void t_rx_thread( void)
+{
+#if XBEE_DEV_RX_QUEUE_SIZE
+   static const uint8_t bad_length[] = { 0x7E, 0x00, 0x01 };
+   uint8_t payload[64];
+   uint8_t buffer[sizeof payload + 4];
+   uint32_t start;
+   int i, length, loaded;
+#if XBEE_DEV_STATS
+   xbee_dev_stats_t stats;
+#endif
+
+   reset_device();
+   for (i = 0; i < sizeof payload; ++i)
+   {
+      payload[i] = (uint8_t) i;
+   }
+   payload[0] = 0x91;
+
+   test_compare( xbee_dev_rx_thread_start( &xbee), 0, NULL,
+      "couldn't start thread");
+   test_compare( xbee_dev_rx_thread_start( &xbee), -EBUSY, NULL,
+      "started second thread");
+
+   // errors counted by the reader
+   length = build_frame( buffer, payload, sizeof payload);
+   buffer[length - 1] ^= 0x55;
+   feed( buffer, length);
+   feed( bad_length, sizeof bad_length);
+
+   // more frames than the queue holds, so the reader has to wait for us
+   for (i = 0; i < XBEE_DEV_RX_QUEUE_SIZE * 2; ++i)
+   {
+      payload[1] = (uint8_t) i;
+      length = build_frame( buffer, payload, sizeof payload);
+      feed( buffer, length);
+   }
+
+   loaded = 0;
+   start = xbee_millisecond_timer();
+   while (loaded < XBEE_DEV_RX_QUEUE_SIZE * 2
+      && xbee_millisecond_timer() - start < 2000)
+   {
+      xbee_dev_wait( &xbee, 10);
+      length = xbee_dev_tick( &xbee);
+      if (length != 0)
+      {
+         test_bool( length > 0 && length <= XBEE_DEV_MAX_DISPATCH_PER_TICK,
+            "bad tick result");
+         loaded += length;
+         test_compare( last_frame[1], (uint8_t)(loaded - 1), NULL,
+            "frames out of order");
+      }
+   }
+   test_compare( loaded, XBEE_DEV_RX_QUEUE_SIZE * 2, NULL,
+      "didn't receive all frames");
+   test_compare( frames_received, loaded, NULL, "wrong handler count");
+
+   // reader's counts are merged into the device's while it's running
+#if XBEE_DEV_STATS
+   xbee_dev_stats_snapshot( &xbee, &stats);
+   test_compare( stats.frames_in, loaded, NULL, "frames not counted");
+   test_compare( stats.checksum_errors, 1, NULL, "checksum errors");
+   test_compare( stats.bad_lengths, 1, NULL, "bad lengths");
+#endif
+   test_compare( xbee.rx.skipped, sizeof buffer, NULL, "skipped bytes");
+
+   test_compare( xbee_dev_rx_thread_stop( &xbee), 0, NULL,
+      "couldn't stop thread");
+   test_compare( xbee_dev_rx_thread_stop( &xbee), -EINVAL, NULL,
+      "stopped twice");
+
+   // back to reading frames directly
+   length = build_frame( buffer, payload, sizeof payload);
+   feed( buffer, length);
+   test_compare( xbee_dev_tick( &xbee), 1, NULL, "didn't load frame");
+#else
+   test_compare( _xbee_frame_drain( &xbee, NULL), -ENOSYS, NULL,
+      "queue not compiled in");
+#endif
+}
+
+// callback for xbee_frame_queue(), records status of each frame sent
+static int sent_count, sent_status;
+void record_sent( xbee_dev_t *xbee, int status, void FAR *context)
+{
+   ++sent_count;
+   sent_status = status;
+   count_handler( xbee, NULL, 0, context);
+}
+
+// fill the (non-blocking) pipe so writes fail with EAGAIN
+void block_pipe( void)
+{
+   static uint8_t junk[4096];
+
+   fcntl( pipe_fd[1], F_SETFL, O_NONBLOCK);
+   while (write( pipe_fd[1], junk, sizeof junk) > 0);
+   while (write( pipe_fd[1], junk, 1) > 0);
+}
+
+// empty the pipe, and go back to blocking writes
+void unblock_pipe( void)
+{
+   static uint8_t junk[4096];
+
+   while (read( pipe_fd[0], junk, sizeof junk) > 0);
+   fcntl( pipe_fd[1], F_SETFL, 0);
+}
+
+// leave room for only <room> more bytes in the pipe
+void throttle_pipe( int room)
+{
+   static uint8_t junk[4096];
+
+   unblock_pipe();
+   block_pipe();
+   // free one page of the pipe, then use all but <room> bytes of it
+   test_compare( read( pipe_fd[0], junk, sizeof junk), sizeof junk, NULL,
+      "couldn't free pipe page");
+   if (room < sizeof junk)
+   {
+      write( pipe_fd[1], junk, sizeof junk - room);
+   }
+}
+
+// load frames from the pipe until there aren't any more
+int load_all( void)
+{
+   int result, total = 0;
+
+   xbee.serport.fd = pipe_fd[0];
+   while ((result = _xbee_frame_load( &xbee)) > 0)
+   {
+      total += result;
+   }
+   xbee.serport.fd = pipe_fd[1];
+
+   return total;
+}
+
+// callback for frames queued by queue_seq(), checks they're sent in order
+static int next_sent, sent_errors;
+void check_sent( xbee_dev_t *xbee, int status, void FAR *context)
+{
+   if (status != 0 || (intptr_t) context != next_sent)
+   {
+      ++sent_errors;
+   }
+   ++next_sent;
+}
+
+// queue a data frame with sequence number <seq>, of varying length
+int queue_seq( uint8_t *data, int seq)
+{
+   data[1] = (uint8_t) seq;
+   return xbee_frame_queue( &xbee, NULL, 0, data, 50 + seq % 7 * 20, 0,
+      check_sent, (void *)(intptr_t) seq);
+}
+
+// read <drain_bytes> bytes from the pipe, after giving the writer time to
+// fill it
+static int drain_bytes;
+void *drain_pipe( void *arg)
+{
+   static uint8_t junk[4096];
+   int result;
+
+   usleep( 50000);
+   while (drain_bytes > 0)
+   {
+      result = read( pipe_fd[0], junk,
+         drain_bytes < sizeof junk ? drain_bytes : sizeof junk);
+      if (result > 0)
+      {
+         drain_bytes -= result;
+      }
+      else
+      {
+         usleep( 1000);
+      }
+   }
+
+   return NULL;
+}
+
+void t_partial_write( void)
+{
+   static uint8_t data[6000];
+   static uint8_t frame[sizeof data + 4];
+   pthread_t thread;
+   int fd, i, length, result;
+
+   reset_device();
+   xbee.serport.fd = pipe_fd[1];
+   data[0] = 0x10;
+   for (i = 1; i < sizeof data; ++i)
+   {
+      data[i] = (uint8_t) i;
+   }
+
+   // pipe takes part of the frame (Linux fills the partial page first), and
+   // the rest once the thread reads what was already in it
+   throttle_pipe( 2000);
+   ioctl( pipe_fd[0], FIONREAD, &drain_bytes);
+   pthread_create( &thread, NULL, drain_pipe, NULL);
+   test_compare( xbee_frame_write( &xbee, NULL, 0, data, sizeof data, 0), 0,
+      NULL, "partial write failed");
+   pthread_join( thread, NULL);
+   for (length = 0; length < sizeof frame; length += result)
+   {
+      result = read( pipe_fd[0], &frame[length], sizeof frame - length);
+      if (result <= 0)
+      {
+         break;
+      }
+   }
+   test_compare( length, sizeof frame, NULL, "frame incomplete");
+   test_bool( frame[0] == 0x7E && frame[1] == sizeof data >> 8
+      && frame[2] == (sizeof data & 0xFF)
+      && memcmp( &frame[3], data, sizeof data) == 0
+      && frame[sizeof frame - 1] == _xbee_checksum( data, sizeof data, 0xFF),
+      "wrong frame");
+
+   // pipe stops taking bytes partway through the frame
+   throttle_pipe( 2000);
+   test_compare( xbee_frame_write( &xbee, NULL, 0, data, sizeof data, 0),
+      -EIO, NULL, "stall not reported");
+   unblock_pipe();
+
+   // errors from the serial driver go back to the caller
+   fd = open( "/dev/null", O_RDONLY);
+   xbee.serport.fd = fd;
+   test_compare( xbee_frame_write( &xbee, NULL, 0, data, 20, 0), -EBADF,
+      NULL, "error not returned");
+   close( fd);
+   xbee.serport.fd = pipe_fd[1];
+}
+
+void t_tx_queue( void)
+{
+#if XBEE_DEV_TX_QUEUE_SIZE
+   static const uint8_t at_cmd[] = { 0x08, 0x01, 'V', 'R' };
+   uint8_t data[200];
+   int i, queued;
+
+   reset_device();
+   memset( data, 0, sizeof data);
+   data[0] = 0x10;
+   xbee.serport.fd = pipe_fd[1];
+   sent_count = 0;
+   call_order[0] = '\0';
+
+   // XBee can't take the frames, so they're queued
+   block_pipe();
+   test_compare( xbee_frame_queue( &xbee, NULL, 0, data, 20, 0,
+      record_sent, "d"), 0, NULL, "didn't queue data frame");
+   test_compare( xbee_frame_queue( &xbee, at_cmd, sizeof at_cmd, NULL, 0, 0,
+      record_sent, "a"), 0, NULL, "didn't queue AT command");
+   test_compare( xbee_frame_write( &xbee, NULL, 0, data, 20,
+      XBEE_WRITE_FLAG_NOQUEUE), -EBUSY, NULL, "NOQUEUE flag ignored");
+   test_compare( xbee_frame_queue_pending( &xbee), 2, NULL, "wrong pending");
+   test_compare( _xbee_frame_queue_send( &xbee), 0, NULL, "sent while busy");
+   test_compare( sent_count, 0, NULL, "callback before sending");
+
+   // AT command goes out ahead of the data frame
+   unblock_pipe();
+   test_compare( _xbee_frame_queue_send( &xbee), 2, NULL, "didn't send");
+   test_string( call_order, "ad", "wrong send order");
+   test_compare( sent_status, 0, NULL, "wrong callback status");
+   test_compare( load_all(), 2, NULL, "frames not looped back");
+   test_compare( last_frame[0], 0x10, NULL, "data frame not sent last");
+
+   // keep the queue full while sending a few frames at a time, so frames
+   // wrap around the end of the ring
+   next_sent = sent_errors = 0;
+   throttle_pipe( 0);
+   for (queued = 0; queue_seq( data, queued) == 0; ++queued);
+   test_bool( queued > 4, "queue too small");
+   for (i = 0; i < 40; ++i)
+   {
+      throttle_pipe( 300);
+      test_bool( _xbee_frame_queue_send( &xbee) > 0, "didn't send");
+      for (; queue_seq( data, queued) == 0; ++queued);
+   }
+   unblock_pipe();
+   _xbee_frame_queue_send( &xbee);
+   test_compare( next_sent, queued, NULL, "lost queued frames");
+   test_compare( sent_errors, 0, NULL, "frames sent out of order");
+
+   // flushing cancels waiting frames
+   block_pipe();
+   call_order[0] = '\0';
+   test_compare( xbee_frame_queue( &xbee, NULL, 0, data, 20, 0,
+      record_sent, "f"), 0, NULL, "didn't queue frame to flush");
+   test_compare( xbee_frame_queue_flush( &xbee), 1, NULL, "didn't flush");
+   test_compare( sent_status, -ECANCELED, NULL, "wrong flush status");
+   test_compare( xbee_frame_queue_pending( &xbee), 0, NULL, "not empty");
+   unblock_pipe();
+
+#if XBEE_DEV_API_ESCAPED
+   // queued frames are escaped as they're sent, XON would be dropped if not
+   xbee_dev_api_mode( &xbee, XBEE_DEV_API_MODE_ESCAPED);
+   data[1] = 0x7E;
+   data[2] = 0x11;
+   block_pipe();
+   test_compare( xbee_frame_queue( &xbee, NULL, 0, data, 20, 0,
+      record_sent, "e"), 0, NULL, "didn't queue escaped frame");
+   unblock_pipe();
+   test_compare( _xbee_frame_queue_send( &xbee), 1, NULL,
+      "didn't send escaped frame");
+   test_compare( load_all(), 1, NULL, "escaped frame not looped back");
+   test_bool( memcmp( last_frame, data, 20) == 0, "wrong escaped frame");
+#endif
+#else
+   test_compare( _xbee_frame_queue_send( &xbee), -ENOSYS, NULL,
+      "queue not compiled in");
+#endif
+}
+
+void t_stats( void)
+{
+   static const uint8_t payload[] = { 0x8A, 0x06 };
+   static const uint8_t bad_length[] = { 0x7E, 0x00, 0x01 };
+   xbee_dev_histogram_t hist;
+   xbee_dev_stats_t stats;
+   uint8_t buffer[32];
+   int i;
+#if XBEE_DEV_STATS
+   uint32_t count;
+   int length;
+
+   reset_device();
+   length = build_frame( buffer, payload, sizeof payload);
+   feed( buffer, length);
+   feed( bad_length, sizeof bad_length);
+   buffer[length - 1] ^= 0x55;
+   feed( buffer, length);
+   buffer[length - 1] ^= 0x55;
+   // more good frames than a single tick dispatches
+   for (i = 0; i < XBEE_DEV_MAX_DISPATCH_PER_TICK + 1; ++i)
+   {
+      feed( buffer, length);
+   }
+   while (_xbee_frame_load( &xbee) > 0);
+
+   test_compare( xbee_dev_stats_snapshot( &xbee, &stats), 0, NULL,
+      "snapshot failed");
+   test_compare( stats.frames_in, XBEE_DEV_MAX_DISPATCH_PER_TICK + 2, NULL,
+      "frames in");
+   test_compare( stats.bytes_in, length * stats.frames_in, NULL, "bytes in");
+   test_compare( stats.checksum_errors, 1, NULL, "checksum errors");
+   test_compare( stats.bad_lengths, 1, NULL, "bad lengths");
+   test_compare( stats.skipped, length, NULL, "skipped bytes");
+   test_compare( stats.dispatch_limited, 1, NULL, "dispatch limited");
+   test_compare( stats.handler[0x8A].frames, stats.frames_in, NULL,
+      "handler frames");
+   for (count = 0, i = 0; i < XBEE_DEV_HISTOGRAM_BUCKETS; ++i)
+   {
+      count += stats.handler_time.bucket[i];
+   }
+   test_compare( count, stats.frames_in, NULL, "handler time samples");
+   for (count = 0, i = 0; i < XBEE_DEV_HISTOGRAM_BUCKETS; ++i)
+   {
+      count += stats.rx_latency.bucket[i];
+   }
+   test_compare( count, stats.frames_in, NULL, "rx latency samples");
+
+   xbee.serport.fd = pipe_fd[1];
+   test_compare( xbee_frame_write( &xbee, payload, sizeof payload, NULL, 0,
+      0), 0, NULL, "write failed");
+   test_compare( read( pipe_fd[0], buffer, sizeof buffer), length, NULL,
+      "read from pipe failed");
+   xbee_dev_stats_snapshot( &xbee, &stats);
+   test_compare( stats.frames_out, 1, NULL, "frames out");
+   test_compare( stats.bytes_out, length, NULL, "bytes out");
+
+   test_compare( xbee_dev_stats_reset( &xbee), 0, NULL, "reset failed");
+   xbee_dev_stats_snapshot( &xbee, &stats);
+   test_bool( stats.frames_in == 0 && stats.skipped == 0
+      && stats.handler[0x8A].frames == 0 && stats.handler_time.max == 0,
+      "reset didn't clear stats");
+#else
+   reset_device();
+   test_compare( xbee_dev_stats_snapshot( &xbee, &stats), -ENOSYS, NULL,
+      "snapshot without XBEE_DEV_STATS");
+   xbee.rx.skipped = 3;
+   test_compare( xbee_dev_stats_reset( &xbee), -ENOSYS, NULL,
+      "reset without XBEE_DEV_STATS");
+   test_compare( xbee.rx.skipped, 3, NULL, "reset changed skipped count");
+   XBEE_UNUSED_PARAMETER( payload);
+   XBEE_UNUSED_PARAMETER( bad_length);
+   XBEE_UNUSED_PARAMETER( buffer);
+#endif
+
+   memset( &hist, 0, sizeof hist);
+   test_compare( xbee_dev_histogram_percentile( &hist, 50), 0, NULL,
+      "percentile of empty histogram");
+   for (i = 0; i < 90; ++i)
+   {
+      _xbee_histogram_add( &hist, 10);
+   }
+   for (i = 0; i < 9; ++i)
+   {
+      _xbee_histogram_add( &hist, 1000);
+   }
+   _xbee_histogram_add( &hist, 5000000);
+   test_compare( hist.bucket[4], 90, NULL, "wrong bucket for 10us");
+   test_compare( hist.bucket[10], 9, NULL, "wrong bucket for 1000us");
+   test_compare( hist.bucket[XBEE_DEV_HISTOGRAM_BUCKETS - 1], 1, NULL,
+      "wrong bucket for 5s");
+   test_compare( xbee_dev_histogram_percentile( &hist, 50), 15, NULL, "p50");
+   test_compare( xbee_dev_histogram_percentile( &hist, 90), 15, NULL, "p90");
+   test_compare( xbee_dev_histogram_percentile( &hist, 99), 1023, NULL, "p99");
+   test_compare( xbee_dev_histogram_percentile( &hist, 100), 5000000, NULL,
+      "p100");
+}
+
+// dispatch a two-byte frame and check handler count and call order
+void check_dispatch( uint8_t type, uint8_t id, int expected,
+   const char *order)
+{
+   uint8_t frame[2] = { type, id };
+   char errmsg[80];
+
+   call_order[0] = '\0';
+   sprintf( errmsg, "wrong handler count for 0x%02X/%u", type, id);
+   test_compare( _xbee_frame_dispatch( &xbee, frame, sizeof frame), expected,
+      NULL, errmsg);
+   sprintf( errmsg, "wrong handler order for 0x%02X/%u", type, id);
+   test_string( call_order, order, errmsg);
+}
+
+void t_dispatch( void)
+{
+   int pass;
+
+   reset_device();
+   test_compare( _xbee_frame_dispatch( &xbee, NULL, 2), -EINVAL, NULL,
+      "accepted NULL frame");
+
+   // first pass uses linear scan, second pass uses index (if enabled)
+   for (pass = 0; pass < 2; ++pass)
+   {
+      check_dispatch( 0x8A, 0x06, 2, "a");
+      check_dispatch( 0x88, 0x01, 3, "bc");
+      check_dispatch( 0x88, 0x02, 3, "wc");
+      check_dispatch( 0x91, 0x02, 2, "w");
+      check_dispatch( 0x91, 0x03, 1, "");
+
+      #if XBEE_DEV_DISPATCH_INDEX_SIZE
+         test_compare( _xbee_dispatch_index_build(), 0, NULL,
+            "failed to build index");
+      #else
+         test_compare( _xbee_dispatch_index_build(), -ENOSYS, NULL,
+            "built index without XBEE_DEV_DISPATCH_INDEX_SIZE");
+      #endif
+   }
+}
+
+// registered handler that removes itself after its first frame
+int one_shot_handler( xbee_dev_t *xbee, const void FAR *frame,
+   uint16_t length, void FAR *context)
+{
+   count_handler( xbee, frame, length, context);
+
+   return XBEE_FRAME_HANDLER_DONE;
+}
+
+// registered handler that removes the handler whose handle is <context>
+static int victim_handle;
+int remove_handler( xbee_dev_t *xbee, const void FAR *frame,
+   uint16_t length, void FAR *context)
+{
+   count_handler( xbee, frame, length, context);
+   test_compare( xbee_frame_handler_remove( xbee, victim_handle), 0, NULL,
+      "couldn't remove handler during dispatch");
+
+   return 0;
+}
+
+void t_registry( void)
+{
+#if XBEE_DEV_HANDLER_REGISTRY_SIZE
+   int h_low, h_x, i;
+
+   reset_device();
+
+   h_low = xbee_frame_handler_add( &xbee, 0x8B, 0, count_handler, "l", -5);
+   test_bool( h_low > 0, "add failed");
+   test_bool( xbee_frame_handler_add( &xbee, 0x8B, 7, one_shot_handler,
+      "o", 10) > 0, "add one-shot failed");
+   test_bool( xbee_frame_handler_add( &xbee, 0, 7, count_handler,
+      "x", 0) > 0, "add any-type failed");
+   test_bool( xbee_frame_handler_add( &xbee, 0x8B, 0, count_handler,
+      "m", 0) > 0, "add same priority failed");
+   test_compare( xbee_frame_handler_add( &xbee, 0x8B, 0, NULL, NULL, 0),
+      -EINVAL, NULL, "added NULL handler");
+
+   // static wildcard handler "w" matches frame ID 2, then priority order
+   // (with ties going to the more-specific frame type)
+   check_dispatch( 0x8B, 0x07, 5, "omxl");
+   check_dispatch( 0x8B, 0x07, 4, "mxl");        // one-shot removed itself
+   check_dispatch( 0x8B, 0x02, 4, "wml");
+   check_dispatch( 0x90, 0x07, 2, "x");
+
+   test_compare( xbee_frame_handler_remove( &xbee, h_low), 0, NULL,
+      "remove failed");
+   test_compare( xbee_frame_handler_remove( &xbee, h_low), -ENOENT, NULL,
+      "removed twice");
+   test_compare( xbee_frame_handler_remove( &xbee, 0), -EINVAL, NULL,
+      "removed invalid handle");
+   check_dispatch( 0x8B, 0x01, 2, "m");
+
+   // a handler can remove another one during dispatch
+   h_x = xbee_frame_handler_add( &xbee, 0x8B, 0, remove_handler, "r", 1);
+   victim_handle = xbee_frame_handler_add( &xbee, 0x8B, 0, count_handler,
+      "v", 0);
+   check_dispatch( 0x8B, 0x01, 3, "rm");
+   xbee_frame_handler_remove( &xbee, h_x);
+   check_dispatch( 0x8B, 0x01, 2, "m");
+
+   // fill the registry, freed slots are reused
+   for (i = 0; xbee_frame_handler_add( &xbee, 0xA0, i, count_handler,
+      "f", 0) > 0; ++i);
+   test_compare( i, XBEE_DEV_HANDLER_REGISTRY_SIZE - 2, NULL,
+      "wrong registry capacity");
+   check_dispatch( 0xA0, 0x05, 3, "ff");      // IDs 0 and 5
+#else
+   test_compare( xbee_frame_handler_add( &xbee, 0x8B, 0, count_handler,
+      "x", 0), -ENOSYS, NULL, "registry not compiled in");
+#endif
+}
+
+// frame ID owner, records its context (or "t" when its ID times out)
+int id_owner( xbee_dev_t *xbee, const void FAR *frame, uint16_t length,
+   void FAR *context)
+{
+   return count_handler( xbee, frame, length, frame == NULL ? "t" : context);
+}
+
+void t_frame_ids( void)
+{
+#if XBEE_DEV_FRAME_ID_TRACKING
+   uint32_t start;
+   int id, i;
+
+   reset_device();
+   test_compare( xbee_frame_id_alloc( NULL, id_owner, "o", 0), -EINVAL, NULL,
+      "accepted NULL device");
+   test_compare( xbee_frame_id_alloc( &xbee, id_owner, "o", 0), 1, NULL,
+      "wrong first ID");
+
+   // responses with a tracked ID go to its owner and then through the
+   // table, other frame types and untracked IDs just go through the table
+   check_dispatch( 0x88, 0x01, 4, "obc");
+   #if XBEE_DEV_HANDLER_REGISTRY_SIZE
+   {
+      int h = xbee_frame_handler_add( &xbee, 0x88, 0, count_handler, "g", 0);
+
+      check_dispatch( 0x88, 0x01, 5, "obcg");
+      xbee_frame_handler_remove( &xbee, h);
+   }
+   #endif
+   check_dispatch( 0x8A, 0x01, 2, "a");
+   check_dispatch( 0x88, 0x02, 3, "wc");
+
+   // reserved IDs aren't routed, but are skipped by xbee_next_frame_id()
+   test_compare( xbee_next_frame_id( &xbee), 2, NULL, "wrong next ID");
+   test_compare( xbee_frame_id_alloc( &xbee, NULL, NULL, 0), 3, NULL,
+      "reserve failed");
+   check_dispatch( 0x88, 0x03, 2, "c");
+   xbee.frame_id = 0;
+   test_compare( xbee_next_frame_id( &xbee), 2, NULL, "reused ID 1");
+   test_compare( xbee_next_frame_id( &xbee), 4, NULL, "reused ID 3");
+
+   test_compare( xbee_frame_id_release( &xbee, 1), 0, NULL,
+      "release failed");
+   test_compare( xbee_frame_id_release( &xbee, 1), -ENOENT, NULL,
+      "released twice");
+   test_compare( xbee_frame_id_release( &xbee, 0), -EINVAL, NULL,
+      "released ID 0");
+   check_dispatch( 0x88, 0x01, 3, "bc");
+
+   // expired IDs are released before their owner hears about it
+   id = xbee_frame_id_alloc( &xbee, id_owner, "o", 10);
+   test_compare( id, 5, NULL, "wrong ID for timed request");
+   test_compare( xbee_timer_wheel_run( &xbee.wpan_dev.timers), 0, NULL,
+      "expired early");
+   start = xbee_millisecond_timer();
+   while (xbee_millisecond_timer() - start < 20);
+   call_order[0] = '\0';
+   test_compare( xbee_timer_wheel_run( &xbee.wpan_dev.timers), 1, NULL,
+      "didn't expire");
+   test_string( call_order, "t", "owner not told about timeout");
+   test_compare( xbee_frame_id_release( &xbee, id), -ENOENT, NULL,
+      "expired ID still allocated");
+
+   // table entries for the owner's handler don't get the frame again
+   id = xbee_frame_id_alloc( &xbee, count_handler, "s", 0);
+   test_compare( id, 6, NULL, "wrong ID for shared handler");
+   check_dispatch( 0x88, (uint8_t) id, 2, "s");
+   xbee_frame_id_release( &xbee, id);
+
+   // everything except ID 3
+   for (i = 0; xbee_frame_id_alloc( &xbee, id_owner, "f", 0) > 0; ++i);
+   test_compare( i, 254, NULL, "wrong number of free IDs");
+   test_compare( xbee_frame_id_alloc( &xbee, id_owner, "f", 0), -ENOSPC,
+      NULL, "allocated ID in use");
+   test_compare( xbee_frame_id_release( &xbee, 200), 0, NULL,
+      "release failed");
+   test_compare( xbee_frame_id_alloc( &xbee, id_owner, "f", 0), 200, NULL,
+      "didn't find only free ID");
+#else
+   test_compare( xbee_frame_id_alloc( &xbee, id_owner, "o", 0), -ENOSYS,
+      NULL, "tracking not compiled in");
+#endif
+}
+
+int main( int argc, char *argv[])
+{
+   int failures = 0;
+
+   if (pipe( pipe_fd))
+   {
+      perror( "pipe");
+      return 1;
+   }
+   // match xbee_ser_open(), reads don't block when the pipe is empty
+   fcntl( pipe_fd[0], F_SETFL, O_NONBLOCK);
+
+   failures += DO_TEST( t_checksum);
+   failures += DO_TEST( t_escape);
+   failures += DO_TEST( t_single_frame);
+   failures += DO_TEST( t_garbage_and_partial);
+   failures += DO_TEST( t_resync);
+   failures += DO_TEST( t_burst);
+   failures += DO_TEST( t_zero_copy);
+   failures += DO_TEST( t_frame_write);
+   failures += DO_TEST( t_escaped_mode);
+   failures += DO_TEST( t_wait);
+   failures += DO_TEST( t_tick_budget);
+   failures += DO_TEST( t_rx_thread);
+   failures += DO_TEST( t_partial_write);
+   failures += DO_TEST( t_tx_queue);
+   failures += DO_TEST( t_stats);
+   failures += DO_TEST( t_dispatch);
+   failures += DO_TEST( t_registry);
+   failures += DO_TEST( t_frame_ids);
+
+   return test_exit( failures);
+}
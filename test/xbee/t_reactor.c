@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2019 Digi International Inc.,
+ * All rights not expressly granted are reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Digi International Inc. 11001 Bren Road East, Minnetonka, MN 55343
+ * =======================================================================
+ */
+
+// Unit tests for the POSIX gateway reactor, with several devices fed
+// through pipes, and timers expiring on an idle device.
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "xbee/platform.h"
+#include "xbee/device.h"
+#include "xbee/reactor.h"
+#include "../unittest.h"
+
+#define DEVICES      6
+#define FRAMES       40       // frames sent to each device
+
+static xbee_dev_t xbee[DEVICES];
+static int pipe_fd[DEVICES][2];
+
+// next sequence number expected by each device, and errors seen
+static int next_seq[DEVICES];
+static int out_of_order;
+
+int check_sequence( xbee_dev_t *dev, const void FAR *frame, uint16_t length,
+   void FAR *context)
+{
+   const uint8_t FAR *bytes = frame;
+   int index = (int)(dev - xbee);
+
+   if (bytes[1] != (uint8_t) next_seq[index])
+   {
+      ++out_of_order;
+   }
+   ++next_seq[index];
+
+   return 0;
+}
+
+const xbee_dispatch_table_entry_t xbee_frame_handlers[] =
+{
+   { 0x90, 0, check_sequence, NULL },
+   XBEE_FRAME_TABLE_END
+};
+
+// send frame <seq> to device <index>
+void feed( int index, uint8_t seq)
+{
+   uint8_t payload[24];
+   uint8_t buffer[sizeof payload + 4];
+
+   memset( payload, seq, sizeof payload);
+   payload[0] = 0x90;
+   payload[1] = seq;
+   buffer[0] = 0x7E;
+   buffer[1] = 0;
+   buffer[2] = sizeof payload;
+   memcpy( &buffer[3], payload, sizeof payload);
+   buffer[3 + sizeof payload] = _xbee_checksum( payload, sizeof payload, 0xFF);
+
+   test_compare( write( pipe_fd[index][1], buffer, sizeof buffer),
+      sizeof buffer, NULL, "write to pipe failed");
+}
+
+void t_reactor( void)
+{
+   xbee_reactor_t reactor;
+   uint32_t start, total;
+   int i, seq;
+
+   test_compare( xbee_reactor_init( NULL), -EINVAL, NULL, "accepted NULL");
+   test_compare( xbee_reactor_init( &reactor), 0, NULL, "init failed");
+
+   for (i = 0; i < DEVICES; ++i)
+   {
+      memset( &xbee[i], 0, sizeof xbee[i]);
+      xbee_timer_wheel_init( &xbee[i].wpan_dev.timers);
+      xbee[i].serport.fd = pipe_fd[i][0];
+      test_compare( xbee_reactor_add( &reactor, &xbee[i]), i, NULL,
+         "add failed");
+   }
+   test_compare( xbee_reactor_add( &reactor, NULL), -EINVAL, NULL,
+      "added NULL device");
+
+   // interleave frames to all devices, with more frames than a single tick
+   // will dispatch
+   for (seq = 0; seq < FRAMES; ++seq)
+   {
+      for (i = 0; i < DEVICES; ++i)
+      {
+         feed( i, (uint8_t) seq);
+      }
+   }
+
+   start = xbee_millisecond_timer();
+   do {
+      xbee_reactor_poll( &reactor, 10);
+      for (total = 0, i = 0; i < DEVICES; ++i)
+      {
+         total += reactor.frames[i];
+      }
+   } while (total < DEVICES * FRAMES && xbee_millisecond_timer() - start < 2000);
+
+   test_compare( xbee_reactor_destroy( &reactor), 0, NULL, "destroy failed");
+
+   for (i = 0; i < DEVICES; ++i)
+   {
+      test_compare( reactor.frames[i], FRAMES, NULL, "lost frames");
+      test_compare( next_seq[i], FRAMES, NULL, "handler count");
+   }
+   test_compare( out_of_order, 0, NULL, "frames dispatched out of order");
+}
+
+static int expired;
+void count_expired( xbee_timer_t *timer)
+{
+   ++expired;
+}
+
+void t_timers( void)
+{
+   xbee_reactor_t reactor;
+   xbee_timer_t timer;
+   uint32_t start, elapsed;
+
+   // nothing arrives on the serial port, but the timer still expires
+   xbee_reactor_init( &reactor);
+   xbee_reactor_add( &reactor, &xbee[0]);
+   xbee_timer_init( &timer, count_expired, NULL);
+   xbee_timer_start( &xbee[0].wpan_dev.timers, &timer, 50);
+
+   start = xbee_millisecond_timer();
+   test_compare( xbee_reactor_poll( &reactor, 1000), 1, NULL,
+      "device not ticked for timer");
+   elapsed = xbee_millisecond_timer() - start;
+   test_bool( elapsed >= 45 && elapsed < 500, "waited past timer");
+   test_compare( expired, 1, NULL, "timer didn't expire");
+
+   xbee_reactor_destroy( &reactor);
+}
+
+int main( int argc, char *argv[])
+{
+   int failures = 0;
+   int i;
+
+   for (i = 0; i < DEVICES; ++i)
+   {
+      if (pipe( pipe_fd[i]))
+      {
+         perror( "pipe");
+         return 1;
+      }
+      // match xbee_ser_open(), reads don't block when the pipe is empty
+      fcntl( pipe_fd[i][0], F_SETFL, O_NONBLOCK);
+   }
+
+   failures += DO_TEST( t_reactor);
+   failures += DO_TEST( t_timers);
+
+   return test_exit( failures);
+}
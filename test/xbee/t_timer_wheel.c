@@ -0,0 +1,337 @@
+/*
+ * Copyright (c) 2019 Digi International Inc.,
+ * All rights not expressly granted are reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Digi International Inc. 11001 Bren Road East, Minnetonka, MN 55343
+ * =======================================================================
+ */
+
+// Unit tests for the timer wheel: timers expire on the right millisecond
+// at every level, callbacks can cancel and restart timers, and a random
+// mix of timers expires in order without any being late.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xbee/platform.h"
+#include "xbee/timer_wheel.h"
+#include "../unittest.h"
+
+#define STRESS_TIMERS   500
+
+static xbee_timer_wheel_t wheel;
+
+// Times used with xbee_timer_wheel_advance() start far enough from
+// xbee_millisecond_timer() that the real time never catches up.
+static uint32_t base;
+
+// timers passed to record(), in order
+static xbee_timer_t *fired[16];
+static int fired_count;
+
+// time passed to the current xbee_timer_wheel_advance()
+static uint32_t advance_until;
+
+void record( xbee_timer_t *timer)
+{
+   if (fired_count < _TABLE_ENTRIES( fired))
+   {
+      fired[fired_count] = timer;
+   }
+   ++fired_count;
+}
+
+void reset( void)
+{
+   xbee_timer_wheel_init( &wheel);
+   base = xbee_millisecond_timer() + 100000;
+   fired_count = 0;
+}
+
+int advance( uint32_t until)
+{
+   advance_until = until;
+   return xbee_timer_wheel_advance( &wheel, until);
+}
+
+void t_exact( void)
+{
+   static const uint32_t delay[] =
+      { 0, 1, 2, 15, 16, 17, 255, 256, 300, 4095, 4096, 5000, 70000, 200000 };
+   xbee_timer_t timer, later;
+   char buffer[40];
+   int i;
+
+   for (i = 0; i < _TABLE_ENTRIES( delay); ++i)
+   {
+      sprintf( buffer, "delay %u", (unsigned) delay[i]);
+      reset();
+      xbee_timer_init( &timer, record, NULL);
+      xbee_timer_start_at( &wheel, &timer, base + delay[i]);
+      test_bool( xbee_timer_pending( &timer), buffer);
+      test_compare( advance( base + delay[i] - 1), 0, buffer, "fired early");
+      test_compare( advance( base + delay[i]), 1, buffer, "didn't fire");
+      test_bool( ! xbee_timer_pending( &timer), buffer);
+      test_compare( wheel.count, 0, buffer, "still counted");
+   }
+
+   // timer started after its time has passed fires on the next advance
+   reset();
+   xbee_timer_init( &timer, record, NULL);
+   xbee_timer_init( &later, record, NULL);
+   xbee_timer_start_at( &wheel, &later, base + 1000);
+   advance( base);
+   xbee_timer_start_at( &wheel, &timer, base - 5);
+   test_compare( xbee_timer_wheel_next( &wheel), 0, NULL, "overdue missed");
+   test_compare( advance( base), 1, NULL, "overdue didn't fire");
+   xbee_timer_cancel( &later);
+}
+
+void t_order( void)
+{
+   static const uint16_t delay[] = { 700, 3, 40, 3, 5000, 16, 1 };
+   static const int order[] = { 6, 1, 3, 5, 2, 0, 4 };
+   xbee_timer_t timer[_TABLE_ENTRIES( delay)];
+   int i;
+
+   reset();
+   for (i = 0; i < _TABLE_ENTRIES( delay); ++i)
+   {
+      xbee_timer_init( &timer[i], record, NULL);
+      xbee_timer_start_at( &wheel, &timer[i], base + delay[i]);
+   }
+   test_compare( wheel.count, _TABLE_ENTRIES( delay), NULL, "wrong count");
+
+   // in steps that don't line up with the slots
+   for (i = 0; i <= 5000; i += 7)
+   {
+      advance( base + i);
+   }
+   advance( base + 5000);
+   test_compare( fired_count, _TABLE_ENTRIES( delay), NULL, "missed timers");
+   for (i = 0; i < _TABLE_ENTRIES( order); ++i)
+   {
+      // timers expiring in the same millisecond can fire in any order
+      if (delay[fired[i] - timer] != delay[order[i]])
+      {
+         test_compare( (long) (fired[i] - timer), order[i], NULL,
+            "fired out of order");
+      }
+   }
+}
+
+// the first of these to fire cancels the other
+static xbee_timer_t pair[2];
+void cancel_other( xbee_timer_t *timer)
+{
+   record( timer);
+   test_compare( xbee_timer_cancel( &pair[timer == &pair[0]]), 0, NULL,
+      "cancel from callback");
+}
+
+static int rearm_count;
+void rearm( xbee_timer_t *timer)
+{
+   record( timer);
+   if (++rearm_count < 3)
+   {
+      xbee_timer_start_at( &wheel, timer, timer->expires + 10);
+   }
+}
+
+void t_cancel( void)
+{
+   xbee_timer_t a;
+
+   reset();
+   xbee_timer_init( &a, record, NULL);
+   test_compare( xbee_timer_cancel( &a), -ENOENT, NULL, "cancelled idle");
+   test_compare( xbee_timer_cancel( NULL), -EINVAL, NULL, "cancelled NULL");
+   xbee_timer_start_at( &wheel, &a, base + 100);
+   test_compare( xbee_timer_cancel( &a), 0, NULL, "cancel failed");
+   test_compare( xbee_timer_cancel( &a), -ENOENT, NULL, "cancelled twice");
+   test_compare( xbee_timer_wheel_next( &wheel), XBEE_WAIT_FOREVER, NULL,
+      "empty wheel has a timeout");
+   test_compare( advance( base + 200), 0, NULL, "cancelled timer fired");
+
+   // a callback cancels a timer due in the same millisecond
+   reset();
+   xbee_timer_init( &pair[0], cancel_other, NULL);
+   xbee_timer_init( &pair[1], cancel_other, NULL);
+   xbee_timer_start_at( &wheel, &pair[0], base + 50);
+   xbee_timer_start_at( &wheel, &pair[1], base + 50);
+   test_compare( advance( base + 50), 1, NULL, "cancelled timer fired");
+
+   // restarting a pending timer moves it
+   reset();
+   xbee_timer_init( &a, record, NULL);
+   xbee_timer_start_at( &wheel, &a, base + 10);
+   xbee_timer_start_at( &wheel, &a, base + 1000);
+   test_compare( wheel.count, 1, NULL, "restart counted twice");
+   test_compare( advance( base + 999), 0, NULL, "fired at old time");
+   test_compare( advance( base + 1000), 1, NULL, "didn't fire at new time");
+}
+
+void t_rearm( void)
+{
+   xbee_timer_t a;
+
+   reset();
+   rearm_count = 0;
+   xbee_timer_init( &a, rearm, NULL);
+   xbee_timer_start_at( &wheel, &a, base + 5);
+
+   // restarted timers wait for a later advance
+   test_compare( advance( base + 5), 1, NULL, "rearmed timer fired again");
+   test_compare( advance( base + 30), 2, NULL, "rearmed timer didn't fire");
+   test_compare( rearm_count, 3, NULL, "wrong number of callbacks");
+   test_bool( ! xbee_timer_pending( &a), "still pending");
+}
+
+void t_next( void)
+{
+   xbee_timer_t a;
+   int32_t next;
+
+   xbee_timer_wheel_init( &wheel);
+   test_compare( xbee_timer_wheel_next( &wheel), XBEE_WAIT_FOREVER, NULL,
+      "empty wheel has a timeout");
+
+   xbee_timer_init( &a, record, NULL);
+   xbee_timer_start( &wheel, &a, 500);
+   next = xbee_timer_wheel_next( &wheel);
+   test_bool( next >= 490 && next <= 500, "wrong next timeout");
+
+   xbee_timer_start( &wheel, &a, 5);
+   next = xbee_timer_wheel_next( &wheel);
+   test_bool( next >= 0 && next <= 5, "wrong next timeout");
+
+   xbee_timer_cancel( &a);
+   test_compare( xbee_timer_wheel_next( &wheel), XBEE_WAIT_FOREVER, NULL,
+      "timeout after cancel");
+}
+
+void t_attach( void)
+{
+   xbee_timer_wheel_t other;
+   xbee_timer_t a, b;
+
+   fired_count = 0;
+   xbee_timer_wheel_init( &wheel);
+   xbee_timer_wheel_init( &other);
+   xbee_timer_init( &a, record, NULL);
+   xbee_timer_init( &b, record, NULL);
+
+   // empty wheels aren't attached
+   xbee_timer_wheel_attach( &wheel);
+   test_compare( xbee_timer_next_timeout(), XBEE_WAIT_FOREVER, NULL,
+      "attached empty wheel");
+
+   xbee_timer_start( &wheel, &a, 0);
+   xbee_timer_start( &other, &b, 60000);
+   xbee_timer_wheel_attach( &wheel);
+   xbee_timer_wheel_attach( &other);
+   xbee_timer_wheel_attach( &other);
+   test_compare( xbee_timer_next_timeout(), 0, NULL, "wrong next timeout");
+   test_compare( xbee_timer_tick(), 1, NULL, "tick missed timer");
+   test_bool( fired[0] == &a, "wrong timer fired");
+
+   // wheel detaches when its last timer goes
+   test_bool( xbee_timer_next_timeout() > 0, "emptied wheel still attached");
+   xbee_timer_cancel( &b);
+   test_compare( xbee_timer_next_timeout(), XBEE_WAIT_FOREVER, NULL,
+      "wheels still attached");
+   test_compare( xbee_timer_tick(), 0, NULL, "tick without wheels");
+}
+
+// stress test against the expiration times of a random set of timers
+static uint32_t stress_last;
+static int stress_late, stress_early;
+void stress_expired( xbee_timer_t *timer)
+{
+   if ((int32_t) (timer->expires - advance_until) > 0)
+   {
+      ++stress_early;
+   }
+   if ((int32_t) (timer->expires - stress_last) <= 0)
+   {
+      ++stress_late;
+   }
+   ++fired_count;
+}
+
+void t_stress( void)
+{
+   static xbee_timer_t timer[STRESS_TIMERS];
+   uint32_t now;
+   int i, pending;
+
+   reset();
+   srand( 1);
+   for (i = 0; i < STRESS_TIMERS; ++i)
+   {
+      xbee_timer_init( &timer[i], stress_expired, NULL);
+      xbee_timer_start_at( &wheel, &timer[i],
+         base + (uint32_t) (rand() % 100000));
+   }
+
+   stress_late = stress_early = 0;
+   stress_last = base - 1;
+   for (now = base; (int32_t) (now - base) <= 100000; )
+   {
+      advance( now);
+
+      // shuffle a few timers around
+      for (i = 0; i < 3; ++i)
+      {
+         xbee_timer_t *t = &timer[rand() % STRESS_TIMERS];
+
+         switch (rand() % 3)
+         {
+            case 0:
+               xbee_timer_cancel( t);
+               break;
+            case 1:
+               xbee_timer_start_at( &wheel, t,
+                  now + 1 + (uint32_t) (rand() % 70000));
+               break;
+         }
+      }
+
+      stress_last = now;
+      now += 1 + rand() % 300;
+   }
+   now = base + 200000;
+   advance( now);
+
+   pending = 0;
+   for (i = 0; i < STRESS_TIMERS; ++i)
+   {
+      pending += xbee_timer_pending( &timer[i]);
+   }
+   test_compare( pending, 0, NULL, "timers left pending");
+   test_compare( wheel.count, 0, NULL, "wrong count");
+   test_compare( stress_early, 0, NULL, "timers fired early");
+   test_compare( stress_late, 0, NULL, "timers fired late");
+   test_bool( fired_count > STRESS_TIMERS / 2, "too few timers fired");
+}
+
+int main( int argc, char *argv[])
+{
+   int failures = 0;
+
+   failures += DO_TEST( t_exact);
+   failures += DO_TEST( t_order);
+   failures += DO_TEST( t_cancel);
+   failures += DO_TEST( t_rearm);
+   failures += DO_TEST( t_next);
+   failures += DO_TEST( t_attach);
+   failures += DO_TEST( t_stress);
+
+   return test_exit( failures);
+}
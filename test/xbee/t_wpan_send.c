@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2019 Digi International Inc.,
+ * All rights not expressly granted are reserved.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * Digi International Inc. 11001 Bren Road East, Minnetonka, MN 55343
+ * =======================================================================
+ */
+
+// Unit tests for xbee_wpan_send() and its Transmit Status callbacks, using
+// the loopback serial driver to capture requests and feed back statuses.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "xbee/platform.h"
+#include "xbee/device.h"
+#include "xbee/wpan.h"
+#include "wpan/aps.h"
+#include "../loopback.h"
+#include "../unittest.h"
+
+static xbee_dev_t xbee;
+static wpan_envelope_t envelope;
+
+// statuses passed to tx_done(), and the context of each call
+static xbee_wpan_tx_status_t last_status;
+static int done_count;
+static char done_order[XBEE_WPAN_TX_PENDING + 4];
+
+const xbee_dispatch_table_entry_t xbee_frame_handlers[] =
+{
+   XBEE_FRAME_HANDLE_TRANSMIT_STATUS,
+   XBEE_FRAME_TABLE_END
+};
+
+const wpan_cluster_table_entry_t digi_data_clusters[] =
+{
+   WPAN_CLUST_ENTRY_LIST_END
+};
+
+// wpan_tick() walks the endpoint table, which can't be empty
+const wpan_endpoint_table_entry_t endpoints[] =
+{
+   { WPAN_ENDPOINT_DIGI_DATA, WPAN_PROFILE_DIGI, NULL, NULL, 0, 0,
+      digi_data_clusters },
+   WPAN_ENDPOINT_TABLE_END
+};
+
+void tx_done( const xbee_wpan_tx_status_t *status, void FAR *context)
+{
+   last_status = *status;
+   done_order[done_count++] = *(const char *) context;
+   done_order[done_count] = '\0';
+}
+
+// return the frame ID of the Transmit Explicit frame the host just sent
+int sent_frame_id( void)
+{
+   sent_t sent;
+
+   if (loopback_collect( &xbee, &sent, 1) < 1
+      || sent.frame_type != XBEE_FRAME_TRANSMIT_EXPLICIT)
+   {
+      return -1;
+   }
+
+   return sent.frame_id;
+}
+
+// feed a Transmit Status for <frame_id> back to the host and process it
+void send_status( int frame_id, uint8_t delivery, uint8_t retries)
+{
+   uint8_t frame[7] = { XBEE_FRAME_TRANSMIT_STATUS };
+
+   frame[1] = (uint8_t) frame_id;
+   frame[2] = 0x12;
+   frame[3] = 0x34;
+   frame[4] = retries;
+   frame[5] = delivery;
+   frame[6] = XBEE_TX_DISCOVERY_ROUTE;
+   loopback_feed_frame( &xbee, frame, sizeof frame);
+   wpan_tick( &xbee.wpan_dev);
+}
+
+void t_send_status( void)
+{
+   int handle, id;
+
+   test_compare( xbee_wpan_send( NULL, tx_done, "a"), -EINVAL, NULL,
+      "accepted NULL envelope");
+   test_compare( xbee_wpan_send( &envelope, NULL, "a"), -EINVAL, NULL,
+      "accepted NULL callback");
+
+   handle = xbee_wpan_send( &envelope, tx_done, "a");
+   test_bool( handle > 0, "send failed");
+   id = sent_frame_id();
+   test_bool( id > 0, "frame not sent with a frame ID");
+   test_compare( xbee_wpan_tx_pending( &xbee), 1, NULL, "not pending");
+
+   done_count = 0;
+   send_status( id, XBEE_TX_DELIVERY_NET_ACK_FAIL, 3);
+   test_compare( done_count, 1, NULL, "callback not called");
+   test_compare( last_status.handle, handle, NULL, "wrong handle");
+   test_compare( last_status.delivery, XBEE_TX_DELIVERY_NET_ACK_FAIL, NULL,
+      "wrong delivery status");
+   test_compare( last_status.retries, 3, NULL, "wrong retries");
+   test_compare( last_status.discovery, XBEE_TX_DISCOVERY_ROUTE, NULL,
+      "wrong discovery status");
+   test_compare( last_status.network_address, 0x1234, NULL,
+      "wrong network address");
+   test_compare( last_status.flags, 0, NULL, "wrong flags");
+   test_compare( xbee_wpan_tx_pending( &xbee), 0, NULL, "still pending");
+
+   // duplicate status is ignored
+   send_status( id, XBEE_TX_DELIVERY_SUCCESS, 0);
+   test_compare( done_count, 1, NULL, "callback called twice");
+}
+
+void t_pipeline( void)
+{
+   static const char names[] = "abcdefghijklmnopqrstuvwxyz";
+   int id[XBEE_WPAN_TX_PENDING];
+   int handle[XBEE_WPAN_TX_PENDING];
+   int i;
+
+   // fill the window
+   for (i = 0; i < XBEE_WPAN_TX_PENDING; ++i)
+   {
+      handle[i] = xbee_wpan_send( &envelope, tx_done, (void *) &names[i]);
+      test_bool( handle[i] > 0, "send failed");
+      id[i] = sent_frame_id();
+   }
+   test_compare( xbee_wpan_send( &envelope, tx_done, "z"), -ENOSPC, NULL,
+      "overfilled window");
+   test_compare( xbee_wpan_tx_pending( NULL), XBEE_WPAN_TX_PENDING, NULL,
+      "wrong pending count");
+
+   // cancelled requests don't call back
+   test_compare( xbee_wpan_send_cancel( handle[1]), 0, NULL,
+      "cancel failed");
+   test_compare( xbee_wpan_send_cancel( handle[1]), -ENOENT, NULL,
+      "cancelled twice");
+   test_compare( xbee_wpan_send_cancel( 0), -ENOENT, NULL,
+      "cancelled invalid handle");
+
+   // statuses complete in any order, and free a slot for the next send
+   done_count = 0;
+   send_status( id[2], XBEE_TX_DELIVERY_SUCCESS, 0);
+   send_status( id[0], XBEE_TX_DELIVERY_SUCCESS, 0);
+   send_status( id[1], XBEE_TX_DELIVERY_SUCCESS, 0);
+   test_string( done_order, "ca", "wrong completion order");
+   for (i = 3; i < XBEE_WPAN_TX_PENDING; ++i)
+   {
+      send_status( id[i], XBEE_TX_DELIVERY_SUCCESS, 0);
+   }
+   test_compare( done_count, XBEE_WPAN_TX_PENDING - 1, NULL,
+      "missed completions");
+   test_compare( xbee_wpan_tx_pending( &xbee), 0, NULL, "still pending");
+
+   // nothing times out right away
+   test_bool( xbee_wpan_send( &envelope, tx_done, "a") > 0, "send failed");
+   test_compare( xbee_timer_wheel_run( &xbee.wpan_dev.timers), 0, NULL,
+      "expired early");
+}
+
+int main( int argc, char *argv[])
+{
+   static const uint8_t payload[] = "ping";
+   xbee_serial_t serport;
+   int failures = 0;
+
+   memset( &serport, 0, sizeof serport);
+   if (xbee_dev_init( &xbee, &serport, NULL, NULL)
+      || xbee_wpan_init( &xbee, endpoints))
+   {
+      printf( "t_wpan_send: init failed\n");
+      return 1;
+   }
+
+   wpan_envelope_create( &envelope, &xbee.wpan_dev, WPAN_IEEE_ADDR_COORDINATOR,
+      WPAN_NET_ADDR_COORDINATOR);
+   envelope.payload = payload;
+   envelope.length = sizeof payload;
+
+   failures += DO_TEST( t_send_status);
+   failures += DO_TEST( t_pipeline);
+
+   return test_exit( failures);
+}